@@ -22,10 +22,14 @@
 // #include <packml_msgs/srv/detail/state_transition__struct.hpp>
 #include <qglobal.h>
 #include <rmw/qos_profiles.h>
+#include <algorithm>
 #include <chrono>
 #include <future>
 #include <map>
 #include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include <rclcpp/callback_group.hpp>
 #include <rclcpp/client.hpp>
@@ -39,14 +43,22 @@
 #include <rclcpp/utilities.hpp>
 
 #include <packml_sm/common.hpp>
+#include <packml_sm/log.hpp>
+#include <packml_sm/mode_registry.hpp>
+#include <packml_sm/snapshot.hpp>
 #include <packml_sm/state_machine.hpp>
+#include <packml_sm/transition_table.hpp>
+#include <packml_sm/trace.hpp>
 
 #include <packml_msgs/srv/mode_transition.hpp>
 #include <packml_msgs/srv/state_transition.hpp>
 #include <packml_msgs/msg/status.hpp>
 
 #include <packml_msgs/msg/state.hpp>
+#include <packml_msgs/msg/transition_stats.hpp>
 #include <packml_msgs/srv/all_status.hpp>
+#include <packml_msgs/srv/command_script.hpp>
+#include <packml_msgs/srv/get_transition_stats.hpp>
 #include <packml_msgs/srv/mode_change.hpp>
 #include <packml_msgs/srv/state_change.hpp>
 
@@ -77,6 +89,15 @@ namespace packml_ros {
     }
   }
 
+  // std::nullopt for a value that is no state, UNDEFINED is kept
+  inline std::optional<packml_sm::State> to_state(packml_msgs::msg::State::_val_type val)
+  {
+    if (val < 0 || static_cast<std::size_t>(val) >= packml_sm::kStateCount) {
+      return std::nullopt;
+    }
+    return static_cast<packml_sm::State>(val);
+  }
+
 }  // namespace packml_ros
 
 class PackmlNodeInterface
@@ -126,7 +147,7 @@ class PackmlNodeInterface
       [this](const std::shared_ptr<packml_msgs::srv::StateTransition::Request> req,
         std::shared_ptr<packml_msgs::srv::StateTransition::Response> res) -> void {
             auto state = static_cast<packml_sm::State>(req->state.val);
-            std::cout << "Node State changing to: " << to_string(state) << std::endl;
+            PACKML_LOG_INFO("Node State changing to: {}", state);
 
             bool success = false;
             std::string error_string;
@@ -139,7 +160,7 @@ class PackmlNodeInterface
             // TODO: else disabled, because currently a node cannot catch-up if it missed a state change
             // else {
               if (on_state_trans_req(state)) {
-                std::cout << "Node approved state switch" << std::endl;
+                PACKML_LOG_DEBUG("Node approved state switch");
                 waiting_for_new_state = true;
                 switching_state = state;
                 success = true;
@@ -152,7 +173,7 @@ class PackmlNodeInterface
 
             if (!success) {
               res->message = error_string;
-              std::cout << error_string << std::endl;
+              PACKML_LOG_WARN("{}", error_string);
             }
             res->success = success;
         };
@@ -161,7 +182,7 @@ class PackmlNodeInterface
       [this](const std::shared_ptr<packml_msgs::srv::ModeTransition::Request> req,
         std::shared_ptr<packml_msgs::srv::ModeTransition::Response> res)-> void {
             auto mode = static_cast<packml_sm::ModeType>(req->mode.val);
-            std::cout << "Node Mode changing to: " << to_string(mode) << std::endl;
+            PACKML_LOG_INFO("Node Mode changing to: {}", mode);
 
             bool success = false;
             std::string error_string;
@@ -174,7 +195,7 @@ class PackmlNodeInterface
             // TODO: else disabled, because currently a node cannot catch-up if it missed a mode change
             // else {
               if (on_mode_trans_req(mode)){
-                std::cout << "Node approved mode switch" << std::endl;
+                PACKML_LOG_DEBUG("Node approved mode switch");
                 waiting_for_new_mode = true;
                 switching_mode = mode;
                 success = true;
@@ -187,7 +208,7 @@ class PackmlNodeInterface
 
             if (!success) {
               res->message = error_string;
-              std::cout << error_string << std::endl;
+              PACKML_LOG_WARN("{}", error_string);
             }
             res->success = success;
 
@@ -202,32 +223,32 @@ class PackmlNodeInterface
 
         if (current_state != state) {
           already_switched = true;
-          std::cout << "State change" << std::endl;
+          PACKML_LOG_DEBUG("State change");
           if (switching_state != state && switching_state != packml_sm::State::UNDEFINED) {
-            std::cout << "State published(" << state <<  ") is not the state expected (" << switching_state << ") switching to" << std::endl;
+            PACKML_LOG_WARN("State published({}) is not the state expected ({}) switching to", state, switching_state);
           }
           // TODO: else disabled, because currently a node cannot catch-up if it missed a state change
           // else {
             current_state = state;
             waiting_for_new_state = false;
-            std::cout << "Status changed to: State: " << state << std::endl;
+            PACKML_LOG_INFO("Status changed to: State: {}", state);
             on_status_changed();
           // }
         }
 
         if (current_mode != mode) {
           if (already_switched) {
-            std::cout << "State and Mode switch detected!" << std::endl;
+            PACKML_LOG_DEBUG("State and Mode switch detected!");
           }
-          std::cout << "Mode change" << std::endl;
+          PACKML_LOG_DEBUG("Mode change");
           if (switching_mode != mode && switching_mode != packml_sm::ModeType::UNDEFINED) {
-            std::cout << "Mode published(" << mode << ") is not the Mode expected (" << switching_mode << ") switching to" << std::endl;
+            PACKML_LOG_WARN("Mode published({}) is not the Mode expected ({}) switching to", mode, switching_mode);
           }
           // TODO: else disabled, because currently a node cannot catch-up if it missed a mode change
           // else {
             current_mode = mode;
             waiting_for_new_mode = false;
-            std::cout << "Mode changed to:" << mode << std::endl;
+            PACKML_LOG_INFO("Mode changed to: {}", mode);
             on_status_changed();
           // }
         }
@@ -237,7 +258,21 @@ class PackmlNodeInterface
     mode_server_ = node->template create_service<packml_msgs::srv::ModeTransition>("~/packml_mode_transition", onModeTransReq);
     status_sub_ = node->template create_subscription<packml_msgs::msg::Status>("packml_status", rclcpp::SensorDataQoS(), onStatusChanged);
 
-    std::cout << "Services created!" << std::endl;
+    PACKML_LOG_DEBUG("Services created!");
+
+    // Optional snapshot file, a restarted node resumes the wait state it was in
+    auto snapshot_file = node->declare_parameter<std::string>("snapshot_file", "");
+    auto resume = node->declare_parameter<bool>("resume_wait_state", true);
+    if (!snapshot_file.empty()) {
+      auto file = packml_sm::SnapshotFile::open(snapshot_file);
+      if (!file) {
+        PACKML_LOG_ERROR("Running without snapshot: {}", file.error());
+      } else if (!sm_->setSnapshotFile(*file, resume ?
+        packml_sm::RestartPolicy::RESUME_WAIT_STATE : packml_sm::RestartPolicy::KEEP_COUNTERS))
+      {
+        PACKML_LOG_ERROR("Could not use the snapshot {}", snapshot_file);
+      }
+    }
 
     current_mode = packml_sm::ModeType::UNDEFINED;
     current_state = packml_sm::State::UNDEFINED;
@@ -283,6 +318,8 @@ class PackmlManagerInterface
   rclcpp::Service<packml_msgs::srv::ModeChange>::SharedPtr mode_server_;
   rclcpp::Service<packml_msgs::srv::StateChange>::SharedPtr state_server_;
   rclcpp::Service<packml_msgs::srv::AllStatus>::SharedPtr status_server_;
+  rclcpp::Service<packml_msgs::srv::GetTransitionStats>::SharedPtr stats_server_;
+  rclcpp::Service<packml_msgs::srv::CommandScript>::SharedPtr script_server_;
 
   rclcpp::Publisher<packml_msgs::msg::Status>::SharedPtr status_pub_;
 
@@ -293,6 +330,9 @@ class PackmlManagerInterface
   rclcpp::Node::SharedPtr node_;
   std::shared_ptr<packml_sm::StateMachine> sm_;
 
+  // Running command scripts, declared last so that they are joined before the members they use
+  std::vector<std::future<void>> script_runs_;
+
 protected:
   // TODO: This should be private!
   // Also this should be in state machine class?
@@ -302,8 +342,98 @@ protected:
   packml_sm::State current_state;
   packml_sm::State switching_state;
 
-  std::promise<bool> changed_prom_;
 
+  /**
+  * @brief Function to fill a status response
+  * @param current - state to flag as active
+  * @param times - time accounting of the state machine, reported in seconds
+  * @param res - response to fill
+  */
+  static void fill_all_status(
+    packml_sm::State current, const packml_sm::StateTimes & times,
+    packml_msgs::srv::AllStatus::Response & res)
+  {
+    res.stopped_state = current == packml_sm::State::STOPPED;
+    res.idle_state = current == packml_sm::State::IDLE;
+    res.starting_state = current == packml_sm::State::STARTING;
+    res.execute_state = current == packml_sm::State::EXECUTE;
+    res.completing_state = current == packml_sm::State::COMPLETING;
+    res.complete_state = current == packml_sm::State::COMPLETE;
+    res.clearing_state = current == packml_sm::State::CLEARING;
+    res.suspended_state = current == packml_sm::State::SUSPENDED;
+    res.aborting_state = current == packml_sm::State::ABORTING;
+    res.aborted_state = current == packml_sm::State::ABORTED;
+    res.holding_state = current == packml_sm::State::HOLDING;
+    res.held_state = current == packml_sm::State::HELD;
+    res.unholding_state = current == packml_sm::State::UNHOLDING;
+    res.suspending_state = current == packml_sm::State::SUSPENDING;
+    res.unsuspending_state = current == packml_sm::State::UNSUSPENDING;
+    res.resetting_state = current == packml_sm::State::RESETTING;
+    res.stopping_state = current == packml_sm::State::STOPPING;
+
+    res.t_stopped_state = times.seconds(packml_sm::State::STOPPED);
+    res.t_idle_state = times.seconds(packml_sm::State::IDLE);
+    res.t_starting_state = times.seconds(packml_sm::State::STARTING);
+    res.t_execute_state = times.seconds(packml_sm::State::EXECUTE);
+    res.t_completing_state = times.seconds(packml_sm::State::COMPLETING);
+    res.t_complete_state = times.seconds(packml_sm::State::COMPLETE);
+    res.t_clearing_state = times.seconds(packml_sm::State::CLEARING);
+    res.t_suspended_state = times.seconds(packml_sm::State::SUSPENDED);
+    res.t_aborting_state = times.seconds(packml_sm::State::ABORTING);
+    res.t_aborted_state = times.seconds(packml_sm::State::ABORTED);
+    res.t_holding_state = times.seconds(packml_sm::State::HOLDING);
+    res.t_held_state = times.seconds(packml_sm::State::HELD);
+    res.t_unholding_state = times.seconds(packml_sm::State::UNHOLDING);
+    res.t_suspending_state = times.seconds(packml_sm::State::SUSPENDING);
+    res.t_unsuspending_state = times.seconds(packml_sm::State::UNSUSPENDING);
+    res.t_resetting_state = times.seconds(packml_sm::State::RESETTING);
+    res.t_stopping_state = times.seconds(packml_sm::State::STOPPING);
+  }
+
+  /**
+  * @brief Function to convert the counters of a transition, latencies are reported in seconds
+  */
+  static packml_msgs::msg::TransitionStats to_msg(const packml_sm::TransitionStats & stats)
+  {
+    auto seconds = [](std::chrono::nanoseconds value) {return std::chrono::duration<double>(value).count();};
+    packml_msgs::msg::TransitionStats msg;
+    msg.from_state.val = static_cast<signed char>(stats.from);
+    msg.trigger = static_cast<signed char>(stats.trigger);
+    msg.command = static_cast<signed char>(stats.command);
+    msg.to_state.val = static_cast<signed char>(stats.to);
+    msg.accepted = stats.accepted;
+    msg.rejected_by_mode = stats.rejected_by_mode;
+    msg.rejected_by_state = stats.rejected_by_state;
+    msg.latency_count = stats.latency.count;
+    msg.latency_mean = seconds(stats.latency.mean());
+    msg.latency_p50 = seconds(stats.latency.percentile(0.5));
+    msg.latency_p90 = seconds(stats.latency.percentile(0.9));
+    msg.latency_p99 = seconds(stats.latency.percentile(0.99));
+    msg.latency_max = seconds(stats.latency.max);
+    return msg;
+  }
+
+  /**
+  * @brief Function to convert the result of a command script, times are reported in seconds
+  */
+  static packml_msgs::srv::CommandScript::Response to_msg(const packml_sm::ScriptResult & result)
+  {
+    auto seconds = [](std::chrono::nanoseconds value) {return std::chrono::duration<double>(value).count();};
+    packml_msgs::srv::CommandScript::Response res;
+    res.success = result.success;
+    res.error_code = result.success ? res.SUCCESS : res.STEP_FAILED;
+    res.message = result.message;
+    for (const auto & step : result.steps) {
+      packml_msgs::msg::ScriptStepResult msg;
+      msg.outcome = static_cast<signed char>(step.outcome);
+      msg.state.val = static_cast<signed char>(step.state);
+      msg.accepted_after = seconds(step.accepted_after);
+      msg.duration = seconds(step.duration);
+      res.steps.push_back(msg);
+    }
+    res.duration = seconds(result.duration);
+    return res;
+  }
 
   static rclcpp::Client<packml_msgs::srv::ModeTransition>::SharedPtr get_mode_client(std::shared_ptr<PackmlClientInterface> client) {
     return client->mode_tr_client;
@@ -324,11 +454,13 @@ protected:
       // std::cout << "Requesting node " << key << " to change mode to: " << switching_mode << std::endl;
 
       if (!func(val)->wait_for_service(std::chrono::seconds(1))){
-        std::cout << "Client :" << client << " Service: "<< func(val)->get_service_name() << " is unavailable!" << std::endl;
+        PACKML_LOG_WARN("Client :{} Service: {} is unavailable!", client, func(val)->get_service_name());
         // TODO: If one of the clients is not online, we problably should error out?
         //  Or; maybe that node is not needed in the current mode and we should just report back information about which client succeeded and which did not
       }
       else {
+        // Spans from the request to the response the wait below receives
+        packml_sm::tracing::begin("client", packml_sm::tracing::Name::copy(client), packml_sm::tracing::trackOf(val.get()));
         futures.emplace(client, func(val)->async_send_request(request));
       }
 
@@ -352,12 +484,27 @@ protected:
   bool wait_all_futures(std::map<std::string, typename rclcpp::Client<T>::FutureAndRequestId>& futures, std::function<bool(std::string, typename T::Response::SharedPtr)> on_value) {
   // bool wait_all_futures(std::map<std::string, typename rclcpp::Client<T>::SharedFuture>& futures, std::function<bool(std::string, typename T::Response::SharedPtr)> on_value) {
 
+      // Closes the span call_all_clients() opened for the request of a client
+      auto end_span = [this](const std::string & client_name, bool ok) {
+        packml_sm::tracing::end("client", packml_sm::tracing::Name::copy(client_name),
+          packml_sm::tracing::trackOf(client_map_.at(client_name).get()), "ok", ok ? 1 : 0);
+      };
+      // Requests given up on, a future that was received is no longer valid
+      auto end_outstanding_spans = [&futures, &end_span]() {
+        for (auto & [client_name, future_and_request_id] : futures) {
+          if (future_and_request_id.valid()) {
+            end_span(client_name, false);
+          }
+        }
+      };
+
       if (futures.size() <= 0) {
-        std::cout << "No futures to wait on!" << std::endl;
+        PACKML_LOG_DEBUG("No futures to wait on!");
         return false;
       } else if (futures.size() != client_map_.size()) {
         // TODO: see line 243
-        std::cout << "Not all clients responded with a future, maybe some are offline?" << std::endl;
+        PACKML_LOG_WARN("Not all clients responded with a future, maybe some are offline?");
+        end_outstanding_spans();
         return false;
       }
 
@@ -372,7 +519,7 @@ protected:
         // Spin the executor of all clients, to receive service responses
         for (auto const& [client_name, client] : client_map_) {
           client->callbck_grp_exec.spin_once();
-           std::cout << client_name << ": Spinnend once" << std::endl;
+           PACKML_LOG_DEBUG("{}: Spinnend once", client_name);
         }
 
         // For all returned future service responses, check if data ready
@@ -380,8 +527,9 @@ protected:
           if (future_and_request_id.valid()) {
             if (auto response = future_and_request_id.wait_for(std::chrono::seconds(0)); response == std::future_status::ready) {
               auto service_response = future_and_request_id.get();
-
-              success = on_value(client_name, service_response);
+              bool ok = on_value(client_name, service_response);
+              end_span(client_name, ok);
+              success = ok;
             }
             else {
               // We are still waiting on one of the future values
@@ -392,13 +540,14 @@ protected:
         done = !any_waiting;
       }
 
+      end_outstanding_spans();
       return success;
   }
 
 
   void publish_status()
   {
-    std::cout << "Borrowing message" << std::endl;
+    PACKML_LOG_DEBUG("Borrowing message");
     auto msg = status_pub_->borrow_loaned_message();
 
     auto state = packml_msgs::msg::State();
@@ -407,16 +556,16 @@ protected:
     // state.set__val(current_state);
     msg.get().state = state;
 
-    std::cout << "Current state: " << current_state << std::endl;
+    PACKML_LOG_DEBUG("Current state: {}", current_state);
 
     auto mode = packml_msgs::msg::Mode();
     // TODO: make mapping between packml_msgs::msg::Mode constant declarations and packml_sm::Mode
     mode.val = static_cast<signed char>(current_mode);
     msg.get().mode = mode;
 
-    std::cout << "Current mode: " << current_mode << std::endl;
+    PACKML_LOG_DEBUG("Current mode: {}", current_mode);
 
-    std::cout << "publising message" << std::endl;
+    PACKML_LOG_DEBUG("publising message");
     status_pub_->publish(std::move(msg));
   }
 
@@ -442,11 +591,11 @@ std::shared_ptr<packml_msgs::srv::ModeChange::Request> req,
       {
         auto handle_value = [res](std::string client, packml_msgs::srv::ModeTransition::Response::SharedPtr value){
             if (value->success) {
-              std::cout << client << " switched to new mode" << std::endl;
+              PACKML_LOG_INFO("{} switched to new mode", client);
               return true;
             }
 
-            std::cout << client << " did not switch mode! Error: " << value->message << std::endl;
+            PACKML_LOG_WARN("{} did not switch mode! Error: {}", client, value->message);
             return false;
           };
 
@@ -481,39 +630,39 @@ std::shared_ptr<packml_msgs::srv::ModeChange::Request> req,
 
   };
 
-  void on_change_state(packml_msgs::srv::StateChange::Request::SharedPtr req, packml_msgs::srv::StateChange::Response::SharedPtr res) {
+  // The response is deferred until the state machine has taken the transition, so the executor thread
+  // serving this request is not parked while the command is in flight
+  void on_change_state(std::shared_ptr<rmw_request_id_t> header, packml_msgs::srv::StateChange::Request::SharedPtr req) {
     // TODO: make mapping between packml_msgs::msg::State constant declarations and packml_sm::State
     // auto command = static_cast<packml_sm::TransitionCmd>(req->command);
 
-    std::string error_message;
-    bool success = true;
+    auto res = std::make_shared<packml_msgs::srv::StateChange::Response>();
 
     auto command = packml_ros::to_transition_cmd(req->command);
 
     if (command == packml_sm::TransitionCmd::NO_COMMAND) {
       // invalid command!
-      error_message =  "Unrecognized transition request command: " + to_string(command);
       res->success = false;
       res->error_code = res->UNRECGONIZED_REQUEST;
-      res->message = error_message;
+      res->message = "Unrecognized transition request command: " + to_string(command);
+      state_server_->send_response(*header, *res);
     }
     else {
-      auto change_result = sm_->changeState(command);
-
-      if (!change_result.has_value()) {
-        res->success = false;
-        res->error_code = res->INVALID_TRANSITION_REQUEST;
-        res->message = change_result.error();
-      }
-      else {
-        std::cout <<  "Starting wait on promise" << std::endl;
-        // TODO: wait on state_machine->on_state_changed and then return final response
-        changed_prom_.get_future().get();
+      auto change_result = sm_->changeStateAsync(command);
 
-        // Send service response
-        res->success = true;
-        res->error_code = res->SUCCESS;
-      }
+      change_result.reached.then([this, header, res, command](const packml_sm::State & state) {
+          if (state == packml_sm::State::UNDEFINED) {
+            res->success = false;
+            res->error_code = res->INVALID_TRANSITION_REQUEST;
+            res->message = "Transition command failed: " + to_string(command);
+          }
+          else {
+            // Send service response
+            res->success = true;
+            res->error_code = res->SUCCESS;
+          }
+          state_server_->send_response(*header, *res);
+        });
     }
 
     // auto change_result = sm_->setState(switching_state, QString name)
@@ -580,8 +729,57 @@ std::shared_ptr<packml_msgs::srv::ModeChange::Request> req,
 
   }
 
-  void on_all_status(std::shared_ptr<packml_msgs::srv::AllStatus::Request> req, std::shared_ptr<packml_msgs::srv::AllStatus::Response> res) {
+  // A script waits for its states for as long as its steps take, it runs on a thread of its own and
+  // the response is deferred so that the executor keeps serving other requests meanwhile
+  void on_command_script(std::shared_ptr<rmw_request_id_t> header, packml_msgs::srv::CommandScript::Request::SharedPtr req) {
+    std::vector<packml_sm::ScriptStep> steps;
+    for (const auto & step : req->steps) {
+      auto command = packml_ros::to_transition_cmd(step.command);
+      if (command == packml_sm::TransitionCmd::NO_COMMAND &&
+        step.command != packml_msgs::srv::StateChange::Request::NO_COMMAND)
+      {
+        packml_msgs::srv::CommandScript::Response res;
+        res.success = false;
+        res.error_code = res.UNRECGONIZED_REQUEST;
+        res.message = "Unrecognized command in step " + std::to_string(steps.size());
+        script_server_->send_response(*header, res);
+        return;
+      }
+      auto target = packml_ros::to_state(step.target_state.val);
+      if (!target) {
+        packml_msgs::srv::CommandScript::Response res;
+        res.success = false;
+        res.error_code = res.UNRECGONIZED_REQUEST;
+        res.message = "Unrecognized target state " + std::to_string(step.target_state.val) +
+          " in step " + std::to_string(steps.size());
+        script_server_->send_response(*header, res);
+        return;
+      }
+      auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::duration<double>(step.timeout));
+      steps.push_back(packml_sm::ScriptStep{command, *target, timeout});
+    }
+
+    std::erase_if(script_runs_, [](const std::future<void> & run) {
+        return run.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+      });
+    script_runs_.push_back(std::async(std::launch::async, [this, header, steps = std::move(steps)]() {
+        script_server_->send_response(*header, to_msg(sm_->runScript(steps)));
+      }));
+  }
+
+  void on_all_status(std::shared_ptr<packml_msgs::srv::AllStatus::Request> /*req*/, std::shared_ptr<packml_msgs::srv::AllStatus::Response> res) {
     // TODO: change the packml_msgs::srv::AllStatus to just contain packml_msgs::msg::Status.
+    // Lock-free snapshot, polling this at any rate does not disturb the state machine thread
+    auto times = sm_->getStateTimes();
+    fill_all_status(times.current, times, *res);
+  };
+
+  void on_transition_stats(std::shared_ptr<packml_msgs::srv::GetTransitionStats::Request> /*req*/, std::shared_ptr<packml_msgs::srv::GetTransitionStats::Response> res) {
+    // Lock-free snapshot, like the state times
+    for (const auto & stats : sm_->getTransitionStats()) {
+      res->transitions.push_back(to_msg(stats));
+    }
   };
 
 protected:
@@ -596,6 +794,26 @@ protected:
 
     node_names_= node->get_parameter("node_names").as_string_array();
 
+    // Optional YAML/JSON file with user defined modes, see packml_sm::ModeRegistry
+    auto modes_file = node->declare_parameter<std::string>("modes_file", "");
+    if (!modes_file.empty()) {
+      auto registry = packml_sm::ModeRegistry::load(modes_file);
+      if (!registry) {
+        PACKML_LOG_ERROR("Keeping the built-in modes: {}", registry.error());
+      } else if (!sm_->setModeRegistry(std::make_shared<packml_sm::ModeRegistry>(std::move(*registry)))) {
+        PACKML_LOG_ERROR("Could not install the modes of {}", modes_file);
+      }
+    }
+
+    // Optional Chrome trace of the state spans, commands, operations and client calls
+    auto trace_file = node->declare_parameter<std::string>("trace_file", "");
+    if (!trace_file.empty()) {
+      auto started = packml_sm::tracing::start(trace_file);
+      if (!started) {
+        PACKML_LOG_ERROR("Running without trace: {}", started.error());
+      }
+    }
+
     current_mode = packml_sm::ModeType::UNDEFINED;
     current_state = packml_sm::State::UNDEFINED;
     switching_mode = packml_sm::ModeType::UNDEFINED;
@@ -610,8 +828,10 @@ protected:
     // mode_server_ = node->create_service<packml_msgs::srv::ModeTransition>("changeMode", [this](auto&& req, auto&& res){/*on_change_mode(std::forward<decltype(hdr)>(hdr), std::forward<decltype(req)>(req), std::forward<decltype(res)>(res));*/});
 
     mode_server_ = node->create_service<packml_msgs::srv::ModeChange>("~/changeMode", [this](const std::shared_ptr<packml_msgs::srv::ModeChange::Request>& req, const std::shared_ptr<packml_msgs::srv::ModeChange::Response>& res){on_change_mode(req, res); });
-    state_server_ = node->create_service<packml_msgs::srv::StateChange>("~/changeState", [this](const std::shared_ptr<packml_msgs::srv::StateChange::Request>& req, const std::shared_ptr<packml_msgs::srv::StateChange::Response>& res){on_change_state(req, res); });
+    state_server_ = node->create_service<packml_msgs::srv::StateChange>("~/changeState", [this](const std::shared_ptr<rmw_request_id_t> header, const std::shared_ptr<packml_msgs::srv::StateChange::Request> req){on_change_state(header, req); });
     status_server_ = node->create_service<packml_msgs::srv::AllStatus>("~/allStatus", [this](const std::shared_ptr<packml_msgs::srv::AllStatus::Request>& req, const std::shared_ptr<packml_msgs::srv::AllStatus::Response>& res){on_all_status(req, res); });
+    stats_server_ = node->create_service<packml_msgs::srv::GetTransitionStats>("~/transitionStats", [this](const std::shared_ptr<packml_msgs::srv::GetTransitionStats::Request>& req, const std::shared_ptr<packml_msgs::srv::GetTransitionStats::Response>& res){on_transition_stats(req, res); });
+    script_server_ = node->create_service<packml_msgs::srv::CommandScript>("~/commandScript", [this](const std::shared_ptr<rmw_request_id_t> header, const std::shared_ptr<packml_msgs::srv::CommandScript::Request> req){on_command_script(header, req); });
     status_pub_ = node->create_publisher<packml_msgs::msg::Status>("packml_status", rclcpp::SensorDataQoS());
 
   }
@@ -21,11 +21,15 @@
 
 #include <memory>
 #include <chrono>
+#include <cstdint>
 #include <thread>
 #include <sstream>
 #include "packml_ros/interface/packml_interface.hpp"
 #include "packml_sm/common.hpp"
+#include "packml_sm/log.hpp"
+#include "packml_sm/state_change_bus.hpp"
 #include "packml_sm/state_machine.hpp"
+#include "packml_sm/trace.hpp"
 #include "rclcpp/rclcpp.hpp"
 
 #include <packml_msgs/srv/state_change.hpp>
@@ -45,6 +49,11 @@ class SMNode_new : PackmlManagerInterface
    */
   std::shared_ptr<packml_sm::StateMachine> sm;
 
+  /**
+   * @brief Subscription of the client fan-out, declared after sm so its delivery thread stops first
+   */
+  std::unique_ptr<packml_sm::StateChangeBus::Subscription> state_changes_;
+
   // /**
   // * @brief Pointer for transition service server
   // */
@@ -57,92 +66,6 @@ class SMNode_new : PackmlManagerInterface
 
   // rclcpp::Service<packml_msgs::srv::ModeChange>::SharedPtr mode_server_;
 
-  // Global variables to keep track of time the SM has been in a state
-  /**
-   * @brief Counter for elapsed time in the stopped state
-   */
-  float stopped_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the idle state
-   */
-  float idle_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the starting state
-   */
-  float starting_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the execute state
-   */
-  float execute_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the completing state
-   */
-  float completing_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the complete state
-   */
-  float complete_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the clearing state
-   */
-  float clearing_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the suspended state
-   */
-  float suspended_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the aborting state
-   */
-  float aborting_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the aborted state
-   */
-  float aborted_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the holding state
-   */
-  float holding_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the held state
-   */
-  float held_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the unholding state
-   */
-  float unholding_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the suspending state
-   */
-  float suspending_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the unsuspending state
-   */
-  float unsuspending_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the resetting state
-   */
-  float resetting_state_t = 0.0;
-
-  /**
-   * @brief Counter for elapsed time in the stopping state
-   */
-  float stopping_state_t = 0.0;
-
 public:
   /**
    * @brief The class constructor
@@ -170,20 +93,26 @@ public:
     // current_mode = packml_sm::ModeType::MANUAL;
     sm = packml_sm::StateMachine::singleCycleSM();  // Execute method runs once
 
-    sm->on_state_changed = [this](packml_sm::State value, QString name) {
-      this->changed_prom_ = std::promise<bool>();
-       this->changed_prom_.set_value(true);
-
-      std::cout << "State changed to: " << name.toStdString() << "(" << value << ")" << std::endl;
+    // The fan-out waits for every client, so it runs on a delivery thread of its own instead of
+    // the state machine thread. When it falls behind it skips to the latest entries.
+    state_changes_ = sm->stateChanges().subscribe(
+      [this, last = std::uint64_t{0}](const packml_sm::StateChange & change) mutable {
+      packml_sm::State value = change.state;
+      if (last != 0 && change.sequence != last + 1) {
+        PACKML_LOG_WARN("Fan-out fell behind, skipped {} state changes", change.sequence - last - 1);
+      }
+      last = change.sequence;
+      PACKML_LOG_INFO("State changed to: {}", value);
+      packml_sm::tracing::Scope span("fan_out", value);
 
       auto handle_value = [](std::string client, packml_msgs::srv::StateTransition::Response::SharedPtr value) {
         if (value->success)
         {
-          std::cout << client << " switched to new state" << std::endl;
+          PACKML_LOG_INFO("{} switched to new state", client);
           return true;
         }
 
-        std::cout << client << " did not switch state! Error: " << value->message << std::endl;
+        PACKML_LOG_WARN("{} did not switch state! Error: {}", client, value->message);
         return false;
       };
 
@@ -196,14 +125,14 @@ public:
 
       auto succes = wait_all_futures<packml_msgs::srv::StateTransition>(futures, handle_value);
 
-      std::cout << "Done waiting all features" << std::endl;
+      PACKML_LOG_DEBUG("Done waiting all features");
 
       if (!succes)
       {
         // res->success = false;
         // res->error_code = 1;
         // res->message = "Error in one of the packml clients";
-        std::cout << "unsuccessfull!" << std::endl;
+        PACKML_LOG_WARN("unsuccessfull!");
       }
       else
       {
@@ -214,13 +143,13 @@ public:
         // Publish new state
         publish_status();
 
-        std::cout << "Done publishing!" << std::endl;
+        PACKML_LOG_DEBUG("Done publishing!");
 
         // Send service response
         // res->success = true;
         // res->error_code = res->SUCCESS;
       }
-    };
+    }, 64, packml_sm::OverflowPolicy::DROP_OLDEST);
 
     sm->on_mode_changed = [this](packml_sm::ModeType value) {
       // TODO: enlighten all clients of new mode!
@@ -57,92 +57,6 @@ class SMNode : PackmlManagerInterface
 
   rclcpp::Service<packml_msgs::srv::ModeChange>::SharedPtr mode_server_;
 
-  // Global variables to keep track of time the SM has been in a state
-  /**
-  * @brief Counter for elapsed time in the stopped state
-  */
-  float stopped_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the idle state
-  */
-  float idle_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the starting state
-  */
-  float starting_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the execute state
-  */
-  float execute_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the completing state
-  */
-  float completing_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the complete state
-  */
-  float complete_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the clearing state
-  */
-  float clearing_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the suspended state
-  */
-  float suspended_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the aborting state
-  */
-  float aborting_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the aborted state
-  */
-  float aborted_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the holding state
-  */
-  float holding_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the held state
-  */
-  float held_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the unholding state
-  */
-  float unholding_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the suspending state
-  */
-  float suspending_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the unsuspending state
-  */
-  float unsuspending_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the resetting state
-  */
-  float resetting_state_t = 0.0;
-
-  /**
-  * @brief Counter for elapsed time in the stopping state
-  */
-  float stopping_state_t = 0.0;
-
 public:
   /**
   * @brief The class constructor
@@ -292,113 +206,8 @@ public:
       [this](const std::shared_ptr<packml_msgs::srv::AllStatus::Request> req,
         std::shared_ptr<packml_msgs::srv::AllStatus::Response> res) -> void {
         (void)req;
-        packml_sm::State curr_state_ = getCurrentState();
-        res->stopped_state = false;
-        res->idle_state = false;
-        res->starting_state = false;
-        res->execute_state = false;
-        res->completing_state = false;
-        res->complete_state = false;
-        res->clearing_state = false;
-        res->suspended_state = false;
-        res->aborting_state = false;
-        res->aborted_state = false;
-        res->holding_state = false;
-        res->held_state = false;
-        res->unholding_state = false;
-        res->suspending_state = false;
-        res->unsuspending_state = false;
-        res->resetting_state = false;
-        res->stopping_state = false;
-        switch (curr_state_) {
-          case packml_sm::State::STOPPED:
-            res->stopped_state = true;
-            stopped_state_t = stopped_state_t + 0.2;
-            break;
-          case packml_sm::State::STARTING:
-            res->starting_state = true;
-            starting_state_t = starting_state_t + 0.2;
-            break;
-          case packml_sm::State::IDLE:
-            res->idle_state = true;
-            idle_state_t = idle_state_t + 0.2;
-            break;
-          case packml_sm::State::SUSPENDED:
-            res->suspended_state = true;
-            suspended_state_t = suspended_state_t + 0.2;
-            break;
-          case packml_sm::State::EXECUTE:
-            res->execute_state = true;
-            execute_state_t = execute_state_t + 0.2;
-            break;
-          case packml_sm::State::STOPPING:
-            res->stopping_state = true;
-            stopping_state_t = stopping_state_t + 0.2;
-            break;
-          case packml_sm::State::ABORTING:
-            res->aborting_state = true;
-            aborting_state_t = aborting_state_t + 0.2;
-            break;
-          case packml_sm::State::ABORTED:
-            res->aborted_state = true;
-            aborted_state_t = aborted_state_t + 0.2;
-            break;
-          case packml_sm::State::HOLDING:
-            res->holding_state = true;
-            holding_state_t = holding_state_t + 0.2;
-            break;
-          case packml_sm::State::HELD:
-            res->held_state = true;
-            held_state_t = held_state_t + 0.2;
-            break;
-          case packml_sm::State::RESETTING:
-            res->resetting_state = true;
-            resetting_state_t = resetting_state_t + 0.2;
-            break;
-          case packml_sm::State::SUSPENDING:
-            res->suspending_state = true;
-            suspending_state_t = suspending_state_t + 0.2;
-            break;
-          case packml_sm::State::UNSUSPENDING:
-            res->unsuspending_state = true;
-            unsuspending_state_t = unsuspending_state_t + 0.2;
-            break;
-          case packml_sm::State::CLEARING:
-            res->clearing_state = true;
-            clearing_state_t = clearing_state_t + 0.2;
-            break;
-          case packml_sm::State::UNHOLDING:
-            res->unholding_state = true;
-            unholding_state_t = unholding_state_t + 0.2;
-            break;
-          case packml_sm::State::COMPLETING:
-            res->completing_state = true;
-            completing_state_t = completing_state_t + 0.2;
-            break;
-          case packml_sm::State::COMPLETE:
-            res->complete_state = true;
-            complete_state_t = complete_state_t + 0.2;
-            break;
-          default:
-            break;
-        }
-        res->t_stopped_state = stopped_state_t;
-        res->t_starting_state = starting_state_t;
-        res->t_idle_state = idle_state_t;
-        res->t_suspended_state = suspended_state_t;
-        res->t_execute_state = execute_state_t;
-        res->t_stopping_state = stopping_state_t;
-        res->t_aborting_state = aborting_state_t;
-        res->t_aborted_state = aborted_state_t;
-        res->t_holding_state = holding_state_t;
-        res->t_held_state = held_state_t;
-        res->t_resetting_state = resetting_state_t;
-        res->t_suspending_state = suspending_state_t;
-        res->t_unsuspending_state = unsuspending_state_t;
-        res->t_clearing_state = clearing_state_t;
-        res->t_unholding_state = unholding_state_t;
-        res->t_completing_state = completing_state_t;
-        res->t_complete_state = complete_state_t;
+        // Durations come from the state machine's own steady clock accounting
+        fill_all_status(getCurrentState(), sm->getStateTimes(), *res);
       };
     // Create service to control the execution of the SM from RViz GUI
     trans_server_ = node->create_service<packml_msgs::srv::StateChange>("~/transition", transRequest);
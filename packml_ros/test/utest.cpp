@@ -587,6 +587,15 @@ TEST(Packml_ros, test_execute_method)
   EXPECT_EQ(result, 0);
 }
 
+TEST(Packml_ros, script_target_state_outside_states_is_rejected)
+{
+  EXPECT_EQ(packml_sm::State::UNDEFINED, packml_ros::to_state(packml_msgs::msg::State::UNDEFINED));
+  EXPECT_EQ(packml_sm::State::COMPLETE, packml_ros::to_state(packml_msgs::msg::State::COMPLETE));
+  EXPECT_FALSE(packml_ros::to_state(packml_msgs::msg::State::COMPLETE + 1).has_value());
+  EXPECT_FALSE(packml_ros::to_state(-1).has_value());
+  EXPECT_FALSE(packml_ros::to_state(64).has_value());
+}
+
 int main(int argc, char ** argv)
 {
   rclcpp::init(argc, argv);
@@ -0,0 +1,223 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__ACTING_EXECUTOR_HPP_
+#define PACKML_SM__ACTING_EXECUTOR_HPP_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packml_sm/common.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Worker lanes of the ActingExecutor
+*/
+enum class ExecutorLane : std::uint8_t
+{
+  SAFETY = 0,   // ABORTING and STOPPING
+  EXECUTE = 1,  // EXECUTE
+  NORMAL = 2    // all other acting states
+};
+
+constexpr std::size_t kExecutorLaneCount = 3;
+
+inline std::string to_string(const ExecutorLane & lane)
+{
+  switch (lane) {
+    case ExecutorLane::SAFETY:  return "SAFETY";
+    case ExecutorLane::EXECUTE: return "EXECUTE";
+    case ExecutorLane::NORMAL:  return "NORMAL";
+  }
+  return std::to_string(static_cast<int>(lane));
+}
+
+
+/**
+* @brief Function that returns the lane the operation of an acting state runs on
+*/
+constexpr ExecutorLane laneFor(State state)
+{
+  switch (state) {
+    case State::ABORTING:
+    case State::STOPPING:
+      return ExecutorLane::SAFETY;
+    case State::EXECUTE:
+      return ExecutorLane::EXECUTE;
+    default:
+      return ExecutorLane::NORMAL;
+  }
+}
+
+
+/**
+* @brief Function to pin the calling thread to a set of CPUs
+* @return 0 on success, an errno value otherwise (ENOTSUP on platforms other than Linux)
+*/
+int setCurrentThreadAffinity(const std::vector<int> & cpus);
+
+
+/**
+* @brief Configuration of one lane
+*/
+struct LaneConfig
+{
+  /**
+  * @brief Number of worker threads owned by the lane, at least 1
+  */
+  std::size_t threads = 1;
+
+  /**
+  * @brief CPUs the workers are pinned to, empty for no affinity (only applied on Linux)
+  */
+  std::vector<int> cpus;
+};
+
+
+/**
+* @brief Configuration of an ActingExecutor, indexed by ExecutorLane
+*/
+struct ExecutorConfig
+{
+  // EXECUTE jobs of several state machines may run at the same time, the other lanes are short
+  std::array<LaneConfig, kExecutorLaneCount> lanes{
+    LaneConfig{2, {}},
+    LaneConfig{std::max(2u, std::thread::hardware_concurrency() / 2), {}},
+    LaneConfig{2, {}}};
+
+  LaneConfig & lane(ExecutorLane value) {return lanes[static_cast<std::size_t>(value)];}
+
+  const LaneConfig & lane(ExecutorLane value) const {return lanes[static_cast<std::size_t>(value)];}
+};
+
+
+/**
+* @brief Counters of one lane, copied out by ActingExecutor::metrics()
+*/
+struct LaneMetrics
+{
+  std::size_t queue_depth = 0;
+  std::size_t max_queue_depth = 0;
+  std::uint64_t submitted = 0;
+  std::uint64_t running = 0;
+  std::uint64_t completed = 0;
+
+  /**
+  * @brief Time between submit() and the start of the job on a worker
+  */
+  std::chrono::nanoseconds last_dispatch_latency{0};
+  std::chrono::nanoseconds max_dispatch_latency{0};
+  std::chrono::nanoseconds total_dispatch_latency{0};
+
+  std::chrono::nanoseconds meanDispatchLatency() const
+  {
+    auto started = static_cast<std::int64_t>(completed + running);
+    return started == 0 ? std::chrono::nanoseconds(0) : total_dispatch_latency / started;
+  }
+};
+
+
+/**
+* @brief Worker pool for acting state operations, with one set of threads per lane.
+*
+* Every lane owns its workers, so a safety operation (ABORTING, STOPPING) never queues behind long
+* running EXECUTE jobs and the EXECUTE workers can be pinned to isolated cores. Idle NORMAL workers
+* also take queued SAFETY jobs, always before their own, so safety work preempts ordinary work
+* whenever both are waiting.
+*/
+class ActingExecutor
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit ActingExecutor(const ExecutorConfig & config = ExecutorConfig());
+
+
+  /**
+  * @brief Class destructor, runs the jobs that are still queued and joins the workers
+  */
+  ~ActingExecutor();
+
+  ActingExecutor(const ActingExecutor &) = delete;
+  ActingExecutor & operator=(const ActingExecutor &) = delete;
+
+
+  /**
+  * @brief Process wide executor used by state machines that were not given one
+  */
+  static std::shared_ptr<ActingExecutor> global();
+
+
+  /**
+  * @brief Function to set the configuration of the process wide executor
+  * @return false if the global executor was already created
+  */
+  static bool configureGlobal(const ExecutorConfig & config);
+
+
+  /**
+  * @brief Function to queue a job on a lane
+  * @return future that becomes ready when the job has returned
+  */
+  std::shared_future<void> submit(ExecutorLane lane, std::function<void()> job);
+
+  LaneMetrics metrics(ExecutorLane lane) const;
+
+  const ExecutorConfig & config() const {return config_;}
+
+private:
+  struct Job
+  {
+    std::function<void()> function;
+    std::promise<void> done;
+    Clock::time_point submitted;
+  };
+
+  struct Lane
+  {
+    std::deque<Job> queue;
+    std::condition_variable cv;
+    LaneMetrics metrics;
+  };
+
+  void worker(ExecutorLane lane);
+
+  Lane & lane(ExecutorLane value) {return lanes_[static_cast<std::size_t>(value)];}
+
+  const ExecutorConfig config_;
+
+  mutable std::mutex mutex_;
+  std::array<Lane, kExecutorLaneCount> lanes_;
+  bool stopping_{false};
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__ACTING_EXECUTOR_HPP_
@@ -0,0 +1,212 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__ASYNC_RESULT_HPP_
+#define PACKML_SM__ASYNC_RESULT_HPP_
+
+#include <coroutine>
+#include <expected>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "packml_sm/common.hpp"
+
+namespace packml_sm
+{
+
+namespace detail
+{
+
+template<typename T>
+struct AsyncState
+{
+  AsyncState()
+  : future(promise.get_future().share()) {}
+
+  std::mutex mutex;
+  bool ready = false;
+  std::promise<T> promise;
+  std::shared_future<T> future;
+  std::vector<std::function<void(const T &)>> callbacks;
+};
+
+}  // namespace detail
+
+
+/**
+* @brief Read side of a value that is produced asynchronously by the state machine.
+*
+* The value can be consumed by blocking on a future, by registering a callback or by co_await from a
+* C++20 coroutine. Callbacks and resumed coroutines run on the thread that sets the value (the state
+* machine thread for the Qt state machine), or immediately if the value is already set. They must
+* not block that thread.
+*/
+template<typename T>
+class AsyncResult
+{
+public:
+  explicit AsyncResult(std::shared_ptr<detail::AsyncState<T>> state)
+  : state_(std::move(state)) {}
+
+  bool ready() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->ready;
+  }
+
+
+  /**
+  * @brief Function that blocks until the value is set and returns it
+  */
+  const T & get() const {return state_->future.get();}
+
+  std::shared_future<T> future() const {return state_->future;}
+
+
+  /**
+  * @brief Function to register a callback for the value
+  * @param callback - called once with the value
+  */
+  void then(std::function<void(const T &)> callback) const
+  {
+    if (!addCallback(callback)) {
+      callback(state_->future.get());
+    }
+  }
+
+  struct Awaiter
+  {
+    std::shared_ptr<detail::AsyncState<T>> state;
+
+    bool await_ready() const
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      return state->ready;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) const
+    {
+      // Resume inline if the value arrived in the meantime
+      return AsyncResult(state).addCallback([handle](const T &) {handle.resume();});
+    }
+
+    const T & await_resume() const {return state->future.get();}
+  };
+
+  Awaiter operator co_await() const {return Awaiter{state_};}
+
+private:
+  // Returns false (and does not register) if the value is already set
+  bool addCallback(std::function<void(const T &)> callback) const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (state_->ready) {
+      return false;
+    }
+    state_->callbacks.push_back(std::move(callback));
+    return true;
+  }
+
+  std::shared_ptr<detail::AsyncState<T>> state_;
+};
+
+
+/**
+* @brief Write side of an AsyncResult, only the first set() has an effect
+*/
+template<typename T>
+class AsyncPromise
+{
+public:
+  AsyncPromise()
+  : state_(std::make_shared<detail::AsyncState<T>>()) {}
+
+  AsyncResult<T> result() const {return AsyncResult<T>(state_);}
+
+
+  /**
+  * @brief Function to publish the value and run the registered callbacks
+  * @return false if a value was set before
+  */
+  bool set(T value) const
+  {
+    std::vector<std::function<void(const T &)>> callbacks;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (state_->ready) {
+        return false;
+      }
+      state_->ready = true;
+      state_->promise.set_value(std::move(value));
+      callbacks.swap(state_->callbacks);
+    }
+    const T & stored = state_->future.get();
+    for (auto & callback : callbacks) {
+      callback(stored);
+    }
+    return true;
+  }
+
+  bool ready() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->ready;
+  }
+
+private:
+  std::shared_ptr<detail::AsyncState<T>> state_;
+};
+
+
+/**
+* @brief Function to create a result that is already set
+*/
+template<typename T>
+AsyncResult<T> makeReadyResult(T value)
+{
+  AsyncPromise<T> promise;
+  promise.set(std::move(value));
+  return promise.result();
+}
+
+
+/**
+* @brief Results of an asynchronous state change command.
+*
+* accepted is set once the state machine has evaluated the command in its current state and mode.
+* reached is set to the state entered by the accepted transition, or to State::UNDEFINED if the
+* command was rejected.
+*/
+struct StateChangeResult
+{
+  AsyncResult<bool> accepted;
+  AsyncResult<State> reached;
+};
+
+
+/**
+* @brief Result of an asynchronous mode change, same contents as the return value of changeMode()
+*/
+using ModeChangeResult = AsyncResult<std::expected<bool, std::string>>;
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__ASYNC_RESULT_HPP_
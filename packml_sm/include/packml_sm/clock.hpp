@@ -0,0 +1,182 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__CLOCK_HPP_
+#define PACKML_SM__CLOCK_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <vector>
+
+#include "packml_sm/timer_wheel.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Time source of a state machine: timed states, watchdogs, state times and latencies are
+* measured and scheduled with it.
+*
+* Clock::system() follows std::chrono::steady_clock. A VirtualClock only moves when it is advanced,
+* which runs simulated production cycles as fast as the state machine can take its transitions.
+*/
+class Clock
+{
+public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  virtual ~Clock() = default;
+
+  virtual TimePoint now() const = 0;
+
+
+  /**
+  * @brief Function to run a callback once the clock reaches deadline. The callback runs on a thread
+  * of the clock and must not block; it may schedule and cancel timers.
+  */
+  virtual TimerWheel::TimerId schedule(TimePoint deadline, TimerWheel::Callback callback) = 0;
+
+
+  /**
+  * @brief Function to remove a timer that has not fired yet
+  * @return true if the timer was removed, false if it already fired or was cancelled
+  */
+  virtual bool cancel(TimerWheel::TimerId id) = 0;
+
+
+  /**
+  * @brief Function to block the calling thread until the clock reaches deadline, for operations
+  * that simulate work
+  * @return false if token was signalled first
+  */
+  virtual bool sleepUntil(TimePoint deadline, std::stop_token token = {}) = 0;
+
+  bool sleepFor(std::chrono::nanoseconds duration, std::stop_token token = {})
+  {
+    return sleepUntil(now() + duration, token);
+  }
+
+
+  /**
+  * @brief Function that returns whether the clock is simulated, its timers then fire on the
+  * thread that advances it instead of the event loop of the state machine
+  */
+  virtual bool simulated() const {return false;}
+
+
+  /**
+  * @brief Functions to count work a step of a simulated clock caused on another thread, e.g. the
+  * events posted to a state machine. A VirtualClock waits until none is outstanding before its next
+  * step, other clocks ignore it.
+  */
+  virtual void beginWork() {}
+
+  virtual void endWork() {}
+
+
+  /**
+  * @brief Wall time clock shared by all state machines that were not given another clock
+  */
+  static std::shared_ptr<Clock> system();
+};
+
+
+/**
+* @brief Clock that only moves when advance() is called.
+*
+* advance() moves the time from timer to timer and runs the due callbacks on the calling thread, so
+* a chain of timed states plays out in order within one call. State machines that react to a timer
+* on another thread count that work with beginWork() and endWork(); before each step the clock
+* waits until the work caused by the previous step is done.
+*
+* Operations that sleep on the clock are woken when the time passes their deadline, they continue
+* concurrently with further advancing.
+*/
+class VirtualClock : public Clock
+{
+public:
+  explicit VirtualClock(TimePoint start = std::chrono::steady_clock::now());
+
+  TimePoint now() const override
+  {
+    return start_ + std::chrono::nanoseconds(elapsed_ns_.load(std::memory_order_acquire));
+  }
+
+  TimerWheel::TimerId schedule(TimePoint deadline, TimerWheel::Callback callback) override;
+
+  bool cancel(TimerWheel::TimerId id) override;
+
+  bool sleepUntil(TimePoint deadline, std::stop_token token = {}) override;
+
+  bool simulated() const override {return true;}
+
+  void beginWork() override;
+
+  void endWork() override;
+
+
+  /**
+  * @brief Function to move the time forward, running every timer due on the way
+  * @return number of timer callbacks run
+  */
+  std::size_t advance(std::chrono::nanoseconds duration) {return advanceTo(now() + duration);}
+
+  std::size_t advanceTo(TimePoint target);
+
+
+  /**
+  * @brief Function that returns the number of pending timers
+  */
+  std::size_t pending() const;
+
+private:
+  void settle();
+
+  const TimePoint start_;
+  std::atomic<std::int64_t> elapsed_ns_{0};
+
+  mutable std::mutex mutex_;
+  std::condition_variable_any sleepers_;
+  TimerWheel wheel_;
+  // Callbacks due in the current step, kept to reuse its capacity. Only used by the advancing thread.
+  std::vector<TimerWheel::Callback> due_;
+
+  std::mutex work_mutex_;
+  std::condition_variable work_done_;
+  std::size_t outstanding_work_ = 0;
+};
+
+
+/**
+* @brief Implemented by state machines whose states read the clock of their machine
+*/
+class ClockProvider
+{
+public:
+  virtual ~ClockProvider() = default;
+
+  virtual Clock & clock() = 0;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__CLOCK_HPP_
@@ -0,0 +1,451 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__COMMAND_QUEUE_HPP_
+#define PACKML_SM__COMMAND_QUEUE_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "packml_sm/async_result.hpp"
+#include "packml_sm/common.hpp"
+#include "packml_sm/latency_histogram.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Link of an intrusive MpscQueue, derive from it to make a type queueable
+*/
+struct MpscNode
+{
+  std::atomic<MpscNode *> next{nullptr};
+};
+
+
+/**
+* @brief Intrusive lock-free multi producer, single consumer queue (Vyukov).
+*
+* push() is wait-free and may be called from any thread, pop() must only be called by the one
+* consumer thread. The queue does not own its nodes.
+*/
+template<typename T>
+class MpscQueue
+{
+public:
+  MpscQueue()
+  : head_(&stub_), tail_(&stub_) {}
+
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue & operator=(const MpscQueue &) = delete;
+
+  void push(T * item)
+  {
+    pushNode(static_cast<MpscNode *>(item));
+  }
+
+
+  /**
+  * @brief Function to take the oldest item from the queue
+  * @return nullptr if the queue is empty or the next producer has not finished its push yet
+  */
+  T * pop()
+  {
+    MpscNode * tail = tail_;
+    MpscNode * next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<T *>(tail);
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    pushNode(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<T *>(tail);
+    }
+    return nullptr;
+  }
+
+private:
+  void pushNode(MpscNode * node)
+  {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    MpscNode * prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  MpscNode stub_;
+  alignas(64) std::atomic<MpscNode *> head_;
+  alignas(64) MpscNode * tail_;
+};
+
+
+/**
+* @brief Intake lane of a command, the EMERGENCY lane is dispatched ahead of every queued command of
+* the NORMAL lane
+*/
+enum class CommandPriority : std::uint8_t
+{
+  NORMAL    = 0,
+  EMERGENCY = 1
+};
+
+constexpr std::size_t kCommandPriorityCount = 2;
+
+constexpr CommandPriority priorityOf(TransitionCmd command)
+{
+  return (command == TransitionCmd::ABORT || command == TransitionCmd::STOP) ?
+         CommandPriority::EMERGENCY : CommandPriority::NORMAL;
+}
+
+
+/**
+* @brief A single command submission and the completion ticket of its caller.
+*
+* Every submission owns its results, so concurrent callers each receive the result of their own
+* command. A ticket that is destroyed before it was completed reports the command as rejected.
+*/
+struct CommandTicket : public MpscNode
+{
+  explicit CommandTicket(TransitionCmd cmd_value)
+  : cmd(cmd_value) {}
+
+  CommandTicket(const CommandTicket &) = delete;
+  CommandTicket & operator=(const CommandTicket &) = delete;
+
+  ~CommandTicket()
+  {
+    complete(false);
+    reached_.set(State::UNDEFINED);
+  }
+
+  AsyncResult<bool> accepted() const {return accepted_.result();}
+
+  AsyncResult<State> reached() const {return reached_.result();}
+
+  StateChangeResult results() const {return StateChangeResult{accepted(), reached()};}
+
+
+  /**
+  * @brief Function to report whether the command was accepted, a rejected command reaches no state
+  */
+  void complete(bool accepted)
+  {
+    accepted_.set(accepted);
+    if (!accepted) {
+      reached_.set(State::UNDEFINED);
+    }
+  }
+
+
+  /**
+  * @brief Function to report the state entered by the accepted command
+  */
+  void reach(State state)
+  {
+    reached_.set(state);
+  }
+
+  const TransitionCmd cmd;
+
+  const CommandPriority priority = priorityOf(cmd);
+
+  /**
+  * @brief Time of the submission, the transition latency is measured from it
+  */
+  const std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+
+private:
+  AsyncPromise<bool> accepted_;
+  AsyncPromise<State> reached_;
+};
+
+
+/**
+* @brief Counters of one lane of a CommandQueue
+*/
+struct CommandLaneStats
+{
+  /**
+  * @brief Commands queued and not yet drained, and the largest number seen
+  */
+  std::size_t depth = 0;
+  std::size_t max_depth = 0;
+
+  std::uint64_t submitted = 0;
+
+
+  /**
+  * @brief Submissions rejected without being dispatched: repeats of a queued command that the
+  * state it leads to does not accept, and HOLD/UNHOLD or SUSPEND/UNSUSPEND pairs that cancel each
+  * other
+  */
+  std::uint64_t coalesced = 0;
+
+
+  /**
+  * @brief Time from the submission to the evaluation of the command by the state machine
+  */
+  LatencyHistogram time_to_dispatch;
+};
+
+
+struct CommandIntakeStats
+{
+  std::array<CommandLaneStats, kCommandPriorityCount> lanes;
+
+  const CommandLaneStats & lane(CommandPriority priority) const
+  {
+    return lanes[static_cast<std::size_t>(priority)];
+  }
+};
+
+
+/**
+* @brief Command intake of a state machine: producers push tickets from any thread, the state
+* machine thread drains them.
+*
+* submit() reports through its return value whether the intake was idle, in which case the caller
+* must schedule one drain() on the consumer thread. While a drain is outstanding further submissions
+* do not schedule another one.
+*
+* ABORT and STOP are queued on the EMERGENCY lane, which every drain empties before the NORMAL lane.
+*
+* A drain that is told the state the state machine rests in coalesces the queued commands of a lane,
+* following the state each dispatched command leads to: a command submitted right after the same
+* command is rejected without being dispatched when that state does not accept it, which is what the
+* state machine would answer, and a HOLD directly followed by an UNHOLD (or SUSPEND by UNSUSPEND) is
+* rejected as a pair when the state accepts the HOLD, leaving the state machine where it was.
+*/
+class CommandQueue
+{
+public:
+  CommandQueue() = default;
+
+  ~CommandQueue()
+  {
+    // Reject whatever was not dispatched
+    for (auto & lane : lanes_) {
+      while (CommandTicket * ticket = lane.queue.pop()) {
+        delete ticket;
+      }
+    }
+  }
+
+
+  /**
+  * @brief Function to queue a command ticket, takes ownership of the ticket
+  * @return true if the consumer has to be woken up
+  */
+  bool submit(CommandTicket * ticket)
+  {
+    Lane & lane = laneOf(ticket->priority);
+    auto depth = lane.depth.fetch_add(1, std::memory_order_relaxed) + 1;
+    auto max_depth = lane.max_depth.load(std::memory_order_relaxed);
+    while (depth > max_depth &&
+      !lane.max_depth.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed))
+    {
+    }
+    lane.submitted.fetch_add(1, std::memory_order_relaxed);
+    lane.queue.push(ticket);
+    return pending_.fetch_add(1, std::memory_order_acq_rel) == 0;
+  }
+
+
+  /**
+  * @brief Function to dispatch all queued tickets, must only be called from the consumer thread
+  * @param settled - state of the state machine when nothing else is queued for it, std::nullopt
+  * disables coalescing. An operation completing before the dispatched commands are evaluated must
+  * not change the answer to a coalesced command.
+  * @param next - State(State from, TransitionCmd command) returning the state command enters from
+  * from, State::UNDEFINED if it is rejected there
+  * @param dispatch - called with ownership of every ticket left after coalescing, the EMERGENCY
+  * lane first and in submission order within a lane
+  * @param discard - called with ownership of every ticket rejected by coalescing
+  */
+  template<typename Next, typename Dispatch, typename Discard>
+  void drain(std::optional<State> settled, Next && next, Dispatch && dispatch, Discard && discard)
+  {
+    // The state the next dispatched command is evaluated in, only known for the first batch: the
+    // EMERGENCY tickets of a later batch would overtake the NORMAL tickets of this one
+    std::optional<State> state = settled;
+    while (std::size_t pending = pending_.load(std::memory_order_acquire)) {
+      // Takes at most the counted tickets, a producer that counts after this drain returns schedules
+      // the next one
+      std::size_t taken = 0;
+      for (auto priority : {CommandPriority::EMERGENCY, CommandPriority::NORMAL}) {
+        Lane & lane = laneOf(priority);
+        batch_.clear();
+        while (taken + batch_.size() < pending) {
+          CommandTicket * ticket = lane.queue.pop();
+          if (ticket == nullptr) {
+            break;
+          }
+          batch_.push_back(ticket);
+        }
+        lane.depth.fetch_sub(batch_.size(), std::memory_order_relaxed);
+        taken += batch_.size();
+        coalesce(lane, state, next, discard);
+        for (CommandTicket * ticket : batch_) {
+          dispatch(ticket);
+        }
+      }
+      if (taken == 0) {
+        // A producer is between its push and link, it finishes within a few instructions
+        std::this_thread::yield();
+        continue;
+      }
+      state.reset();
+      if (pending_.fetch_sub(taken, std::memory_order_acq_rel) == taken) {
+        return;
+      }
+    }
+  }
+
+
+  /**
+  * @brief Function to dispatch all queued tickets without coalescing, from the consumer thread
+  */
+  template<typename Dispatch>
+  void drain(Dispatch && dispatch)
+  {
+    drain(
+      std::nullopt, [](State, TransitionCmd) {return State::UNDEFINED;},
+      std::forward<Dispatch>(dispatch), [](CommandTicket * ticket) {delete ticket;});
+  }
+
+
+  /**
+  * @brief Function to record that the state machine evaluated a dispatched ticket, from the consumer
+  * thread
+  */
+  void dispatched(const CommandTicket & ticket)
+  {
+    laneOf(ticket.priority).time_to_dispatch.add(std::chrono::steady_clock::now() - ticket.submitted);
+  }
+
+  std::size_t size() const {return pending_.load(std::memory_order_relaxed);}
+
+
+  /**
+  * @brief Function that returns the counters of both lanes, from any thread
+  */
+  CommandIntakeStats stats() const
+  {
+    CommandIntakeStats stats;
+    for (std::size_t ii = 0; ii < kCommandPriorityCount; ++ii) {
+      const Lane & lane = lanes_[ii];
+      CommandLaneStats & out = stats.lanes[ii];
+      out.depth = lane.depth.load(std::memory_order_relaxed);
+      out.max_depth = lane.max_depth.load(std::memory_order_relaxed);
+      out.submitted = lane.submitted.load(std::memory_order_relaxed);
+      out.coalesced = lane.coalesced.load(std::memory_order_relaxed);
+      out.time_to_dispatch = lane.time_to_dispatch.snapshot();
+    }
+    return stats;
+  }
+
+private:
+  struct Lane
+  {
+    MpscQueue<CommandTicket> queue;
+    std::atomic<std::size_t> depth{0};
+    std::atomic<std::size_t> max_depth{0};
+    std::atomic<std::uint64_t> submitted{0};
+    std::atomic<std::uint64_t> coalesced{0};
+    AtomicLatencyHistogram time_to_dispatch;
+  };
+
+  static constexpr bool cancels(TransitionCmd first, TransitionCmd second)
+  {
+    return (first == TransitionCmd::HOLD && second == TransitionCmd::UNHOLD) ||
+           (first == TransitionCmd::SUSPEND && second == TransitionCmd::UNSUSPEND);
+  }
+
+  Lane & laneOf(CommandPriority priority) {return lanes_[static_cast<std::size_t>(priority)];}
+
+  // Drops the coalesced tickets from batch_ and advances state past the kept ones, which becomes
+  // unknown once the outcome of a kept ticket cannot be told
+  template<typename Next, typename Discard>
+  void coalesce(Lane & lane, std::optional<State> & state, Next & next, Discard & discard)
+  {
+    std::size_t kept = 0;
+    std::uint64_t coalesced = 0;
+    // State the last kept ticket is evaluated in, unknown after a pair before it was dropped
+    std::optional<State> previous_from;
+    for (CommandTicket * ticket : batch_) {
+      CommandTicket * previous = kept > 0 ? batch_[kept - 1] : nullptr;
+      if (state && previous != nullptr && previous->cmd == ticket->cmd &&
+        next(*state, ticket->cmd) == State::UNDEFINED)
+      {
+        // Rejected where the previous one leaves the state machine, the state does not change
+        ++coalesced;
+        discard(ticket);
+        continue;
+      }
+      if (state && previous_from && previous != nullptr && cancels(previous->cmd, ticket->cmd) &&
+        next(*previous_from, previous->cmd) != State::UNDEFINED)
+      {
+        coalesced += 2;
+        --kept;
+        state = previous_from;
+        previous_from.reset();
+        discard(previous);
+        discard(ticket);
+        continue;
+      }
+      batch_[kept++] = ticket;
+      previous_from = state;
+      if (state) {
+        State entered = next(*state, ticket->cmd);
+        if (entered != State::UNDEFINED) {
+          state = entered;
+        }
+      }
+    }
+    batch_.resize(kept);
+    if (coalesced > 0) {
+      lane.coalesced.fetch_add(coalesced, std::memory_order_relaxed);
+    }
+  }
+
+  std::array<Lane, kCommandPriorityCount> lanes_;
+  std::atomic<std::size_t> pending_{0};
+  // Only used by the consumer thread
+  std::vector<CommandTicket *> batch_;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__COMMAND_QUEUE_HPP_
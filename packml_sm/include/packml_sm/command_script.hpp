@@ -0,0 +1,103 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__COMMAND_SCRIPT_HPP_
+#define PACKML_SM__COMMAND_SCRIPT_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "packml_sm/common.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief One step of a command script: submit command, then wait until target is entered
+*/
+struct ScriptStep
+{
+  /**
+  * @brief Command to submit, NO_COMMAND only waits for target
+  */
+  TransitionCmd command = TransitionCmd::NO_COMMAND;
+
+  /**
+  * @brief State the step waits for, State::UNDEFINED ends the step once command is accepted
+  */
+  State target = State::UNDEFINED;
+
+  /**
+  * @brief Time the step may take, from the submission of command to the entry of target
+  */
+  std::chrono::milliseconds timeout{10000};
+};
+
+
+enum class StepOutcome : std::uint8_t
+{
+  DONE      = 0,
+  REJECTED  = 1,
+  TIMED_OUT = 2,
+  NOT_RUN   = 3
+};
+
+inline std::string to_string(StepOutcome outcome)
+{
+  switch (outcome) {
+    case StepOutcome::DONE:      return "DONE";
+    case StepOutcome::REJECTED:  return "REJECTED";
+    case StepOutcome::TIMED_OUT: return "TIMED_OUT";
+    case StepOutcome::NOT_RUN:   return "NOT_RUN";
+  }
+  return std::to_string(static_cast<int>(outcome));
+}
+
+
+/**
+* @brief Result and timings of one step, measured on the steady clock from the start of the step
+*/
+struct StepResult
+{
+  StepOutcome outcome = StepOutcome::NOT_RUN;
+
+  /**
+  * @brief Current state when the step ended
+  */
+  State state = State::UNDEFINED;
+
+  std::chrono::nanoseconds accepted_after{0};
+  std::chrono::nanoseconds duration{0};
+};
+
+
+/**
+* @brief Result of a command script, one step result per step. The script stops at the first step
+* that is rejected or times out, the steps after it are NOT_RUN.
+*/
+struct ScriptResult
+{
+  bool success = false;
+  std::string message;
+  std::vector<StepResult> steps;
+  std::chrono::nanoseconds duration{0};
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__COMMAND_SCRIPT_HPP_
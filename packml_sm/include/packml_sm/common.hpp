@@ -182,5 +182,17 @@ inline std::ostream& operator<< (std::ostream& os, TransitionCmd command)
   return os << to_string(command);
 }
 
+
+/**
+* @brief Error code of the ErrorEvent posted when a state watchdog expires
+*/
+constexpr int kWatchdogErrorCode = -100;
+
+
+/**
+* @brief Error code an acting state completes with when its operation throws
+*/
+constexpr int kOperationExceptionErrorCode = -101;
+
 }  // namespace packml_sm
 #endif  // PACKML_SM__COMMON_HPP_
@@ -0,0 +1,160 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__EVENT_POOL_HPP_
+#define PACKML_SM__EVENT_POOL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace packml_sm
+{
+
+/**
+* @brief Pool of fixed size blocks for the events posted to one state machine.
+*
+* Every block starts with a small header that points back to its pool, so an event allocated from
+* the pool returns to it when Qt deletes the event after delivery, on whatever thread that happens.
+* Released blocks are kept on an intrusive free list and reused; the pool only grows when more
+* events are in flight than ever before, so steady state cycling allocates nothing.
+*
+* Blocks may outlive the pool: the ones still in flight when the pool is destroyed are freed when
+* they are released.
+*/
+class EventPool
+{
+public:
+  /**
+  * @brief Largest object a block can hold, bigger objects are allocated on the heap
+  */
+  static constexpr std::size_t kBlockSize = 128;
+
+  struct Stats
+  {
+    /**
+    * @brief Number of allocate() calls
+    */
+    std::uint64_t allocations = 0;
+
+    /**
+    * @brief Allocations served from the free list
+    */
+    std::uint64_t recycled = 0;
+
+    /**
+    * @brief Blocks obtained from the heap (pool growth and oversized objects)
+    */
+    std::uint64_t heap_allocations = 0;
+
+    std::size_t outstanding = 0;
+    std::size_t free = 0;
+  };
+
+
+  /**
+  * @brief Class constructor
+  * @param preallocate - number of blocks allocated up front
+  */
+  explicit EventPool(std::size_t preallocate = 16);
+
+  ~EventPool();
+
+  EventPool(const EventPool &) = delete;
+  EventPool & operator=(const EventPool &) = delete;
+
+
+  /**
+  * @brief Function to get storage for an object, may be called from any thread
+  */
+  void * allocate(std::size_t size);
+
+
+  /**
+  * @brief Function to return storage obtained from allocate() or PooledEvent, from any thread
+  */
+  static void deallocate(void * object);
+
+
+  /**
+  * @brief Function to get heap storage with the same layout, released by deallocate()
+  */
+  static void * allocateUnpooled(std::size_t size);
+
+  Stats stats() const;
+
+
+  /**
+  * @brief Function to be told when the first block is taken out of the pool (true) and when the
+  * last one is returned (false), e.g. to know when every posted event was delivered. Called with
+  * the pool locked, on the thread that takes or returns the block; nullptr removes the listener.
+  */
+  void setBusyListener(std::function<void(bool busy)> listener);
+
+private:
+  struct Header;
+  struct Shared;
+
+  Shared * shared_;
+};
+
+
+/**
+* @brief Base that routes the allocation of an event through an EventPool.
+*
+* new (pool) Event(...) takes a block of the pool, a plain new Event(...) uses the heap; delete
+* returns either to where it came from.
+*/
+struct PooledEvent
+{
+  static void * operator new(std::size_t size) {return EventPool::allocateUnpooled(size);}
+
+  static void * operator new(std::size_t size, EventPool & pool) {return pool.allocate(size);}
+
+  static void operator delete(void * object) {EventPool::deallocate(object);}
+
+  static void operator delete(void * object, EventPool & /*pool*/) {EventPool::deallocate(object);}
+};
+
+
+/**
+* @brief Function to create an event from pool, or on the heap if pool is nullptr
+*/
+template<typename Event, typename ... Args>
+Event * makeEvent(EventPool * pool, Args && ... args)
+{
+  if (pool == nullptr) {
+    return new Event(std::forward<Args>(args)...);
+  }
+  return new (*pool) Event(std::forward<Args>(args)...);
+}
+
+
+/**
+* @brief Implemented by state machines that own an EventPool
+*/
+class EventPoolProvider
+{
+public:
+  virtual ~EventPoolProvider() = default;
+
+  virtual EventPool & eventPool() = 0;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__EVENT_POOL_HPP_
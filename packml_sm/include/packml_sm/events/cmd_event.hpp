@@ -16,27 +16,38 @@
 
 #pragma once
 
+#include <chrono>
+#include <memory>
+#include <utility>
+
 #include "QEvent"
+#include "packml_sm/event_pool.hpp"
+#include "packml_sm/command_queue.hpp"
 #include "packml_sm/common.hpp"
 
 namespace packml_sm {
 static int PACKML_CMD_EVENT_TYPE = QEvent::User + 1;
 
-struct CmdEvent : public QEvent {
-  static CmdEvent *clear() { return new CmdEvent(TransitionCmd::CLEAR); }
-  static CmdEvent *start() { return new CmdEvent(TransitionCmd::START); }
-  static CmdEvent *stop() { return new CmdEvent(TransitionCmd::STOP); }
-  static CmdEvent *hold() { return new CmdEvent(TransitionCmd::HOLD); }
-  static CmdEvent *abort() { return new CmdEvent(TransitionCmd::ABORT); }
-  static CmdEvent *reset() { return new CmdEvent(TransitionCmd::RESET); }
-  // static CmdEvent *estop() { return new CmdEvent(Cmd::ESTOP); }
-  static CmdEvent *suspend() { return new CmdEvent(TransitionCmd::SUSPEND); }
-  static CmdEvent *unsuspend() { return new CmdEvent(TransitionCmd::UNSUSPEND); }
-  static CmdEvent *unhold() { return new CmdEvent(TransitionCmd::UNHOLD); }
-
+/**
+* @brief Command event, created from the EventPool of the state machine with new (pool) CmdEvent(...)
+*/
+struct CmdEvent : public QEvent, public PooledEvent {
   explicit CmdEvent(const TransitionCmd &cmd_value)
       : QEvent(QEvent::Type(PACKML_CMD_EVENT_TYPE)), cmd(cmd_value) {}
 
+  /**
+  * @brief Creates the event for a queued submission, the ticket is completed when the state machine
+  * has evaluated the event (rejected if the event is dropped)
+  */
+  explicit CmdEvent(std::unique_ptr<CommandTicket> cmd_ticket)
+      : QEvent(QEvent::Type(PACKML_CMD_EVENT_TYPE)), cmd(cmd_ticket->cmd), posted(cmd_ticket->submitted),
+        ticket(std::move(cmd_ticket)) {}
+
   TransitionCmd cmd;
+  // Submission of the ticket, or creation of an event posted without one
+  std::chrono::steady_clock::time_point posted = std::chrono::steady_clock::now();
+  std::unique_ptr<CommandTicket> ticket;
 };
+
+static_assert(sizeof(CmdEvent) <= EventPool::kBlockSize, "CmdEvent does not fit an EventPool block");
 } // namespace packml_sm
\ No newline at end of file
@@ -16,14 +16,20 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+
 #include "QEvent"
 #include "QString"
+#include "packml_sm/event_pool.hpp"
 
 namespace packml_sm {
 
+struct PackmlState;
+
 static int PACKML_ERROR_EVENT_TYPE = QEvent::User + 3;
 
-struct ErrorEvent : public QEvent {
+struct ErrorEvent : public QEvent, public PooledEvent {
   explicit ErrorEvent(const int &code_value)
       : QEvent(QEvent::Type(PACKML_ERROR_EVENT_TYPE)), code(code_value), name(),
         description() {}
@@ -33,8 +39,19 @@ struct ErrorEvent : public QEvent {
       : QEvent(QEvent::Type(PACKML_ERROR_EVENT_TYPE)), code(code_value),
         name(name_value), description(description_value) {}
 
+  // Failure of the operation started by entry number entry_value of origin_value
+  ErrorEvent(const int &code_value, const PackmlState *origin_value,
+             std::uint64_t entry_value)
+      : QEvent(QEvent::Type(PACKML_ERROR_EVENT_TYPE)), code(code_value), name(),
+        description(), origin(origin_value), entry(entry_value) {}
+
   int code;
   QString name;
   QString description;
+  const PackmlState *origin = nullptr;
+  std::uint64_t entry = 0;
+  std::chrono::steady_clock::time_point posted = std::chrono::steady_clock::now();
 };
+
+static_assert(sizeof(ErrorEvent) <= EventPool::kBlockSize, "ErrorEvent does not fit an EventPool block");
 } // namespace packml_sm
\ No newline at end of file
@@ -16,14 +16,31 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+
 #include "QEvent"
+#include "packml_sm/event_pool.hpp"
 
 namespace packml_sm {
 
+struct PackmlState;
+
 static int PACKML_STATE_COMPLETE_EVENT_TYPE = QEvent::User + 2;
 
-struct StateCompleteEvent : public QEvent {
+struct StateCompleteEvent : public QEvent, public PooledEvent {
   StateCompleteEvent()
       : QEvent(QEvent::Type(PACKML_STATE_COMPLETE_EVENT_TYPE)) {}
+
+  // Completion of the operation started by entry number entry_value of origin_value
+  StateCompleteEvent(const PackmlState *origin_value, std::uint64_t entry_value)
+      : QEvent(QEvent::Type(PACKML_STATE_COMPLETE_EVENT_TYPE)),
+        origin(origin_value), entry(entry_value) {}
+
+  const PackmlState *origin = nullptr;
+  std::uint64_t entry = 0;
+  std::chrono::steady_clock::time_point posted = std::chrono::steady_clock::now();
 };
+
+static_assert(sizeof(StateCompleteEvent) <= EventPool::kBlockSize, "StateCompleteEvent does not fit an EventPool block");
 } // namespace packml_sm
\ No newline at end of file
@@ -0,0 +1,246 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__JOURNAL_HPP_
+#define PACKML_SM__JOURNAL_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <expected>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packml_sm/common.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief One entry of a transition journal
+*/
+struct JournalRecord
+{
+  enum class Type : std::uint8_t
+  {
+    COMMAND = 1,
+    STATE_ENTERED = 2,
+    MODE_CHANGED = 3,
+    COMPLETED = 4,
+  };
+
+  Type type = Type::STATE_ENTERED;
+
+  /**
+  * @brief Time on the clock of the state machine, since the epoch of the clock
+  */
+  std::chrono::nanoseconds time{0};
+
+  /**
+  * @brief State entered by STATE_ENTERED, state the machine was in for the other types
+  */
+  State state = State::UNDEFINED;
+
+  TransitionCmd command = TransitionCmd::NO_COMMAND;
+
+  ModeType mode = ModeType::UNDEFINED;
+
+  /**
+  * @brief Whether the COMMAND or MODE_CHANGED request was accepted
+  */
+  bool accepted = true;
+
+  /**
+  * @brief Result of the operation for COMPLETED, 0 if it completed, its error code otherwise
+  */
+  int code = 0;
+
+  static JournalRecord ofCommand(std::chrono::nanoseconds time, State state, TransitionCmd cmd, bool accepted)
+  {
+    JournalRecord record;
+    record.type = Type::COMMAND;
+    record.time = time;
+    record.state = state;
+    record.command = cmd;
+    record.accepted = accepted;
+    return record;
+  }
+
+  static JournalRecord ofEntry(std::chrono::nanoseconds time, State state)
+  {
+    JournalRecord record;
+    record.type = Type::STATE_ENTERED;
+    record.time = time;
+    record.state = state;
+    return record;
+  }
+
+  static JournalRecord ofModeChange(std::chrono::nanoseconds time, State state, ModeType mode, bool accepted)
+  {
+    JournalRecord record;
+    record.type = Type::MODE_CHANGED;
+    record.time = time;
+    record.state = state;
+    record.mode = mode;
+    record.accepted = accepted;
+    return record;
+  }
+
+  static JournalRecord ofCompletion(std::chrono::nanoseconds time, State state, int code)
+  {
+    JournalRecord record;
+    record.type = Type::COMPLETED;
+    record.time = time;
+    record.state = state;
+    record.code = code;
+    return record;
+  }
+};
+
+
+/**
+* @brief Batching and durability of a JournalWriter
+*/
+struct JournalOptions
+{
+  /**
+  * @brief A batch is written once it holds this many bytes
+  */
+  std::size_t batch_bytes = 64 * 1024;
+
+  /**
+  * @brief Longest time a record waits in memory before its batch is written
+  */
+  std::chrono::milliseconds flush_interval{50};
+
+  /**
+  * @brief Call fdatasync after every batch, written records then survive a power loss
+  */
+  bool fsync = false;
+};
+
+
+/**
+* @brief Append-only binary journal of the commands, state entries, mode changes and operation
+* results of a state machine.
+*
+* append() only encodes the record into the current batch, a writer thread hands full batches to
+* the file. Every record is a length-prefixed frame, so a reader can skip record types it does not
+* know and detect a frame torn by a crash at the end of the file.
+*/
+class JournalWriter
+{
+public:
+  /**
+  * @brief Function to open a journal for appending, records are added after the existing ones
+  */
+  static std::expected<std::shared_ptr<JournalWriter>, std::string> open(
+    const std::string & path, JournalOptions options = {});
+
+  JournalWriter(const JournalWriter &) = delete;
+  JournalWriter & operator=(const JournalWriter &) = delete;
+
+  /**
+  * @brief Class destructor, writes the pending records
+  */
+  ~JournalWriter();
+
+
+  /**
+  * @brief Function to add a record to the current batch, may be called from any thread
+  */
+  void append(const JournalRecord & record);
+
+
+  /**
+  * @brief Function that blocks until every record appended before the call is written
+  * @return false if writing to the file failed
+  */
+  bool flush();
+
+
+  /**
+  * @brief Function that returns the number of records appended
+  */
+  std::uint64_t records() const;
+
+  const std::string & path() const {return path_;}
+
+private:
+  JournalWriter(std::string path, int fd, JournalOptions options);
+
+  void worker();
+
+  bool write(const std::vector<char> & batch);
+
+  const std::string path_;
+  const int fd_;
+  const JournalOptions options_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable written_;
+  std::vector<char> batch_;
+  std::vector<char> spare_;
+  std::uint64_t appended_ = 0;
+  std::uint64_t flush_target_ = 0;
+  std::uint64_t written_end_ = 0;
+  bool failed_ = false;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+
+/**
+* @brief Sequential reader of a journal written by JournalWriter
+*/
+class JournalReader
+{
+public:
+  static std::expected<JournalReader, std::string> open(const std::string & path);
+
+
+  /**
+  * @brief Function that returns the next record, empty at the end of the journal
+  */
+  std::optional<JournalRecord> next();
+
+
+  /**
+  * @brief Function that returns whether the journal ends in an incomplete record, e.g. after a crash
+  */
+  bool truncated() const {return truncated_;}
+
+  /**
+  * @brief Function to read every remaining record
+  */
+  std::vector<JournalRecord> readAll();
+
+private:
+  explicit JournalReader(std::ifstream stream);
+
+  std::ifstream stream_;
+  bool truncated_ = false;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__JOURNAL_HPP_
@@ -0,0 +1,149 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__LATENCY_HISTOGRAM_HPP_
+#define PACKML_SM__LATENCY_HISTOGRAM_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+namespace packml_sm
+{
+
+/**
+* @brief Log-linear latency histogram: every power of two of nanoseconds is split into 8 buckets,
+* so a bucket is at most 12.5 % wide. Covers 1 ns to about 73 minutes, larger values are counted in
+* the last bucket.
+*/
+struct LatencyHistogram
+{
+  static constexpr unsigned kSubBucketBits = 3;
+  static constexpr std::size_t kSubBuckets = std::size_t{1} << kSubBucketBits;
+  static constexpr unsigned kMaxExponent = 41;
+  static constexpr std::size_t kBucketCount = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+  std::array<std::uint64_t, kBucketCount> buckets{};
+  std::uint64_t count = 0;
+  std::chrono::nanoseconds total{0};
+  std::chrono::nanoseconds max{0};
+
+
+  /**
+  * @brief Function that returns the bucket counting a latency of ns nanoseconds
+  */
+  static constexpr std::size_t bucketOf(std::uint64_t ns)
+  {
+    if (ns < 2 * kSubBuckets) {
+      return static_cast<std::size_t>(ns);
+    }
+    auto exponent = static_cast<unsigned>(std::bit_width(ns)) - 1;
+    if (exponent > kMaxExponent) {
+      return kBucketCount - 1;
+    }
+    // The leading bit and the kSubBucketBits bits after it select the bucket
+    auto mantissa = static_cast<std::size_t>(ns >> (exponent - kSubBucketBits));
+    return (exponent - kSubBucketBits) * kSubBuckets + mantissa;
+  }
+
+
+  /**
+  * @brief Function that returns the smallest latency counted in a bucket, in nanoseconds
+  */
+  static constexpr std::uint64_t lowerBound(std::size_t bucket)
+  {
+    if (bucket < 2 * kSubBuckets) {
+      return bucket;
+    }
+    std::size_t exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+    std::uint64_t mantissa = bucket % kSubBuckets + kSubBuckets;
+    return mantissa << (exponent - kSubBucketBits);
+  }
+
+  void add(std::chrono::nanoseconds value)
+  {
+    auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(value.count(), 0));
+    ++buckets[bucketOf(ns)];
+    ++count;
+    total += value;
+    max = std::max(max, value);
+  }
+
+  std::chrono::nanoseconds mean() const
+  {
+    return count == 0 ? std::chrono::nanoseconds(0) : total / static_cast<std::int64_t>(count);
+  }
+
+
+  /**
+  * @brief Function that returns the latency below which the fraction q of the samples fall
+  * @param q - quantile in [0, 1], e.g. 0.99
+  * @return upper bound of the bucket holding the quantile, at most the largest sample
+  */
+  std::chrono::nanoseconds percentile(double q) const;
+};
+
+static_assert(LatencyHistogram::bucketOf(15) == 15);
+static_assert(LatencyHistogram::bucketOf(16) == 16);
+static_assert(LatencyHistogram::lowerBound(LatencyHistogram::bucketOf(1000)) == 960);
+
+
+/**
+* @brief LatencyHistogram that any number of threads may add to without locking, read with
+* snapshot()
+*/
+class AtomicLatencyHistogram
+{
+public:
+  void add(std::chrono::nanoseconds value)
+  {
+    auto ns = std::max<std::int64_t>(value.count(), 0);
+    buckets_[LatencyHistogram::bucketOf(static_cast<std::uint64_t>(ns))].fetch_add(
+      1, std::memory_order_relaxed);
+    total_ns_.fetch_add(ns, std::memory_order_relaxed);
+    auto max = max_ns_.load(std::memory_order_relaxed);
+    while (ns > max && !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+
+  /**
+  * @brief Function that copies the histogram, the count is the sum of the copied buckets
+  */
+  LatencyHistogram snapshot() const
+  {
+    LatencyHistogram histogram;
+    for (std::size_t ii = 0; ii < LatencyHistogram::kBucketCount; ++ii) {
+      histogram.buckets[ii] = buckets_[ii].load(std::memory_order_relaxed);
+      histogram.count += histogram.buckets[ii];
+    }
+    histogram.total = std::chrono::nanoseconds(total_ns_.load(std::memory_order_relaxed));
+    histogram.max = std::chrono::nanoseconds(max_ns_.load(std::memory_order_relaxed));
+    return histogram;
+  }
+
+private:
+  std::array<std::atomic<std::uint64_t>, LatencyHistogram::kBucketCount> buckets_{};
+  std::atomic<std::int64_t> total_ns_{0};
+  std::atomic<std::int64_t> max_ns_{0};
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__LATENCY_HISTOGRAM_HPP_
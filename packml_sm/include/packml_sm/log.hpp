@@ -0,0 +1,278 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__LOG_HPP_
+#define PACKML_SM__LOG_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "packml_sm/common.hpp"
+
+/**
+* @brief Lowest level that is compiled in: 0 DEBUG, 1 INFO, 2 WARN, 3 ERROR, 4 OFF. Statements below
+* it cost nothing at runtime, statements above it are filtered with one relaxed atomic load.
+*/
+#ifndef PACKML_SM_LOG_LEVEL
+#define PACKML_SM_LOG_LEVEL 0
+#endif
+
+#define PACKML_LOG(level, ...) \
+  do { \
+    if constexpr (::packml_sm::logging::compiledIn(level)) { \
+      if (::packml_sm::logging::enabled(level)) { \
+        ::packml_sm::logging::write(level, __VA_ARGS__); \
+      } \
+    } \
+  } while (0)
+
+#define PACKML_LOG_DEBUG(...) PACKML_LOG(::packml_sm::logging::Level::DEBUG, __VA_ARGS__)
+#define PACKML_LOG_INFO(...) PACKML_LOG(::packml_sm::logging::Level::INFO, __VA_ARGS__)
+#define PACKML_LOG_WARN(...) PACKML_LOG(::packml_sm::logging::Level::WARN, __VA_ARGS__)
+#define PACKML_LOG_ERROR(...) PACKML_LOG(::packml_sm::logging::Level::ERROR, __VA_ARGS__)
+
+namespace packml_sm
+{
+
+/**
+* @brief Asynchronous logger.
+*
+* A log statement copies its format string pointer and its arguments into a fixed size record in a
+* ring buffer owned by the calling thread; a background sink thread formats the records and writes
+* them out. Enum arguments are stored as integers together with a pointer to their to_string(), so
+* no string is built on the logging thread. When a ring is full the record is dropped and counted,
+* the logging thread never waits for the sink.
+*/
+namespace logging
+{
+
+enum class Level : std::uint8_t
+{
+  DEBUG = 0,
+  INFO = 1,
+  WARN = 2,
+  ERROR = 3,
+  OFF = 4
+};
+
+inline std::string to_string(const Level & level)
+{
+  switch (level) {
+    case Level::DEBUG: return "DEBUG";
+    case Level::INFO:  return "INFO";
+    case Level::WARN:  return "WARN";
+    case Level::ERROR: return "ERROR";
+    case Level::OFF:   return "OFF";
+  }
+  return std::to_string(static_cast<int>(level));
+}
+
+constexpr int kCompiledLevel = PACKML_SM_LOG_LEVEL;
+
+/**
+* @brief Receives every formatted line (without trailing newline) on the sink thread
+*/
+using Sink = std::function<void (Level level, std::string_view line)>;
+
+
+/**
+* @brief Function to set the runtime level, defaults to INFO or to the PACKML_SM_LOG_LEVEL
+* environment variable (DEBUG, INFO, WARN, ERROR or OFF)
+*/
+void setLevel(Level level);
+
+Level level();
+
+
+/**
+* @brief Function to replace the output, nullptr restores the default (stdout)
+*/
+void setSink(Sink sink);
+
+
+/**
+* @brief Function that blocks until all records logged before the call have been written
+*/
+void flush();
+
+
+/**
+* @brief Function that returns the number of records dropped because a ring buffer was full
+*/
+std::uint64_t dropped();
+
+namespace detail
+{
+
+extern std::atomic<Level> g_level;
+
+constexpr std::size_t kMaxArgs = 6;
+constexpr std::size_t kTextSize = 64;
+
+union ArgValue
+{
+  std::int64_t i;
+  std::uint64_t u;
+  double d;
+  const void * p;
+  struct
+  {
+    std::uint16_t offset;
+    std::uint16_t length;
+  } text;
+};
+
+using FormatFn = void (*)(std::string & out, const ArgValue & value, const char * text);
+
+struct Arg
+{
+  FormatFn format;
+  ArgValue value;
+};
+
+struct Record
+{
+  std::int64_t stamp_ns;
+  const char * format;
+  Level level;
+  std::uint8_t arg_count;
+  std::uint16_t text_used;
+  std::uint32_t thread;
+  Arg args[kMaxArgs];
+  char text[kTextSize];
+};
+
+void formatSigned(std::string & out, const ArgValue & value, const char * text);
+void formatUnsigned(std::string & out, const ArgValue & value, const char * text);
+void formatBool(std::string & out, const ArgValue & value, const char * text);
+void formatDouble(std::string & out, const ArgValue & value, const char * text);
+void formatPointer(std::string & out, const ArgValue & value, const char * text);
+void formatText(std::string & out, const ArgValue & value, const char * text);
+
+template<typename E>
+void formatEnum(std::string & out, const ArgValue & value, const char * /*text*/)
+{
+  out += to_string(static_cast<E>(value.i));
+}
+
+
+/**
+* @brief Returns a free record in the ring of the calling thread, nullptr if the ring is full
+*/
+Record * acquire();
+
+
+/**
+* @brief Hands the record returned by acquire() to the sink thread
+*/
+void commit(Record * record);
+
+inline void encodeText(Record & record, std::string_view text)
+{
+  auto & arg = record.args[record.arg_count++];
+  auto length = std::min<std::size_t>(text.size(), kTextSize - record.text_used);
+  std::memcpy(record.text + record.text_used, text.data(), length);
+  arg.format = &formatText;
+  arg.value.text.offset = record.text_used;
+  arg.value.text.length = static_cast<std::uint16_t>(length);
+  record.text_used = static_cast<std::uint16_t>(record.text_used + length);
+}
+
+template<typename T>
+void encode(Record & record, const T & value)
+{
+  using U = std::decay_t<T>;
+  if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+    encodeText(record, std::string_view(value));
+    return;
+  } else {
+    auto & arg = record.args[record.arg_count++];
+    if constexpr (std::is_same_v<U, bool>) {
+      arg.format = &formatBool;
+      arg.value.u = value ? 1 : 0;
+    } else if constexpr (std::is_enum_v<U>) {
+      arg.value.i = static_cast<std::int64_t>(value);
+      if constexpr (requires {to_string(value);}) {
+        arg.format = &formatEnum<U>;
+      } else {
+        arg.format = &formatSigned;
+      }
+    } else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+      arg.format = &formatSigned;
+      arg.value.i = value;
+    } else if constexpr (std::is_integral_v<U>) {
+      arg.format = &formatUnsigned;
+      arg.value.u = value;
+    } else if constexpr (std::is_floating_point_v<U>) {
+      arg.format = &formatDouble;
+      arg.value.d = value;
+    } else if constexpr (std::is_pointer_v<U>) {
+      arg.format = &formatPointer;
+      arg.value.p = static_cast<const void *>(value);
+    } else {
+      static_assert(sizeof(U) == 0, "Unsupported log argument type");
+    }
+  }
+}
+
+}  // namespace detail
+
+constexpr bool compiledIn(Level level)
+{
+  return static_cast<int>(level) >= kCompiledLevel;
+}
+
+inline bool enabled(Level level)
+{
+  return level >= detail::g_level.load(std::memory_order_relaxed);
+}
+
+
+/**
+* @brief Function to log a message, normally used through the PACKML_LOG_* macros
+* @param format - string literal, every {} is replaced by the next argument
+* @param args - up to 6 integers, floating point values, enums, pointers or strings (strings are
+* copied, at most 64 characters per record)
+*/
+template<typename ... Args>
+void write(Level level, const char * format, const Args & ... args)
+{
+  static_assert(sizeof...(Args) <= detail::kMaxArgs, "A log record holds at most 6 arguments");
+  detail::Record * record = detail::acquire();
+  if (record == nullptr) {
+    return;
+  }
+  record->stamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  record->format = format;
+  record->level = level;
+  record->arg_count = 0;
+  record->text_used = 0;
+  (detail::encode(*record, args), ...);
+  detail::commit(record);
+}
+
+}  // namespace logging
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__LOG_HPP_
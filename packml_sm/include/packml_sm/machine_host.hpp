@@ -0,0 +1,172 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__MACHINE_HOST_HPP_
+#define PACKML_SM__MACHINE_HOST_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <QThread>
+
+#include "packml_sm/state_machine.hpp"
+#include "packml_sm/state_times.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Configuration of a MachineHost
+*/
+struct MachineHostConfig
+{
+  /**
+  * @brief Number of event loop threads, at least 1
+  */
+  std::size_t shards = std::max(1u, std::thread::hardware_concurrency());
+
+  /**
+  * @brief CPU of every shard, shard n is pinned to cpus[n % cpus.size()]; empty for no affinity
+  */
+  std::vector<int> cpus;
+
+  /**
+  * @brief Period of the probe that measures event loop latency, 0 disables it
+  */
+  std::chrono::milliseconds probe_interval{100};
+};
+
+
+/**
+* @brief Load of one shard, copied out by MachineHost::metrics()
+*/
+struct ShardMetrics
+{
+  std::size_t machines = 0;
+
+  /**
+  * @brief Number of times the event loop woke up to process events
+  */
+  std::uint64_t wakeups = 0;
+
+  /**
+  * @brief Time spent processing events and blocked waiting for them
+  */
+  std::chrono::nanoseconds busy{0};
+  std::chrono::nanoseconds idle{0};
+
+  /**
+  * @brief Delay of the periodic probe timer, i.e. how long an event waits for the loop
+  */
+  LatencyStats loop_latency;
+
+  double utilisation() const
+  {
+    auto total = busy + idle;
+    return total.count() == 0 ? 0.0 : static_cast<double>(busy.count()) / total.count();
+  }
+};
+
+
+/**
+* @brief Runs many StateMachine instances on a fixed set of event loop threads (shards).
+*
+* StateMachine::activate() moves every machine to the QCoreApplication thread, so all machines of a
+* process share one event loop. A host owns one QThread per shard and activates each machine it is
+* given on one of them; a machine and its timers then only ever run on its shard. Machines are
+* assigned explicitly or to the shard with the fewest machines. packml_sm::init() must have created
+* the QCoreApplication before a host is constructed.
+*/
+class MachineHost
+{
+public:
+  explicit MachineHost(const MachineHostConfig & config = MachineHostConfig());
+
+
+  /**
+  * @brief Class destructor, deactivates the machines and stops the shards
+  */
+  ~MachineHost();
+
+  MachineHost(const MachineHost &) = delete;
+  MachineHost & operator=(const MachineHost &) = delete;
+
+  std::size_t shardCount() const {return shards_.size();}
+
+
+  /**
+  * @brief Function to activate a machine on the shard with the fewest machines
+  * @return the shard, std::nullopt if the machine could not be activated
+  */
+  std::optional<std::size_t> add(std::shared_ptr<StateMachine> machine);
+
+
+  /**
+  * @brief Function to activate a machine on a given shard
+  * @return false if shard is out of range, the machine is already hosted or could not be activated
+  */
+  bool add(std::shared_ptr<StateMachine> machine, std::size_t shard);
+
+
+  /**
+  * @brief Function to deactivate a machine and release it from its shard
+  */
+  bool remove(const std::shared_ptr<StateMachine> & machine);
+
+
+  /**
+  * @brief Function that returns the shard a machine runs on
+  */
+  std::optional<std::size_t> shardOf(const std::shared_ptr<StateMachine> & machine) const;
+
+  ShardMetrics metrics(std::size_t shard) const;
+
+  std::vector<ShardMetrics> metrics() const;
+
+private:
+  struct Shard
+  {
+    QThread thread;
+    std::vector<std::shared_ptr<StateMachine>> machines;
+
+    // Written by the shard thread, read by metrics()
+    std::atomic<std::uint64_t> wakeups{0};
+    std::atomic<std::int64_t> busy_ns{0};
+    std::atomic<std::int64_t> idle_ns{0};
+    std::chrono::steady_clock::time_point last_switch;
+
+    mutable std::mutex latency_mutex;
+    LatencyStats loop_latency;
+  };
+
+  void startShard(std::size_t index);
+
+  const MachineHostConfig config_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__MACHINE_HOST_HPP_
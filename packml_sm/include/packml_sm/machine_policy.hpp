@@ -0,0 +1,119 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__MACHINE_POLICY_HPP_
+#define PACKML_SM__MACHINE_POLICY_HPP_
+
+#include <chrono>
+#include <concepts>
+#include <optional>
+
+#include "packml_sm/common.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Compile time description of a kind of state machine: the acting states that loop on
+* completion, the states it has and the default duration of its acting states.
+*
+* The transition table of a policy is computed by the compiler; both backends build their state
+* graph from it as is, so a machine is never patched after it is formed.
+*/
+template<typename P>
+concept MachinePolicy = requires(State state) {
+  {P::kName} -> std::convertible_to<const char *>;
+  {P::kSelfLoops} -> std::convertible_to<StateMask>;
+  {P::kAvailable} -> std::convertible_to<StateMask>;
+  {P::kTable} -> std::convertible_to<const TransitionTable &>;
+  {P::operationDelay(state)} -> std::same_as<std::optional<std::chrono::milliseconds>>;
+};
+
+
+/**
+* @brief Default duration of the operations of the built-in machines, std::nullopt keeps the
+* duration of the state
+*/
+constexpr std::optional<std::chrono::milliseconds> defaultOperationDelay(State state)
+{
+  if (state == State::EXECUTE) {
+    return std::chrono::seconds(1);
+  }
+  return std::nullopt;
+}
+
+
+/**
+* @brief Machine that executes once: EXECUTE completes into COMPLETING
+*/
+struct SingleCyclePolicy
+{
+  static constexpr const char * kName = "SINGLE CYCLE";
+  static constexpr StateMask kSelfLoops = 0;
+  static constexpr StateMask kAvailable = kAllStates;
+  static constexpr TransitionTable kTable = makeTransitionTable(kSelfLoops, kAvailable);
+
+  static constexpr std::optional<std::chrono::milliseconds> operationDelay(State state)
+  {
+    return defaultOperationDelay(state);
+  }
+};
+
+
+/**
+* @brief Machine that executes until it is stopped: EXECUTE completes into itself
+*/
+struct ContinuousCyclePolicy
+{
+  static constexpr const char * kName = "CONTINUOUS CYCLE";
+  static constexpr StateMask kSelfLoops = stateBit(State::EXECUTE);
+  static constexpr StateMask kAvailable = kAllStates;
+  static constexpr TransitionTable kTable = makeTransitionTable(kSelfLoops, kAvailable);
+
+  static constexpr std::optional<std::chrono::milliseconds> operationDelay(State state)
+  {
+    return defaultOperationDelay(state);
+  }
+};
+
+/**
+* @brief Function to give the acting states a policy has their default operation duration, for a
+* state machine of either backend
+*/
+template<MachinePolicy Policy, typename StateMachineT>
+void applyOperationDelays(StateMachineT & sm)
+{
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    auto state = static_cast<State>(ii);
+    if (!isActingState(state) || !hasState(Policy::kAvailable, state)) {
+      continue;
+    }
+    // A timed state instead of a sleeping function, so that the operation follows a simulated clock
+    if (auto delay = Policy::operationDelay(state)) {
+      sm.setOperationDelay(state, *delay);
+    }
+  }
+}
+
+static_assert(MachinePolicy<SingleCyclePolicy>);
+static_assert(MachinePolicy<ContinuousCyclePolicy>);
+static_assert(SingleCyclePolicy::kTable == kSingleCycleTable);
+static_assert(ContinuousCyclePolicy::kTable == kContinuousCycleTable);
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__MACHINE_POLICY_HPP_
@@ -0,0 +1,152 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__MODE_GRAPH_HPP_
+#define PACKML_SM__MODE_GRAPH_HPP_
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "packml_sm/common.hpp"
+#include "packml_sm/mode_registry.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Effective transition graph of a state machine in one mode.
+*
+* Transitions into states the mode disables are removed and the self loops of the mode are applied,
+* so a lookup in table answers whether a command or completion is taken without further tests.
+*/
+struct ModeGraph
+{
+  /**
+  * @brief Mode the graph was compiled for, nullptr for the graph used before a mode is set
+  */
+  const ModeDefinition * definition = nullptr;
+
+  TransitionTable table{};
+
+  /**
+  * @brief Commands accepted in every state
+  */
+  std::array<CommandMask, kStateCount> commands{};
+
+  /**
+  * @brief States reachable from the initial state
+  */
+  StateMask reachable = 0;
+
+  /**
+  * @brief Available states that cannot be reached from the initial state
+  */
+  StateMask unreachable = 0;
+
+  /**
+  * @brief Reachable states without any transition to another state
+  */
+  StateMask dead_ends = 0;
+
+  /**
+  * @brief Reachable acting states whose completion is ignored, they can only be left by a command
+  * or an error
+  */
+  StateMask stalled = 0;
+
+  CommandMask allowedCommands(State state) const {return commands[toIndex(state)];}
+
+  bool allows(State state, TransitionCmd command) const
+  {
+    return hasCommand(allowedCommands(state), command);
+  }
+
+  State onCommand(State from, TransitionCmd command) const {return table.onCommand(from, command);}
+
+  State onComplete(State from) const {return table.onComplete(from);}
+
+  State onError(State from) const {return table.onError(from);}
+};
+
+
+/**
+* @brief Function to compile the graph of a mode
+* @param base - transition table of the state machine
+* @param mode - mode to compile, nullptr makes every state available
+* @param initial - state the state machine starts in
+*/
+ModeGraph compileModeGraph(
+  const TransitionTable & base, const ModeDefinition * mode, State initial = State::ABORTED);
+
+
+/**
+* @brief Function that describes the unreachable, dead end and stalled states of a graph, empty if
+* there are none
+*/
+std::string describeModeGraph(const ModeGraph & graph);
+
+
+/**
+* @brief Compiled graphs of every mode of a ModeRegistry, built once when a state machine receives
+* the registry. Unreachable states and dead ends are logged when the graphs are compiled.
+*/
+class ModeGraphs
+{
+public:
+  /**
+  * @brief Class constructor
+  * @param registry - modes to compile
+  * @param base - transition table of the state machine
+  * @param initial - state the state machine starts in
+  */
+  ModeGraphs(
+    std::shared_ptr<const ModeRegistry> registry, const TransitionTable & base,
+    State initial = State::ABORTED);
+
+
+  /**
+  * @brief Function that returns the graph of a mode, nullptr if the mode is not registered
+  */
+  const ModeGraph * find(ModeType mode) const
+  {
+    const ModeDefinition * definition = registry_->find(mode);
+    return definition == nullptr ? nullptr : &graphs_[definition - registry_->modes().data()];
+  }
+
+
+  /**
+  * @brief Function that returns the graph used until a mode is set, every state is available
+  */
+  const ModeGraph & unmoded() const {return unmoded_;}
+
+  const ModeRegistry & registry() const {return *registry_;}
+
+  const std::vector<ModeGraph> & graphs() const {return graphs_;}
+
+private:
+  std::shared_ptr<const ModeRegistry> registry_;
+  ModeGraph unmoded_;
+
+  // Same order as registry_->modes()
+  std::vector<ModeGraph> graphs_;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__MODE_GRAPH_HPP_
@@ -0,0 +1,150 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__MODE_REGISTRY_HPP_
+#define PACKML_SM__MODE_REGISTRY_HPP_
+
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "packml_sm/common.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Compiled definition of one unit mode
+*/
+struct ModeDefinition
+{
+  ModeType mode = ModeType::UNDEFINED;
+  std::string name;
+
+  /**
+  * @brief States that may be entered in this mode
+  */
+  StateMask available = kAllStates;
+
+  /**
+  * @brief States in which the machine may switch to this mode
+  */
+  StateMask switch_states = stateBit(State::IDLE);
+
+  /**
+  * @brief Acting states that re-enter themselves on completion in this mode, e.g. EXECUTE for
+  * continuous production
+  */
+  StateMask self_loops = 0;
+
+  bool isAvailable(State state) const {return hasState(available, state);}
+
+  bool allowsSwitchFrom(State state) const {return hasState(switch_states, state);}
+
+  bool loops(State state) const {return hasState(self_loops, state);}
+};
+
+
+/**
+* @brief Immutable set of the unit modes a state machine can switch between.
+*
+* The default registry holds the built-in modes (UNDEFINED, PRODUCTION, MAINTENANCE, MANUAL). A
+* registry loaded from a YAML or JSON document starts from the built-in modes; entries replace a mode
+* with the same id or add user defined modes with ids above MANUAL:
+*
+*   modes:
+*     - name: MAINTENANCE
+*       unavailable: [COMPLETING]
+*       switch_states: [IDLE, STOPPED, ABORTED]
+*     - name: CONTINUOUS
+*       id: 4
+*       self_loops: [EXECUTE]
+*
+* "available" lists the available states (default: all), "unavailable" removes states from it.
+* Lookups by mode are an array access; state machines keep a pointer to the definition of the
+* current mode, so switching modes allocates nothing.
+*/
+class ModeRegistry
+{
+public:
+  /**
+  * @brief Creates the registry of the built-in modes
+  */
+  ModeRegistry();
+
+
+  /**
+  * @brief Function to parse a registry from a YAML (or JSON) document
+  * @return the registry, or a description of the first invalid entry
+  */
+  static std::expected<ModeRegistry, std::string> fromYaml(const std::string & document);
+
+
+  /**
+  * @brief Function to load a registry from a YAML or JSON file
+  */
+  static std::expected<ModeRegistry, std::string> load(const std::string & path);
+
+
+  /**
+  * @brief Registry used by state machines that were not given one, the built-in modes unless
+  * replaced with setGlobal()
+  */
+  static std::shared_ptr<const ModeRegistry> global();
+
+  static void setGlobal(std::shared_ptr<const ModeRegistry> registry);
+
+
+  /**
+  * @brief Largest id of a user defined mode
+  */
+  static constexpr int kMaxModeId = 255;
+
+
+  /**
+  * @brief Function to add a mode, or replace the mode with the same id
+  * @return true, or why the definition was rejected
+  */
+  std::expected<bool, std::string> add(ModeDefinition definition);
+
+
+  /**
+  * @brief Function that returns the definition of a mode, nullptr if the mode is not registered
+  */
+  const ModeDefinition * find(ModeType mode) const
+  {
+    auto index = static_cast<std::size_t>(mode);
+    return (index < index_.size() && index_[index] >= 0) ? &modes_[index_[index]] : nullptr;
+  }
+
+  const ModeDefinition * find(std::string_view name) const;
+
+  const std::vector<ModeDefinition> & modes() const {return modes_;}
+
+private:
+  std::vector<ModeDefinition> modes_;
+
+  // Position in modes_ of every mode id, -1 for unregistered ids
+  std::vector<std::int32_t> index_;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__MODE_REGISTRY_HPP_
@@ -0,0 +1,89 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__REPLAY_HPP_
+#define PACKML_SM__REPLAY_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "packml_sm/clock.hpp"
+#include "packml_sm/journal.hpp"
+#include "packml_sm/table_state_machine.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Outcome of replaying a journal
+*/
+struct ReplayReport
+{
+  std::size_t records = 0;
+
+  /**
+  * @brief State entries of the journal the machine reproduced
+  */
+  std::size_t transitions = 0;
+
+  /**
+  * @brief Records whose outcome the machine did not reproduce
+  */
+  std::size_t divergences = 0;
+
+  /**
+  * @brief Description of the first divergence, empty if the journal was reproduced
+  */
+  std::string first_divergence;
+
+  /**
+  * @brief Time covered by the journal, and wall time the replay took
+  */
+  std::chrono::nanoseconds journal_time{0};
+  std::chrono::nanoseconds wall_time{0};
+
+  bool reproduced() const {return divergences == 0;}
+
+  std::chrono::nanoseconds perTransition() const
+  {
+    return transitions == 0 ? std::chrono::nanoseconds(0) :
+           wall_time / static_cast<std::int64_t>(transitions);
+  }
+};
+
+
+/**
+* @brief Function to feed a journal back through a state machine in virtual time.
+*
+* Commands and mode changes are issued at their recorded times on clock. The operations, timed
+* states and watchdogs of machine are replaced by the recorded operation results, so the replay is
+* deterministic and does not wait for any operation. Every recorded state entry is compared with the
+* state the machine is in.
+* @param records - journal to replay, e.g. from JournalReader::readAll()
+* @param machine - inactive machine with the transition table and modes of the recorded one
+* @param clock - clock the machine runs on during the replay
+*/
+std::expected<ReplayReport, std::string> replayJournal(
+  const std::vector<JournalRecord> & records, TableStateMachine & machine,
+  std::shared_ptr<VirtualClock> clock);
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__REPLAY_HPP_
@@ -0,0 +1,147 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__SNAPSHOT_HPP_
+#define PACKML_SM__SNAPSHOT_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "packml_sm/common.hpp"
+#include "packml_sm/state_times.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief What a state machine takes over from the snapshot of its previous run when it is activated
+*/
+enum class RestartPolicy
+{
+  /**
+  * @brief Start in ABORTED with cleared times, the snapshot is overwritten
+  */
+  COLD,
+
+  /**
+  * @brief Start in ABORTED, restore the mode, state times, entry counters and abort latency
+  */
+  KEEP_COUNTERS,
+
+  /**
+  * @brief Like KEEP_COUNTERS, and resume the saved state if it is a wait state. A run that ended in
+  * an acting state was interrupted in the middle of an operation and starts in ABORTED.
+  */
+  RESUME_WAIT_STATE,
+};
+
+
+/**
+* @brief State of a state machine as saved on every transition
+*/
+struct MachineSnapshot
+{
+  State state = State::UNDEFINED;
+
+  /**
+  * @brief Mode of the machine, empty if no mode was set
+  */
+  std::optional<ModeType> mode;
+
+  /**
+  * @brief Times and entry counters up to the save
+  */
+  StateTimes times;
+
+  LatencyStats abort_latency;
+
+  /**
+  * @brief Wall time of the save
+  */
+  std::chrono::system_clock::time_point saved_at;
+};
+
+
+/**
+* @brief Function that returns the state a machine starts in after a restart
+* @param saved - snapshot of the previous run, empty if there is none
+*/
+State restartState(const std::optional<MachineSnapshot> & saved, RestartPolicy policy);
+
+
+/**
+* @brief Memory mapped file with the last MachineSnapshot of one state machine.
+*
+* The file holds two slots that are written alternately, a save only touches the slot that does not
+* hold the last snapshot and is published by its sequence number and checksum. A save interrupted by
+* a crash therefore leaves the previous snapshot readable. Saves reach the page cache, which
+* survives a crash of the process; sync() also writes them to the disk.
+*/
+class SnapshotFile
+{
+public:
+  /**
+  * @brief Function to open or create a snapshot file. A file written for another number of states
+  * is started over.
+  */
+  static std::expected<std::shared_ptr<SnapshotFile>, std::string> open(const std::string & path);
+
+  SnapshotFile(const SnapshotFile &) = delete;
+  SnapshotFile & operator=(const SnapshotFile &) = delete;
+
+  ~SnapshotFile();
+
+
+  /**
+  * @brief Function that returns the last complete snapshot, empty if none was saved
+  */
+  std::optional<MachineSnapshot> load() const;
+
+
+  /**
+  * @brief Function to save a snapshot, only copies it into the mapping
+  */
+  void save(const MachineSnapshot & snapshot);
+
+
+  /**
+  * @brief Function to write the saved snapshots to the disk, blocks until they are written
+  */
+  bool sync();
+
+  const std::string & path() const {return path_;}
+
+private:
+  struct Layout;
+
+  SnapshotFile(std::string path, int fd, Layout * layout);
+
+  std::string path_;
+  int fd_;
+  Layout * layout_;
+
+  mutable std::mutex mutex_;
+  std::uint64_t sequence_ = 0;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__SNAPSHOT_HPP_
@@ -0,0 +1,160 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__STATE_CHANGE_BUS_HPP_
+#define PACKML_SM__STATE_CHANGE_BUS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "packml_sm/common.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Entry of a state as delivered to the subscribers of a StateChangeBus
+*/
+struct StateChange
+{
+  State state = State::UNDEFINED;
+
+  /**
+  * @brief Number of the entry on its bus, starting at 1; a gap tells a subscriber it lost entries
+  */
+  std::uint64_t sequence = 0;
+
+  std::chrono::steady_clock::time_point entered;
+};
+
+
+/**
+* @brief What a subscription does with an entry published while its queue is full
+*/
+enum class OverflowPolicy : std::uint8_t
+{
+  DROP_NEWEST = 0,  // keep the queued entries, e.g. for a subscriber that must see them in order
+  DROP_OLDEST = 1   // overwrite the oldest entry, e.g. for a status publisher
+};
+
+
+/**
+* @brief Broadcast of the state entries of a state machine to any number of subscribers.
+*
+* Every subscription owns a bounded single producer, single consumer ring. Publishing copies the
+* entry into each ring without waiting for any subscriber, so a slow subscriber only loses entries
+* of its own queue and never delays a transition. The state machine publishes from one thread at a
+* time; a subscription is consumed either by poll() on a thread of the subscriber's choice or by a
+* delivery thread of its own.
+*/
+class StateChangeBus
+{
+  struct Queue;
+
+public:
+  /**
+  * @brief Handle of a subscriber, destroying it unsubscribes and joins its delivery thread
+  */
+  class Subscription
+  {
+  public:
+    explicit Subscription(std::shared_ptr<Queue> queue);
+
+    ~Subscription();
+
+    Subscription(const Subscription &) = delete;
+    Subscription & operator=(const Subscription &) = delete;
+
+
+    /**
+    * @brief Function to deliver the queued entries to callback on the calling thread, oldest first.
+    * Not for subscriptions with a delivery thread.
+    * @return number of entries delivered
+    */
+    std::size_t poll(const std::function<void(const StateChange &)> & callback);
+
+
+    /**
+    * @brief Function that blocks until an entry is queued or the subscription is closed
+    */
+    void wait();
+
+
+    /**
+    * @brief Function that returns the number of entries this subscriber lost to overflow
+    */
+    std::uint64_t dropped() const;
+
+  private:
+    friend class StateChangeBus;
+
+    std::shared_ptr<Queue> queue_;
+    std::jthread thread_;
+  };
+
+
+  StateChangeBus();
+
+  ~StateChangeBus();
+
+  StateChangeBus(const StateChangeBus &) = delete;
+  StateChangeBus & operator=(const StateChangeBus &) = delete;
+
+
+  /**
+  * @brief Function to subscribe for entries consumed with Subscription::poll()
+  * @param capacity - entries the queue holds, rounded up to a power of two
+  */
+  std::unique_ptr<Subscription> subscribe(std::size_t capacity, OverflowPolicy overflow);
+
+
+  /**
+  * @brief Function to subscribe with a delivery thread of its own, which calls callback for every
+  * entry in order. The callback may block, it only delays its own subscription.
+  * @param capacity - entries the queue holds, rounded up to a power of two
+  */
+  std::unique_ptr<Subscription> subscribe(
+    std::function<void(const StateChange &)> callback, std::size_t capacity,
+    OverflowPolicy overflow);
+
+
+  /**
+  * @brief Function to publish the entry of state to every subscription, called by the state
+  * machine on one thread at a time. Never waits for a subscriber.
+  */
+  void publish(State state);
+
+private:
+  using QueueList = std::vector<std::shared_ptr<Queue>>;
+
+  std::shared_ptr<Queue> add(std::size_t capacity, OverflowPolicy overflow);
+
+  // Serializes subscribe() calls, publish() never takes it
+  std::mutex subscribe_mutex_;
+  std::atomic<std::shared_ptr<const QueueList>> queues_;
+  std::uint64_t sequence_ = 0;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__STATE_CHANGE_BUS_HPP_
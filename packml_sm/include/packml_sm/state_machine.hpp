@@ -27,9 +27,25 @@
 #include "QAbstractTransition"
 // #include "packml_sm/events.hpp"
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <expected>
-
+#include <future>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "packml_sm/clock.hpp"
+#include "packml_sm/command_queue.hpp"
 #include "packml_sm/common.hpp"
+#include "packml_sm/event_pool.hpp"
+#include "packml_sm/log.hpp"
+#include "packml_sm/machine_policy.hpp"
+#include "packml_sm/state_machine_interface.hpp"
+#include "packml_sm/trace.hpp"
+#include "packml_sm/transition_stats.hpp"
 // #include "packml_sm/events.hpp"
 #include "packml_sm/events/sc_event.hpp"
 #include "packml_sm/states/toplevel_states.hpp"
@@ -50,286 +66,462 @@ namespace packml_sm
   class StatesGenerator;
 
 
-  class PackmlStateMachine : public QStateMachine
+  class PackmlStateMachine : public QStateMachine, public EventPoolProvider, public ClockProvider
   {
     // https://stackoverflow.com/questions/4818863/how-can-i-detect-ignored-rejected-posted-qevent-to-qstatemachine
     void endSelectTransitions(QEvent *event) override
     {
       if (event->type() == PACKML_CMD_EVENT_TYPE)
       {
+        auto cmd_event = static_cast<CmdEvent *>(event);
+        PACKML_LOG_DEBUG("Command {} accepted: {}", cmd_event->cmd, event->isAccepted());
+        if (journal_ != nullptr)
+        {
+          journal_->append(JournalRecord::ofCommand(
+              clock_->now().time_since_epoch(), activeState(), cmd_event->cmd, event->isAccepted()));
+        }
         if (event->isAccepted())
         {
-          prom.set_value(true);
-          std::cout << "We have accepted the event!" << std::endl;
+          selected_from_ = activeState();
         }
         else
         {
-          prom.set_value(false);
-          std::cout << "Event has not been accepted!" << std::endl;
+          transition_stats_.rejected(*table_, activeState(), Trigger::COMMAND, cmd_event->cmd);
+        }
+        if (event->isAccepted() && cmd_event->cmd == TransitionCmd::ABORT)
+        {
+          // Exits run after this, their wait for running operations is part of the abort latency
+          abort_selected_ = clock_->now();
+        }
+        // Each submission gets the answer to its own command
+        if (cmd_event->ticket)
+        {
+          commands_.dispatched(*cmd_event->ticket);
+          endCommandSpans(*cmd_event->ticket, "accepted", event->isAccepted());
+          cmd_event->ticket->complete(event->isAccepted());
         }
       }
       else if (event->type() == PACKML_ERROR_EVENT_TYPE || event->type() == PACKML_STATE_COMPLETE_EVENT_TYPE)
       {
-        // We can do something here with these custom packml events
+        // Results of operations of states that were already left are not accepted
+        if (event->isAccepted())
+        {
+          selected_from_ = activeState();
+        }
+        if (journal_ != nullptr && event->isAccepted())
+        {
+          int code = event->type() == PACKML_ERROR_EVENT_TYPE ? static_cast<ErrorEvent *>(event)->code : 0;
+          journal_->append(JournalRecord::ofCompletion(clock_->now().time_since_epoch(), activeState(), code));
+        }
       }
       else
       {
-        std::cout << "This is not a user defined event!" << std::endl;
+        PACKML_LOG_DEBUG("This is not a user defined event! type: {}", event->type());
       }
     }
 
-  public:
-    std::promise<bool> prom;
-  };
+    // Called once the transitions selected for the event have been taken
+    void endMicrostep(QEvent *event) override
+    {
+      auto now = std::chrono::steady_clock::now();
+      if (event->type() == PACKML_CMD_EVENT_TYPE)
+      {
+        auto cmd_event = static_cast<CmdEvent *>(event);
+        transition_stats_.accepted(
+          selected_from_, Trigger::COMMAND, cmd_event->cmd, activeState(), now - cmd_event->posted);
+        if (cmd_event->ticket)
+        {
+          cmd_event->ticket->reach(activeState());
+        }
+      }
+      else if (event->type() == PACKML_STATE_COMPLETE_EVENT_TYPE)
+      {
+        transition_stats_.accepted(selected_from_, Trigger::COMPLETED, TransitionCmd::NO_COMMAND, activeState(),
+          now - static_cast<StateCompleteEvent *>(event)->posted);
+      }
+      else if (event->type() == PACKML_ERROR_EVENT_TYPE)
+      {
+        transition_stats_.accepted(selected_from_, Trigger::FAILED, TransitionCmd::NO_COMMAND, activeState(),
+          now - static_cast<ErrorEvent *>(event)->posted);
+      }
+    }
 
+    // Returns the innermost active PackML state, super states report State::UNDEFINED
+    State activeState() const
+    {
+      for (auto state : configuration())
+      {
+        auto packml_state = qobject_cast<PackmlState *>(state);
+        if (packml_state && packml_state->state() != State::UNDEFINED)
+        {
+          return packml_state->state();
+        }
+      }
+      return State::UNDEFINED;
+    }
 
+    // Ends the span submit() opened for a ticket
+    static void endCommandSpans(const CommandTicket & ticket, const char * arg_name, std::int64_t arg_value)
+    {
+      tracing::end("command", ticket.cmd, tracing::trackOf(&ticket), arg_name, arg_value);
+    }
 
-/**
- * @brief The StateMachineInterface class defines a implementation independent interface
- * to a PackML state machine.
- */
-class StateMachineInterface
-{
-public:
-  /**
-  * @brief Function to activate the state machine
-  */
-  virtual bool activate() = 0;
+    // Runs on the state machine thread, turns the queued tickets into events, emergency commands
+    // first and as high priority events that overtake the commands already posted
+    void drainCommands()
+    {
+      // Commands are only coalesced while the machine rests in a wait state or in EXECUTE with no
+      // event queued, the dispatched ones are then evaluated one after the other from that state.
+      // The operation of EXECUTE may still complete first: it either enters EXECUTE again or a state
+      // that rejects HOLD and SUSPEND as well as the commands they pair with.
+      std::optional<State> settled;
+      const ModeGraph * graph = graph_.load(std::memory_order_acquire);
+      if (isRunning() && graph != nullptr && events_.stats().outstanding == 0) {
+        State active = activeState();
+        if (isWaitState(active) || active == State::EXECUTE) {
+          settled = active;
+        }
+      }
+      commands_.drain(settled,
+        [graph](State from, TransitionCmd cmd) {return graph->onCommand(from, cmd);},
+        [this](CommandTicket * ticket)
+        {
+          if (!isRunning())
+          {
+            // postEvent drops events of a stopped machine, reject instead of leaving the caller waiting
+            endCommandSpans(*ticket, "accepted", 0);
+            delete ticket;
+            return;
+          }
+          auto priority = ticket->priority == CommandPriority::EMERGENCY ? HighPriority : NormalPriority;
+          postEvent(new (events_) CmdEvent(std::unique_ptr<CommandTicket>(ticket)), priority);
+        },
+        [](CommandTicket * ticket)
+        {
+          endCommandSpans(*ticket, "coalesced", 1);
+          delete ticket;
+        });
+      // The intake is idle, the posted events are counted by the event pool
+      clock_->endWork();
+    }
 
+    CommandQueue commands_;
 
-  /**
-  * @brief Function to bind a function for the Execute state
-  * @param execute_method - a function for the Execute state
-  */
-  virtual bool setExecute(std::function<int()> execute_method) = 0;
+    std::optional<Clock::TimePoint> abort_selected_;
 
+    // State the transitions selected for the event leave, recorded once they have been taken
+    State selected_from_ = State::UNDEFINED;
+    TransitionStatsTable transition_stats_;
 
-  /**
-  * @brief Function to bind a function for the Resetting state
-  * @param resetting_method - a function for the Resetting state
-  */
-  virtual bool setResetting(std::function<int()> resetting_method) = 0;
+    // Owned by the StateMachine, which destroys them after this machine
+    EventPool & events_;
+    Clock * clock_;
+    JournalWriter * journal_ = nullptr;
+    // Transition table equivalent to the Qt state graph, rejected commands are classified with it
+    const TransitionTable * table_;
+    // Graph of the current mode, queued commands are coalesced with it
+    std::atomic<const ModeGraph *> graph_{nullptr};
 
+  public:
+    PackmlStateMachine(EventPool & events, Clock & clock, const TransitionTable & table)
+    : events_(events), clock_(&clock), table_(&table) {}
+
+    EventPool & eventPool() override {return events_;}
+
+    Clock & clock() override {return *clock_;}
+
+    /**
+    * @brief Function that returns the number of submitted commands not yet posted as events
+    */
+    std::size_t pendingCommands() const {return commands_.size();}
+
+    /**
+    * @brief Function to replace the clock, only while the machine is stopped
+    */
+    void setClock(Clock & clock) {clock_ = &clock;}
+
+    /**
+    * @brief Function to set the journal of the commands and operation results, only while the
+    * machine is stopped
+    */
+    void setJournal(JournalWriter * journal) {journal_ = journal;}
+
+    /**
+    * @brief Function to set the graph of the current mode, from any thread. A replaced graph must
+    * stay alive until a call queued on the state machine thread after this one has run.
+    */
+    void setModeGraph(const ModeGraph * graph) {graph_.store(graph, std::memory_order_release);}
+
+    /**
+    * @brief Function that returns and clears the time the last ABORT command was selected, must be
+    * called from the state machine thread
+    */
+    std::optional<Clock::TimePoint> takeAbortSelected()
+    {
+      return std::exchange(abort_selected_, std::nullopt);
+    }
 
-  /**
-  * @brief Function that returns whether the state machine is active or not
-  */
-  virtual bool isActive() = 0;
+    /**
+    * @brief Function that returns the transition counters, from any thread
+    */
+    std::vector<TransitionStats> transitionStats() const
+    {
+      return transition_stats_.snapshot();
+    }
 
+    /**
+    * @brief Function that returns the depth and time to dispatch of both command lanes, from any
+    * thread
+    */
+    CommandIntakeStats intakeStats() const
+    {
+      return commands_.stats();
+    }
 
-  /**
-  * @brief Function that returns the current state of the state machine
-  */
-  virtual State getCurrentState() = 0;
+    /**
+    * @brief Function to submit a command from any thread, without locking
+    * @param cmd - command to evaluate in the current state
+    * @return results for the acceptance of the command and for the state it entered
+    */
+    StateChangeResult submit(TransitionCmd cmd)
+    {
+      auto ticket = new CommandTicket(cmd);
+      auto result = ticket->results();
+      // Spans from the submission to the answer, the queueing and event delivery are part of it
+      tracing::begin("command", cmd, tracing::trackOf(ticket));
+      if (commands_.submit(ticket))
+      {
+        // Only the submission that finds the intake idle wakes up the state machine thread. The
+        // drain is work of a simulated clock step until the commands are posted as events.
+        clock_->beginWork();
+        QMetaObject::invokeMethod(this, [this]() {drainCommands();}, Qt::QueuedConnection);
+      }
+      return result;
+    }
+  };
 
-  virtual std::expected<bool, std::string> changeMode(ModeType mode) = 0;
 
-  virtual std::expected<bool, std::string> changeState(TransitionCmd command) = 0;
 
+/**
+* @brief Function to start and run a state machine
+* @param argc - number of command line arguments
+* @param argv - list of command line arguments
+*/
+void init(int argc, char * argv[]);
 
-  /**
-  * @brief Function that implements the start state
-  */
-  virtual bool start();
 
+/**
+* @brief Class that implements a state machine object
+*/
+class StateMachine : public QObject, public StateMachineInterface, public std::enable_shared_from_this<StateMachine>
+{
+  Q_OBJECT
 
+public:
   /**
-  * @brief Function that implements the clear state
+  * @brief Function to create a single cycle state machine (executes once)
   */
-  virtual bool clear();
+  static std::shared_ptr<StateMachine> singleCycleSM();
 
 
   /**
-  * @brief Function that implements the reset state
+  * @brief Function to create a continuous cycle state machine (executes forever until stopped)
   */
-  virtual bool reset();
+  static std::shared_ptr<StateMachine> continuousCycleSM();
 
 
   /**
-  * @brief Function that implements the hold state
+  * @brief Function to activate the state machine on the QCoreApplication thread
   */
-  virtual bool hold();
+  bool activate();
 
 
   /**
-  * @brief Function that implements the unhold state
+  * @brief Function to activate the state machine on the event loop of another thread, must be
+  * called from the thread the state machine currently lives on
+  * @param thread - running QThread that processes the events and timers of the state machine
   */
-  virtual bool unhold();
+  bool activate(QThread * thread);
 
 
   /**
-  * @brief Function that implements the suspend state
+  * @brief Function to deactivate the state machine
   */
-  virtual bool suspend();
+  bool deactivate();
 
 
   /**
-  * @brief Function that implements the unsuspend state
+  * @brief Function to bind the Execute state to a function
+  * @param execute_method - Function for the Execute state
   */
-  virtual bool unsuspend();
+  bool setExecute(std::function<int()> execute_method);
 
 
   /**
-  * @brief Function that implements the stop state
+  * @brief Function to bind the Resetting state to a function
+  * @param execute_method - Function for the Resetting state
   */
-  virtual bool stop();
+  bool setResetting(std::function<int()> resetting_method);
 
 
   /**
-  * @brief Function that implements the abort state
+  * @brief Function to bind a cancellable function to an acting state
+  * @param state - acting state to bind to
+  * @param method - function receiving the stop token of the state entry
   */
-  virtual bool abort();
+  bool setCancellableOperation(State state, CancellableOperation method) override;
+
 
-protected:
   /**
-  * @brief Function that binds a QT event to the function for the state start
+  * @brief Function to set how long leaving an acting state waits for its cancelled operation, only
+  * for operations bound with setCancellableOperation(); the others are always waited for
+  * @param timeout - bound after which the exit proceeds, milliseconds::max() to wait indefinitely
   */
-  virtual bool _start() = 0;
+  void setExitTimeout(std::chrono::milliseconds timeout);
 
+  bool setWatchdog(State state, std::chrono::milliseconds timeout) override;
 
-  /**
-  * @brief Function that binds a QT action to the function for the state clear
-  */
-  virtual bool _clear() = 0;
 
   /**
-  * @brief Function that binds a QT action to the function for the state reset
+  * @brief Function to make an acting state a timed state that completes after delay
   */
-  virtual bool _reset() = 0;
+  bool setOperationDelay(State state, std::chrono::milliseconds delay);
 
 
   /**
-  * @brief Function that binds a QT action to the function for the state hold
+  * @brief Function to replace the clock of the state machine. A VirtualClock waits for the events
+  * posted to this machine to be processed before every step it advances.
   */
-  virtual bool _hold() = 0;
+  bool setClock(std::shared_ptr<Clock> clock) override;
 
+  bool setSnapshotFile(std::shared_ptr<SnapshotFile> file, RestartPolicy policy) override;
 
-  /**
-  * @brief Function that binds a QT action to the function for the state unhold
-  */
-  virtual bool _unhold() = 0;
+  bool setJournal(std::shared_ptr<JournalWriter> journal) override;
 
+  bool setModeRegistry(std::shared_ptr<const ModeRegistry> registry) override;
 
-  /**
-  * @brief Function that binds a QT action to the function for the state suspend
-  */
-  virtual bool _suspend() = 0;
+  std::shared_ptr<const ModeGraphs> getModeGraphs() override;
+
+  CommandMask getAllowedCommands() override;
 
 
   /**
-  * @brief Function that binds a QT action to the function for the state unsuspend
+  * @brief Function that returns whether the state machine is active or not
   */
-  virtual bool _unsuspend() = 0;
+  bool isActive()
+  {
+    return sm_internal_.isRunning();
+  }
 
 
   /**
-  * @brief Function that binds a QT action to the function for the state stop
+  * @brief Function that returns the current state of the state machine
   */
-  virtual bool _stop() = 0;
+  State getCurrentState()
+  {
+    return state_value_;
+  }
 
 
   /**
-  * @brief Function that binds a QT action to the function for the state abort
+  * @brief Function that returns the time spent in every state on the clock of the machine
+  * (lock-free)
   */
-  virtual bool _abort() = 0;
-};
-
-
-/**
-* @brief Function to start and run a state machine
-* @param argc - number of command line arguments
-* @param argv - list of command line arguments
-*/
-void init(int argc, char * argv[]);
-
+  StateTimes getStateTimes() override
+  {
+    return state_times_.snapshot(sm_internal_.clock().now());
+  }
 
-/**
-* @brief Class that implements a state machine object
-*/
-class StateMachine : public QObject, public StateMachineInterface, public std::enable_shared_from_this<StateMachine>
-{
-  Q_OBJECT
 
-public:
   /**
-  * @brief Function to create a single cycle state machine (executes once)
+  * @brief Function that returns the latency from an accepted ABORT command to the entry of ABORTED
   */
-  static std::shared_ptr<StateMachine> singleCycleSM();
+  LatencyStats getAbortLatency() override
+  {
+    std::lock_guard<std::mutex> lock(abort_latency_mutex_);
+    return abort_latency_;
+  }
 
 
   /**
-  * @brief Function to create a continuous cycle state machine (executes forever until stopped)
+  * @brief Function that returns the counters and latencies of the transitions (lock-free). Results
+  * of operations of states that were already left are not counted.
   */
-  static std::shared_ptr<StateMachine> continuousCycleSM();
+  std::vector<TransitionStats> getTransitionStats() override
+  {
+    return sm_internal_.transitionStats();
+  }
 
 
   /**
-  * @brief Function to activate the state machine
+  * @brief Function that returns the queue depth and time to dispatch of the normal and the emergency
+  * (ABORT and STOP) command lanes, and how many submissions were coalesced
   */
-  bool activate();
+  CommandIntakeStats getCommandIntakeStats() const
+  {
+    return sm_internal_.intakeStats();
+  }
 
 
   /**
-  * @brief Function to deactivate the state machine
+  * @brief Function that returns the allocation counters of the events posted to the state machine
   */
-  bool deactivate();
+  EventPool::Stats getEventPoolStats() const
+  {
+    return event_pool_.stats();
+  }
 
+  virtual std::expected<bool, std::string> changeMode(ModeType mode);
 
-  /**
-  * @brief Function to bind the Execute state to a function
-  * @param execute_method - Function for the Execute state
-  */
-  bool setExecute(std::function<int()> execute_method);
+  virtual std::expected<bool, std::string> changeState(TransitionCmd mode);
 
 
   /**
-  * @brief Function to bind the Resetting state to a function
-  * @param execute_method - Function for the Resetting state
+  * @brief Function to post a command to the state machine thread and return immediately
+  * @param command - transition command
   */
-  bool setResetting(std::function<int()> resetting_method);
+  StateChangeResult changeStateAsync(TransitionCmd command) override;
 
 
   /**
-  * @brief Function that returns whether the state machine is active or not
+  * @brief Function to switch the mode on the state machine thread and return immediately
+  * @param mode - mode to switch to
   */
-  bool isActive()
-  {
-    return sm_internal_.isRunning();
-  }
-
+  ModeChangeResult changeModeAsync(ModeType mode) override;
 
   /**
-  * @brief Function that returns the current state of the state machine
+  * @brief Called for every state entered, on the Qt thread before the next transition can run.
+  * Slow work belongs on a subscription of stateChanges().
   */
-  State getCurrentState()
-  {
-    return state_value_;
-  }
-
-  virtual std::expected<bool, std::string> changeMode(ModeType mode);
-
-  virtual std::expected<bool, std::string> changeState(TransitionCmd mode);
-
-  std::function<void(State value, QString name)> on_state_changed = [](packml_sm::State value, QString name){
-      std::cout << "Default callback; State changed to: " << name.toStdString() << "(" << value << ")" << std::endl;
+  std::function<void(State value, QString name)> on_state_changed = [](packml_sm::State value, QString /*name*/){
+      PACKML_LOG_INFO("Default callback; State changed to: {}", value);
     };
   std::function<void(ModeType value)> on_mode_changed = [](packml_sm::ModeType value) {
-      std::cout << "Default callback; Mode changed to: " << value << std::endl;
+      PACKML_LOG_INFO("Default callback; Mode changed to: {}", value);
     };
 
   /**
   * @brief Class destructor
   */
-  virtual ~StateMachine() {}
+  virtual ~StateMachine();
 
 protected:
   /**
   * @brief Class constructor
+  * @param table - transition table equivalent to the Qt state graph built by the derived class,
+  * the mode graphs are compiled from it
   */
-  StateMachine();
+  explicit StateMachine(const TransitionTable & table = kSingleCycleTable);
 
   std::shared_ptr<StatesGenerator> gen;
 
+
+  /**
+  * @brief Function that forms the Qt state graph from the transition table of the machine
+  * @param name - kind of machine, for the log
+  */
+  void form(const char * name);
+
   /**
   * @brief Function that binds a QT action to the function for the state start
   */
@@ -387,7 +579,7 @@ protected:
   /**
   * @brief Number of the current state
   */
-  State state_value_;
+  State state_value_ = State::UNDEFINED;
 
 
   /**
@@ -396,6 +588,29 @@ protected:
   QString state_name_;
 
 
+  /**
+  * @brief Time accounting of all states, written on state entry
+  */
+  StateTimeAccounting state_times_;
+
+
+  /**
+  * @brief Abort command to ABORTED latency, written on the state machine thread
+  */
+  std::mutex abort_latency_mutex_;
+  LatencyStats abort_latency_;
+
+
+  /**
+  * @brief Compiled graphs of the modes changeMode() switches between. Replaced graphs live until
+  * the state machine thread is done with the event it was processing, see setModeRegistry().
+  */
+  std::mutex mode_mutex_;
+  const TransitionTable table_;
+  std::shared_ptr<const ModeGraphs> mode_graphs_;
+  const ModeGraph * graph_;
+
+
   /**
   * @brief Waiting for event to transition to abort state
   */
@@ -509,6 +724,43 @@ protected:
   DualState * execute_;
 
 
+  /**
+  * @brief Clock of sm_internal_ and its states, declared before it so that it outlives them
+  */
+  std::shared_ptr<Clock> clock_;
+
+
+  /**
+  * @brief Snapshot saved on every state entry, only the first activation after
+  * setSnapshotFile() restores from it
+  */
+  std::shared_ptr<SnapshotFile> snapshot_file_;
+  RestartPolicy restart_policy_ = RestartPolicy::COLD;
+  bool restore_pending_ = false;
+
+  /**
+  * @brief Initial states changed to start the machine in a resumed state, put back once started
+  */
+  std::vector<std::pair<QState *, QAbstractState *>> resume_initial_states_;
+
+  void restore(const MachineSnapshot & saved);
+
+  void saveSnapshot(State state);
+
+  void restoreInitialStates();
+
+  /**
+  * @brief Journal of sm_internal_, state entries and mode changes are appended by this class
+  */
+  std::shared_ptr<JournalWriter> journal_;
+
+
+  /**
+  * @brief Events posted to sm_internal_, declared first so that it outlives them
+  */
+  EventPool event_pool_;
+
+
   /**
   * @brief QT state machine object
   */
@@ -533,48 +785,39 @@ signals:
 
 
 /**
-* @brief Class for the definition of a continuous cycle state machine
+* @brief State machine of the kind a MachinePolicy describes, e.g. Machine<ContinuousCyclePolicy>
 */
-class ContinuousCycle : public StateMachine
+template<MachinePolicy Policy>
+class Machine : public StateMachine
 {
-  Q_OBJECT
-
 public:
   /**
   * @brief Class constructor
   */
-  ContinuousCycle();
+  Machine()
+  : StateMachine(Policy::kTable) {}
 
-  void init();
 
   /**
-  * @brief Class desstructor
+  * @brief Function that forms the states and transitions of the policy and applies its default
+  * operations, the machine must be owned by a shared_ptr
   */
-  virtual ~ContinuousCycle() {}
-};
-
-
-/**
-* @brief Class for the definition of a single cycle state machine
-*/
-class SingleCycle : public StateMachine
-{
-  Q_OBJECT
-
-public:
-  /**
-  * @brief Class constructor
-  */
-  SingleCycle();
+  void init()
+  {
+    form(Policy::kName);
+    applyOperationDelays<Policy>(*this);
+  }
 
-  void init();
 
   /**
   * @brief Class destructor
   */
-  virtual ~SingleCycle() {}
+  virtual ~Machine() {}
 };
 
+using SingleCycle = Machine<SingleCyclePolicy>;
+using ContinuousCycle = Machine<ContinuousCyclePolicy>;
+
 }  // namespace packml_sm
 
 #endif  // PACKML_SM__STATE_MACHINE_HPP_
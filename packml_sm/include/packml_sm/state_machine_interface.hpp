@@ -0,0 +1,367 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__STATE_MACHINE_INTERFACE_HPP_
+#define PACKML_SM__STATE_MACHINE_INTERFACE_HPP_
+
+#include <chrono>
+#include <expected>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <vector>
+
+#include "packml_sm/async_result.hpp"
+#include "packml_sm/clock.hpp"
+#include "packml_sm/command_script.hpp"
+#include "packml_sm/common.hpp"
+#include "packml_sm/journal.hpp"
+#include "packml_sm/mode_graph.hpp"
+#include "packml_sm/mode_registry.hpp"
+#include "packml_sm/snapshot.hpp"
+#include "packml_sm/state_change_bus.hpp"
+#include "packml_sm/state_times.hpp"
+#include "packml_sm/state_waiters.hpp"
+#include "packml_sm/transition_stats.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Operation of an acting state that can be cancelled, returns 0 on success or an error code.
+* The stop token is signalled as soon as the state is left; the function should then return
+* promptly, its result is discarded.
+*/
+using CancellableOperation = std::function<int(std::stop_token)>;
+
+/**
+ * @brief The StateMachineInterface class defines a implementation independent interface
+ * to a PackML state machine.
+ */
+class StateMachineInterface
+{
+public:
+  virtual ~StateMachineInterface() = default;
+
+  /**
+  * @brief Function to activate the state machine
+  */
+  virtual bool activate() = 0;
+
+
+  /**
+  * @brief Function to bind a function for the Execute state
+  * @param execute_method - a function for the Execute state
+  */
+  virtual bool setExecute(std::function<int()> execute_method) = 0;
+
+
+  /**
+  * @brief Function to bind a function for the Resetting state
+  * @param resetting_method - a function for the Resetting state
+  */
+  virtual bool setResetting(std::function<int()> resetting_method) = 0;
+
+
+  /**
+  * @brief Function to bind a cancellable function to an acting state
+  * @param state - acting state to bind to
+  * @param method - function receiving the stop token of the state entry
+  * @return false if state is not an acting state
+  */
+  virtual bool setCancellableOperation(State state, CancellableOperation method) = 0;
+
+
+  /**
+  * @brief Function that returns whether the state machine is active or not
+  */
+  virtual bool isActive() = 0;
+
+
+  /**
+  * @brief Function that returns the current state of the state machine
+  */
+  virtual State getCurrentState() = 0;
+
+
+  /**
+  * @brief Function that returns the time spent in every state, safe to call from any thread without
+  * blocking the state machine
+  */
+  virtual StateTimes getStateTimes() = 0;
+
+
+  /**
+  * @brief Function that returns the latency from an accepted ABORT command to the entry of ABORTED
+  */
+  virtual LatencyStats getAbortLatency() = 0;
+
+
+  /**
+  * @brief Function that returns the accepted and rejected counts and the latency histogram of every
+  * transition taken or refused so far, safe to call from any thread without blocking the state
+  * machine
+  */
+  virtual std::vector<TransitionStats> getTransitionStats() = 0;
+
+
+  /**
+  * @brief Function to set a watchdog on a state, staying in it longer than timeout raises an error
+  * with code kWatchdogErrorCode
+  * @param state - state to watch
+  * @param timeout - maximum time in the state, 0 disables the watchdog
+  */
+  virtual bool setWatchdog(State state, std::chrono::milliseconds timeout) = 0;
+
+
+  /**
+  * @brief Function to run timed states, watchdogs and the time accounting on another clock than
+  * Clock::system(), e.g. a VirtualClock for simulation
+  * @return false if clock is null or the state machine is active
+  */
+  virtual bool setClock(std::shared_ptr<Clock> clock) = 0;
+
+
+  /**
+  * @brief Function to save the state, mode, state times and counters to file on every transition.
+  * The next activate() restores them from the snapshot of the previous run according to policy.
+  * @return false if file is null or the state machine is active
+  */
+  virtual bool setSnapshotFile(std::shared_ptr<SnapshotFile> file, RestartPolicy policy) = 0;
+
+
+  /**
+  * @brief Function to append every accepted and rejected command, state entry, mode change and
+  * operation result to journal, nullptr stops journaling
+  * @return false if the state machine is active
+  */
+  virtual bool setJournal(std::shared_ptr<JournalWriter> journal) = 0;
+
+
+  /**
+  * @brief Function to set the modes changeMode() can switch to, ModeRegistry::global() by default
+  * @return false if registry is null or lacks the current mode
+  */
+  virtual bool setModeRegistry(std::shared_ptr<const ModeRegistry> registry) = 0;
+
+
+  /**
+  * @brief Function that returns the transition graphs of the registered modes, compiled when the
+  * mode registry was set
+  */
+  virtual std::shared_ptr<const ModeGraphs> getModeGraphs() = 0;
+
+
+  /**
+  * @brief Function that returns the commands accepted in the current mode and state, a lookup in
+  * the compiled graph of the mode that does not wait for the state machine
+  */
+  virtual CommandMask getAllowedCommands() = 0;
+
+  virtual std::expected<bool, std::string> changeMode(ModeType mode) = 0;
+
+  virtual std::expected<bool, std::string> changeState(TransitionCmd command) = 0;
+
+
+  /**
+  * @brief Function to request a state change without waiting for the state machine to evaluate it.
+  * The default implementation evaluates the command on the calling thread.
+  * @param command - transition command
+  * @return results for the acceptance of the command and for the state it entered
+  */
+  virtual StateChangeResult changeStateAsync(TransitionCmd command);
+
+
+  /**
+  * @brief Function to request a mode change without waiting for the state machine to apply it.
+  * The default implementation switches the mode on the calling thread.
+  * @param mode - mode to switch to
+  */
+  virtual ModeChangeResult changeModeAsync(ModeType mode);
+
+
+  /**
+  * @brief Function to run a command script in one call: each step submits its command and waits
+  * for its target state, without polling. Scripts of one state machine run one at a time, commands
+  * of other callers may still interleave with their steps. Must not be called from the state
+  * machine thread.
+  * @param steps - steps to run in order, the script stops at the first one that fails
+  */
+  ScriptResult runScript(const std::vector<ScriptStep> & steps);
+
+
+  /**
+  * @brief Function to wait until the state machine is in state, woken by the entry of the state
+  * instead of polling getCurrentState(). Must not be called from the state machine thread.
+  * @return true if the state machine is in state or entered it within timeout
+  */
+  bool awaitState(State state, std::chrono::milliseconds timeout);
+
+
+  /**
+  * @brief Function to wait until the state machine is in one of states, like awaitState()
+  * @return the state the state machine is in or entered first, State::UNDEFINED on timeout
+  */
+  State awaitAnyOf(StateMask states, std::chrono::milliseconds timeout);
+
+  State awaitAnyOf(std::initializer_list<State> states, std::chrono::milliseconds timeout);
+
+
+  /**
+  * @brief Function that returns an eventfd that becomes readable whenever a state is entered, to
+  * wait for state changes in an epoll or poll loop. Reading the eventfd resets it, the loop then
+  * reads getCurrentState(). The eventfd is owned by the state machine.
+  */
+  std::expected<int, std::string> getStateEventFd() {return state_waiters_.eventFd();}
+
+
+  /**
+  * @brief Function that returns the bus every state entry is published on. Subscribers get their
+  * own bounded queue and are served on their own threads, so unlike on_state_changed they never
+  * delay a transition.
+  */
+  StateChangeBus & stateChanges() {return state_change_bus_;}
+
+
+  /**
+  * @brief Function that implements the start state
+  */
+  virtual bool start();
+
+
+  /**
+  * @brief Function that implements the clear state
+  */
+  virtual bool clear();
+
+
+  /**
+  * @brief Function that implements the reset state
+  */
+  virtual bool reset();
+
+
+  /**
+  * @brief Function that implements the hold state
+  */
+  virtual bool hold();
+
+
+  /**
+  * @brief Function that implements the unhold state
+  */
+  virtual bool unhold();
+
+
+  /**
+  * @brief Function that implements the suspend state
+  */
+  virtual bool suspend();
+
+
+  /**
+  * @brief Function that implements the unsuspend state
+  */
+  virtual bool unsuspend();
+
+
+  /**
+  * @brief Function that implements the stop state
+  */
+  virtual bool stop();
+
+
+  /**
+  * @brief Function that implements the abort state
+  */
+  virtual bool abort();
+
+protected:
+  /**
+  * @brief Function the implementations call on every state entry, wakes the threads waiting for
+  * the state and publishes the entry to the subscribers of stateChanges()
+  */
+  void notifyStateEntered(State state)
+  {
+    state_waiters_.entered(state);
+    state_change_bus_.publish(state);
+  }
+
+
+  /**
+  * @brief Function that binds a QT event to the function for the state start
+  */
+  virtual bool _start() = 0;
+
+
+  /**
+  * @brief Function that binds a QT action to the function for the state clear
+  */
+  virtual bool _clear() = 0;
+
+  /**
+  * @brief Function that binds a QT action to the function for the state reset
+  */
+  virtual bool _reset() = 0;
+
+
+  /**
+  * @brief Function that binds a QT action to the function for the state hold
+  */
+  virtual bool _hold() = 0;
+
+
+  /**
+  * @brief Function that binds a QT action to the function for the state unhold
+  */
+  virtual bool _unhold() = 0;
+
+
+  /**
+  * @brief Function that binds a QT action to the function for the state suspend
+  */
+  virtual bool _suspend() = 0;
+
+
+  /**
+  * @brief Function that binds a QT action to the function for the state unsuspend
+  */
+  virtual bool _unsuspend() = 0;
+
+
+  /**
+  * @brief Function that binds a QT action to the function for the state stop
+  */
+  virtual bool _stop() = 0;
+
+
+  /**
+  * @brief Function that binds a QT action to the function for the state abort
+  */
+  virtual bool _abort() = 0;
+
+private:
+  StateWaiters state_waiters_;
+  StateChangeBus state_change_bus_;
+  std::mutex script_mutex_;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__STATE_MACHINE_INTERFACE_HPP_
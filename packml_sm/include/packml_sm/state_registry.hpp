@@ -0,0 +1,166 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__STATE_REGISTRY_HPP_
+#define PACKML_SM__STATE_REGISTRY_HPP_
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+#include "packml_sm/common.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Number of entries in the SuperState enum
+*/
+constexpr std::size_t kSuperStateCount = static_cast<std::size_t>(SuperState::STOPPABLE) + 1;
+
+/**
+* @brief Number of slots of a StateRegistry: every State followed by every SuperState
+*/
+constexpr std::size_t kRegistrySize = kStateCount + kSuperStateCount;
+
+constexpr std::size_t registryIndex(State state)
+{
+  return toIndex(state);
+}
+
+constexpr std::size_t registryIndex(SuperState state)
+{
+  return kStateCount + static_cast<std::size_t>(state);
+}
+
+
+/**
+* @brief Names of the registry slots, equal to to_string() of their State or SuperState
+*/
+constexpr std::array<std::string_view, kRegistrySize> kRegistryNames{
+  "UNDEFINED", "CLEARING", "STOPPED", "STARTING", "IDLE", "SUSPENDED", "EXECUTE", "STOPPING",
+  "ABORTING", "ABORTED", "HOLDING", "HELD", "UNHOLDING", "SUSPENDING", "UNSUSPENDING", "RESETTING",
+  "COMPLETING", "COMPLETE", "ABORTABLE", "STOPPABLE"};
+
+static_assert(kRegistryNames[registryIndex(State::COMPLETE)] == "COMPLETE");
+static_assert(kRegistryNames[registryIndex(SuperState::ABORTABLE)] == "ABORTABLE");
+
+constexpr std::string_view registryName(State state)
+{
+  return kRegistryNames[registryIndex(state)];
+}
+
+constexpr std::string_view registryName(SuperState state)
+{
+  return kRegistryNames[registryIndex(state)];
+}
+
+
+/**
+* @brief Function that returns the slot of a state name, for the string based compatibility API
+*/
+constexpr std::optional<std::size_t> registryIndex(std::string_view name)
+{
+  for (std::size_t ii = 0; ii < kRegistrySize; ++ii) {
+    if (kRegistryNames[ii] == name) {
+      return ii;
+    }
+  }
+  return std::nullopt;
+}
+
+
+/**
+* @brief Contiguous table of the state objects of a state machine, indexed by State and SuperState.
+*
+* Lookups are an array access and never allocate. The registry does not own the states.
+*/
+template<typename T>
+class StateRegistry
+{
+public:
+  T * get(State state) const {return at(registryIndex(state));}
+
+  T * get(SuperState state) const {return at(registryIndex(state));}
+
+  T * operator[](State state) const {return get(state);}
+
+  T * operator[](SuperState state) const {return get(state);}
+
+
+  /**
+  * @brief Function to look a state up by its name, nullptr if the name is unknown or not registered
+  */
+  T * find(std::string_view name) const
+  {
+    auto index = registryIndex(name);
+    return index ? slots_[*index] : nullptr;
+  }
+
+
+  /**
+  * @brief Function to register a state
+  * @return false if the slot is already taken
+  */
+  bool add(State state, T * value) {return add(registryIndex(state), value);}
+
+  bool add(SuperState state, T * value) {return add(registryIndex(state), value);}
+
+  bool contains(State state) const {return get(state) != nullptr;}
+
+
+  /**
+  * @brief Function to call visit(name, state) for every registered state, in enum order
+  */
+  template<typename Visit>
+  void forEach(Visit && visit) const
+  {
+    for (std::size_t ii = 0; ii < kRegistrySize; ++ii) {
+      if (slots_[ii] != nullptr) {
+        visit(kRegistryNames[ii], slots_[ii]);
+      }
+    }
+  }
+
+  std::size_t size() const
+  {
+    std::size_t count = 0;
+    for (auto slot : slots_) {
+      count += (slot != nullptr) ? 1 : 0;
+    }
+    return count;
+  }
+
+private:
+  T * at(std::size_t index) const {return index < kRegistrySize ? slots_[index] : nullptr;}
+
+  bool add(std::size_t index, T * value)
+  {
+    if (index >= kRegistrySize || slots_[index] != nullptr) {
+      return false;
+    }
+    slots_[index] = value;
+    return true;
+  }
+
+  std::array<T *, kRegistrySize> slots_{};
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__STATE_REGISTRY_HPP_
@@ -0,0 +1,186 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__STATE_TIMES_HPP_
+#define PACKML_SM__STATE_TIMES_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "packml_sm/common.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Consistent copy of the time a state machine spent in each state
+*/
+struct StateTimes
+{
+  /**
+  * @brief Time per state, the current state includes the time since it was last entered
+  */
+  std::array<std::chrono::nanoseconds, kStateCount> time{};
+
+  /**
+  * @brief Number of times each state was entered
+  */
+  std::array<std::uint64_t, kStateCount> entries{};
+
+  State current = State::UNDEFINED;
+
+  /**
+  * @brief Time since the current state was entered
+  */
+  std::chrono::nanoseconds in_state{0};
+
+  std::chrono::nanoseconds total(State state) const {return time[toIndex(state)];}
+
+  double seconds(State state) const
+  {
+    return std::chrono::duration<double>(time[toIndex(state)]).count();
+  }
+};
+
+
+/**
+* @brief Count, last, maximum and total of a measured latency
+*/
+struct LatencyStats
+{
+  std::uint64_t count = 0;
+  std::chrono::nanoseconds last{0};
+  std::chrono::nanoseconds max{0};
+  std::chrono::nanoseconds total{0};
+
+  void add(std::chrono::nanoseconds value)
+  {
+    ++count;
+    last = value;
+    max = std::max(max, value);
+    total += value;
+  }
+
+  std::chrono::nanoseconds mean() const
+  {
+    return count == 0 ? std::chrono::nanoseconds(0) : total / static_cast<std::int64_t>(count);
+  }
+};
+
+
+/**
+* @brief Monotonic per state time accounting with lock-free readers.
+*
+* enter() must be called by a single thread at a time (the state machine thread), snapshot() may be
+* called from any thread at any rate. Readers never block the writer: they retry on the sequence
+* counter if an update happened while they were copying.
+*/
+class StateTimeAccounting
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+
+  /**
+  * @brief Function to record the entry of a state, closes the time of the previous state
+  */
+  void enter(State state, Clock::time_point now = Clock::now())
+  {
+    auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    auto sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    State previous = current_.load(std::memory_order_relaxed);
+    if (previous != State::UNDEFINED) {
+      auto & closed = closed_ns_[toIndex(previous)];
+      closed.store(
+        closed.load(std::memory_order_relaxed) + (now_ns - entered_ns_.load(std::memory_order_relaxed)),
+        std::memory_order_relaxed);
+    }
+    auto & entries = entries_[toIndex(state)];
+    entries.store(entries.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    current_.store(state, std::memory_order_relaxed);
+    entered_ns_.store(now_ns, std::memory_order_relaxed);
+
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+
+  /**
+  * @brief Function to continue from times saved by an earlier run, before the first enter()
+  */
+  void restore(const StateTimes & times)
+  {
+    auto sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+      closed_ns_[ii].store(times.time[ii].count(), std::memory_order_relaxed);
+      entries_[ii].store(times.entries[ii], std::memory_order_relaxed);
+    }
+    current_.store(State::UNDEFINED, std::memory_order_relaxed);
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+
+  /**
+  * @brief Function that returns the accumulated times, with the current state counted up to now
+  */
+  StateTimes snapshot(Clock::time_point now = Clock::now()) const
+  {
+    StateTimes times;
+    std::int64_t entered_ns = 0;
+    while (true) {
+      auto before = sequence_.load(std::memory_order_acquire);
+      if (before & 1) {
+        continue;
+      }
+      for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+        times.time[ii] = std::chrono::nanoseconds(closed_ns_[ii].load(std::memory_order_relaxed));
+        times.entries[ii] = entries_[ii].load(std::memory_order_relaxed);
+      }
+      times.current = current_.load(std::memory_order_relaxed);
+      entered_ns = entered_ns_.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence_.load(std::memory_order_relaxed) == before) {
+        break;
+      }
+    }
+
+    if (times.current != State::UNDEFINED) {
+      auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+      times.in_state = std::chrono::nanoseconds(std::max<std::int64_t>(0, now_ns - entered_ns));
+      times.time[toIndex(times.current)] += times.in_state;
+    }
+    return times;
+  }
+
+private:
+  std::atomic<std::uint64_t> sequence_{0};
+  std::array<std::atomic<std::int64_t>, kStateCount> closed_ns_{};
+  std::array<std::atomic<std::uint64_t>, kStateCount> entries_{};
+  std::atomic<State> current_{State::UNDEFINED};
+  std::atomic<std::int64_t> entered_ns_{0};
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__STATE_TIMES_HPP_
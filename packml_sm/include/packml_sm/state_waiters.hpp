@@ -0,0 +1,106 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__STATE_WAITERS_HPP_
+#define PACKML_SM__STATE_WAITERS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <expected>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "packml_sm/common.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Threads waiting for the entry of a state, woken by the state machine instead of polling
+* its current state. Event loops can wait on an eventfd instead, see eventFd().
+*
+* An entry only costs two atomic loads while nobody waits.
+*/
+class StateWaiters
+{
+public:
+  StateWaiters() = default;
+
+  ~StateWaiters();
+
+  StateWaiters(const StateWaiters &) = delete;
+  StateWaiters & operator=(const StateWaiters &) = delete;
+
+
+  /**
+  * @brief Registration of a thread waiting for one of a set of states. It is armed from
+  * construction to destruction, an entry between the arming and the wait is not missed.
+  */
+  class Watch
+  {
+  public:
+    Watch(StateWaiters & waiters, StateMask targets);
+
+    ~Watch();
+
+    Watch(const Watch &) = delete;
+    Watch & operator=(const Watch &) = delete;
+
+
+    /**
+    * @brief Function to wait for the entry of a target state
+    * @return the target state entered first since the watch was armed, State::UNDEFINED on timeout
+    */
+    State waitUntil(std::chrono::steady_clock::time_point deadline);
+
+  private:
+    friend class StateWaiters;
+
+    StateWaiters & waiters_;
+    const StateMask targets_;
+    // Guarded by the mutex of waiters_
+    State entered_ = State::UNDEFINED;
+  };
+
+
+  /**
+  * @brief Function the state machine calls on every state entry, wakes the watches of state
+  */
+  void entered(State state);
+
+
+  /**
+  * @brief Function that returns an eventfd that becomes readable when a state is entered, created
+  * on the first call and closed with the waiters. Reading it resets it; entries between two reads
+  * are coalesced.
+  */
+  std::expected<int, std::string> eventFd();
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Watch *> watches_;
+  std::atomic<std::size_t> watch_count_{0};
+  std::atomic<int> event_fd_{-1};
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__STATE_WAITERS_HPP_
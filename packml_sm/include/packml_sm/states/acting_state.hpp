@@ -15,8 +15,16 @@
 
 #pragma  once
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stop_token>
+#include <vector>
+
 #include "QState"
-#include "QFuture"
+#include "packml_sm/acting_executor.hpp"
 #include "packml_sm/common.hpp"
 #include "packml_sm/states/state.hpp"
 #include <qchar.h>
@@ -24,6 +32,12 @@
 namespace packml_sm
 {
 
+/**
+* @brief Default time onExit() waits for a cancelled operation bound with
+* setCancellableOperationMethod() before leaving the state without it
+*/
+constexpr std::chrono::milliseconds kDefaultExitTimeout{100};
+
 struct ActingState : public PackmlState
 {
 public:
@@ -94,7 +108,7 @@ public:
     : PackmlState(state_value, name_value, super_state), delay_ms(delay_ms_value) {}
 
   ActingState(State state_value, const char * name_value, QState * super_state, std::function<int()> function_value)
-    : PackmlState(state_value, QString(name_value), super_state), function_(function_value) {}
+    : PackmlState(state_value, QString(name_value), super_state), function_(cancellable(function_value)) {}
 
 
   ActingState(State state_value, int delay_ms_value = 200)
@@ -104,24 +118,96 @@ public:
     : PackmlState(state_value, to_string(state_value).c_str(), super_state), delay_ms(delay_ms_value) {}
 
   ActingState(State state_value, QState * super_state, std::function<int()> function_value)
-    : PackmlState(state_value, to_string(state_value).c_str(), super_state), function_(function_value) {}
+    : PackmlState(state_value, to_string(state_value).c_str(), super_state), function_(cancellable(function_value)) {}
+
+  /**
+  * @brief Function to make the state a timed state again, it completes delay after its entry on
+  * the clock of the state machine
+  */
+  bool setDelay(std::chrono::milliseconds delay)
+  {
+    delay_ms = static_cast<int>(delay.count());
+    function_ = nullptr;
+    return true;
+  }
 
+  /**
+  * @brief Function to bind an operation that cannot be cancelled, onExit() always waits for it to
+  * return, so a state is never entered while its previous operation is still running
+  */
   bool setOperationMethod(std::function<int()> function_value)
+  {
+    function_ = cancellable(function_value);
+    stoppable_ = false;
+    return true;
+  }
+
+
+  /**
+  * @brief Function to bind an operation that is told through its stop token when the state is left
+  */
+  bool setCancellableOperationMethod(std::function<int(std::stop_token)> function_value)
   {
     function_ = function_value;
+    stoppable_ = true;
     return true;
   }
-  virtual void operation();
-  virtual ~ActingState() {}
+
+
+  /**
+  * @brief Function to set how long onExit() waits for a cancelled operation bound with
+  * setCancellableOperationMethod() to return. After the timeout the state is left anyway and the
+  * late result of the operation is discarded; the next entry of the state may then start the
+  * operation while the abandoned run still returns. Operations bound without a stop token are
+  * always waited for. std::chrono::milliseconds::max() waits until the operation returns.
+  */
+  void setExitTimeout(std::chrono::milliseconds exit_timeout_value)
+  {
+    exit_timeout_ = exit_timeout_value;
+  }
+
+  /**
+  * @brief Function to run the operation on another executor than ActingExecutor::global()
+  */
+  void setExecutor(std::shared_ptr<ActingExecutor> executor_value)
+  {
+    executor_ = std::move(executor_value);
+  }
+  virtual void operation(std::stop_token token, std::uint64_t entry);
+
+
+  /**
+  * @brief Class destructor, cancels and waits for the operations still running
+  */
+  virtual ~ActingState();
 
 protected:
   virtual void onEntry(QEvent * e);
   virtual void onExit(QEvent * e);
 
 private:
+  static std::function<int(std::stop_token)> cancellable(std::function<int()> function_value)
+  {
+    if (!function_value) {
+      return nullptr;
+    }
+    return [function_value](std::stop_token) {return function_value();};
+  }
+
   int delay_ms;
-  std::function<int()> function_;
-  QFuture<void> function_state_;
+  std::function<int(std::stop_token)> function_;
+  // Whether function_ takes the stop token, only then does onExit() give up on it
+  bool stoppable_ = false;
+  // Of the operation of the current entry, function_ may be rebound while it runs
+  bool running_stoppable_ = false;
+  std::chrono::milliseconds exit_timeout_{kDefaultExitTimeout};
+  std::shared_ptr<ActingExecutor> executor_;
+  std::stop_source stop_;
+  std::shared_future<void> function_state_;
+  TimerWheel::TimerId delay_timer_ = TimerWheel::kNoTimer;
+
+  // Operations that did not return within the exit timeout
+  std::vector<std::shared_future<void>> abandoned_;
 };
 
 // TODO: needed?
@@ -15,12 +15,21 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
 #include "QState"
+#include "packml_sm/clock.hpp"
 #include "packml_sm/common.hpp"
+#include "packml_sm/event_pool.hpp"
+#include "packml_sm/timer_wheel.hpp"
 
 namespace packml_sm
 {
 
+class TimerService;
+
 struct PackmlState : public QState
 {
 Q_OBJECT
@@ -39,7 +48,25 @@ public:
 
   State state() const {return state_;}
   const std::string name() const {return name_.toStdString();}
-  virtual ~PackmlState() {}
+
+  /**
+  * @brief Number of times the state was entered, only valid on the state machine thread
+  */
+  std::uint64_t entryCount() const {return entry_count_;}
+
+  /**
+  * @brief Function that returns whether the state is active and was not re-entered since entry
+  */
+  bool isCurrentEntry(std::uint64_t entry) const {return active() && entry == entry_count_;}
+
+  /**
+  * @brief Function to post an ErrorEvent (code kWatchdogErrorCode) when the state is not left
+  * within timeout of its entry
+  * @param timeout - watchdog time, zero disables the watchdog
+  */
+  void setWatchdog(std::chrono::milliseconds timeout) {watchdog_timeout_.store(timeout);}
+
+  virtual ~PackmlState();
 
 signals:
   void stateEntered(State value, QString name);
@@ -48,12 +75,47 @@ protected:
   State state_;
   QString name_;
 
-  std::chrono::time_point<std::chrono::system_clock> enter_time_;
-  std::chrono::time_point<std::chrono::system_clock> exit_time_;
-  std::chrono::duration<double> cummulative_time_;
+  Clock::TimePoint enter_time_;
+  Clock::TimePoint exit_time_;
+  std::chrono::nanoseconds cummulative_time_;
+  std::uint64_t entry_count_ = 0;
+
+  // Set from any thread, read on entry
+  std::atomic<std::chrono::milliseconds> watchdog_timeout_{std::chrono::milliseconds(0)};
+  TimerWheel::TimerId watchdog_timer_ = TimerWheel::kNoTimer;
+
+  /**
+  * @brief Timer service of the state machine thread, set on the first entry
+  */
+  TimerService * timer_service_ = nullptr;
+
+  /**
+  * @brief Clock of the state machine, set on every entry; Clock::system() if the machine is no
+  * ClockProvider
+  */
+  Clock * clock_ = nullptr;
+
+  /**
+  * @brief Function to run callback after delay of the clock. Wall time timers run on the state
+  * machine thread, the timers of a simulated clock on the thread advancing it, so callback must
+  * only post events.
+  */
+  TimerWheel::TimerId startTimer(std::chrono::milliseconds delay, TimerWheel::Callback callback);
+
+  void cancelTimer(TimerWheel::TimerId & timer);
+
+  /**
+  * @brief Function to open ('b') or close ('e') the trace span of this state on the track of its
+  * machine
+  */
+  void traceSpan(char phase);
+
+  /**
+  * @brief Event pool of the state machine, set on the first entry; nullptr allocates on the heap
+  */
+  EventPool * event_pool_ = nullptr;
 
   virtual void onEntry(QEvent * e);
-  virtual void operation() {}
   virtual void onExit(QEvent * e);
 };
 
@@ -34,9 +34,13 @@ public:
   }
 
   PackmlSuperState(SuperState state_value, TransitionCmd transition_command, QState * super_state = nullptr)
-    : PackmlState(State::UNDEFINED, to_string(state_value).c_str(), super_state), transition_command(transition_command) {}
+    : PackmlState(State::UNDEFINED, to_string(state_value).c_str(), super_state),
+      super_state_(state_value), transition_command(transition_command) {}
+
+  SuperState superState() const {return super_state_;}
 
 private:
+  SuperState super_state_;
   TransitionCmd transition_command;
 };
 }  // namespace packml_sm
\ No newline at end of file
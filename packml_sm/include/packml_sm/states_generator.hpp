@@ -17,7 +17,11 @@
 #pragma once
 
 #include "packml_sm/common.hpp"
+#include "packml_sm/log.hpp"
+#include "packml_sm/mode_registry.hpp"
 #include "packml_sm/state_machine.hpp"
+#include "packml_sm/state_registry.hpp"
+#include "packml_sm/transition_table.hpp"
 #include "packml_sm/states/acting_state.hpp"
 #include "packml_sm/states/state.hpp"
 #include "packml_sm/states/toplevel_states.hpp"
@@ -25,11 +29,11 @@
 #include "packml_sm/transitions/cmd_transition.hpp"
 #include "packml_sm/transitions/error_transition.hpp"
 #include "packml_sm/transitions/sc_transition.hpp"
+#include <array>
+#include <atomic>
 #include <expected>
-#include <map>
 #include <qabstracttransition.h>
 #include <qchar.h>
-#include <set>
 #include <sstream>
 
 namespace packml_sm {
@@ -40,35 +44,6 @@ class StatesGenerator {
 public:
   enum class TransitionType { ERROR, STATE_COMPLETED, COMMAND };
 
-  using AvailableStates = std::map<State, bool>;
-  using ModeSwitchStates = std::set<State>;
-
-  AvailableStates Available = {
-    {State::ABORTING, true},
-    {State::ABORTED, true},
-    {State::CLEARING, true},
-    {State::STOPPING, true},
-    {State::STOPPED, true},
-    {State::RESETTING, true},
-    {State::IDLE, true},
-    {State::STARTING, true},
-    {State::EXECUTE, true},
-    {State::HOLDING, true},
-    {State::HELD, true},
-    {State::UNHOLDING, true},
-    {State::SUSPENDING, true},
-    {State::SUSPENDED, true},
-    {State::UNSUSPENDING, true},
-    {State::COMPLETING, true},
-    {State::COMPLETE, true},
-  };
-
-  ModeSwitchStates switch_states = {
-    State::IDLE
-  };
-
-
-
   // struct AvailableStates {
   //   bool Aborting = true;
   //   bool Aborted = true;
@@ -88,48 +63,44 @@ public:
   //   bool Complete = true;
   // };
 
-  struct Mode {
-    std::string name;
-    // std::map<State, bool> avail_states;
-    AvailableStates available_states;
-
-    Mode(std::string name, AvailableStates available_states)
-        : name(name), available_states(available_states)
-        {}
-  };
-
-  Mode currentMode{"", {}};
-
-  inline std::expected<bool, std::string> mode_switcher(std::shared_ptr<StateMachine> sm, Mode mode_to_switch)
+  /**
+  * @brief Definition of the current mode, read by every PackmlTransition when it tests an event.
+  * Until the first mode switch it is nullptr: every state is available and no state loops.
+  */
+  std::atomic<const ModeDefinition *> mode{nullptr};
+
+  /**
+  * @brief Function to switch to a mode, allowed in its switch states or while no mode is set
+  * @param definition - mode to switch to, must outlive the state machine or the next switch
+  */
+  inline std::expected<bool, std::string> mode_switcher(std::shared_ptr<StateMachine> sm,
+                                                        const ModeDefinition &definition)
   {
-    // TODO: Hacky if current mode name is empty; probably uninitialized
-    if (switch_states.find(sm->getCurrentState()) != switch_states.end() || currentMode.name.empty())
+    State current = sm->getCurrentState();
+    if (mode.load(std::memory_order_acquire) == nullptr || definition.allowsSwitchFrom(current))
     {
-      for (auto state : mode_to_switch.available_states)
-      {
-        // TODO: states key enum instead of string?
-        auto state1 = states[to_string(state.first)];
-        state1->setProperty("Available", state.second);
-      }
-      currentMode = mode_to_switch;
-      std::cout << "Switched mode: " << mode_to_switch.name << std::endl;
+      mode.store(&definition, std::memory_order_release);
+      PACKML_LOG_DEBUG("Switched mode: {}", definition.name);
       return true;
     }
-    else
-    {
-      std::stringstream msg;
-      msg << "Cannot switch mode in state: " << sm->getCurrentState();
-      std::cout << msg.str() << std::endl;
-      return std::unexpected(msg.str());
-    }
-    // Cannot reach this
-    return false;
+    std::stringstream msg;
+    msg << "Cannot switch to mode " << definition.name << " in state: " << current;
+    PACKML_LOG_WARN("{}", msg.str());
+    return std::unexpected(msg.str());
   }
 
   // IDLE  |-CMD Start->  Starting  |-SC->  Execute
 
-  inline void generate_all_packml_states(std::shared_ptr<StateMachine> sm) {
-    printf("Forming state machine (states + transitions)\n");
+  /**
+  * @brief Function that forms the states of the machine and the transitions of table.
+  *
+  * A transition every state of a super state has in common (ABORT and errors for ABORTABLE, STOP
+  * for STOPPABLE) is added once to the super state, all other transitions to their own state. A
+  * completion that re-enters its state (e.g. EXECUTE of a continuous cycle machine) becomes a
+  * StateCompleteTransition onto the state itself.
+  */
+  inline void generate_all_packml_states(std::shared_ptr<StateMachine> sm,
+                                         const TransitionTable &table) {
     // Create SuperState
     PackmlSuperState *abortable = PackmlSuperState::Abortable();
     PackmlSuperState *stoppable = PackmlSuperState::Stoppable(abortable);
@@ -176,94 +147,112 @@ public:
     add_state(sm, Completing);
     add_state(sm, Complete);
 
-    // Create transitions
-    // Naming <from state>_<to state>
-    auto abortable_aborting =
-        generate_transition(Aborting, TransitionType::COMMAND);
-    auto abortable_aborting_on_error =
-        generate_transition(Aborting, TransitionType::ERROR);
-
-    abortable->addTransition(abortable_aborting);
-    abortable->addTransition(abortable_aborting_on_error);
-
-    auto aborting_aborted =
-        generate_transition(Aborted, TransitionType::STATE_COMPLETED);
-    Aborting->addTransition(aborting_aborted);
-
-    auto aborted_clearing =
-        generate_transition(Clearing, TransitionType::COMMAND);
-    Aborted->addTransition(aborted_clearing);
-
-    auto clearing_stopped =
-        generate_transition(Stopped, TransitionType::STATE_COMPLETED);
-    Clearing->addTransition(clearing_stopped);
-
-    auto stoppable_stopping =
-        generate_transition(Stopping, TransitionType::COMMAND);
-    stoppable->addTransition(stoppable_stopping);
-
-    auto stopping_stopped =
-        generate_transition(Stopped, TransitionType::STATE_COMPLETED);
-    Stopping->addTransition(stopping_stopped);
-
-    auto stopped_resetting =
-        generate_transition(Resetting, TransitionType::COMMAND);
-    Stopped->addTransition(stopped_resetting);
-
-    auto resetting_idle =
-        generate_transition(Idle, TransitionType::STATE_COMPLETED);
-    Resetting->addTransition(resetting_idle);
-
-    auto idle_starting = generate_transition(Starting, TransitionType::COMMAND);
-    Idle->addTransition(idle_starting);
-
-    auto starting_execute =
-        generate_transition(Execute, TransitionType::STATE_COMPLETED);
-    Starting->addTransition(starting_execute);
-
-    auto execute_holding =
-        generate_transition(Holding, TransitionType::COMMAND);
-    Execute->addTransition(execute_holding);
-
-    auto holding_held =
-        generate_transition(Held, TransitionType::STATE_COMPLETED);
-    Holding->addTransition(holding_held);
-
-    auto held_unholding =
-        generate_transition(Unholding, TransitionType::COMMAND);
-    Held->addTransition(held_unholding);
-
-    auto unholding_execute =
-        generate_transition(Execute, TransitionType::STATE_COMPLETED);
-    Unholding->addTransition(unholding_execute);
-
-    auto execute_suspending =
-        generate_transition(Suspending, TransitionType::COMMAND);
-    Execute->addTransition(execute_suspending);
-
-    auto suspending_suspended =
-        generate_transition(Suspended, TransitionType::STATE_COMPLETED);
-    Suspending->addTransition(suspending_suspended);
-
-    auto suspended_unsuspending =
-        generate_transition(Unsuspending, TransitionType::COMMAND);
-    Suspended->addTransition(suspended_unsuspending);
-
-    auto unsuspending_execute =
-        generate_transition(Execute, TransitionType::STATE_COMPLETED);
-    Unsuspending->addTransition(unsuspending_execute);
+    // Target shared by every state of members, State::UNDEFINED if they differ
+    auto shared_target = [](StateMask members, auto target_of) {
+      State shared = State::UNDEFINED;
+      bool first = true;
+      for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+        auto state = static_cast<State>(ii);
+        if (!hasState(members, state)) {
+          continue;
+        }
+        State to = target_of(state);
+        if (first) {
+          shared = to;
+          first = false;
+        } else if (to != shared) {
+          return State::UNDEFINED;
+        }
+      }
+      return shared;
+    };
+
+    struct Shared {
+      PackmlSuperState *super_state;
+      StateMask members;
+      std::array<State, kCommandCount> command;
+      State error;
+    };
+    std::array<Shared, 2> shared{{{abortable, kAbortableStates, {}, State::UNDEFINED},
+                                  {stoppable, kStoppableStates, {}, State::UNDEFINED}}};
+    for (auto &super : shared) {
+      for (std::size_t cmd = 0; cmd < kCommandCount; ++cmd) {
+        super.command[cmd] = shared_target(super.members, [&table, cmd](State state) {
+          return table.onCommand(state, static_cast<TransitionCmd>(cmd));
+        });
+      }
+      super.error = shared_target(super.members, [&table](State state) {
+        return table.onError(state);
+      });
+    }
+    // A transition of the outer super state already covers the inner one
+    for (std::size_t cmd = 0; cmd < kCommandCount; ++cmd) {
+      if (shared[1].command[cmd] == shared[0].command[cmd]) {
+        shared[1].command[cmd] = State::UNDEFINED;
+      }
+    }
+    if (shared[1].error == shared[0].error) {
+      shared[1].error = State::UNDEFINED;
+    }
 
-    auto execute_completing =
-        generate_transition(Completing, TransitionType::STATE_COMPLETED);
-    Execute->addTransition(execute_completing);
+    for (const auto &super : shared) {
+      for (std::size_t cmd = 0; cmd < kCommandCount; ++cmd) {
+        if (super.command[cmd] != State::UNDEFINED) {
+          super.super_state->addTransition(generate_transition(
+            states[super.command[cmd]], TransitionType::COMMAND, static_cast<TransitionCmd>(cmd)));
+        }
+      }
+      if (super.error != State::UNDEFINED) {
+        super.super_state->addTransition(
+          generate_transition(states[super.error], TransitionType::ERROR));
+      }
+    }
 
-    auto completing_complete =
-        generate_transition(Complete, TransitionType::STATE_COMPLETED);
-    Completing->addTransition(completing_complete);
+    auto covered = [&shared](State from, auto target_of) {
+      for (const auto &super : shared) {
+        if (hasState(super.members, from) && target_of(super) != State::UNDEFINED) {
+          return true;
+        }
+      }
+      return false;
+    };
+
+    // Naming <from state>_<to state>: e.g. IDLE -START-> STARTING, EXECUTE -SC-> COMPLETING
+    for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+      auto from = static_cast<State>(ii);
+      PackmlState *from_state = states.get(from);
+      if (from_state == nullptr) {
+        continue;
+      }
+      for (std::size_t cmd = 0; cmd < kCommandCount; ++cmd) {
+        State to = table.command[ii][cmd];
+        if (to == State::UNDEFINED ||
+            covered(from, [cmd](const Shared &super) {return super.command[cmd];})) {
+          continue;
+        }
+        from_state->addTransition(
+          generate_transition(states[to], TransitionType::COMMAND, static_cast<TransitionCmd>(cmd)));
+      }
+      if (table.onComplete(from) != State::UNDEFINED) {
+        from_state->addTransition(
+          generate_transition(states[table.onComplete(from)], TransitionType::STATE_COMPLETED));
+      }
+      if (table.onError(from) != State::UNDEFINED &&
+          !covered(from, [](const Shared &super) {return super.error;})) {
+        from_state->addTransition(
+          generate_transition(states[table.onError(from)], TransitionType::ERROR));
+      }
+    }
 
-    auto complete_resetting =
-        generate_transition(Resetting, TransitionType::COMMAND);
-    Complete->addTransition(complete_resetting);
+    // Taken instead of the transitions above when the current mode loops the state
+    for (ActingState *acting : {Aborting, Clearing, Stopping, Resetting, Starting, Execute, Holding,
+                                Unholding, Suspending, Unsuspending, Completing}) {
+      auto loop = new StateCompleteTransition(); // NOLINT, this is how qt works
+      loop->setModeLoop(true);
+      loop->setTargetState(acting);
+      loop->setMode(&mode);
+      acting->addTransition(loop);
+    }
 
     // Set initial states of super states
     abortable->setInitialState(Clearing);
@@ -271,77 +260,22 @@ public:
 
     // Don't forget to set state machine initial state, currently set elsewhere
     // sm_internal_.setInitialState(Aborted);
-    printf("State machine formed\n");
   }
 
-  inline QAbstractTransition *generate_transition(PackmlState *transition_to,
-                                                  TransitionType trans_type) {
-    QAbstractTransition *transition;
+  inline QAbstractTransition *generate_transition(
+      PackmlState *transition_to, TransitionType trans_type,
+      TransitionCmd command = TransitionCmd::NO_COMMAND) {
+    PackmlTransition *transition;
     if (trans_type == TransitionType::ERROR) {
       transition = new ErrorTransition(); // NOLINT, this is how qt works
     } else if (trans_type == TransitionType::STATE_COMPLETED) {
       transition = new StateCompleteTransition(); // NOLINT, this is how qt works
-    } else if (trans_type == TransitionType::COMMAND) {
-      // TODO: pass transition command instead of checking target state
-      switch (transition_to->state()) {
-        case State::CLEARING: {
-          transition = CmdTransition::clear();
-          break;
-        }
-        case State::STARTING: {
-          transition = CmdTransition::start();
-          break;
-        }
-        case State::STOPPING: {
-          transition = CmdTransition::stop();
-          break;
-        }
-        case State::ABORTING: {
-          transition = CmdTransition::abort();
-          break;
-        }
-        case State::HOLDING: {
-          transition = CmdTransition::hold();
-          break;
-        }
-        case State::UNHOLDING: {
-          transition = CmdTransition::unhold();
-          break;
-        }
-        case State::SUSPENDING: {
-          transition = CmdTransition::suspend();
-          break;
-        }
-        case State::UNSUSPENDING: {
-          transition = CmdTransition::unsuspend();
-          break;
-        }
-        case State::RESETTING: {
-          transition = CmdTransition::reset();
-          break;
-        }
-        case State::UNDEFINED:
-        case State::STOPPED:
-        case State::IDLE:
-        case State::SUSPENDED:
-        case State::EXECUTE:
-        case State::ABORTED:
-        case State::HELD:
-        case State::COMPLETING:
-        case State::COMPLETE:
-        default: {
-            std::cout << "Fell through Transition switch, returning 'No Command' "
-                        "transition" << std::endl;
-            transition = new CmdTransition(TransitionCmd::NO_COMMAND, "No_Command"); // NOLINT, this is how qt works
-        }
-      }
     } else {
-      transition = new CmdTransition(TransitionCmd::NO_COMMAND, "No_Command"); // NOLINT, this is how qt works
-      // transition = CmdTransition(TransitionCmd::NO_COMMAND,
-      // QString(to_string(TransitionCmd::NO_COMMAND)));
+      transition = new CmdTransition(command, to_string(command).c_str()); // NOLINT, this is how qt works
     }
 
     transition->setTargetState(transition_to);
+    transition->setMode(&mode);
 
     return transition;
   }
@@ -352,26 +286,31 @@ public:
   }
 
   inline void add_state(std::shared_ptr<StateMachine> sm, PackmlState *state) {
-    if (states.find(state->name()) == states.end()) {
-      states[state->name()] = state;
-      std::cout << "Added state: " << state->name() << std::endl;
+    if (states.add(state->state(), state)) {
+      PACKML_LOG_DEBUG("Added state: {}", state->state());
 
-      // auto function = std::bind(StateMachine::setState )
-      // Hacky way to filter out superstates. This way we do not get events from super states.
-      if (state->state() != State::UNDEFINED) {
-        // Connect State Entered Event to Set State function
-        StateMachine::connect(state, &PackmlState::stateEntered, sm.get(),
-          &StateMachine::setState); // NOLINT(whitespace/comma)
-      }
-      // transition->setTargetState(state);
-      // previous_state->addTransition(transition);
+      // Connect State Entered Event to Set State function
+      StateMachine::connect(state, &PackmlState::stateEntered, sm.get(),
+        &StateMachine::setState); // NOLINT(whitespace/comma)
+    } else {
+      PACKML_LOG_DEBUG("{}: Already exists", state->state());
+    }
+  }
+
+  // Super states do not report their entry, they only hold the common transitions
+  inline void add_state(std::shared_ptr<StateMachine> /*sm*/, PackmlSuperState *state) {
+    if (states.add(state->superState(), state)) {
+      PACKML_LOG_DEBUG("Added state: {}", state->superState());
     } else {
-      std::cout << state->name() << ": Already exists" << std::endl;
+      PACKML_LOG_DEBUG("{}: Already exists", state->superState());
     }
   }
 
   // private:
-  std::map<std::string, PackmlState *> states;
+  /**
+  * @brief States of the machine indexed by State and SuperState, find() looks them up by name
+  */
+  StateRegistry<PackmlState> states;
 };
 
 } // namespace packml_sm
\ No newline at end of file
@@ -0,0 +1,316 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__TABLE_STATE_MACHINE_HPP_
+#define PACKML_SM__TABLE_STATE_MACHINE_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "packml_sm/acting_executor.hpp"
+#include "packml_sm/clock.hpp"
+#include "packml_sm/common.hpp"
+#include "packml_sm/journal.hpp"
+#include "packml_sm/machine_policy.hpp"
+#include "packml_sm/mode_graph.hpp"
+#include "packml_sm/mode_registry.hpp"
+#include "packml_sm/snapshot.hpp"
+#include "packml_sm/state_machine_interface.hpp"
+#include "packml_sm/timer_wheel.hpp"
+#include "packml_sm/transition_stats.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief State machine backend that dispatches commands through a flat TransitionTable instead of
+* QStateMachine transition selection.
+*
+* Commands are evaluated on the calling thread with a table lookup and a mask test, so no Qt event
+* loop is needed. Acting state operations run on the lanes of an ActingExecutor and report back
+* through complete(); leaving a state signals the stop token of its operation and a completion that
+* arrives after its state has been left is discarded.
+*/
+class TableStateMachine : public StateMachineInterface
+{
+public:
+  /**
+  * @brief Function to create a single cycle state machine (executes once)
+  */
+  static std::shared_ptr<TableStateMachine> singleCycleSM();
+
+
+  /**
+  * @brief Function to create a continuous cycle state machine (executes forever until stopped)
+  */
+  static std::shared_ptr<TableStateMachine> continuousCycleSM();
+
+
+  /**
+  * @brief Function to create the state machine a policy describes, with its default operations
+  */
+  template<MachinePolicy Policy>
+  static std::shared_ptr<TableStateMachine> create()
+  {
+    auto sm = std::make_shared<TableStateMachine>(Policy::kTable);
+    applyOperationDelays<Policy>(*sm);
+    return sm;
+  }
+
+
+  /**
+  * @brief Class constructor
+  * @param table - transition table that defines the state graph
+  */
+  explicit TableStateMachine(const TransitionTable & table = kSingleCycleTable);
+
+
+  /**
+  * @brief Class destructor, waits for running state operations to return
+  */
+  virtual ~TableStateMachine();
+
+  TableStateMachine(const TableStateMachine &) = delete;
+  TableStateMachine & operator=(const TableStateMachine &) = delete;
+
+  bool activate() override;
+
+  bool deactivate();
+
+  bool setExecute(std::function<int()> execute_method) override;
+
+  bool setResetting(std::function<int()> resetting_method) override;
+
+
+  /**
+  * @brief Function to bind a function to any acting state
+  * @param state - acting state to bind to
+  * @param method - function returning 0 on success or an error code
+  */
+  bool setOperationMethod(State state, std::function<int()> method);
+
+  bool setCancellableOperation(State state, CancellableOperation method) override;
+
+
+  /**
+  * @brief Function to run bound operations on another executor than ActingExecutor::global()
+  */
+  void setExecutor(std::shared_ptr<ActingExecutor> executor);
+
+
+  /**
+  * @brief Function to set the duration of an acting state without bound function
+  * @param state - acting state
+  * @param delay - time the state takes to complete, milliseconds::max() makes it wait for
+  * completeState()
+  */
+  bool setOperationDelay(State state, std::chrono::milliseconds delay);
+
+  bool setWatchdog(State state, std::chrono::milliseconds timeout) override;
+
+  /**
+  * @brief Function to complete the current acting state from outside its operation, as a replayed
+  * journal does
+  * @param error_code - 0 to complete, error code to fail the state
+  * @return false if the machine is not active or not in an acting state
+  */
+  bool completeState(int error_code);
+
+
+  bool setModeRegistry(std::shared_ptr<const ModeRegistry> registry) override;
+
+  std::shared_ptr<const ModeGraphs> getModeGraphs() override;
+
+  CommandMask getAllowedCommands() override;
+
+  bool isActive() override {return active_.load(std::memory_order_acquire);}
+
+  State getCurrentState() override {return state_value_.load(std::memory_order_acquire);}
+
+  StateTimes getStateTimes() override;
+
+  bool setClock(std::shared_ptr<Clock> clock) override;
+
+  bool setSnapshotFile(std::shared_ptr<SnapshotFile> file, RestartPolicy policy) override;
+
+  bool setJournal(std::shared_ptr<JournalWriter> journal) override;
+
+  LatencyStats getAbortLatency() override;
+
+  std::vector<TransitionStats> getTransitionStats() override;
+
+  std::expected<bool, std::string> changeMode(ModeType mode) override;
+
+  std::expected<bool, std::string> changeState(TransitionCmd command) override;
+
+  StateChangeResult changeStateAsync(TransitionCmd command) override;
+
+
+  /**
+  * @brief Function that returns the mask of the states available in the current mode
+  */
+  StateMask getAvailableStates() const {return available_.load(std::memory_order_acquire);}
+
+  /**
+  * @brief Called for every state entered, in order and never concurrently, after the state machine
+  * lock is released. It may call back into the state machine. It runs on a thread that caused a
+  * transition and delays that thread, slow work belongs on a subscription of stateChanges().
+  */
+  std::function<void(State value)> on_state_changed = [](State /*value*/) {};
+
+  std::function<void(ModeType value)> on_mode_changed = [](ModeType /*value*/) {};
+
+protected:
+  bool _start() override {return dispatch(TransitionCmd::START);}
+  bool _clear() override {return dispatch(TransitionCmd::CLEAR);}
+  bool _reset() override {return dispatch(TransitionCmd::RESET);}
+  bool _hold() override {return dispatch(TransitionCmd::HOLD);}
+  bool _unhold() override {return dispatch(TransitionCmd::UNHOLD);}
+  bool _suspend() override {return dispatch(TransitionCmd::SUSPEND);}
+  bool _unsuspend() override {return dispatch(TransitionCmd::UNSUSPEND);}
+  bool _stop() override {return dispatch(TransitionCmd::STOP);}
+  bool _abort() override {return dispatch(TransitionCmd::ABORT);}
+
+
+  /**
+  * @brief Same as transit(), reports whether the command was accepted in the current state and mode
+  */
+  bool dispatch(TransitionCmd command) {return transit(command) != State::UNDEFINED;}
+
+
+  /**
+  * @brief Function that looks up and takes the transition for a command
+  * @return the state entered, State::UNDEFINED if the command was rejected
+  */
+  State transit(TransitionCmd command);
+
+
+  /**
+  * @brief Function called when the operation of an acting state returns
+  * @param generation - entry count of the state the operation was started for
+  * @param error_code - 0 on success, error code otherwise
+  */
+  void complete(std::uint64_t generation, int error_code);
+
+private:
+  struct Operation
+  {
+    CancellableOperation method;
+    std::chrono::milliseconds delay{200};
+  };
+
+  void enter(State state);
+
+  void deliverEntries();
+
+  // Runs deliverEntries() on destruction, declared before the lock of mutex_ it outlives
+  struct EntryDelivery
+  {
+    explicit EntryDelivery(TableStateMachine & sm)
+    : sm(sm) {}
+    ~EntryDelivery() {sm.deliverEntries();}
+    TableStateMachine & sm;
+  };
+
+  State restore(const MachineSnapshot & saved);
+
+  void saveSnapshot(Clock::TimePoint now);
+
+  void record(const JournalRecord & record)
+  {
+    if (journal_) {
+      journal_->append(record);
+    }
+  }
+
+  std::chrono::nanoseconds journalTime() const {return clock_->now().time_since_epoch();}
+
+  void cancelTimer();
+
+  bool isCurrent(std::uint64_t generation);
+
+  void finished();
+
+  const TransitionTable table_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  std::atomic<bool> active_{false};
+  std::atomic<State> state_value_{State::UNDEFINED};
+  std::atomic<StateMask> available_{kAllStates};
+
+  std::shared_ptr<const ModeGraphs> mode_graphs_;
+
+  // Graph of the current mode in mode_graphs_, its definition is nullptr until a mode is set
+  const ModeGraph * graph_;
+
+  std::uint64_t generation_{0};
+  std::size_t running_operations_{0};
+
+  TimerWheel::TimerId timer_{TimerWheel::kNoTimer};
+  TimerWheel::TimerId watchdog_timer_{TimerWheel::kNoTimer};
+
+  std::array<std::chrono::milliseconds, kStateCount> watchdogs_{};
+
+  std::array<Operation, kStateCount> operations_{};
+
+  std::shared_ptr<Clock> clock_;
+
+  std::shared_ptr<ActingExecutor> executor_;
+
+  // Signalled when the state of the running operation is left. Replacing it allocates, so that is
+  // only done once an operation was given its token or it was signalled.
+  std::stop_source stop_;
+  bool stop_shared_ = false;
+
+  std::optional<Clock::TimePoint> abort_selected_;
+  LatencyStats abort_latency_;
+
+  // Written with mutex_ locked, read without it
+  TransitionStatsTable transition_stats_;
+
+  StateTimeAccounting state_times_;
+
+  std::shared_ptr<SnapshotFile> snapshot_file_;
+  RestartPolicy restart_policy_{RestartPolicy::COLD};
+  // Only the first activation after setSnapshotFile() restores
+  bool restore_pending_{false};
+
+  std::shared_ptr<JournalWriter> journal_;
+
+  // States entered but not yet passed to on_state_changed, see deliverEntries()
+  std::vector<State> pending_entries_;
+  std::vector<State> delivered_entries_;
+  bool delivering_{false};
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__TABLE_STATE_MACHINE_HPP_
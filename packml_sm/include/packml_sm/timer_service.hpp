@@ -0,0 +1,89 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__TIMER_SERVICE_HPP_
+#define PACKML_SM__TIMER_SERVICE_HPP_
+
+#include <chrono>
+#include <optional>
+
+#include <QTimer>
+
+#include "packml_sm/timer_wheel.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief TimerWheel driven by the Qt event loop of the calling thread.
+*
+* All state machines living on a thread share one wheel and one single shot QTimer that is armed for
+* the next wakeup of the wheel, so pending state timers and watchdogs hold no thread. Callbacks run
+* on that thread from its event loop.
+*/
+class TimerService
+{
+public:
+  using Clock = TimerWheel::Clock;
+
+
+  /**
+  * @brief Returns the service of the calling thread, which must run a Qt event loop
+  */
+  static TimerService & forCurrentThread();
+
+
+  /**
+  * @brief Returns true once the service of the calling thread was destroyed at thread exit. State
+  * machines destroyed after that, e.g. during static destruction, must not stop their timers.
+  */
+  static bool destroyedForCurrentThread();
+
+  ~TimerService();
+
+  TimerService(const TimerService &) = delete;
+  TimerService & operator=(const TimerService &) = delete;
+
+
+  /**
+  * @brief Function to run a callback after a delay, must be called from the owning thread
+  */
+  TimerWheel::TimerId start(std::chrono::nanoseconds delay, TimerWheel::Callback callback);
+
+
+  /**
+  * @brief Function to stop a timer, must be called from the owning thread
+  * @return false if the timer already fired or was stopped
+  */
+  bool cancel(TimerWheel::TimerId id);
+
+  std::size_t pending() const {return wheel_.size();}
+
+private:
+  TimerService();
+
+  void rearm();
+
+  void onTimeout();
+
+  TimerWheel wheel_;
+  QTimer timer_;
+  std::optional<Clock::time_point> armed_;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__TIMER_SERVICE_HPP_
@@ -0,0 +1,153 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__TIMER_WHEEL_HPP_
+#define PACKML_SM__TIMER_WHEEL_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace packml_sm
+{
+
+/**
+* @brief Hierarchical timing wheel.
+*
+* Four levels of 64 slots cover 2^24 ticks (about 4.6 hours at the default 1 ms tick), later
+* deadlines are parked in the last level and re-cascaded. Scheduling and cancelling are O(1) and
+* reuse the nodes of fired timers, so a pending timer costs one node and no thread. Deadlines are
+* rounded up to the next tick, a timer never fires early.
+*
+* The wheel is not thread safe, it is advanced by its owner (an event loop or a timer thread).
+*/
+class TimerWheel
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using Callback = std::function<void()>;
+
+  /**
+  * @brief Handle of a scheduled timer, 0 is never returned by schedule()
+  */
+  using TimerId = std::uint64_t;
+
+  static constexpr TimerId kNoTimer = 0;
+
+  explicit TimerWheel(
+    std::chrono::nanoseconds tick = std::chrono::milliseconds(1),
+    Clock::time_point origin = Clock::now());
+
+
+  /**
+  * @brief Function to schedule a callback, a deadline in the past fires on the next tick
+  * @param deadline - time the callback is due
+  * @param callback - called from advance(), may schedule and cancel timers
+  */
+  TimerId schedule(Clock::time_point deadline, Callback callback);
+
+
+  /**
+  * @brief Function to remove a timer that has not fired yet
+  * @return true if the timer was removed, false if it already fired or was cancelled
+  */
+  bool cancel(TimerId id);
+
+
+  /**
+  * @brief Function to run the callbacks of all timers due at now
+  * @return number of callbacks run
+  */
+  std::size_t advance(Clock::time_point now);
+
+
+  /**
+  * @brief Same as advance() but moves the due callbacks into due instead of running them, for
+  * owners that must run them without holding their lock
+  * @return number of callbacks added
+  */
+  std::size_t collect(Clock::time_point now, std::vector<Callback> & due);
+
+
+  /**
+  * @brief Function that returns when advance() has to be called next, either the deadline of the
+  * next timer or the time timers of a higher level have to be cascaded; nullopt if no timer is
+  * pending
+  */
+  std::optional<Clock::time_point> nextWakeup() const;
+
+  std::size_t size() const {return size_;}
+
+  bool empty() const {return size_ == 0;}
+
+private:
+  static constexpr unsigned kLevels = 4;
+  static constexpr unsigned kSlotBits = 6;
+  static constexpr unsigned kSlots = 1u << kSlotBits;
+  static constexpr std::uint64_t kSlotMask = kSlots - 1;
+  static constexpr std::uint32_t kNil = std::numeric_limits<std::uint32_t>::max();
+
+  struct Node
+  {
+    std::uint64_t expiry = 0;
+    Callback callback;
+    std::uint32_t prev = kNil;
+    std::uint32_t next = kNil;
+    std::uint32_t generation = 0;
+    std::uint8_t level = 0;
+    std::uint8_t slot = 0;
+    bool linked = false;
+  };
+
+  static constexpr unsigned shift(unsigned level) {return level * kSlotBits;}
+
+  std::uint64_t ceilTick(Clock::time_point time) const;
+
+  std::uint64_t floorTick(Clock::time_point time) const;
+
+  Clock::time_point timeOf(std::uint64_t tick) const {return origin_ + tick_ * tick;}
+
+  void insert(std::uint32_t index);
+
+  void unlink(std::uint32_t index);
+
+  void cascade(unsigned level);
+
+  // Removes the timers of the current tick one by one and hands their callbacks to sink
+  template<typename Sink>
+  std::size_t fire(Sink && sink);
+
+  template<typename Sink>
+  std::size_t step(Clock::time_point now, Sink && sink);
+
+  const std::chrono::nanoseconds tick_;
+  const Clock::time_point origin_;
+  std::uint64_t now_tick_;
+
+  std::vector<Node> nodes_;
+  std::vector<std::uint32_t> free_;
+  std::array<std::array<std::uint32_t, kSlots>, kLevels> heads_;
+  std::array<std::size_t, kLevels> level_size_{};
+  std::size_t size_{0};
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__TIMER_WHEEL_HPP_
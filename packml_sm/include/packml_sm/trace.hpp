@@ -0,0 +1,269 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__TRACE_HPP_
+#define PACKML_SM__TRACE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <string>
+#include <string_view>
+
+#include "packml_sm/common.hpp"
+
+/**
+* @brief 0 compiles every trace point out, otherwise they are filtered with one relaxed atomic load
+*/
+#ifndef PACKML_SM_TRACING
+#define PACKML_SM_TRACING 1
+#endif
+
+namespace packml_sm
+{
+
+/**
+* @brief Trace of state spans, command flows and operation run times in the Chrome trace event
+* format, which chrome://tracing and the Perfetto UI load.
+*
+* Like the logger, a trace point copies a fixed size event into a ring buffer owned by the calling
+* thread and a writer thread turns the events into JSON. While no trace is started a trace point
+* only loads one atomic flag.
+*
+* Spans that start and end on different threads are matched by an id: the states of a machine share
+* the id of the machine, each submitted command has its own.
+*/
+namespace tracing
+{
+
+constexpr bool kCompiledIn = PACKML_SM_TRACING != 0;
+
+
+/**
+* @brief Name of a trace event: a string literal, an enum formatted by the writer thread, or text
+* copied into the event (at most 47 characters)
+*/
+class Name
+{
+public:
+  template<std::size_t N>
+  Name(const char (&literal)[N])  // NOLINT(runtime/explicit)
+  : literal_(literal) {}
+
+  Name(State state)  // NOLINT(runtime/explicit)
+  : format_(&formatEnum<State>), value_(static_cast<std::int64_t>(state)) {}
+
+  Name(TransitionCmd command)  // NOLINT(runtime/explicit)
+  : format_(&formatEnum<TransitionCmd>), value_(static_cast<std::int64_t>(command)) {}
+
+  Name(ModeType mode)  // NOLINT(runtime/explicit)
+  : format_(&formatEnum<ModeType>), value_(static_cast<std::int64_t>(mode)) {}
+
+  static Name copy(std::string_view text)
+  {
+    Name name;
+    name.text_ = text;
+    return name;
+  }
+
+  using FormatFn = std::string (*)(std::int64_t value);
+
+private:
+  Name() = default;
+
+  template<typename E>
+  static std::string formatEnum(std::int64_t value)
+  {
+    return to_string(static_cast<E>(value));
+  }
+
+  friend struct Event;
+
+  const char * literal_ = nullptr;
+  FormatFn format_ = nullptr;
+  std::int64_t value_ = 0;
+  std::string_view text_;
+};
+
+
+/**
+* @brief Event as stored in the ring of the thread that traced it
+*/
+struct Event
+{
+  static constexpr std::size_t kTextSize = 48;
+
+  std::int64_t stamp_ns;
+  std::int64_t duration_ns;
+  std::uint64_t id;
+  const char * category;
+  const char * literal;
+  Name::FormatFn format;
+  std::int64_t value;
+  const char * arg_name;
+  std::int64_t arg_value;
+  std::uint32_t session;
+  char phase;
+  char text[kTextSize];
+
+  void setName(const Name & name)
+  {
+    literal = name.literal_;
+    format = name.format_;
+    value = name.value_;
+    auto length = std::min(name.text_.size(), kTextSize - 1);
+    if (length > 0) {
+      std::memcpy(text, name.text_.data(), length);
+    }
+    text[length] = '\0';
+  }
+};
+
+
+/**
+* @brief Function to start writing a trace, replaces a trace that is running
+* @param path - file the JSON trace is written to, it is overwritten
+*/
+std::expected<bool, std::string> start(const std::string & path);
+
+
+/**
+* @brief Function to write the remaining events and close the trace
+*/
+void stop();
+
+
+/**
+* @brief Function that returns the number of events dropped because a ring buffer was full
+*/
+std::uint64_t dropped();
+
+namespace detail
+{
+
+extern std::atomic<bool> g_enabled;
+
+
+/**
+* @brief Copies an event into the ring of the calling thread, drops it if the ring is full
+*/
+void record(
+  char phase, const char * category, const Name & name, std::uint64_t id, std::int64_t stamp_ns,
+  std::int64_t duration_ns, const char * arg_name, std::int64_t arg_value);
+
+}  // namespace detail
+
+inline bool enabled()
+{
+  if constexpr (!kCompiledIn) {
+    return false;
+  }
+  return detail::g_enabled.load(std::memory_order_relaxed);
+}
+
+
+/**
+* @brief Time stamp of the trace clock, in nanoseconds
+*/
+inline std::int64_t now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+* @brief Function to open a span on the track id, e.g. the state a machine entered. Spans of a
+* track may start and end on different threads.
+*/
+inline void begin(const char * category, const Name & name, std::uint64_t id)
+{
+  if (enabled()) {
+    detail::record('b', category, name, id, now(), 0, nullptr, 0);
+  }
+}
+
+
+/**
+* @brief Function to close the last span begin() opened on the track id
+* @param arg_name - optional string literal, shown with arg_value as argument of the span
+*/
+inline void end(
+  const char * category, const Name & name, std::uint64_t id, const char * arg_name = nullptr,
+  std::int64_t arg_value = 0)
+{
+  if (enabled()) {
+    detail::record('e', category, name, id, now(), 0, arg_name, arg_value);
+  }
+}
+
+
+/**
+* @brief Function to trace a span of the calling thread that started at start_ns
+*/
+inline void complete(
+  const char * category, const Name & name, std::int64_t start_ns, const char * arg_name = nullptr,
+  std::int64_t arg_value = 0)
+{
+  if (enabled()) {
+    detail::record('X', category, name, 0, start_ns, now() - start_ns, arg_name, arg_value);
+  }
+}
+
+
+/**
+* @brief Span of the calling thread from construction to destruction, e.g. an operation run. A name
+* copied from text must outlive the scope.
+*/
+class Scope
+{
+public:
+  Scope(const char * category, const Name & name)
+  : category_(category), name_(name), start_(enabled() ? now() : -1) {}
+
+  Scope(const Scope &) = delete;
+  Scope & operator=(const Scope &) = delete;
+
+  ~Scope()
+  {
+    // A trace started during the span has no start for it
+    if (start_ >= 0) {
+      complete(category_, name_, start_);
+    }
+  }
+
+private:
+  const char * category_;
+  Name name_;
+  std::int64_t start_;
+};
+
+
+/**
+* @brief Function that returns the track id of an object, e.g. of a state machine
+*/
+inline std::uint64_t trackOf(const void * object)
+{
+  return static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(object));
+}
+
+}  // namespace tracing
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__TRACE_HPP_
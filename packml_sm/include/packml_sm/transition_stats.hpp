@@ -0,0 +1,172 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__TRANSITION_STATS_HPP_
+#define PACKML_SM__TRANSITION_STATS_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "packml_sm/common.hpp"
+#include "packml_sm/latency_histogram.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief What a transition is taken for: a command, or the result of the operation of an acting
+* state
+*/
+enum class Trigger : std::uint8_t
+{
+  COMMAND   = 0,
+  COMPLETED = 1,
+  FAILED    = 2
+};
+
+inline std::string to_string(Trigger trigger)
+{
+  switch (trigger) {
+    case Trigger::COMMAND:   return "COMMAND";
+    case Trigger::COMPLETED: return "COMPLETED";
+    case Trigger::FAILED:    return "FAILED";
+  }
+  return std::to_string(static_cast<int>(trigger));
+}
+
+
+/**
+* @brief Counters of one transition: the state it leaves, what triggered it and the state it
+* enters. A trigger taken into different states, e.g. the completion of EXECUTE in a mode that loops
+* it, has one entry per target. A rejected command has no target state, it is counted with to set to
+* State::UNDEFINED unless only the mode disables its target.
+*/
+struct TransitionStats
+{
+  State from = State::UNDEFINED;
+  Trigger trigger = Trigger::COMMAND;
+  TransitionCmd command = TransitionCmd::NO_COMMAND;
+  State to = State::UNDEFINED;
+
+  std::uint64_t accepted = 0;
+  std::uint64_t rejected_by_mode = 0;
+  std::uint64_t rejected_by_state = 0;
+
+
+  /**
+  * @brief Latency of the accepted transitions, from the submission of the command (or the
+  * operation result) to the entry of the target state, on the steady clock
+  */
+  LatencyHistogram latency;
+};
+
+
+/**
+* @brief Per transition counters and latency histograms of a state machine.
+*
+* The recording functions are lock-free and meant for the one thread that takes the transitions
+* (the state machine thread, or the caller holding the lock of the machine); snapshot() may be
+* called from any thread. Each counter is read atomically, but a snapshot taken while a transition
+* is recorded may include some of its counters and not others.
+*/
+class TransitionStatsTable
+{
+public:
+  TransitionStatsTable();
+
+  ~TransitionStatsTable();
+
+  TransitionStatsTable(const TransitionStatsTable &) = delete;
+  TransitionStatsTable & operator=(const TransitionStatsTable &) = delete;
+
+
+  /**
+  * @brief Function to count a transition that was taken
+  * @param latency - time from the submission of the trigger to the entry of state to
+  */
+  void accepted(
+    State from, Trigger trigger, TransitionCmd command, State to, std::chrono::nanoseconds latency);
+
+
+  /**
+  * @brief Function to count a trigger the state graph allows but the current mode does not
+  * @param to - state the transition would have entered
+  */
+  void rejectedByMode(State from, Trigger trigger, TransitionCmd command, State to);
+
+
+  /**
+  * @brief Function to count a trigger the state graph has no transition for
+  */
+  void rejectedByState(State from, Trigger trigger, TransitionCmd command);
+
+
+  /**
+  * @brief Function to count a trigger the current mode graph rejected, classified by the
+  * transition table the mode graphs were compiled from
+  */
+  void rejected(const TransitionTable & table, State from, Trigger trigger, TransitionCmd command);
+
+
+  /**
+  * @brief Function that returns the counters of every transition that was recorded at least once
+  */
+  std::vector<TransitionStats> snapshot() const;
+
+private:
+  static constexpr std::size_t kTriggerCount = kCommandCount + 2;
+
+  struct Target
+  {
+    std::atomic<std::uint64_t> accepted{0};
+    std::atomic<std::uint64_t> rejected_by_mode{0};
+    // Allocated on the first accepted transition, most targets are never taken
+    std::atomic<AtomicLatencyHistogram *> latency{nullptr};
+  };
+
+  struct Cell
+  {
+    std::atomic<std::uint64_t> rejected_by_state{0};
+    // kStateCount entries indexed by the target state, allocated on the first transition with a
+    // target
+    std::atomic<Target *> targets{nullptr};
+  };
+
+  static std::size_t triggerIndex(Trigger trigger, TransitionCmd command)
+  {
+    return trigger == Trigger::COMMAND ? toIndex(command) :
+           kCommandCount + static_cast<std::size_t>(trigger) - 1;
+  }
+
+  Cell & cell(State from, Trigger trigger, TransitionCmd command)
+  {
+    return cells_[toIndex(from) * kTriggerCount + triggerIndex(trigger, command)];
+  }
+
+  Target & target(State from, Trigger trigger, TransitionCmd command, State to);
+
+  std::unique_ptr<Cell[]> cells_;
+};
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__TRANSITION_STATS_HPP_
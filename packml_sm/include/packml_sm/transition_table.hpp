@@ -0,0 +1,251 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PACKML_SM__TRANSITION_TABLE_HPP_
+#define PACKML_SM__TRANSITION_TABLE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "packml_sm/common.hpp"
+
+namespace packml_sm
+{
+
+/**
+* @brief Number of entries in the State enum (UNDEFINED up to and including COMPLETE)
+*/
+constexpr std::size_t kStateCount = static_cast<std::size_t>(State::COMPLETE) + 1;
+
+/**
+* @brief Number of entries in the TransitionCmd enum (NO_COMMAND up to and including CLEAR)
+*/
+constexpr std::size_t kCommandCount = static_cast<std::size_t>(TransitionCmd::CLEAR) + 1;
+
+/**
+* @brief One bit per State, bit n corresponds to the state with value n
+*/
+using StateMask = std::uint32_t;
+
+static_assert(kStateCount <= sizeof(StateMask) * 8, "StateMask too small for State enum");
+
+/**
+* @brief One bit per TransitionCmd, bit n corresponds to the command with value n
+*/
+using CommandMask = std::uint16_t;
+
+static_assert(kCommandCount <= sizeof(CommandMask) * 8, "CommandMask too small for TransitionCmd enum");
+
+constexpr std::size_t toIndex(State state)
+{
+  return static_cast<std::size_t>(state);
+}
+
+constexpr std::size_t toIndex(TransitionCmd command)
+{
+  return static_cast<std::size_t>(command);
+}
+
+constexpr StateMask stateBit(State state)
+{
+  return StateMask{1} << toIndex(state);
+}
+
+constexpr bool hasState(StateMask mask, State state)
+{
+  return (mask & stateBit(state)) != 0;
+}
+
+constexpr CommandMask commandBit(TransitionCmd command)
+{
+  return static_cast<CommandMask>(CommandMask{1} << toIndex(command));
+}
+
+constexpr bool hasCommand(CommandMask mask, TransitionCmd command)
+{
+  return (mask & commandBit(command)) != 0;
+}
+
+/**
+* @brief All PackML states (UNDEFINED excluded)
+*/
+constexpr StateMask kAllStates = ((StateMask{1} << kStateCount) - 1) & ~stateBit(State::UNDEFINED);
+
+/**
+* @brief States that are contained in the ABORTABLE super state
+*/
+constexpr StateMask kAbortableStates =
+  kAllStates & ~stateBit(State::ABORTING) & ~stateBit(State::ABORTED);
+
+/**
+* @brief States that are contained in the STOPPABLE super state
+*/
+constexpr StateMask kStoppableStates =
+  kAbortableStates & ~stateBit(State::CLEARING) & ~stateBit(State::STOPPING) & ~stateBit(State::STOPPED);
+
+/**
+* @brief States that wait for a command, all other states run an operation and complete by themselves
+*/
+constexpr StateMask kWaitStates =
+  stateBit(State::STOPPED) | stateBit(State::IDLE) | stateBit(State::HELD) |
+  stateBit(State::SUSPENDED) | stateBit(State::COMPLETE) | stateBit(State::ABORTED);
+
+constexpr StateMask kActingStates = kAllStates & ~kWaitStates;
+
+constexpr bool isWaitState(State state)
+{
+  return hasState(kWaitStates, state);
+}
+
+constexpr bool isActingState(State state)
+{
+  return hasState(kActingStates, state);
+}
+
+/**
+* @brief Flat representation of the PackML state graph.
+*
+* command[from][cmd] is the state entered when cmd is accepted in from, complete[from] is the state
+* entered when the operation of from finishes and error[from] the state entered when it fails.
+* State::UNDEFINED marks the absence of a transition.
+*/
+struct TransitionTable
+{
+  std::array<std::array<State, kCommandCount>, kStateCount> command{};
+  std::array<State, kStateCount> complete{};
+  std::array<State, kStateCount> error{};
+
+  constexpr State onCommand(State from, TransitionCmd cmd) const
+  {
+    return command[toIndex(from)][toIndex(cmd)];
+  }
+
+  constexpr State onComplete(State from) const
+  {
+    return complete[toIndex(from)];
+  }
+
+  constexpr State onError(State from) const
+  {
+    return error[toIndex(from)];
+  }
+
+  constexpr bool operator==(const TransitionTable &) const = default;
+};
+
+/**
+* @brief Builds the transition table of the standard PackML state machine
+* @param self_loops - acting states that re-enter themselves on completion instead of following the
+* default completion transition (e.g. EXECUTE for a continuous cycle machine)
+* @param available - states the machine has, transitions from or into the other states are left out
+*/
+constexpr TransitionTable makeTransitionTable(StateMask self_loops = 0, StateMask available = kAllStates)
+{
+  TransitionTable table;
+  for (auto & row : table.command) {
+    row.fill(State::UNDEFINED);
+  }
+  table.complete.fill(State::UNDEFINED);
+  table.error.fill(State::UNDEFINED);
+
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    auto state = static_cast<State>(ii);
+    // Super state transitions; the abortable super state also catches errors
+    if (hasState(kAbortableStates, state)) {
+      table.command[ii][toIndex(TransitionCmd::ABORT)] = State::ABORTING;
+      table.error[ii] = State::ABORTING;
+    }
+    if (hasState(kStoppableStates, state)) {
+      table.command[ii][toIndex(TransitionCmd::STOP)] = State::STOPPING;
+    }
+  }
+
+  auto cmd = [&table](State from, TransitionCmd command, State to) {
+      table.command[toIndex(from)][toIndex(command)] = to;
+    };
+  cmd(State::ABORTED, TransitionCmd::CLEAR, State::CLEARING);
+  cmd(State::STOPPED, TransitionCmd::RESET, State::RESETTING);
+  cmd(State::IDLE, TransitionCmd::START, State::STARTING);
+  cmd(State::EXECUTE, TransitionCmd::HOLD, State::HOLDING);
+  cmd(State::HELD, TransitionCmd::UNHOLD, State::UNHOLDING);
+  cmd(State::EXECUTE, TransitionCmd::SUSPEND, State::SUSPENDING);
+  cmd(State::SUSPENDED, TransitionCmd::UNSUSPEND, State::UNSUSPENDING);
+  cmd(State::COMPLETE, TransitionCmd::RESET, State::RESETTING);
+
+  auto sc = [&table](State from, State to) {table.complete[toIndex(from)] = to;};
+  sc(State::ABORTING, State::ABORTED);
+  sc(State::CLEARING, State::STOPPED);
+  sc(State::STOPPING, State::STOPPED);
+  sc(State::RESETTING, State::IDLE);
+  sc(State::STARTING, State::EXECUTE);
+  sc(State::EXECUTE, State::COMPLETING);
+  sc(State::HOLDING, State::HELD);
+  sc(State::UNHOLDING, State::EXECUTE);
+  sc(State::SUSPENDING, State::SUSPENDED);
+  sc(State::UNSUSPENDING, State::EXECUTE);
+  sc(State::COMPLETING, State::COMPLETE);
+
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    auto state = static_cast<State>(ii);
+    if (hasState(self_loops, state) && isActingState(state)) {
+      table.complete[ii] = state;
+    }
+  }
+
+  auto keep = [available](State & to) {
+      if (to != State::UNDEFINED && !hasState(available, to)) {
+        to = State::UNDEFINED;
+      }
+    };
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    if (!hasState(available, static_cast<State>(ii))) {
+      table.command[ii].fill(State::UNDEFINED);
+      table.complete[ii] = State::UNDEFINED;
+      table.error[ii] = State::UNDEFINED;
+    }
+    for (auto & to : table.command[ii]) {
+      keep(to);
+    }
+    keep(table.complete[ii]);
+    keep(table.error[ii]);
+  }
+  return table;
+}
+
+constexpr TransitionTable kSingleCycleTable = makeTransitionTable();
+constexpr TransitionTable kContinuousCycleTable = makeTransitionTable(stateBit(State::EXECUTE));
+
+static_assert(kSingleCycleTable.onCommand(State::IDLE, TransitionCmd::START) == State::STARTING);
+static_assert(kSingleCycleTable.onCommand(State::ABORTED, TransitionCmd::ABORT) == State::UNDEFINED);
+static_assert(kSingleCycleTable.onComplete(State::EXECUTE) == State::COMPLETING);
+static_assert(kContinuousCycleTable.onComplete(State::EXECUTE) == State::EXECUTE);
+
+/**
+* @brief Default availability of the built-in modes, MAINTENANCE runs without the COMPLETING state
+*/
+constexpr StateMask defaultAvailableStates(ModeType mode)
+{
+  if (mode == ModeType::MAINTENANCE) {
+    return kAllStates & ~stateBit(State::COMPLETING);
+  }
+  return kAllStates;
+}
+
+}  // namespace packml_sm
+
+#endif  // PACKML_SM__TRANSITION_TABLE_HPP_
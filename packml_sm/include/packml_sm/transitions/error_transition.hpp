@@ -60,7 +60,7 @@ protected:
   * @brief Function to trigger an action when the transition is happening
   * @param e - triggering event
   */
-  virtual void onTransition(QEvent * e) {std::cout << e << std::endl;}
+  virtual void onTransition(QEvent * e) {PACKML_LOG_DEBUG("Taking transition for event type: {}", e->type());}
 };
 
 }  // namespace packml_sm
\ No newline at end of file
@@ -15,13 +15,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <iostream>
 #include <memory>
 
 #include "QEvent"
 #include "QAbstractTransition"
-// #include "packml_sm/common.hpp"
-// #include "packml_sm/states/state.hpp"
+#include "packml_sm/log.hpp"
+#include "packml_sm/states/state.hpp"
+#include "packml_sm/mode_registry.hpp"
 // #include "packml_sm/states_generator.hpp"
 
 namespace packml_sm
@@ -38,44 +40,54 @@ public:
   */
   PackmlTransition() {}
 
-//   std::shared_ptr<std::vector<StatesGenerator::Mode>> modes;
-//   std::string current_mode = "";
-
   /**
   * @brief Destructor of the class
   */
   virtual ~PackmlTransition() {}
 
+
+  /**
+  * @brief Function to bind the transition to the current mode of the state machine
+  * @param mode - current mode owned by the state machine, nullptr makes every target available
+  */
+  void setMode(const std::atomic<const ModeDefinition *> * mode) {mode_ = mode;}
+
 protected:
+  /**
+  * @brief Function that returns the current mode, nullptr if no mode is set
+  */
+  const ModeDefinition * mode() const
+  {
+    return mode_ == nullptr ? nullptr : mode_->load(std::memory_order_acquire);
+  }
+
+
   /**
   * @brief Function to check if the transition is valid
   * @param e - triggering event
   */
   virtual bool eventTest(QEvent * e)
   {
-    // for (auto && item : *modes.get()) {
-    //     if (item.name == current_mode) {
-            auto statetarget = targetState();
-            if (statetarget->property("Available").toBool())
-            {
-                std::cout << "Transition is available!" << std::endl;
-                return true;
-            }
-            else {
-                std::cout << "Transition to next state: is not available in this mode!" << std::endl;
-                e->ignore();
-                return false;
-            }
-    //     }
-    // }
-    // std::cout << "unkown mode: " << item.name <<
+    auto statetarget = static_cast<PackmlState *>(targetState());
+    auto current = mode();
+    if (current == nullptr || current->isAvailable(statetarget->state()))
+    {
+      PACKML_LOG_DEBUG("Transition is available!");
+      return true;
+    }
+    PACKML_LOG_DEBUG("Transition to next state: {} is not available in this mode!", statetarget->state());
+    e->ignore();
+    return false;
   };
 
   /**
   * @brief Function to trigger an action when the transition is happening
   * @param e - triggering event
   */
-  virtual void onTransition(QEvent * e) {std::cout << e << std::endl;}
+  virtual void onTransition(QEvent * e) {PACKML_LOG_DEBUG("Taking transition for event type: {}", e->type());}
+
+private:
+  const std::atomic<const ModeDefinition *> * mode_ = nullptr;
 };
 
 }  // namespace packml_sm
\ No newline at end of file
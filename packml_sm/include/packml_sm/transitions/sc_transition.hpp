@@ -51,6 +51,13 @@ public:
   */
   virtual ~StateCompleteTransition() {}
 
+
+  /**
+  * @brief Function to make the transition a self loop of its source state, taken on completion
+  * only when the current mode loops the state. Other completions of that state are then ignored.
+  */
+  void setModeLoop(bool mode_loop) {mode_loop_ = mode_loop;}
+
 protected:
   /**
   * @brief Function to check if the transition is valid
@@ -63,6 +70,9 @@ protected:
   * @brief Function to trigger an action when the transition is happening
   * @param e - triggering event
   */
-  virtual void onTransition(QEvent * e) {std::cout << "State Complete! type: " << e->type() << std::endl;}
+  virtual void onTransition(QEvent * e) {PACKML_LOG_DEBUG("State Complete! type: {}", e->type());}
+
+private:
+  bool mode_loop_ = false;
 };
 } // namespace packml_sm
\ No newline at end of file
@@ -0,0 +1,181 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/acting_executor.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <exception>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "packml_sm/log.hpp"
+
+namespace packml_sm
+{
+
+namespace
+{
+
+std::mutex g_global_mutex;
+ExecutorConfig g_global_config;
+std::shared_ptr<ActingExecutor> g_global;
+
+void pinCurrentThread(ExecutorLane lane, const std::vector<int> & cpus)
+{
+  if (cpus.empty()) {
+    return;
+  }
+  int error = setCurrentThreadAffinity(cpus);
+  if (error != 0) {
+    PACKML_LOG_WARN("Could not pin {} lane worker to its cpus, error: {}", lane, error);
+  }
+}
+
+}  // namespace
+
+int setCurrentThreadAffinity(const std::vector<int> & cpus)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)cpus;
+  return ENOTSUP;
+#endif
+}
+
+ActingExecutor::ActingExecutor(const ExecutorConfig & config)
+: config_(config)
+{
+  for (auto value : {ExecutorLane::SAFETY, ExecutorLane::EXECUTE, ExecutorLane::NORMAL}) {
+    auto count = std::max<std::size_t>(1, config_.lane(value).threads);
+    for (std::size_t ii = 0; ii < count; ++ii) {
+      workers_.emplace_back(&ActingExecutor::worker, this, value);
+    }
+  }
+}
+
+ActingExecutor::~ActingExecutor()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  for (auto & value : lanes_) {
+    value.cv.notify_all();
+  }
+  for (auto & thread : workers_) {
+    thread.join();
+  }
+}
+
+std::shared_ptr<ActingExecutor> ActingExecutor::global()
+{
+  std::lock_guard<std::mutex> lock(g_global_mutex);
+  if (!g_global) {
+    // Never destroyed, operations may still complete during static destruction
+    g_global = std::shared_ptr<ActingExecutor>(new ActingExecutor(g_global_config), [](ActingExecutor *) {});
+  }
+  return g_global;
+}
+
+bool ActingExecutor::configureGlobal(const ExecutorConfig & config)
+{
+  std::lock_guard<std::mutex> lock(g_global_mutex);
+  if (g_global) {
+    return false;
+  }
+  g_global_config = config;
+  return true;
+}
+
+std::shared_future<void> ActingExecutor::submit(ExecutorLane value, std::function<void()> job)
+{
+  std::shared_future<void> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Lane & target = lane(value);
+    target.queue.push_back(Job{std::move(job), std::promise<void>(), Clock::now()});
+    done = target.queue.back().done.get_future().share();
+    ++target.metrics.submitted;
+    target.metrics.queue_depth = target.queue.size();
+    target.metrics.max_queue_depth = std::max(target.metrics.max_queue_depth, target.queue.size());
+  }
+  lane(value).cv.notify_one();
+  if (value == ExecutorLane::SAFETY) {
+    // An idle NORMAL worker may get to it first
+    lane(ExecutorLane::NORMAL).cv.notify_one();
+  }
+  return done;
+}
+
+LaneMetrics ActingExecutor::metrics(ExecutorLane value) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return lanes_[static_cast<std::size_t>(value)].metrics;
+}
+
+void ActingExecutor::worker(ExecutorLane own)
+{
+  pinCurrentThread(own, config_.lane(own).cpus);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    Lane * source = nullptr;
+    if (own == ExecutorLane::NORMAL && !lane(ExecutorLane::SAFETY).queue.empty()) {
+      source = &lane(ExecutorLane::SAFETY);
+    } else if (!lane(own).queue.empty()) {
+      source = &lane(own);
+    } else if (stopping_) {
+      return;
+    } else {
+      lane(own).cv.wait(lock);
+      continue;
+    }
+
+    Job job = std::move(source->queue.front());
+    source->queue.pop_front();
+    LaneMetrics & metrics = source->metrics;
+    auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - job.submitted);
+    metrics.queue_depth = source->queue.size();
+    metrics.last_dispatch_latency = latency;
+    metrics.max_dispatch_latency = std::max(metrics.max_dispatch_latency, latency);
+    metrics.total_dispatch_latency += latency;
+    ++metrics.running;
+    lock.unlock();
+
+    try {
+      job.function();
+      job.done.set_value();
+    } catch (...) {
+      job.done.set_exception(std::current_exception());
+    }
+
+    lock.lock();
+    --metrics.running;
+    ++metrics.completed;
+  }
+}
+
+}  // namespace packml_sm
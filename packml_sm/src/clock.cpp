@@ -0,0 +1,200 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/clock.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <utility>
+
+namespace packml_sm
+{
+
+namespace
+{
+
+/**
+* @brief Wall time clock. Pending timers only occupy a node of a TimerWheel until they expire, one
+* detached worker runs the due callbacks after the wheel lock is released.
+*/
+class SystemClock : public Clock
+{
+public:
+  SystemClock()
+  {
+    std::thread(&SystemClock::worker, this).detach();
+  }
+
+  TimePoint now() const override {return std::chrono::steady_clock::now();}
+
+  TimerWheel::TimerId schedule(TimePoint deadline, TimerWheel::Callback callback) override
+  {
+    TimerWheel::TimerId id;
+    bool earlier = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto before = wheel_.nextWakeup();
+      id = wheel_.schedule(deadline, std::move(callback));
+      earlier = !before || *wheel_.nextWakeup() < *before;
+    }
+    if (earlier) {
+      cv_.notify_one();
+    }
+    return id;
+  }
+
+  bool cancel(TimerWheel::TimerId id) override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return wheel_.cancel(id);
+  }
+
+  bool sleepUntil(TimePoint deadline, std::stop_token token) override
+  {
+    std::mutex mutex;
+    std::condition_variable_any cv;
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait_until(lock, token, deadline, [] {return false;});
+    return !token.stop_requested();
+  }
+
+private:
+  void worker()
+  {
+    std::vector<TimerWheel::Callback> due;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      auto wakeup = wheel_.nextWakeup();
+      if (!wakeup) {
+        cv_.wait(lock);
+        continue;
+      }
+      if (*wakeup > now()) {
+        cv_.wait_until(lock, *wakeup);
+        continue;
+      }
+      wheel_.collect(now(), due);
+      if (due.empty()) {
+        continue;
+      }
+      lock.unlock();
+      for (auto & job : due) {
+        job();
+      }
+      due.clear();
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  TimerWheel wheel_;
+};
+
+}  // namespace
+
+std::shared_ptr<Clock> Clock::system()
+{
+  // Never destroyed, the detached worker outlives static destruction
+  static auto clock = new std::shared_ptr<Clock>(std::make_shared<SystemClock>());
+  return *clock;
+}
+
+VirtualClock::VirtualClock(TimePoint start)
+: start_(start), wheel_(std::chrono::milliseconds(1), start)
+{
+}
+
+TimerWheel::TimerId VirtualClock::schedule(TimePoint deadline, TimerWheel::Callback callback)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return wheel_.schedule(deadline, std::move(callback));
+}
+
+bool VirtualClock::cancel(TimerWheel::TimerId id)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return wheel_.cancel(id);
+}
+
+bool VirtualClock::sleepUntil(TimePoint deadline, std::stop_token token)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  // An empty timer makes advance() stop at the deadline instead of jumping past it
+  auto timer = wheel_.schedule(deadline, [] {});
+  bool reached = sleepers_.wait(lock, token, [this, deadline] {return now() >= deadline;});
+  if (!reached) {
+    wheel_.cancel(timer);
+  }
+  return reached;
+}
+
+std::size_t VirtualClock::advanceTo(TimePoint target)
+{
+  std::size_t count = 0;
+  while (true) {
+    settle();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto wakeup = wheel_.nextWakeup();
+      TimePoint next = (wakeup && *wakeup <= target) ? *wakeup : target;
+      if (next > now()) {
+        elapsed_ns_.store(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(next - start_).count(),
+          std::memory_order_release);
+      }
+      sleepers_.notify_all();
+      if (!wakeup || *wakeup > target) {
+        break;
+      }
+      wheel_.collect(now(), due_);
+    }
+    for (auto & callback : due_) {
+      callback();
+    }
+    count += due_.size();
+    due_.clear();
+  }
+  settle();
+  return count;
+}
+
+void VirtualClock::beginWork()
+{
+  std::lock_guard<std::mutex> lock(work_mutex_);
+  ++outstanding_work_;
+}
+
+void VirtualClock::endWork()
+{
+  std::lock_guard<std::mutex> lock(work_mutex_);
+  if (--outstanding_work_ == 0) {
+    work_done_.notify_all();
+  }
+}
+
+std::size_t VirtualClock::pending() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return wheel_.size();
+}
+
+void VirtualClock::settle()
+{
+  std::unique_lock<std::mutex> lock(work_mutex_);
+  work_done_.wait(lock, [this] {return outstanding_work_ == 0;});
+}
+
+}  // namespace packml_sm
@@ -0,0 +1,175 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/event_pool.hpp"
+
+#include <mutex>
+#include <new>
+
+namespace packml_sm
+{
+
+// Precedes the object, keeps it aligned for any type
+struct alignas(alignof(std::max_align_t)) EventPool::Header
+{
+  Shared * pool;
+  Header * next;
+};
+
+// Outlives the EventPool while blocks are in flight
+struct EventPool::Shared
+{
+  std::mutex mutex;
+  Header * free = nullptr;
+  Stats stats;
+  bool closed = false;
+  std::function<void(bool busy)> busy_listener;
+};
+
+EventPool::EventPool(std::size_t preallocate)
+: shared_(new Shared())
+{
+  for (std::size_t ii = 0; ii < preallocate; ++ii) {
+    auto header = static_cast<Header *>(::operator new(sizeof(Header) + kBlockSize));
+    header->pool = shared_;
+    header->next = shared_->free;
+    shared_->free = header;
+    ++shared_->stats.free;
+    ++shared_->stats.heap_allocations;
+  }
+}
+
+EventPool::~EventPool()
+{
+  bool last = false;
+  {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    shared_->closed = true;
+    while (shared_->free != nullptr) {
+      Header * header = shared_->free;
+      shared_->free = header->next;
+      ::operator delete(header);
+    }
+    shared_->stats.free = 0;
+    last = shared_->stats.outstanding == 0;
+    // Blocks still in flight are given up on, they no longer report to the listener
+    if (!last && shared_->busy_listener) {
+      shared_->busy_listener(false);
+    }
+    shared_->busy_listener = nullptr;
+  }
+  if (last) {
+    delete shared_;
+  }
+}
+
+void * EventPool::allocate(std::size_t size)
+{
+  if (size > kBlockSize) {
+    {
+      std::lock_guard<std::mutex> lock(shared_->mutex);
+      ++shared_->stats.allocations;
+      ++shared_->stats.heap_allocations;
+    }
+    return allocateUnpooled(size);
+  }
+
+  Header * header = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    ++shared_->stats.allocations;
+    if (++shared_->stats.outstanding == 1 && shared_->busy_listener) {
+      shared_->busy_listener(true);
+    }
+    if (shared_->free != nullptr) {
+      header = shared_->free;
+      shared_->free = header->next;
+      --shared_->stats.free;
+      ++shared_->stats.recycled;
+    } else {
+      ++shared_->stats.heap_allocations;
+    }
+  }
+  if (header == nullptr) {
+    header = static_cast<Header *>(::operator new(sizeof(Header) + kBlockSize));
+    header->pool = shared_;
+  }
+  header->next = nullptr;
+  return header + 1;
+}
+
+void * EventPool::allocateUnpooled(std::size_t size)
+{
+  auto header = static_cast<Header *>(::operator new(sizeof(Header) + size));
+  header->pool = nullptr;
+  header->next = nullptr;
+  return header + 1;
+}
+
+void EventPool::deallocate(void * object)
+{
+  if (object == nullptr) {
+    return;
+  }
+  Header * header = static_cast<Header *>(object) - 1;
+  Shared * pool = header->pool;
+  if (pool == nullptr) {
+    ::operator delete(header);
+    return;
+  }
+
+  bool last = false;
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    --pool->stats.outstanding;
+    if (pool->stats.outstanding == 0 && pool->busy_listener) {
+      pool->busy_listener(false);
+    }
+    if (!pool->closed) {
+      header->next = pool->free;
+      pool->free = header;
+      ++pool->stats.free;
+      return;
+    }
+    last = pool->stats.outstanding == 0;
+  }
+  ::operator delete(header);
+  if (last) {
+    delete pool;
+  }
+}
+
+void EventPool::setBusyListener(std::function<void(bool busy)> listener)
+{
+  std::lock_guard<std::mutex> lock(shared_->mutex);
+  if (shared_->stats.outstanding > 0) {
+    // Keeps the busy and idle calls of each listener balanced
+    if (shared_->busy_listener) {
+      shared_->busy_listener(false);
+    }
+    if (listener) {
+      listener(true);
+    }
+  }
+  shared_->busy_listener = std::move(listener);
+}
+
+EventPool::Stats EventPool::stats() const
+{
+  std::lock_guard<std::mutex> lock(shared_->mutex);
+  return shared_->stats;
+}
+
+}  // namespace packml_sm
@@ -0,0 +1,259 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/journal.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include "packml_sm/log.hpp"
+
+namespace packml_sm
+{
+
+namespace
+{
+
+// "PKJ" and the format version
+constexpr std::array<char, 4> kJournalHeader{'P', 'K', 'J', 1};
+
+// Length prefix, then type, state, command or mode, accepted, code and time
+constexpr std::uint16_t kPayloadSize = 16;
+constexpr std::size_t kFrameSize = sizeof(std::uint16_t) + kPayloadSize;
+
+void encode(const JournalRecord & record, char * out)
+{
+  std::uint16_t length = kPayloadSize;
+  std::uint8_t value = record.type == JournalRecord::Type::MODE_CHANGED ?
+    static_cast<std::uint8_t>(record.mode) : static_cast<std::uint8_t>(record.command);
+  std::int32_t code = record.code;
+  std::int64_t time = record.time.count();
+  std::memcpy(out, &length, sizeof(length));
+  out[2] = static_cast<char>(record.type);
+  out[3] = static_cast<char>(record.state);
+  out[4] = static_cast<char>(value);
+  out[5] = record.accepted ? 1 : 0;
+  std::memcpy(out + 6, &code, sizeof(code));
+  std::memcpy(out + 10, &time, sizeof(time));
+}
+
+JournalRecord decode(const char * payload)
+{
+  JournalRecord record;
+  auto value = static_cast<std::uint8_t>(payload[2]);
+  std::int32_t code;
+  std::int64_t time;
+  std::memcpy(&code, payload + 4, sizeof(code));
+  std::memcpy(&time, payload + 8, sizeof(time));
+  record.type = static_cast<JournalRecord::Type>(payload[0]);
+  record.state = static_cast<State>(static_cast<std::uint8_t>(payload[1]));
+  if (record.type == JournalRecord::Type::MODE_CHANGED) {
+    record.mode = static_cast<ModeType>(value);
+  } else {
+    record.command = static_cast<TransitionCmd>(value);
+  }
+  record.accepted = payload[3] != 0;
+  record.code = code;
+  record.time = std::chrono::nanoseconds(time);
+  return record;
+}
+
+}  // namespace
+
+std::expected<std::shared_ptr<JournalWriter>, std::string> JournalWriter::open(
+  const std::string & path, JournalOptions options)
+{
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return std::unexpected("Cannot open journal " + path + ": " + std::strerror(errno));
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0 ||
+    (info.st_size == 0 &&
+    ::write(fd, kJournalHeader.data(), kJournalHeader.size()) != static_cast<ssize_t>(kJournalHeader.size())))
+  {
+    auto message = "Cannot write journal " + path + ": " + std::strerror(errno);
+    ::close(fd);
+    return std::unexpected(message);
+  }
+  return std::shared_ptr<JournalWriter>(new JournalWriter(path, fd, options));
+}
+
+JournalWriter::JournalWriter(std::string path, int fd, JournalOptions options)
+: path_(std::move(path)), fd_(fd), options_(options)
+{
+  batch_.reserve(options_.batch_bytes + kFrameSize);
+  spare_.reserve(options_.batch_bytes + kFrameSize);
+  thread_ = std::thread(&JournalWriter::worker, this);
+}
+
+JournalWriter::~JournalWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+  ::close(fd_);
+}
+
+void JournalWriter::append(const JournalRecord & record)
+{
+  bool full;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto offset = batch_.size();
+    batch_.resize(offset + kFrameSize);
+    encode(record, batch_.data() + offset);
+    ++appended_;
+    // Only the record that fills the batch wakes up the writer
+    full = offset < options_.batch_bytes && batch_.size() >= options_.batch_bytes;
+  }
+  if (full) {
+    wake_.notify_one();
+  }
+}
+
+bool JournalWriter::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto target = appended_;
+  flush_target_ = std::max(flush_target_, target);
+  wake_.notify_one();
+  written_.wait(lock, [this, target] {return written_end_ >= target || failed_;});
+  return !failed_;
+}
+
+std::uint64_t JournalWriter::records() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return appended_;
+}
+
+void JournalWriter::worker()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait_for(
+      lock, options_.flush_interval, [this] {
+        return stop_ || batch_.size() >= options_.batch_bytes || flush_target_ > written_end_;
+      });
+    if (batch_.empty()) {
+      if (stop_) {
+        return;
+      }
+      continue;
+    }
+    // The writing thread owns the full batch, appends continue into the spare one
+    std::vector<char> batch;
+    batch.swap(batch_);
+    batch_.swap(spare_);
+    auto end = appended_;
+    lock.unlock();
+    bool ok = write(batch);
+    lock.lock();
+    batch.clear();
+    spare_.swap(batch);
+    failed_ = failed_ || !ok;
+    written_end_ = end;
+    written_.notify_all();
+  }
+}
+
+bool JournalWriter::write(const std::vector<char> & batch)
+{
+  const char * data = batch.data();
+  std::size_t left = batch.size();
+  while (left > 0) {
+    auto written = ::write(fd_, data, left);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PACKML_LOG_ERROR("Cannot write journal {}: {}", path_, std::strerror(errno));
+      return false;
+    }
+    data += written;
+    left -= static_cast<std::size_t>(written);
+  }
+  if (options_.fsync && ::fdatasync(fd_) != 0) {
+    PACKML_LOG_ERROR("Cannot sync journal {}: {}", path_, std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+std::expected<JournalReader, std::string> JournalReader::open(const std::string & path)
+{
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) {
+    return std::unexpected("Cannot open journal " + path);
+  }
+  std::array<char, kJournalHeader.size()> header{};
+  if (!stream.read(header.data(), header.size()) || header != kJournalHeader) {
+    return std::unexpected("Not a state machine journal: " + path);
+  }
+  return JournalReader(std::move(stream));
+}
+
+JournalReader::JournalReader(std::ifstream stream)
+: stream_(std::move(stream))
+{
+}
+
+std::optional<JournalRecord> JournalReader::next()
+{
+  std::array<char, kPayloadSize> payload;
+  while (true) {
+    std::uint16_t length;
+    if (!stream_.read(reinterpret_cast<char *>(&length), sizeof(length))) {
+      truncated_ = stream_.gcount() != 0;
+      return std::nullopt;
+    }
+    if (length < kPayloadSize || !stream_.read(payload.data(), kPayloadSize) ||
+      !stream_.ignore(length - kPayloadSize) ||
+      stream_.gcount() != length - kPayloadSize)
+    {
+      truncated_ = true;
+      return std::nullopt;
+    }
+    auto type = static_cast<std::uint8_t>(payload[0]);
+    if (type >= static_cast<std::uint8_t>(JournalRecord::Type::COMMAND) &&
+      type <= static_cast<std::uint8_t>(JournalRecord::Type::COMPLETED))
+    {
+      return decode(payload.data());
+    }
+    // Written by a newer version, the length prefix lets us skip it
+  }
+}
+
+std::vector<JournalRecord> JournalReader::readAll()
+{
+  std::vector<JournalRecord> records;
+  while (auto record = next()) {
+    records.push_back(*record);
+  }
+  return records;
+}
+
+}  // namespace packml_sm
@@ -0,0 +1,41 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/latency_histogram.hpp"
+
+#include <cmath>
+
+namespace packml_sm
+{
+
+std::chrono::nanoseconds LatencyHistogram::percentile(double q) const
+{
+  if (count == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  auto rank = static_cast<std::uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(count)));
+  rank = std::max<std::uint64_t>(rank, 1);
+  std::uint64_t seen = 0;
+  for (std::size_t ii = 0; ii < kBucketCount; ++ii) {
+    seen += buckets[ii];
+    if (seen >= rank) {
+      std::uint64_t upper = ii + 1 < kBucketCount ? lowerBound(ii + 1) - 1 : lowerBound(ii);
+      return std::min(std::chrono::nanoseconds(static_cast<std::int64_t>(upper)), max);
+    }
+  }
+  return max;
+}
+
+}  // namespace packml_sm
@@ -0,0 +1,349 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/log.hpp"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace packml_sm
+{
+namespace logging
+{
+namespace detail
+{
+
+namespace
+{
+
+Level levelFromEnvironment()
+{
+  const char * value = std::getenv("PACKML_SM_LOG_LEVEL");
+  if (value == nullptr) {
+    return Level::INFO;
+  }
+  std::string_view name(value);
+  for (auto level : {Level::DEBUG, Level::INFO, Level::WARN, Level::ERROR, Level::OFF}) {
+    if (name == to_string(level)) {
+      return level;
+    }
+  }
+  return Level::INFO;
+}
+
+
+/**
+* @brief Single producer (the owning thread), single consumer (the sink thread) ring of records
+*/
+struct Ring
+{
+  static constexpr std::size_t kCapacity = 1024;
+
+  std::array<Record, kCapacity> records;
+  alignas(64) std::atomic<std::size_t> head{0};
+  alignas(64) std::atomic<std::size_t> tail{0};
+  std::atomic<std::uint64_t> dropped{0};
+  std::atomic<bool> retired{false};
+  std::uint32_t thread = 0;
+};
+
+
+class Logger
+{
+public:
+  static Logger & instance()
+  {
+    // Never destroyed, threads may log during static destruction
+    static Logger * logger = new Logger();
+    return *logger;
+  }
+
+  std::shared_ptr<Ring> registerThread()
+  {
+    auto ring = std::make_shared<Ring>();
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring->thread = ++thread_count_;
+    rings_.push_back(ring);
+    return ring;
+  }
+
+  void setSink(Sink sink)
+  {
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    sink_ = std::move(sink);
+  }
+
+  void flush()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto request = ++flush_requests_;
+    cv_.notify_all();
+    // Bounded, a blocked sink must not hang the caller
+    flushed_cv_.wait_for(lock, std::chrono::seconds(2), [this, request] {return flushed_ >= request;});
+  }
+
+  /**
+  * @brief Called after every commit, only takes the lock while the sink thread sleeps
+  */
+  void wake()
+  {
+    if (!sleeping_.load(std::memory_order_seq_cst)) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_ = true;
+    }
+    cv_.notify_one();
+  }
+
+  std::uint64_t dropped()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::uint64_t count = retired_dropped_;
+    for (const auto & ring : rings_) {
+      count += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return count;
+  }
+
+private:
+  Logger()
+  {
+    std::thread(&Logger::run, this).detach();
+  }
+
+  void run()
+  {
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::string line;
+    while (true) {
+      std::uint64_t request;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Announced before the rings are checked: a record committed after the check sees it and
+        // wakes the sink, one committed before it is found by the check
+        sleeping_.store(true, std::memory_order_seq_cst);
+        cv_.wait(lock, [this] {return wake_ || flushed_ < flush_requests_ || pending();});
+        sleeping_.store(false, std::memory_order_relaxed);
+        wake_ = false;
+        request = flush_requests_;
+        rings = rings_;
+      }
+
+      for (auto & ring : rings) {
+        drain(*ring, line);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::erase_if(rings_, [this](const std::shared_ptr<Ring> & ring) {
+          bool done = ring->retired.load(std::memory_order_acquire) &&
+          ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+          if (done) {
+            retired_dropped_ += ring->dropped.load(std::memory_order_relaxed);
+          }
+          return done;
+        });
+      flushed_ = request;
+      flushed_cv_.notify_all();
+    }
+  }
+
+  // Must be called with mutex_ locked
+  bool pending() const
+  {
+    return std::any_of(
+      rings_.begin(), rings_.end(), [](const std::shared_ptr<Ring> & ring) {
+        return ring->head.load(std::memory_order_seq_cst) !=
+        ring->tail.load(std::memory_order_relaxed);
+      });
+  }
+
+  void drain(Ring & ring, std::string & line)
+  {
+    auto tail = ring.tail.load(std::memory_order_relaxed);
+    auto head = ring.head.load(std::memory_order_acquire);
+    if (tail == head) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    for (; tail != head; ++tail) {
+      const Record & record = ring.records[tail % Ring::kCapacity];
+      format(record, ring.thread, line);
+      if (sink_) {
+        sink_(record.level, line);
+      } else {
+        line += '\n';
+        std::fwrite(line.data(), 1, line.size(), stdout);
+      }
+      // Hand the slot back as soon as it is formatted
+      ring.tail.store(tail + 1, std::memory_order_release);
+    }
+    if (!sink_) {
+      std::fflush(stdout);
+    }
+  }
+
+  static void format(const Record & record, std::uint32_t thread, std::string & line)
+  {
+    char prefix[64];
+    std::snprintf(
+      prefix, sizeof(prefix), "[%s] [%lld.%09lld] [%u] ", to_string(record.level).c_str(),
+      static_cast<long long>(record.stamp_ns / 1000000000),
+      static_cast<long long>(record.stamp_ns % 1000000000), thread);
+    line = prefix;
+
+    std::size_t arg = 0;
+    for (const char * c = record.format; *c != '\0'; ++c) {
+      if (c[0] == '{' && c[1] == '}') {
+        if (arg < record.arg_count) {
+          record.args[arg].format(line, record.args[arg].value, record.text);
+        }
+        ++arg;
+        ++c;
+      } else {
+        line += *c;
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable flushed_cv_;
+  std::vector<std::shared_ptr<Ring>> rings_;
+  std::uint32_t thread_count_{0};
+  std::uint64_t flush_requests_{0};
+  std::uint64_t flushed_{0};
+  std::uint64_t retired_dropped_{0};
+  bool wake_{false};
+  std::atomic<bool> sleeping_{false};
+
+  std::mutex sink_mutex_;
+  Sink sink_;
+};
+
+
+/**
+* @brief Owner of the ring of a thread, retires it when the thread exits
+*/
+struct ThreadRing
+{
+  ThreadRing()
+  : ring(Logger::instance().registerThread()) {}
+
+  ~ThreadRing()
+  {
+    ring->retired.store(true, std::memory_order_release);
+  }
+
+  std::shared_ptr<Ring> ring;
+};
+
+thread_local ThreadRing t_ring;
+
+}  // namespace
+
+std::atomic<Level> g_level{levelFromEnvironment()};
+
+void formatSigned(std::string & out, const ArgValue & value, const char * /*text*/)
+{
+  out += std::to_string(value.i);
+}
+
+void formatUnsigned(std::string & out, const ArgValue & value, const char * /*text*/)
+{
+  out += std::to_string(value.u);
+}
+
+void formatBool(std::string & out, const ArgValue & value, const char * /*text*/)
+{
+  out += value.u ? "true" : "false";
+}
+
+void formatDouble(std::string & out, const ArgValue & value, const char * /*text*/)
+{
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%g", value.d);
+  out += buffer;
+}
+
+void formatPointer(std::string & out, const ArgValue & value, const char * /*text*/)
+{
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%p", value.p);
+  out += buffer;
+}
+
+void formatText(std::string & out, const ArgValue & value, const char * text)
+{
+  out.append(text + value.text.offset, value.text.length);
+}
+
+Record * acquire()
+{
+  Ring & ring = *t_ring.ring;
+  auto head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= Ring::kCapacity) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  return &ring.records[head % Ring::kCapacity];
+}
+
+void commit(Record * /*record*/)
+{
+  Ring & ring = *t_ring.ring;
+  // Sequentially consistent with the sleeping flag of the sink, see Logger::run()
+  ring.head.store(ring.head.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+  Logger::instance().wake();
+}
+
+}  // namespace detail
+
+void setLevel(Level level)
+{
+  detail::g_level.store(level, std::memory_order_relaxed);
+}
+
+Level level()
+{
+  return detail::g_level.load(std::memory_order_relaxed);
+}
+
+void setSink(Sink sink)
+{
+  detail::Logger::instance().setSink(std::move(sink));
+}
+
+void flush()
+{
+  detail::Logger::instance().flush();
+}
+
+std::uint64_t dropped()
+{
+  return detail::Logger::instance().dropped();
+}
+
+}  // namespace logging
+}  // namespace packml_sm
@@ -0,0 +1,211 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/machine_host.hpp"
+
+#include <utility>
+
+#include <QAbstractEventDispatcher>
+#include <QTimer>
+
+#include "packml_sm/acting_executor.hpp"
+#include "packml_sm/log.hpp"
+
+namespace packml_sm
+{
+
+MachineHost::MachineHost(const MachineHostConfig & config)
+: config_(config)
+{
+  if (QCoreApplication::instance() == nullptr) {
+    PACKML_LOG_ERROR("QCoreApplication is not running, call packml_sm::init before creating a MachineHost");
+  }
+  auto count = std::max<std::size_t>(1, config_.shards);
+  for (std::size_t ii = 0; ii < count; ++ii) {
+    shards_.push_back(std::make_unique<Shard>());
+  }
+  for (std::size_t ii = 0; ii < count; ++ii) {
+    startShard(ii);
+  }
+}
+
+MachineHost::~MachineHost()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto & shard : shards_) {
+    for (auto & machine : shard->machines) {
+      machine->deactivate();
+    }
+    shard->thread.quit();
+  }
+  for (auto & shard : shards_) {
+    shard->thread.wait();
+    // The machines are released after their thread finished, nothing runs on them any more
+    shard->machines.clear();
+  }
+}
+
+void MachineHost::startShard(std::size_t index)
+{
+  Shard * shard = shards_[index].get();
+  shard->thread.setObjectName(QString("packml_shard_%1").arg(index));
+
+  std::vector<int> cpus;
+  if (!config_.cpus.empty()) {
+    cpus.push_back(config_.cpus[index % config_.cpus.size()]);
+  }
+  auto interval = config_.probe_interval;
+
+  // Emitted on the shard thread once its event dispatcher exists, before the event loop starts
+  QObject::connect(
+    &shard->thread, &QThread::started, [shard, index, cpus, interval]() {
+      if (!cpus.empty()) {
+        int error = setCurrentThreadAffinity(cpus);
+        if (error != 0) {
+          PACKML_LOG_WARN("Could not pin shard {} to cpu {}, error: {}", index, cpus.front(), error);
+        }
+      }
+
+      shard->last_switch = std::chrono::steady_clock::now();
+      auto dispatcher = QAbstractEventDispatcher::instance();
+      QObject::connect(
+        dispatcher, &QAbstractEventDispatcher::aboutToBlock, [shard]() {
+          auto now = std::chrono::steady_clock::now();
+          shard->busy_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - shard->last_switch).count(),
+            std::memory_order_relaxed);
+          shard->last_switch = now;
+        });
+      QObject::connect(
+        dispatcher, &QAbstractEventDispatcher::awake, [shard]() {
+          auto now = std::chrono::steady_clock::now();
+          shard->idle_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - shard->last_switch).count(),
+            std::memory_order_relaxed);
+          shard->last_switch = now;
+          shard->wakeups.fetch_add(1, std::memory_order_relaxed);
+        });
+
+      if (interval.count() <= 0) {
+        return;
+      }
+      auto probe = new QTimer();
+      probe->setTimerType(Qt::PreciseTimer);
+      auto expected = std::make_shared<std::chrono::steady_clock::time_point>(
+        std::chrono::steady_clock::now() + interval);
+      QObject::connect(
+        probe, &QTimer::timeout, [shard, interval, expected]() {
+          auto now = std::chrono::steady_clock::now();
+          auto latency = std::max(std::chrono::nanoseconds(0), std::chrono::nanoseconds(now - *expected));
+          *expected = now + interval;
+          std::lock_guard<std::mutex> lock(shard->latency_mutex);
+          shard->loop_latency.add(latency);
+        });
+      // Emitted on the shard thread after its event loop returned
+      QObject::connect(&shard->thread, &QThread::finished, [probe]() {delete probe;});
+      probe->start(static_cast<int>(interval.count()));
+    });
+  shard->thread.start();
+}
+
+std::optional<std::size_t> MachineHost::add(std::shared_ptr<StateMachine> machine)
+{
+  std::size_t target = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t ii = 1; ii < shards_.size(); ++ii) {
+      if (shards_[ii]->machines.size() < shards_[target]->machines.size()) {
+        target = ii;
+      }
+    }
+  }
+  if (!add(std::move(machine), target)) {
+    return std::nullopt;
+  }
+  return target;
+}
+
+bool MachineHost::add(std::shared_ptr<StateMachine> machine, std::size_t shard)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!machine || shard >= shards_.size()) {
+    return false;
+  }
+  for (auto & item : shards_) {
+    if (std::find(item->machines.begin(), item->machines.end(), machine) != item->machines.end()) {
+      PACKML_LOG_WARN("State machine is already hosted");
+      return false;
+    }
+  }
+  if (!machine->activate(&shards_[shard]->thread)) {
+    return false;
+  }
+  shards_[shard]->machines.push_back(std::move(machine));
+  return true;
+}
+
+bool MachineHost::remove(const std::shared_ptr<StateMachine> & machine)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto & shard : shards_) {
+    auto found = std::find(shard->machines.begin(), shard->machines.end(), machine);
+    if (found != shard->machines.end()) {
+      machine->deactivate();
+      shard->machines.erase(found);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::optional<std::size_t> MachineHost::shardOf(const std::shared_ptr<StateMachine> & machine) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::size_t ii = 0; ii < shards_.size(); ++ii) {
+    auto & machines = shards_[ii]->machines;
+    if (std::find(machines.begin(), machines.end(), machine) != machines.end()) {
+      return ii;
+    }
+  }
+  return std::nullopt;
+}
+
+ShardMetrics MachineHost::metrics(std::size_t shard) const
+{
+  ShardMetrics result;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (shard >= shards_.size()) {
+    return result;
+  }
+  const Shard & value = *shards_[shard];
+  result.machines = value.machines.size();
+  result.wakeups = value.wakeups.load(std::memory_order_relaxed);
+  result.busy = std::chrono::nanoseconds(value.busy_ns.load(std::memory_order_relaxed));
+  result.idle = std::chrono::nanoseconds(value.idle_ns.load(std::memory_order_relaxed));
+  std::lock_guard<std::mutex> latency_lock(value.latency_mutex);
+  result.loop_latency = value.loop_latency;
+  return result;
+}
+
+std::vector<ShardMetrics> MachineHost::metrics() const
+{
+  std::vector<ShardMetrics> result;
+  for (std::size_t ii = 0; ii < shardCount(); ++ii) {
+    result.push_back(metrics(ii));
+  }
+  return result;
+}
+
+}  // namespace packml_sm
@@ -0,0 +1,137 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/mode_graph.hpp"
+
+#include <utility>
+
+#include "packml_sm/log.hpp"
+#include "packml_sm/state_registry.hpp"
+
+namespace packml_sm
+{
+
+namespace
+{
+
+std::string stateList(StateMask mask)
+{
+  std::string result;
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    if (hasState(mask, static_cast<State>(ii))) {
+      if (!result.empty()) {
+        result += ", ";
+      }
+      result += registryName(static_cast<State>(ii));
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
+ModeGraph compileModeGraph(const TransitionTable & base, const ModeDefinition * mode, State initial)
+{
+  StateMask available = (mode == nullptr) ? kAllStates : mode->available;
+  StateMask self_loops = (mode == nullptr) ? 0 : mode->self_loops;
+  auto filter = [available](State target) {
+      return hasState(available, target) ? target : State::UNDEFINED;
+    };
+
+  ModeGraph graph;
+  graph.definition = mode;
+  std::array<StateMask, kStateCount> exits{};
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    auto state = static_cast<State>(ii);
+    for (std::size_t cc = 0; cc < kCommandCount; ++cc) {
+      State target = filter(base.command[ii][cc]);
+      graph.table.command[ii][cc] = target;
+      if (target != State::UNDEFINED) {
+        graph.commands[ii] |= commandBit(static_cast<TransitionCmd>(cc));
+        exits[ii] |= stateBit(target);
+      }
+    }
+    State complete = hasState(self_loops, state) ? state : base.complete[ii];
+    graph.table.complete[ii] = filter(complete);
+    graph.table.error[ii] = filter(base.error[ii]);
+    for (State target : {graph.table.complete[ii], graph.table.error[ii]}) {
+      if (target != State::UNDEFINED) {
+        exits[ii] |= stateBit(target);
+      }
+    }
+    exits[ii] &= ~stateBit(state);
+  }
+
+  // Breadth first over the state masks, the graph has fewer states than bits in a mask
+  StateMask frontier = hasState(available, initial) ? stateBit(initial) : 0;
+  while (frontier != 0) {
+    graph.reachable |= frontier;
+    StateMask next = 0;
+    for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+      if (hasState(frontier, static_cast<State>(ii))) {
+        next |= exits[ii];
+      }
+    }
+    frontier = next & ~graph.reachable;
+  }
+
+  graph.unreachable = available & ~graph.reachable;
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    auto state = static_cast<State>(ii);
+    if (!hasState(graph.reachable, state)) {
+      continue;
+    }
+    if (exits[ii] == 0) {
+      graph.dead_ends |= stateBit(state);
+    }
+    if (isActingState(state) && graph.table.complete[ii] == State::UNDEFINED) {
+      graph.stalled |= stateBit(state);
+    }
+  }
+  return graph;
+}
+
+std::string describeModeGraph(const ModeGraph & graph)
+{
+  std::string result;
+  auto append = [&result](const char * what, StateMask mask) {
+      if (mask != 0) {
+        result += (result.empty() ? "" : "; ") + std::string(what) + ": " + stateList(mask);
+      }
+    };
+  append("unreachable", graph.unreachable);
+  append("dead ends", graph.dead_ends);
+  append("completion ignored", graph.stalled);
+  return result;
+}
+
+ModeGraphs::ModeGraphs(
+  std::shared_ptr<const ModeRegistry> registry, const TransitionTable & base, State initial)
+: registry_(std::move(registry)), unmoded_(compileModeGraph(base, nullptr, initial))
+{
+  graphs_.reserve(registry_->modes().size());
+  for (const auto & mode : registry_->modes()) {
+    graphs_.push_back(compileModeGraph(base, &mode, initial));
+    const ModeGraph & graph = graphs_.back();
+    auto description = describeModeGraph(graph);
+    if (graph.dead_ends != 0 || !hasState(graph.reachable, initial)) {
+      PACKML_LOG_WARN("Mode {} can get stuck, {}", mode.name, description);
+    } else if (!description.empty()) {
+      PACKML_LOG_DEBUG("Mode {}: {}", mode.name, description);
+    }
+  }
+}
+
+}  // namespace packml_sm
@@ -0,0 +1,235 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/mode_registry.hpp"
+
+#include <mutex>
+#include <utility>
+
+#include <yaml-cpp/yaml.h>
+
+#include "packml_sm/state_registry.hpp"
+
+namespace packml_sm
+{
+
+namespace
+{
+
+std::mutex global_mutex;
+std::shared_ptr<const ModeRegistry> global_registry;
+
+std::expected<State, std::string> parseState(const YAML::Node & node)
+{
+  auto name = node.as<std::string>();
+  auto index = registryIndex(std::string_view(name));
+  if (!index || *index == toIndex(State::UNDEFINED) || *index >= kStateCount) {
+    return std::unexpected("Unknown state: " + name);
+  }
+  return static_cast<State>(*index);
+}
+
+
+/**
+* @brief Parses a list of state names, or "all"
+*/
+std::expected<StateMask, std::string> parseStates(const YAML::Node & node, const std::string & key)
+{
+  if (node.IsScalar() && node.as<std::string>() == "all") {
+    return kAllStates;
+  }
+  if (!node.IsSequence()) {
+    return std::unexpected(key + " must be a list of states or \"all\"");
+  }
+  StateMask mask = 0;
+  for (const auto & item : node) {
+    auto state = parseState(item);
+    if (!state) {
+      return std::unexpected(key + ": " + state.error());
+    }
+    mask |= stateBit(*state);
+  }
+  return mask;
+}
+
+std::expected<bool, std::string> parseMode(
+  const YAML::Node & node, const ModeRegistry & registry, ModeDefinition & definition)
+{
+  if (!node.IsMap() || !node["name"]) {
+    return std::unexpected<std::string>("Every mode needs a name");
+  }
+  definition.name = node["name"].as<std::string>();
+
+  // An entry for a registered mode starts from its current definition
+  const ModeDefinition * existing = nullptr;
+  if (node["id"]) {
+    int id = node["id"].as<int>();
+    if (id < 0 || id > ModeRegistry::kMaxModeId) {
+      return std::unexpected("Mode id out of range: " + std::to_string(id));
+    }
+    existing = registry.find(static_cast<ModeType>(id));
+    definition.mode = static_cast<ModeType>(id);
+  } else {
+    existing = registry.find(std::string_view(definition.name));
+    if (existing == nullptr) {
+      return std::unexpected("Mode " + definition.name + " needs an id");
+    }
+    definition.mode = existing->mode;
+  }
+  if (existing != nullptr) {
+    definition.available = existing->available;
+    definition.switch_states = existing->switch_states;
+    definition.self_loops = existing->self_loops;
+  }
+
+  if (node["available"]) {
+    auto mask = parseStates(node["available"], "available");
+    if (!mask) {
+      return std::unexpected(mask.error());
+    }
+    definition.available = *mask;
+  }
+  if (node["unavailable"]) {
+    auto mask = parseStates(node["unavailable"], "unavailable");
+    if (!mask) {
+      return std::unexpected(mask.error());
+    }
+    definition.available &= ~*mask;
+  }
+  if (node["switch_states"]) {
+    auto mask = parseStates(node["switch_states"], "switch_states");
+    if (!mask) {
+      return std::unexpected(mask.error());
+    }
+    definition.switch_states = *mask;
+  }
+  if (node["self_loops"]) {
+    auto mask = parseStates(node["self_loops"], "self_loops");
+    if (!mask) {
+      return std::unexpected(mask.error());
+    }
+    definition.self_loops = *mask;
+  }
+  return true;
+}
+
+// Throws YAML::Exception for malformed documents and values of the wrong type
+std::expected<ModeRegistry, std::string> parseRegistry(const YAML::Node & root)
+{
+  ModeRegistry registry;
+  YAML::Node modes = root["modes"];
+  if (!modes || !modes.IsSequence()) {
+    return std::unexpected<std::string>("Mode configuration needs a \"modes\" list");
+  }
+  for (const auto & node : modes) {
+    ModeDefinition definition;
+    auto parsed = parseMode(node, registry, definition);
+    if (!parsed) {
+      return std::unexpected(parsed.error());
+    }
+    auto added = registry.add(std::move(definition));
+    if (!added) {
+      return std::unexpected(added.error());
+    }
+  }
+  return registry;
+}
+
+}  // namespace
+
+ModeRegistry::ModeRegistry()
+{
+  for (auto mode : {ModeType::UNDEFINED, ModeType::PRODUCTION, ModeType::MAINTENANCE, ModeType::MANUAL}) {
+    add(ModeDefinition{mode, to_string(mode), defaultAvailableStates(mode), stateBit(State::IDLE), 0});
+  }
+}
+
+std::expected<ModeRegistry, std::string> ModeRegistry::fromYaml(const std::string & document)
+{
+  try {
+    return parseRegistry(YAML::Load(document));
+  } catch (const YAML::Exception & ex) {
+    return std::unexpected(std::string("Invalid mode configuration: ") + ex.what());
+  }
+}
+
+std::expected<ModeRegistry, std::string> ModeRegistry::load(const std::string & path)
+{
+  try {
+    return parseRegistry(YAML::LoadFile(path));
+  } catch (const YAML::Exception & ex) {
+    return std::unexpected("Invalid mode configuration " + path + ": " + ex.what());
+  }
+}
+
+std::shared_ptr<const ModeRegistry> ModeRegistry::global()
+{
+  std::lock_guard<std::mutex> lock(global_mutex);
+  if (!global_registry) {
+    global_registry = std::make_shared<const ModeRegistry>();
+  }
+  return global_registry;
+}
+
+void ModeRegistry::setGlobal(std::shared_ptr<const ModeRegistry> registry)
+{
+  std::lock_guard<std::mutex> lock(global_mutex);
+  global_registry = std::move(registry);
+}
+
+std::expected<bool, std::string> ModeRegistry::add(ModeDefinition definition)
+{
+  auto id = static_cast<int>(definition.mode);
+  if (id < 0 || id > kMaxModeId) {
+    return std::unexpected("Mode id out of range: " + std::to_string(id));
+  }
+  if (definition.name.empty()) {
+    return std::unexpected("Mode " + std::to_string(id) + " needs a name");
+  }
+  if ((definition.self_loops & ~kActingStates) != 0) {
+    return std::unexpected("Only acting states can loop, mode: " + definition.name);
+  }
+  if ((definition.self_loops & ~definition.available) != 0) {
+    return std::unexpected("Looping states must be available, mode: " + definition.name);
+  }
+  const ModeDefinition * same_name = find(std::string_view(definition.name));
+  if (same_name != nullptr && same_name->mode != definition.mode) {
+    return std::unexpected("Duplicate mode name: " + definition.name);
+  }
+
+  auto index = static_cast<std::size_t>(id);
+  if (index >= index_.size()) {
+    index_.resize(index + 1, -1);
+  }
+  if (index_[index] >= 0) {
+    modes_[index_[index]] = std::move(definition);
+  } else {
+    index_[index] = static_cast<std::int32_t>(modes_.size());
+    modes_.push_back(std::move(definition));
+  }
+  return true;
+}
+
+const ModeDefinition * ModeRegistry::find(std::string_view name) const
+{
+  for (const auto & mode : modes_) {
+    if (mode.name == name) {
+      return &mode;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace packml_sm
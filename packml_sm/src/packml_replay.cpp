@@ -0,0 +1,131 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replays a transition journal through a table state machine and reports whether the machine
+// reproduces it.
+//
+//   packml_replay [--continuous] [--modes <registry.yaml>] [--print] <journal>
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "packml_sm/journal.hpp"
+#include "packml_sm/mode_registry.hpp"
+#include "packml_sm/replay.hpp"
+#include "packml_sm/table_state_machine.hpp"
+
+namespace
+{
+
+void usage()
+{
+  std::cerr << "usage: packml_replay [--continuous] [--modes <registry.yaml>] [--print] <journal>\n";
+}
+
+void print(const packml_sm::JournalRecord & record)
+{
+  using Type = packml_sm::JournalRecord::Type;
+  std::cout << record.time.count() << " ";
+  switch (record.type) {
+    case Type::COMMAND:
+      std::cout << "command " << record.command << (record.accepted ? " accepted" : " rejected") <<
+        " in " << record.state;
+      break;
+    case Type::STATE_ENTERED:
+      std::cout << "entered " << record.state;
+      break;
+    case Type::MODE_CHANGED:
+      std::cout << "mode " << record.mode << (record.accepted ? " accepted" : " rejected") <<
+        " in " << record.state;
+      break;
+    case Type::COMPLETED:
+      std::cout << "completed " << record.state << " with " << record.code;
+      break;
+  }
+  std::cout << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char * argv[])
+{
+  bool continuous = false;
+  bool print_records = false;
+  std::string modes;
+  std::string path;
+  for (int ii = 1; ii < argc; ++ii) {
+    std::string arg = argv[ii];
+    if (arg == "--continuous") {
+      continuous = true;
+    } else if (arg == "--print") {
+      print_records = true;
+    } else if (arg == "--modes" && ii + 1 < argc) {
+      modes = argv[++ii];
+    } else if (path.empty() && !arg.starts_with("--")) {
+      path = arg;
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (path.empty()) {
+    usage();
+    return 2;
+  }
+
+  auto reader = packml_sm::JournalReader::open(path);
+  if (!reader) {
+    std::cerr << reader.error() << "\n";
+    return 2;
+  }
+  auto records = reader->readAll();
+  if (reader->truncated()) {
+    std::cerr << "Journal ends in an incomplete record, replaying the complete ones\n";
+  }
+  if (print_records) {
+    for (const auto & record : records) {
+      print(record);
+    }
+  }
+
+  auto machine = continuous ? packml_sm::TableStateMachine::continuousCycleSM() :
+    packml_sm::TableStateMachine::singleCycleSM();
+  if (!modes.empty()) {
+    auto registry = packml_sm::ModeRegistry::load(modes);
+    if (!registry) {
+      std::cerr << registry.error() << "\n";
+      return 2;
+    }
+    machine->setModeRegistry(std::make_shared<const packml_sm::ModeRegistry>(std::move(*registry)));
+  }
+
+  auto report = packml_sm::replayJournal(records, *machine, std::make_shared<packml_sm::VirtualClock>());
+  if (!report) {
+    std::cerr << report.error() << "\n";
+    return 2;
+  }
+  std::cout << report->records << " records, " << report->transitions << " transitions over " <<
+    std::chrono::duration<double>(report->journal_time).count() << " s replayed in " <<
+    std::chrono::duration<double, std::micro>(report->wall_time).count() << " us (" <<
+    report->perTransition().count() << " ns per transition)\n";
+  if (!report->reproduced()) {
+    std::cout << report->divergences << " divergences, first at " << report->first_divergence << "\n";
+    return 1;
+  }
+  std::cout << "Journal reproduced\n";
+  return 0;
+}
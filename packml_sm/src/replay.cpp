@@ -0,0 +1,112 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/replay.hpp"
+
+#include <sstream>
+#include <utility>
+
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+std::expected<ReplayReport, std::string> replayJournal(
+  const std::vector<JournalRecord> & records, TableStateMachine & machine,
+  std::shared_ptr<VirtualClock> clock)
+{
+  if (!clock || !machine.setClock(clock)) {
+    return std::unexpected<std::string>("Replay needs a clock and an inactive state machine");
+  }
+  // Only the recorded results leave the acting states
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    auto state = static_cast<State>(ii);
+    if (isActingState(state)) {
+      machine.setOperationDelay(state, std::chrono::milliseconds::max());
+    }
+    machine.setWatchdog(state, std::chrono::milliseconds(0));
+  }
+
+  ReplayReport report;
+  auto diverged = [&report](std::size_t index, const std::string & what) {
+      if (report.divergences++ == 0) {
+        report.first_divergence = "record " + std::to_string(index) + ": " + what;
+      }
+    };
+
+  auto started = std::chrono::steady_clock::now();
+  auto origin = clock->now();
+  for (std::size_t ii = 0; ii < records.size(); ++ii) {
+    const JournalRecord & record = records[ii];
+    auto at = origin + (record.time - records.front().time);
+    if (at > clock->now()) {
+      clock->advanceTo(at);
+    }
+
+    switch (record.type) {
+      case JournalRecord::Type::COMMAND: {
+          bool accepted = machine.changeState(record.command).has_value();
+          if (accepted != record.accepted) {
+            std::stringstream msg;
+            msg << "command " << record.command << (record.accepted ? " was accepted" : " was rejected") <<
+              " in state " << record.state << ", not in the replay";
+            diverged(ii, msg.str());
+          }
+          break;
+        }
+      case JournalRecord::Type::MODE_CHANGED: {
+          bool accepted = machine.changeMode(record.mode).has_value();
+          if (accepted != record.accepted) {
+            std::stringstream msg;
+            msg << "switch to mode " << record.mode << (record.accepted ? " was accepted" : " was rejected") <<
+              ", not in the replay";
+            diverged(ii, msg.str());
+          }
+          break;
+        }
+      case JournalRecord::Type::COMPLETED:
+        if (!machine.completeState(record.code)) {
+          std::stringstream msg;
+          msg << "operation result " << record.code << " of " << record.state <<
+            " without an acting state in the replay";
+          diverged(ii, msg.str());
+        }
+        break;
+      case JournalRecord::Type::STATE_ENTERED: {
+          // The first state entered is the activation of the recorded machine
+          if (!machine.isActive()) {
+            machine.activate();
+          }
+          State current = machine.getCurrentState();
+          if (current == record.state) {
+            ++report.transitions;
+          } else {
+            std::stringstream msg;
+            msg << "entered " << record.state << ", the replay is in " << current;
+            diverged(ii, msg.str());
+          }
+          break;
+        }
+    }
+    ++report.records;
+  }
+  report.wall_time = std::chrono::steady_clock::now() - started;
+  if (!records.empty()) {
+    report.journal_time = records.back().time - records.front().time;
+  }
+  return report;
+}
+
+}  // namespace packml_sm
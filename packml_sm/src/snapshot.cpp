@@ -0,0 +1,231 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/snapshot.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "packml_sm/log.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace packml_sm
+{
+
+namespace
+{
+
+constexpr std::uint32_t kSnapshotMagic = 0x4e534b50;  // "PKSN"
+constexpr std::uint16_t kSnapshotVersion = 1;
+constexpr std::uint32_t kNoMode = 0xffffffff;
+
+/**
+* @brief One saved snapshot, every field is 8 byte aligned so the layout has no padding
+*/
+struct Slot
+{
+  std::uint64_t sequence;
+  std::int64_t saved_at_ns;
+  std::uint32_t state;
+  std::uint32_t mode;
+  std::int64_t time_ns[kStateCount];
+  std::uint64_t entries[kStateCount];
+  std::uint64_t abort_count;
+  std::int64_t abort_last_ns;
+  std::int64_t abort_max_ns;
+  std::int64_t abort_total_ns;
+  std::uint64_t checksum;
+};
+
+static_assert(std::is_trivially_copyable_v<Slot> && std::is_standard_layout_v<Slot>);
+
+// FNV-1a over the slot without its checksum, a torn write does not match
+std::uint64_t checksum(const Slot & slot)
+{
+  auto bytes = reinterpret_cast<const unsigned char *>(&slot);
+  std::uint64_t hash = 14695981039346656037ull;
+  for (std::size_t ii = 0; ii < offsetof(Slot, checksum); ++ii) {
+    hash = (hash ^ bytes[ii]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+bool valid(const Slot & slot)
+{
+  return slot.sequence != 0 && slot.checksum == checksum(slot) &&
+         slot.state < kStateCount && slot.state != toIndex(State::UNDEFINED);
+}
+
+std::string errnoMessage(const std::string & what, const std::string & path)
+{
+  return what + " " + path + ": " + std::strerror(errno);
+}
+
+}  // namespace
+
+struct SnapshotFile::Layout
+{
+  std::uint32_t magic;
+  std::uint16_t version;
+  std::uint16_t state_count;
+  std::uint64_t slot_size;
+  Slot slots[2];
+};
+
+State restartState(const std::optional<MachineSnapshot> & saved, RestartPolicy policy)
+{
+  if (!saved || policy != RestartPolicy::RESUME_WAIT_STATE || !isWaitState(saved->state)) {
+    return State::ABORTED;
+  }
+  return saved->state;
+}
+
+std::expected<std::shared_ptr<SnapshotFile>, std::string> SnapshotFile::open(const std::string & path)
+{
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return std::unexpected(errnoMessage("Cannot open snapshot", path));
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0) {
+    auto message = errnoMessage("Cannot stat snapshot", path);
+    ::close(fd);
+    return std::unexpected(message);
+  }
+  bool created = info.st_size == 0;
+  if (!created && static_cast<std::size_t>(info.st_size) != sizeof(Layout)) {
+    PACKML_LOG_WARN("Snapshot {} has an unexpected size, starting it over", path);
+  }
+  if (static_cast<std::size_t>(info.st_size) != sizeof(Layout) &&
+    ::ftruncate(fd, sizeof(Layout)) != 0)
+  {
+    auto message = errnoMessage("Cannot resize snapshot", path);
+    ::close(fd);
+    return std::unexpected(message);
+  }
+  void * mapping = ::mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    auto message = errnoMessage("Cannot map snapshot", path);
+    ::close(fd);
+    return std::unexpected(message);
+  }
+
+  auto layout = static_cast<Layout *>(mapping);
+  if (!created && layout->magic != 0 && layout->magic != kSnapshotMagic) {
+    ::munmap(mapping, sizeof(Layout));
+    ::close(fd);
+    return std::unexpected("Not a state machine snapshot: " + path);
+  }
+  if (layout->magic != kSnapshotMagic || layout->version != kSnapshotVersion ||
+    layout->state_count != kStateCount || layout->slot_size != sizeof(Slot))
+  {
+    if (!created) {
+      PACKML_LOG_WARN("Snapshot {} was written by another version, starting it over", path);
+    }
+    std::memset(static_cast<void *>(layout), 0, sizeof(Layout));
+    layout->magic = kSnapshotMagic;
+    layout->version = kSnapshotVersion;
+    layout->state_count = kStateCount;
+    layout->slot_size = sizeof(Slot);
+  }
+  return std::shared_ptr<SnapshotFile>(new SnapshotFile(path, fd, layout));
+}
+
+SnapshotFile::SnapshotFile(std::string path, int fd, Layout * layout)
+: path_(std::move(path)), fd_(fd), layout_(layout)
+{
+  for (const auto & slot : layout_->slots) {
+    if (valid(slot)) {
+      sequence_ = std::max(sequence_, slot.sequence);
+    }
+  }
+}
+
+SnapshotFile::~SnapshotFile()
+{
+  ::munmap(layout_, sizeof(Layout));
+  ::close(fd_);
+}
+
+std::optional<MachineSnapshot> SnapshotFile::load() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Slot * last = nullptr;
+  for (const auto & slot : layout_->slots) {
+    if (valid(slot) && (last == nullptr || slot.sequence > last->sequence)) {
+      last = &slot;
+    }
+  }
+  if (last == nullptr) {
+    return std::nullopt;
+  }
+
+  MachineSnapshot snapshot;
+  snapshot.state = static_cast<State>(last->state);
+  if (last->mode != kNoMode) {
+    snapshot.mode = static_cast<ModeType>(last->mode);
+  }
+  snapshot.times.current = snapshot.state;
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    snapshot.times.time[ii] = std::chrono::nanoseconds(last->time_ns[ii]);
+    snapshot.times.entries[ii] = last->entries[ii];
+  }
+  snapshot.abort_latency.count = last->abort_count;
+  snapshot.abort_latency.last = std::chrono::nanoseconds(last->abort_last_ns);
+  snapshot.abort_latency.max = std::chrono::nanoseconds(last->abort_max_ns);
+  snapshot.abort_latency.total = std::chrono::nanoseconds(last->abort_total_ns);
+  snapshot.saved_at = std::chrono::system_clock::time_point(
+    std::chrono::duration_cast<std::chrono::system_clock::duration>(
+      std::chrono::nanoseconds(last->saved_at_ns)));
+  return snapshot;
+}
+
+void SnapshotFile::save(const MachineSnapshot & snapshot)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The slot of the previous save stays intact until this one is complete
+  Slot & slot = layout_->slots[(sequence_ + 1) % 2];
+  slot.sequence = ++sequence_;
+  slot.saved_at_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    snapshot.saved_at.time_since_epoch()).count();
+  slot.state = static_cast<std::uint32_t>(toIndex(snapshot.state));
+  slot.mode = snapshot.mode ? static_cast<std::uint32_t>(*snapshot.mode) : kNoMode;
+  for (std::size_t ii = 0; ii < kStateCount; ++ii) {
+    slot.time_ns[ii] = snapshot.times.time[ii].count();
+    slot.entries[ii] = snapshot.times.entries[ii];
+  }
+  slot.abort_count = snapshot.abort_latency.count;
+  slot.abort_last_ns = snapshot.abort_latency.last.count();
+  slot.abort_max_ns = snapshot.abort_latency.max.count();
+  slot.abort_total_ns = snapshot.abort_latency.total.count();
+  slot.checksum = checksum(slot);
+}
+
+bool SnapshotFile::sync()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return ::msync(layout_, sizeof(Layout), MS_SYNC) == 0;
+}
+
+}  // namespace packml_sm
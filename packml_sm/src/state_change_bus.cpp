@@ -0,0 +1,230 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/state_change_bus.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <iterator>
+#include <utility>
+
+namespace packml_sm
+{
+
+/**
+* @brief Ring of one subscription. Position p lives in slot p & mask; the version of a slot is
+* 2p + 2 once p is written and odd while it is written, so a reader can tell a slot it was lapped
+* on under DROP_OLDEST.
+*/
+struct StateChangeBus::Queue
+{
+  struct Slot
+  {
+    std::atomic<std::uint64_t> version{0};
+    std::atomic<State> state{State::UNDEFINED};
+    std::atomic<std::uint64_t> sequence{0};
+    std::atomic<std::chrono::steady_clock::rep> entered{0};
+  };
+
+  Queue(std::size_t capacity, OverflowPolicy overflow)
+  : slots(std::bit_ceil(std::max<std::size_t>(capacity, 2))), mask(slots.size() - 1),
+    overflow(overflow)
+  {
+  }
+
+  // Producer side, called with the publishing thread serialized by the state machine
+  void push(State state, std::uint64_t sequence, std::chrono::steady_clock::time_point entered)
+  {
+    std::uint64_t position = head.load(std::memory_order_relaxed);
+    if (overflow == OverflowPolicy::DROP_NEWEST &&
+      position - tail.load(std::memory_order_acquire) > mask)
+    {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    Slot & slot = slots[position & mask];
+    slot.version.store(2 * position + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.state.store(state, std::memory_order_relaxed);
+    slot.sequence.store(sequence, std::memory_order_relaxed);
+    slot.entered.store(entered.time_since_epoch().count(), std::memory_order_relaxed);
+    slot.version.store(2 * position + 2, std::memory_order_release);
+    head.store(position + 1, std::memory_order_release);
+    wake();
+  }
+
+  // Consumer side, called by one thread at a time
+  std::size_t pop(const std::function<void(const StateChange &)> & callback)
+  {
+    std::size_t delivered = 0;
+    std::uint64_t position = tail.load(std::memory_order_relaxed);
+    std::uint64_t end = head.load(std::memory_order_acquire);
+    while (!closed.load(std::memory_order_acquire)) {
+      if (position == end) {
+        end = head.load(std::memory_order_acquire);
+        if (position == end) {
+          break;
+        }
+      }
+      if (end - position > slots.size()) {
+        // Lapped by the producer, only possible under DROP_OLDEST
+        dropped.fetch_add(end - slots.size() - position, std::memory_order_relaxed);
+        position = end - slots.size();
+      }
+      const Slot & slot = slots[position & mask];
+      std::uint64_t version = slot.version.load(std::memory_order_acquire);
+      StateChange change;
+      change.state = slot.state.load(std::memory_order_relaxed);
+      change.sequence = slot.sequence.load(std::memory_order_relaxed);
+      change.entered = std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(slot.entered.load(std::memory_order_relaxed)));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (version != 2 * position + 2 ||
+        slot.version.load(std::memory_order_relaxed) != version)
+      {
+        // Overwritten while it was read, the lap check above skips it once head moves on
+        end = head.load(std::memory_order_acquire);
+        continue;
+      }
+      ++position;
+      tail.store(position, std::memory_order_release);
+      callback(change);
+      ++delivered;
+    }
+    return delivered;
+  }
+
+  bool empty() const
+  {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_relaxed);
+  }
+
+  void wake()
+  {
+    signal.fetch_add(1, std::memory_order_release);
+    signal.notify_all();
+  }
+
+  void wait()
+  {
+    std::uint32_t seen = signal.load(std::memory_order_acquire);
+    if (empty() && !closed.load(std::memory_order_acquire)) {
+      signal.wait(seen, std::memory_order_acquire);
+    }
+  }
+
+  std::vector<Slot> slots;
+  const std::size_t mask;
+  const OverflowPolicy overflow;
+
+  alignas(64) std::atomic<std::uint64_t> head{0};
+  alignas(64) std::atomic<std::uint64_t> tail{0};
+  alignas(64) std::atomic<std::uint64_t> dropped{0};
+  std::atomic<std::uint32_t> signal{0};
+  std::atomic<bool> closed{false};
+};
+
+
+StateChangeBus::Subscription::Subscription(std::shared_ptr<Queue> queue)
+: queue_(std::move(queue))
+{
+}
+
+StateChangeBus::Subscription::~Subscription()
+{
+  queue_->closed.store(true, std::memory_order_release);
+  queue_->wake();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+std::size_t StateChangeBus::Subscription::poll(
+  const std::function<void(const StateChange &)> & callback)
+{
+  return queue_->pop(callback);
+}
+
+void StateChangeBus::Subscription::wait()
+{
+  queue_->wait();
+}
+
+std::uint64_t StateChangeBus::Subscription::dropped() const
+{
+  return queue_->dropped.load(std::memory_order_relaxed);
+}
+
+
+StateChangeBus::StateChangeBus()
+: queues_(std::make_shared<const QueueList>())
+{
+}
+
+StateChangeBus::~StateChangeBus() = default;
+
+std::unique_ptr<StateChangeBus::Subscription> StateChangeBus::subscribe(
+  std::size_t capacity, OverflowPolicy overflow)
+{
+  return std::make_unique<Subscription>(add(capacity, overflow));
+}
+
+std::unique_ptr<StateChangeBus::Subscription> StateChangeBus::subscribe(
+  std::function<void(const StateChange &)> callback, std::size_t capacity,
+  OverflowPolicy overflow)
+{
+  auto subscription = std::make_unique<Subscription>(add(capacity, overflow));
+  subscription->thread_ = std::jthread(
+    [queue = subscription->queue_, callback = std::move(callback)] {
+      while (!queue->closed.load(std::memory_order_acquire)) {
+        queue->pop(callback);
+        queue->wait();
+      }
+    });
+  return subscription;
+}
+
+void StateChangeBus::publish(State state)
+{
+  std::shared_ptr<const QueueList> queues = queues_.load(std::memory_order_acquire);
+  std::uint64_t sequence = ++sequence_;
+  auto entered = std::chrono::steady_clock::now();
+  for (const auto & queue : *queues) {
+    if (!queue->closed.load(std::memory_order_relaxed)) {
+      queue->push(state, sequence, entered);
+    }
+  }
+}
+
+std::shared_ptr<StateChangeBus::Queue> StateChangeBus::add(
+  std::size_t capacity, OverflowPolicy overflow)
+{
+  auto queue = std::make_shared<Queue>(capacity, overflow);
+  // Copy on write, serialized between subscribers only: publish() loads the list without a lock
+  // and keeps iterating the one it loaded. Subscriptions closed since the last subscribe are
+  // dropped here.
+  std::lock_guard<std::mutex> lock(subscribe_mutex_);
+  std::shared_ptr<const QueueList> current = queues_.load(std::memory_order_relaxed);
+  auto queues = std::make_shared<QueueList>();
+  std::copy_if(
+    current->begin(), current->end(), std::back_inserter(*queues),
+    [](const auto & existing) {return !existing->closed.load(std::memory_order_relaxed);});
+  queues->push_back(queue);
+  queues_.store(std::move(queues), std::memory_order_release);
+  return queue;
+}
+
+}  // namespace packml_sm
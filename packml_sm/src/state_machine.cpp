@@ -15,7 +15,10 @@
 
 #include "packml_sm/state_machine.hpp"
 
+#include <algorithm>
+
 #include "packml_sm/common.hpp"
+#include "packml_sm/log.hpp"
 #include "packml_sm/states/wait_state.hpp"
 #include "packml_sm/states_generator.hpp"
 #include "packml_sm/transitions/cmd_transition.hpp"
@@ -24,193 +27,55 @@
 
 // #include "packml_sm/events.hpp"
 #include "packml_sm/states/acting_state.hpp"
+#include <chrono>
 #include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
-#include <thread>
+#include <utility>
 
 namespace packml_sm {
 
-bool StateMachineInterface::start() {
-  return _start();
-  // return true;
-  // switch (State(getCurrentState())) {
-  // case State::IDLE:
-  //   _start();
-  //   return true;
-  // default:
-  //   std::cout << "Ignoring START command in current state: "
-  //             << getCurrentState() << std::endl;
-  //   return false;
-  // }
-}
-
-bool StateMachineInterface::clear() {
-  return _clear();
-  // return true;
-  // switch (State(getCurrentState())) {
-  // case State::ABORTED:
-  //   return _clear();
-  //   return true;
-  // default:
-  //   std::cout << "Ignoring CLEAR command in current state: "
-  //             << getCurrentState() << std::endl;
-  //   return false;
-  // }
-}
-
-bool StateMachineInterface::reset() {
-  return _reset();
-  // return true;
-  // switch (State(getCurrentState())) {
-  // case State::COMPLETE:
-  // case State::STOPPED:
-  //   _reset();
-  //   return true;
-  // default:
-  //   std::cout << "Ignoring RESET command in current state: "
-  //             << getCurrentState() << std::endl;
-  //   return false;
-  // }
-}
-
-bool StateMachineInterface::hold() {
-  return _hold();
-  // return true;
-  // switch (State(getCurrentState())) {
-  // case State::EXECUTE:
-  //   _hold();
-  //   return true;
-  // default:
-  //   std::cout << "Ignoring HOLD command in current state: " << getCurrentState()
-  //             << std::endl;
-  //   return false;
-  // }
-}
-
-bool StateMachineInterface::unhold() {
-  return _unhold();
-  // return true;
-  // switch (State(getCurrentState())) {
-  // case State::HELD:
-  //   _unhold();
-  //   return true;
-  // default:
-  //   std::cout << "Ignoring HELD command in current state: " << getCurrentState()
-  //             << std::endl;
-  //   return false;
-  // }
-}
-
-bool StateMachineInterface::suspend() {
-  return _suspend();
-  // return true;
-  // switch (State(getCurrentState())) {
-  // case State::EXECUTE:
-  //   _suspend();
-  //   return true;
-  // default:
-  //   std::cout << "Ignoring SUSPEND command in current state: "
-  //             << getCurrentState() << std::endl;
-  //   return false;
-  // }
-}
-
-bool StateMachineInterface::unsuspend() {
-  return _unsuspend();
-  // return true;
-  // switch (State(getCurrentState())) {
-  // case State::SUSPENDED:
-  //   _unsuspend();
-  //   return true;
-  // default:
-  //   std::cout << "Ignoring UNSUSPEND command in current state: "
-  //             << getCurrentState() << std::endl;
-  //   return false;
-  // }
-}
-
-bool StateMachineInterface::stop() {
-  return _stop();
-  // return true;
-  // switch (State(getCurrentState())) {
-  // // case StatesEnum::STOPPABLE:
-  // case State::STARTING:
-  // case State::IDLE:
-  // case State::SUSPENDED:
-  // case State::EXECUTE:
-  // case State::HOLDING:
-  // case State::HELD:
-  // case State::SUSPENDING:
-  // case State::UNSUSPENDING:
-  // case State::UNHOLDING:
-  // case State::COMPLETING:
-  // case State::COMPLETE:
-  //   _stop();
-  //   return true;
-  // default:
-  //   std::cout << "Ignoring STOP command in current state: " << getCurrentState()
-  //             << std::endl;
-  //   return false;
-  // }
-}
-
-bool StateMachineInterface::abort() {
-  return _abort();
-  // return true;
-  // switch (State(getCurrentState())) {
-  // // case StatesEnum::ABORTABLE:
-  // case State::STOPPED:
-  // case State::STARTING:
-  // case State::IDLE:
-  // case State::SUSPENDED:
-  // case State::EXECUTE:
-  // case State::HOLDING:
-  // case State::HELD:
-  // case State::SUSPENDING:
-  // case State::UNSUSPENDING:
-  // case State::UNHOLDING:
-  // case State::COMPLETING:
-  // case State::COMPLETE:
-  // case State::CLEARING:
-  // case State::STOPPING:
-  //   _abort();
-  //   return true;
-  // default:
-  //   std::cout << "Ignoring ABORT command in current state: "
-  //             << getCurrentState() << std::endl;
-  //   return false;
-  // }
-}
-
 QCoreApplication *a;
 void init(int argc, char *argv[]) {
   if (NULL == QCoreApplication::instance()) {
-    printf("Starting QCoreApplication\n");
+    PACKML_LOG_INFO("Starting QCoreApplication");
     a = new QCoreApplication(argc, argv);
   }
 }
 
 bool StateMachine::activate() {
-  printf("Checking if QCore application is running\n");
+  PACKML_LOG_INFO("Checking if QCore application is running");
   if (NULL == QCoreApplication::instance()) {
-    printf("QCore application is not running, QCoreApplication must be created "
-           "in main");
-    printf(" thread for state machine to run\n");
+    PACKML_LOG_ERROR("QCore application is not running, QCoreApplication must be created in main "
+                     "thread for state machine to run");
     return false;
   } else {
-    printf("Moving state machine to Qcore thread\n");
-    sm_internal_.moveToThread(QCoreApplication::instance()->thread());
-    this->moveToThread(QCoreApplication::instance()->thread());
-    sm_internal_.start();
-    printf("State machine thread created and started\n");
-    return true;
+    PACKML_LOG_INFO("Moving state machine to Qcore thread");
+    return activate(QCoreApplication::instance()->thread());
   }
 }
 
+bool StateMachine::activate(QThread * thread) {
+  if (thread == nullptr) {
+    PACKML_LOG_ERROR("Cannot activate state machine without a thread");
+    return false;
+  }
+  if (std::exchange(restore_pending_, false) && restart_policy_ != RestartPolicy::COLD) {
+    if (auto saved = snapshot_file_->load()) {
+      restore(*saved);
+    }
+  }
+  sm_internal_.moveToThread(thread);
+  this->moveToThread(thread);
+  sm_internal_.start();
+  PACKML_LOG_INFO("State machine thread created and started");
+  return true;
+}
+
 bool StateMachine::deactivate() {
-  printf("Deactivating state machine\n");
+  PACKML_LOG_INFO("Deactivating state machine");
   sm_internal_.stop();
   return true;
 }
@@ -221,7 +86,6 @@ std::shared_ptr<StateMachine> StateMachine::singleCycleSM() {
   SS->init();
   // SS->changeMode(ModeType::MANUAL);
   return SS;
-  // return std::shared_ptr<StateMachine>(new SingleCycle());
 }
 
 std::shared_ptr<StateMachine> StateMachine::continuousCycleSM() {
@@ -229,7 +93,21 @@ std::shared_ptr<StateMachine> StateMachine::continuousCycleSM() {
   CS->init();
   // CS->changeMode(ModeType::MANUAL);
   return CS;
-  // return std::shared_ptr<StateMachine>(new ContinuousCycle());
+}
+
+void StateMachine::form(const char * name) {
+  PACKML_LOG_INFO("Forming {} state machine (states + transitions)", name);
+  gen->generate_all_packml_states(shared_from_this(), table_);
+
+  // Add parent states to state machine
+  // All other states are added 'automatically' because they are under the superstate "abortable"
+  sm_internal_.addState(gen->states[SuperState::ABORTABLE]);
+  sm_internal_.addState(gen->states[State::ABORTED]);
+  sm_internal_.addState(gen->states[State::ABORTING]);
+
+  sm_internal_.setInitialState(gen->states[State::ABORTED]);
+
+  PACKML_LOG_INFO("State machine formed");
 }
 
 /*
@@ -248,8 +126,15 @@ std::shared_ptr<StateMachine> StateMachine::continuousCycleSM() {
  * that reference/utilize many of the same transitions/states (maybe)
  */
 
-StateMachine::StateMachine() : gen(std::make_shared<StatesGenerator>()) {
-  printf("State machine constructor\n");
+StateMachine::StateMachine(const TransitionTable & table)
+: gen(std::make_shared<StatesGenerator>()),
+  table_(table),
+  mode_graphs_(std::make_shared<const ModeGraphs>(ModeRegistry::global(), table_)),
+  graph_(&mode_graphs_->unmoded()),
+  clock_(Clock::system()),
+  sm_internal_(event_pool_, *clock_, table_) {
+  PACKML_LOG_INFO("State machine constructor");
+  sm_internal_.setModeGraph(graph_);
   // printf("Constructiong super states\n");
   abortable_ = PackmlSuperState::Abortable();
   stoppable_ = PackmlSuperState::Stoppable(abortable_);
@@ -314,33 +199,231 @@ StateMachine::StateMachine() : gen(std::make_shared<StatesGenerator>()) {
   connect(execute_, SIGNAL(stateEntered(State, QString)), this,
           SLOT(setState(State, QString))); // NOLINT(whitespace/comma)
 
-  printf("Adding states to state machine\n");
+  // Puts back the initial states that a resumed start changed
+  connect(&sm_internal_, &QStateMachine::started, this, &StateMachine::restoreInitialStates);
+
+  PACKML_LOG_INFO("Adding states to state machine");
   sm_internal_.addState(abortable_);
   sm_internal_.addState(aborted_);
   sm_internal_.addState(aborting_);
 }
 
+void StateMachine::restore(const MachineSnapshot & saved) {
+  state_times_.restore(saved.times);
+  {
+    std::lock_guard<std::mutex> lock(abort_latency_mutex_);
+    abort_latency_ = saved.abort_latency;
+  }
+  if (saved.mode) {
+    // No mode is set before the first activation, so the switch is allowed in any state
+    auto switched = changeMode(*saved.mode);
+    if (!switched) {
+      PACKML_LOG_WARN("Mode of the snapshot not restored: {}", switched.error());
+    }
+  }
+
+  State initial = restartState(saved, restart_policy_);
+  PACKML_LOG_INFO("Restored snapshot {}, saved in state {}, starting in {}",
+    snapshot_file_->path(), saved.state, initial);
+  if (initial == State::ABORTED) {
+    return;
+  }
+  // QStateMachine enters a nested state through the initial states of its ancestors
+  QState * child = gen->states[initial];
+  for (QState * parent = child->parentState(); parent != nullptr; parent = parent->parentState()) {
+    resume_initial_states_.emplace_back(parent, parent->initialState());
+    parent->setInitialState(child);
+    child = parent;
+  }
+}
+
+void StateMachine::restoreInitialStates() {
+  for (auto & [state, initial] : resume_initial_states_) {
+    state->setInitialState(initial);
+  }
+  resume_initial_states_.clear();
+}
+
+void StateMachine::saveSnapshot(State state) {
+  MachineSnapshot snapshot;
+  snapshot.state = state;
+  {
+    std::lock_guard<std::mutex> lock(mode_mutex_);
+    if (graph_->definition != nullptr) {
+      snapshot.mode = graph_->definition->mode;
+    }
+  }
+  snapshot.times = state_times_.snapshot(clock_->now());
+  {
+    std::lock_guard<std::mutex> lock(abort_latency_mutex_);
+    snapshot.abort_latency = abort_latency_;
+  }
+  snapshot.saved_at = std::chrono::system_clock::now();
+  snapshot_file_->save(snapshot);
+}
+
+StateMachine::~StateMachine() {
+  event_pool_.setBusyListener(nullptr);
+}
+
 // Callback from QT state machine when state changed
 void StateMachine::setState(State value, QString name) {
-  std::string nameUtf = name.toStdString();
-  std::cout << "State changed(event) to: " << nameUtf << "(" << value << ")"
-            << std::endl;
+  auto now = clock_->now();
+  state_times_.enter(value, now);
+  if (value == State::ABORTED) {
+    if (auto selected = sm_internal_.takeAbortSelected()) {
+      std::lock_guard<std::mutex> lock(abort_latency_mutex_);
+      abort_latency_.add(now - *selected);
+    }
+  }
+  PACKML_LOG_INFO("State changed(event) to: {}", value);
   state_value_ = value;
   state_name_ = name;
+  // Super states report State::UNDEFINED, their nested state is saved when it is entered
+  if (value != State::UNDEFINED) {
+    if (journal_) {
+      journal_->append(JournalRecord::ofEntry(now.time_since_epoch(), value));
+    }
+    if (snapshot_file_) {
+      saveSnapshot(value);
+    }
+  }
   on_state_changed(value, name);
+  if (value != State::UNDEFINED) {
+    notifyStateEntered(value);
+  }
   // emit stateChanged(value, name);
 }
 
 bool StateMachine::setExecute(std::function<int()> execute_method) {
-  printf("Initializing state machine with EXECUTE function pointer\n");
+  PACKML_LOG_INFO("Initializing state machine with EXECUTE function pointer");
   return execute_->setOperationMethod(execute_method);
 }
 
 bool StateMachine::setResetting(std::function<int()> resetting_method) {
-  printf("Initializing state machine with RESETTING function pointer\n");
+  PACKML_LOG_INFO("Initializing state machine with RESETTING function pointer");
   return resetting_->setOperationMethod(resetting_method);
 }
 
+bool StateMachine::setCancellableOperation(State state, CancellableOperation method) {
+  auto acting = dynamic_cast<ActingState *>(gen->states.get(state));
+  if (acting == nullptr) {
+    PACKML_LOG_WARN("Cannot bind an operation to {}, it is not an acting state", state);
+    return false;
+  }
+  return acting->setCancellableOperationMethod(std::move(method));
+}
+
+void StateMachine::setExitTimeout(std::chrono::milliseconds timeout) {
+  gen->states.forEach([timeout](std::string_view /*name*/, PackmlState * item) {
+      if (auto acting = dynamic_cast<ActingState *>(item)) {
+        acting->setExitTimeout(timeout);
+      }
+    });
+}
+
+bool StateMachine::setWatchdog(State state, std::chrono::milliseconds timeout) {
+  auto found = gen->states.get(state);
+  if (found == nullptr) {
+    PACKML_LOG_WARN("Cannot set a watchdog on {}, the state does not exist", state);
+    return false;
+  }
+  found->setWatchdog(std::max(timeout, std::chrono::milliseconds(0)));
+  return true;
+}
+
+bool StateMachine::setOperationDelay(State state, std::chrono::milliseconds delay) {
+  auto acting = dynamic_cast<ActingState *>(gen->states.get(state));
+  if (acting == nullptr) {
+    PACKML_LOG_WARN("Cannot set a delay on {}, it is not an acting state", state);
+    return false;
+  }
+  return acting->setDelay(std::max(delay, std::chrono::milliseconds(0)));
+}
+
+bool StateMachine::setClock(std::shared_ptr<Clock> clock) {
+  if (!clock || isActive()) {
+    return false;
+  }
+  clock_ = std::move(clock);
+  sm_internal_.setClock(*clock_);
+  if (clock_->simulated()) {
+    // Posted events stay outstanding until the state machine thread processed them, a step of the
+    // clock has settled once every transition it caused was taken. Queued commands are counted by
+    // sm_internal_ until they are posted.
+    event_pool_.setBusyListener([clock = clock_.get()](bool busy) {
+        if (busy) {
+          clock->beginWork();
+        } else {
+          clock->endWork();
+        }
+      });
+  } else {
+    event_pool_.setBusyListener(nullptr);
+  }
+  return true;
+}
+
+bool StateMachine::setSnapshotFile(std::shared_ptr<SnapshotFile> file, RestartPolicy policy) {
+  if (!file || isActive()) {
+    return false;
+  }
+  snapshot_file_ = std::move(file);
+  restart_policy_ = policy;
+  restore_pending_ = true;
+  return true;
+}
+
+bool StateMachine::setJournal(std::shared_ptr<JournalWriter> journal) {
+  if (isActive()) {
+    return false;
+  }
+  journal_ = std::move(journal);
+  sm_internal_.setJournal(journal_.get());
+  return true;
+}
+
+bool StateMachine::setModeRegistry(std::shared_ptr<const ModeRegistry> registry) {
+  if (!registry) {
+    return false;
+  }
+  auto graphs = std::make_shared<const ModeGraphs>(std::move(registry), table_);
+  std::lock_guard<std::mutex> lock(mode_mutex_);
+  const ModeGraph * graph = &graphs->unmoded();
+  if (graph_->definition != nullptr) {
+    graph = graphs->find(graph_->definition->mode);
+    if (graph == nullptr) {
+      PACKML_LOG_WARN("Mode registry lacks the current mode {}", graph_->definition->name);
+      return false;
+    }
+    gen->mode.store(graph->definition, std::memory_order_release);
+  }
+  sm_internal_.setModeGraph(graph);
+  // Transitions read the installed mode definition on the state machine thread, while they test
+  // an event, and the command drain reads the installed graph. The replaced graphs are released by
+  // a call queued behind the event or drain being processed, or with the queue when the state
+  // machine is destroyed first.
+  QMetaObject::invokeMethod(&sm_internal_, [retired = std::move(mode_graphs_)]() {}, Qt::QueuedConnection);
+  mode_graphs_ = std::move(graphs);
+  graph_ = graph;
+  return true;
+}
+
+
+std::shared_ptr<const ModeGraphs> StateMachine::getModeGraphs() {
+  std::lock_guard<std::mutex> lock(mode_mutex_);
+  return mode_graphs_;
+}
+
+
+CommandMask StateMachine::getAllowedCommands() {
+  if (!isActive()) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(mode_mutex_);
+  return graph_->allowedCommands(getCurrentState());
+}
+
 
 // Change state triggers asynchronous switching of state machine. If successful it will call callback on_state_changed
 std::expected<bool, std::string> StateMachine::changeState(TransitionCmd command)
@@ -349,8 +432,7 @@ std::expected<bool, std::string> StateMachine::changeState(TransitionCmd command
   bool command_valid = true;
   std::string error_message;
 
-  std::stringstream ss;
-  std::cout << "Evaluating transition request command: " << command << std::endl;
+  PACKML_LOG_DEBUG("Evaluating transition request command: {}", command);
 
   switch (command) {
     case TransitionCmd::ABORT:
@@ -387,13 +469,13 @@ std::expected<bool, std::string> StateMachine::changeState(TransitionCmd command
 
   if (!command_valid) {
     error_message = "Invalid transition request command: " + to_string(command);
-    std::cout << error_message << std::endl;
+    PACKML_LOG_WARN("Invalid transition request command: {}", command);
     return std::unexpected<std::string>(error_message);
   }
 
   if (!command_rtn) {
     error_message =  "Transition command failed: " + to_string(command);
-    std::cout << error_message << std::endl;
+    PACKML_LOG_INFO("Transition command failed: {}", command);
     return std::unexpected<std::string>(error_message);
   }
 
@@ -403,239 +485,80 @@ std::expected<bool, std::string> StateMachine::changeState(TransitionCmd command
 
 std::expected<bool, std::string> StateMachine::changeMode(ModeType mode)
 {
-  // TODO: define available states elsewhere
-  StatesGenerator::AvailableStates avail{
-    {State::ABORTING, true},
-    {State::ABORTED, true},
-    {State::CLEARING, true},
-    {State::STOPPING, true},
-    {State::STOPPED, true},
-    {State::RESETTING, true},
-    {State::IDLE, true},
-    {State::STARTING, true},
-    {State::EXECUTE, true},
-    {State::HOLDING, true},
-    {State::HELD, true},
-    {State::UNHOLDING, true},
-    {State::SUSPENDING, true},
-    {State::SUSPENDED, true},
-    {State::UNSUSPENDING, true},
-    {State::COMPLETING, true},
-    {State::COMPLETE, true},
-  };
-
-  if (mode == ModeType::MAINTENANCE)
+  std::expected<bool, std::string> return_val;
   {
-    // We disabled the state completing here!
-    avail =
-    {
-    {State::ABORTING, true},
-    {State::ABORTED, true},
-    {State::CLEARING, true},
-    {State::STOPPING, true},
-    {State::STOPPED, true},
-    {State::RESETTING, true},
-    {State::IDLE, true},
-    {State::STARTING, true},
-    {State::EXECUTE, true},
-    {State::HOLDING, true},
-    {State::HELD, true},
-    {State::UNHOLDING, true},
-    {State::SUSPENDING, true},
-    {State::SUSPENDED, true},
-    {State::UNSUSPENDING, true},
-    {State::COMPLETING, false},
-    {State::COMPLETE, true},
-    };
+    std::lock_guard<std::mutex> lock(mode_mutex_);
+    const ModeGraph * graph = mode_graphs_->find(mode);
+    if (graph == nullptr) {
+      return_val = std::unexpected("Unknown mode: " + to_string(mode));
+    } else {
+      return_val = gen->mode_switcher(shared_from_this(), *graph->definition);
+    }
+    if (journal_) {
+      journal_->append(JournalRecord::ofModeChange(
+          clock_->now().time_since_epoch(), state_value_, mode, return_val.has_value()));
+    }
+    if (graph == nullptr) {
+      return return_val;
+    }
+    if (return_val.has_value()) {
+      graph_ = graph;
+      sm_internal_.setModeGraph(graph);
+    }
   }
 
-  // TODO: Mode should have reference to ModeType?
-  StatesGenerator::Mode mode1 = StatesGenerator::Mode(to_string(mode), avail);
-
-  auto return_val = gen->mode_switcher(shared_from_this(), mode1);
-
   if (return_val.has_value()) {
+    if (snapshot_file_ && isActive()) {
+      saveSnapshot(state_value_);
+    }
     on_mode_changed(mode);
   }
   return return_val;
 }
 
-bool StateMachine::_start() {     sm_internal_.prom = std::promise<bool>(); sm_internal_.postEvent(CmdEvent::start());     return sm_internal_.prom.get_future().get(); }
-bool StateMachine::_clear() {     sm_internal_.prom = std::promise<bool>(); sm_internal_.postEvent(CmdEvent::clear());     return sm_internal_.prom.get_future().get(); }
-bool StateMachine::_reset() {     sm_internal_.prom = std::promise<bool>(); sm_internal_.postEvent(CmdEvent::reset());     return sm_internal_.prom.get_future().get(); }
-bool StateMachine::_hold() {      sm_internal_.prom = std::promise<bool>(); sm_internal_.postEvent(CmdEvent::hold());      return sm_internal_.prom.get_future().get(); }
-bool StateMachine::_unhold() {    sm_internal_.prom = std::promise<bool>(); sm_internal_.postEvent(CmdEvent::unhold());    return sm_internal_.prom.get_future().get(); }
-bool StateMachine::_suspend() {   sm_internal_.prom = std::promise<bool>(); sm_internal_.postEvent(CmdEvent::suspend());   return sm_internal_.prom.get_future().get(); }
-bool StateMachine::_unsuspend() { sm_internal_.prom = std::promise<bool>(); sm_internal_.postEvent(CmdEvent::unsuspend()); return sm_internal_.prom.get_future().get(); }
-bool StateMachine::_stop() {      sm_internal_.prom = std::promise<bool>(); sm_internal_.postEvent(CmdEvent::stop());      return sm_internal_.prom.get_future().get(); }
-bool StateMachine::_abort() {     sm_internal_.prom = std::promise<bool>(); sm_internal_.postEvent(CmdEvent::abort());     return sm_internal_.prom.get_future().get(); }
-
-ContinuousCycle::ContinuousCycle() {
-  printf("Forming CONTINUOUS CYCLE state machine (states + transitions)\n");
-  // // Naming <from state>_<to state>
-  // CmdTransition::abort(*abortable_, *aborting_);
-  // ErrorTransition *abortable_aborting_on_error =
-  //     new ErrorTransition(*abortable_, *aborting_);
-
-  // StateCompleteTransition *aborting_aborted =
-  //     new StateCompleteTransition(*aborting_, *aborted_);
-
-  // CmdTransition::clear(*aborted_, *clearing_);
-  // StateCompleteTransition *clearing_stopped_ =
-  //     new StateCompleteTransition(*clearing_, *stopped_);
-
-  // CmdTransition::stop(*stoppable_, *stopping_);
-  // StateCompleteTransition *stopping_stopped =
-  //     new StateCompleteTransition(*stopping_, *stopped_);
-
-  // CmdTransition::reset(*stopped_, *resetting_);
-  // StateCompleteTransition *unholding_execute_ =
-  //     new StateCompleteTransition(*unholding_, *execute_);
-
-  // CmdTransition::unhold(*held_, *unholding_);
-  // StateCompleteTransition *holding_held_ =
-  //     new StateCompleteTransition(*holding_, *held_);
-
-  // CmdTransition::start(*idle_, *starting_);
-  // StateCompleteTransition *starting_execute_ =
-  //     new StateCompleteTransition(*starting_, *execute_);
-
-  // CmdTransition::hold(*execute_, *holding_);
-  // StateCompleteTransition *execute_execute_ =
-  //     new StateCompleteTransition(*execute_, *execute_);
-
-  // StateCompleteTransition *completing_complete =
-  //     new StateCompleteTransition(*completing_, *complete_);
-
-  // CmdTransition::reset(*complete_, *resetting_);
-  // StateCompleteTransition *resetting_idle_ =
-  //     new StateCompleteTransition(*resetting_, *idle_);
-
-  // CmdTransition::suspend(*execute_, *suspending_);
-  // StateCompleteTransition *suspending_suspended_ =
-  //     new StateCompleteTransition(*suspending_, *suspended_);
-
-  // CmdTransition::unsuspend(*suspended_, *unsuspending_);
-  // StateCompleteTransition *unsuspending_execute_ =
-  //     new StateCompleteTransition(*unsuspending_, *execute_);
-
-  // abortable_->setInitialState(clearing_);
-  // stoppable_->setInitialState(resetting_);
-  // sm_internal_.setInitialState(aborted_);
-}
-void ContinuousCycle::init(){
-  gen->generate_all_packml_states(shared_from_this());
-  // Add parent states to state machine
-  // All other states are added 'automatically' because they are under the superstate "abortable"
-  sm_internal_.addState(gen->states[to_string(SuperState::ABORTABLE)]);
-  sm_internal_.addState(gen->states[to_string(State::ABORTED)]);
-  sm_internal_.addState(gen->states[to_string(State::ABORTING)]);
-
-  sm_internal_.setInitialState(gen->states[to_string(State::ABORTED)]);
-
-  // Test to see if we can adjust the state machines transitions
-  auto list = gen->states[to_string(State::EXECUTE)]->transitions();
-  for (const auto& item : list)
-  {
-    if (item->targetState() == gen->states[to_string(State::COMPLETING)])
-    {
-      std::cout << "Found transition!" << std::endl;
-      gen->states[to_string(State::EXECUTE)]->removeTransition(item);
-      std::cout << "Removed transition!" << std::endl;
-      auto trans = gen->generate_transition(gen->states[to_string(State::EXECUTE)], StatesGenerator::TransitionType::STATE_COMPLETED);
-      gen->states[to_string(State::EXECUTE)]->addTransition(trans);
-      std::cout << "Added transition to self!" << std::endl;
-    }
+StateChangeResult StateMachine::changeStateAsync(TransitionCmd command)
+{
+  switch (command) {
+    case TransitionCmd::ABORT:
+    case TransitionCmd::STOP:
+    case TransitionCmd::CLEAR:
+    case TransitionCmd::HOLD:
+    case TransitionCmd::RESET:
+    case TransitionCmd::START:
+    case TransitionCmd::SUSPEND:
+    case TransitionCmd::UNHOLD:
+    case TransitionCmd::UNSUSPEND:
+      return sm_internal_.submit(command);
+    default:
+      PACKML_LOG_WARN("Invalid transition request command: {}", command);
+      return StateChangeResult{makeReadyResult(false), makeReadyResult(State::UNDEFINED)};
   }
-
-  ((ActingState*) gen->states[to_string(State::EXECUTE)])->setOperationMethod(std::bind([]()->int {std::this_thread::sleep_for(std::chrono::seconds(1));return 0;}));
-
-  printf("State machine formed\n");
 }
 
-SingleCycle::SingleCycle() {
-  printf("Forming SINGLE CYCLE state machine (states + transitions)\n");
-  // Naming <from state>_<to state>
-  // auto aborttrans = CmdTransition::abort(*abortable_, *aborting_);
-  // ErrorTransition *abortable_aborting_on_error =
-  //     new ErrorTransition(*abortable_, *aborting_);
-
-  // StateCompleteTransition *aborting_aborted =
-  //     new StateCompleteTransition(*aborting_, *aborted_);
-
-  // CmdTransition::clear(*aborted_, *clearing_);
-  // StateCompleteTransition *clearing_stopped_ =
-  //     new StateCompleteTransition(*clearing_, *stopped_);
-
-  // CmdTransition::stop(*stoppable_, *stopping_);
-  // StateCompleteTransition *stopping_stopped =
-  //     new StateCompleteTransition(*stopping_, *stopped_);
-
-  // CmdTransition::reset(*stopped_, *resetting_);
-  // StateCompleteTransition *unholding_execute_ =
-  //     new StateCompleteTransition(*unholding_, *execute_);
-
-  // CmdTransition::unhold(*held_, *unholding_);
-  // StateCompleteTransition *holding_held_ =
-  //     new StateCompleteTransition(*holding_, *held_);
-
-  // CmdTransition::start(*idle_, *starting_);
-  // StateCompleteTransition *starting_execute_ =
-  //     new StateCompleteTransition(*starting_, *execute_);
-
-  // CmdTransition::hold(*execute_, *holding_);
-  // StateCompleteTransition *execute_completing_ =
-  //     new StateCompleteTransition(*execute_, *completing_);
-
-  // StateCompleteTransition *completing_complete =
-  //     new StateCompleteTransition(*completing_, *complete_);
-
-  // CmdTransition::reset(*complete_, *resetting_);
-  // StateCompleteTransition *resetting_idle_ =
-  //     new StateCompleteTransition(*resetting_, *idle_);
-
-  // CmdTransition::suspend(*execute_, *suspending_);
-  // StateCompleteTransition *suspending_suspended_ =
-  //     new StateCompleteTransition(*suspending_, *suspended_);
-
-  // CmdTransition::unsuspend(*suspended_, *unsuspending_);
-  // StateCompleteTransition *unsuspending_execute_ =
-  //     new StateCompleteTransition(*unsuspending_, *execute_);
-
-  // abortable_->setInitialState(clearing_);
-  // stoppable_->setInitialState(resetting_);
 
+ModeChangeResult StateMachine::changeModeAsync(ModeType mode)
+{
+  // Without a running state machine there is no thread to hand the switch to
+  if (!isActive() || QThread::currentThread() == sm_internal_.thread()) {
+    return makeReadyResult(changeMode(mode));
   }
-void SingleCycle::init(){
-  gen->generate_all_packml_states(shared_from_this());
-
-  // Add parent states to state machine
-  // All other states are added 'automatically' because they are under the superstate "abortable"
-  sm_internal_.addState(gen->states[to_string(SuperState::ABORTABLE)]);
-  sm_internal_.addState(gen->states[to_string(State::ABORTED)]);
-  sm_internal_.addState(gen->states[to_string(State::ABORTING)]);
-
-  sm_internal_.setInitialState(gen->states[to_string(State::ABORTED)]);
-
-  // // Test to see if we can adjust the state machines transitions
-  // auto list = gen.states[to_string(State::EXECUTE)]->transitions();
-  // for (const auto& item : list)
-  // {
-  //     if (item->targetState() == gen.states[to_string(State::COMPLETING)])
-  //     {
-  //       std::cout << "Foind transition!" << std::endl;
-  //       gen.states[to_string(State::EXECUTE)]->removeTransition(item);
-  //       std::cout << "Removed transition!" << std::endl;
-  //       auto trans = gen.generate_transition(gen.states[to_string(State::EXECUTE)], StatesGenerator::TransitionType::STATE_COMPLETED);
-  //       gen.states[to_string(State::EXECUTE)]->addTransition(trans);
-  //       std::cout << "Added transition to self!" << std::endl;
-  //     }
-  // }
-
-  ((ActingState*) gen->states[to_string(State::EXECUTE)])->setOperationMethod(std::bind([]()->int { std::this_thread::sleep_for(std::chrono::seconds(1)); return 0;}));
-
-  printf("End of single cycle setup\n");
 
+  AsyncPromise<std::expected<bool, std::string>> promise;
+  auto self = shared_from_this();
+  QMetaObject::invokeMethod(&sm_internal_, [self, mode, promise]() {
+      promise.set(self->changeMode(mode));
+    }, Qt::QueuedConnection);
+  return promise.result();
 }
 
+bool StateMachine::_start() {     return sm_internal_.submit(TransitionCmd::START).accepted.get(); }
+bool StateMachine::_clear() {     return sm_internal_.submit(TransitionCmd::CLEAR).accepted.get(); }
+bool StateMachine::_reset() {     return sm_internal_.submit(TransitionCmd::RESET).accepted.get(); }
+bool StateMachine::_hold() {      return sm_internal_.submit(TransitionCmd::HOLD).accepted.get(); }
+bool StateMachine::_unhold() {    return sm_internal_.submit(TransitionCmd::UNHOLD).accepted.get(); }
+bool StateMachine::_suspend() {   return sm_internal_.submit(TransitionCmd::SUSPEND).accepted.get(); }
+bool StateMachine::_unsuspend() { return sm_internal_.submit(TransitionCmd::UNSUSPEND).accepted.get(); }
+bool StateMachine::_stop() {      return sm_internal_.submit(TransitionCmd::STOP).accepted.get(); }
+bool StateMachine::_abort() {     return sm_internal_.submit(TransitionCmd::ABORT).accepted.get(); }
+
 } // namespace packml_sm
@@ -0,0 +1,273 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 Dejanira Araiza Illan, ROS-Industrial Asia Pacific
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/state_machine_interface.hpp"
+
+#include <algorithm>
+#include <future>
+#include <string>
+
+#include "packml_sm/log.hpp"
+
+namespace packml_sm {
+
+StateChangeResult StateMachineInterface::changeStateAsync(TransitionCmd command) {
+  auto result = changeState(command);
+  bool accepted = result.has_value() && result.value();
+  return StateChangeResult{makeReadyResult(accepted),
+                           makeReadyResult(accepted ? getCurrentState() : State::UNDEFINED)};
+}
+
+ModeChangeResult StateMachineInterface::changeModeAsync(ModeType mode) {
+  return makeReadyResult(changeMode(mode));
+}
+
+ScriptResult StateMachineInterface::runScript(const std::vector<ScriptStep> & steps) {
+  std::lock_guard<std::mutex> script(script_mutex_);
+  ScriptResult result;
+  result.steps.resize(steps.size());
+  auto script_start = std::chrono::steady_clock::now();
+
+  for (std::size_t ii = 0; ii < steps.size(); ++ii) {
+    const ScriptStep & step = steps[ii];
+    StepResult & done = result.steps[ii];
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + step.timeout;
+    auto fail = [&](StepOutcome outcome, const std::string & why) {
+        done.outcome = outcome;
+        done.state = getCurrentState();
+        done.duration = std::chrono::steady_clock::now() - start;
+        result.message = "Step " + std::to_string(ii) + ": " + why;
+      };
+
+    // Armed before the command is submitted, an entry of target right after it is not missed
+    StateWaiters::Watch watch(
+      state_waiters_, step.target == State::UNDEFINED ? StateMask{0} : stateBit(step.target));
+    bool reached = false;
+    if (step.command != TransitionCmd::NO_COMMAND) {
+      auto change = changeStateAsync(step.command);
+      if (change.accepted.future().wait_until(deadline) != std::future_status::ready) {
+        fail(StepOutcome::TIMED_OUT, to_string(step.command) + " not evaluated in time");
+        break;
+      }
+      if (!change.accepted.get()) {
+        fail(StepOutcome::REJECTED,
+          to_string(step.command) + " rejected in state " + to_string(getCurrentState()));
+        break;
+      }
+      done.accepted_after = std::chrono::steady_clock::now() - start;
+    } else {
+      reached = getCurrentState() == step.target;
+    }
+    if (step.target != State::UNDEFINED && !reached &&
+      watch.waitUntil(deadline) == State::UNDEFINED)
+    {
+      fail(StepOutcome::TIMED_OUT,
+        to_string(step.target) + " not reached in time, state is " + to_string(getCurrentState()));
+      break;
+    }
+    done.outcome = StepOutcome::DONE;
+    done.state = getCurrentState();
+    done.duration = std::chrono::steady_clock::now() - start;
+  }
+
+  result.duration = std::chrono::steady_clock::now() - script_start;
+  result.success = std::all_of(
+    result.steps.begin(), result.steps.end(),
+    [](const StepResult & step) {return step.outcome == StepOutcome::DONE;});
+  if (!result.success) {
+    PACKML_LOG_WARN("Command script failed: {}", result.message);
+  }
+  return result;
+}
+
+bool StateMachineInterface::awaitState(State state, std::chrono::milliseconds timeout) {
+  return awaitAnyOf(stateBit(state), timeout) == state;
+}
+
+State StateMachineInterface::awaitAnyOf(StateMask states, std::chrono::milliseconds timeout) {
+  states &= ~stateBit(State::UNDEFINED);
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  // Armed before the current state is read, an entry in between is not missed
+  StateWaiters::Watch watch(state_waiters_, states);
+  State current = getCurrentState();
+  if (hasState(states, current)) {
+    return current;
+  }
+  return watch.waitUntil(deadline);
+}
+
+State StateMachineInterface::awaitAnyOf(
+  std::initializer_list<State> states, std::chrono::milliseconds timeout) {
+  StateMask mask = 0;
+  for (State state : states) {
+    mask |= stateBit(state);
+  }
+  return awaitAnyOf(mask, timeout);
+}
+
+bool StateMachineInterface::start() {
+  return _start();
+  // return true;
+  // switch (State(getCurrentState())) {
+  // case State::IDLE:
+  //   _start();
+  //   return true;
+  // default:
+  //   std::cout << "Ignoring START command in current state: "
+  //             << getCurrentState() << std::endl;
+  //   return false;
+  // }
+}
+
+bool StateMachineInterface::clear() {
+  return _clear();
+  // return true;
+  // switch (State(getCurrentState())) {
+  // case State::ABORTED:
+  //   return _clear();
+  //   return true;
+  // default:
+  //   std::cout << "Ignoring CLEAR command in current state: "
+  //             << getCurrentState() << std::endl;
+  //   return false;
+  // }
+}
+
+bool StateMachineInterface::reset() {
+  return _reset();
+  // return true;
+  // switch (State(getCurrentState())) {
+  // case State::COMPLETE:
+  // case State::STOPPED:
+  //   _reset();
+  //   return true;
+  // default:
+  //   std::cout << "Ignoring RESET command in current state: "
+  //             << getCurrentState() << std::endl;
+  //   return false;
+  // }
+}
+
+bool StateMachineInterface::hold() {
+  return _hold();
+  // return true;
+  // switch (State(getCurrentState())) {
+  // case State::EXECUTE:
+  //   _hold();
+  //   return true;
+  // default:
+  //   std::cout << "Ignoring HOLD command in current state: " << getCurrentState()
+  //             << std::endl;
+  //   return false;
+  // }
+}
+
+bool StateMachineInterface::unhold() {
+  return _unhold();
+  // return true;
+  // switch (State(getCurrentState())) {
+  // case State::HELD:
+  //   _unhold();
+  //   return true;
+  // default:
+  //   std::cout << "Ignoring HELD command in current state: " << getCurrentState()
+  //             << std::endl;
+  //   return false;
+  // }
+}
+
+bool StateMachineInterface::suspend() {
+  return _suspend();
+  // return true;
+  // switch (State(getCurrentState())) {
+  // case State::EXECUTE:
+  //   _suspend();
+  //   return true;
+  // default:
+  //   std::cout << "Ignoring SUSPEND command in current state: "
+  //             << getCurrentState() << std::endl;
+  //   return false;
+  // }
+}
+
+bool StateMachineInterface::unsuspend() {
+  return _unsuspend();
+  // return true;
+  // switch (State(getCurrentState())) {
+  // case State::SUSPENDED:
+  //   _unsuspend();
+  //   return true;
+  // default:
+  //   std::cout << "Ignoring UNSUSPEND command in current state: "
+  //             << getCurrentState() << std::endl;
+  //   return false;
+  // }
+}
+
+bool StateMachineInterface::stop() {
+  return _stop();
+  // return true;
+  // switch (State(getCurrentState())) {
+  // // case StatesEnum::STOPPABLE:
+  // case State::STARTING:
+  // case State::IDLE:
+  // case State::SUSPENDED:
+  // case State::EXECUTE:
+  // case State::HOLDING:
+  // case State::HELD:
+  // case State::SUSPENDING:
+  // case State::UNSUSPENDING:
+  // case State::UNHOLDING:
+  // case State::COMPLETING:
+  // case State::COMPLETE:
+  //   _stop();
+  //   return true;
+  // default:
+  //   std::cout << "Ignoring STOP command in current state: " << getCurrentState()
+  //             << std::endl;
+  //   return false;
+  // }
+}
+
+bool StateMachineInterface::abort() {
+  return _abort();
+  // return true;
+  // switch (State(getCurrentState())) {
+  // // case StatesEnum::ABORTABLE:
+  // case State::STOPPED:
+  // case State::STARTING:
+  // case State::IDLE:
+  // case State::SUSPENDED:
+  // case State::EXECUTE:
+  // case State::HOLDING:
+  // case State::HELD:
+  // case State::SUSPENDING:
+  // case State::UNSUSPENDING:
+  // case State::UNHOLDING:
+  // case State::COMPLETING:
+  // case State::COMPLETE:
+  // case State::CLEARING:
+  // case State::STOPPING:
+  //   _abort();
+  //   return true;
+  // default:
+  //   std::cout << "Ignoring ABORT command in current state: "
+  //             << getCurrentState() << std::endl;
+  //   return false;
+  // }
+}
+
+} // namespace packml_sm
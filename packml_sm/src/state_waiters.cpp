@@ -0,0 +1,99 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/state_waiters.hpp"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace packml_sm
+{
+
+StateWaiters::~StateWaiters()
+{
+  int fd = event_fd_.load(std::memory_order_relaxed);
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+StateWaiters::Watch::Watch(StateWaiters & waiters, StateMask targets)
+: waiters_(waiters), targets_(targets)
+{
+  std::lock_guard<std::mutex> lock(waiters_.mutex_);
+  waiters_.watches_.push_back(this);
+  waiters_.watch_count_.store(waiters_.watches_.size(), std::memory_order_release);
+}
+
+StateWaiters::Watch::~Watch()
+{
+  std::lock_guard<std::mutex> lock(waiters_.mutex_);
+  std::erase(waiters_.watches_, this);
+  waiters_.watch_count_.store(waiters_.watches_.size(), std::memory_order_release);
+}
+
+State StateWaiters::Watch::waitUntil(std::chrono::steady_clock::time_point deadline)
+{
+  std::unique_lock<std::mutex> lock(waiters_.mutex_);
+  waiters_.cv_.wait_until(lock, deadline, [this] {return entered_ != State::UNDEFINED;});
+  return entered_;
+}
+
+void StateWaiters::entered(State state)
+{
+  int fd = event_fd_.load(std::memory_order_acquire);
+  if (fd >= 0) {
+    // Cannot block: the counter of a non-blocking eventfd only saturates after 2^64 - 2 entries
+    std::uint64_t one = 1;
+    [[maybe_unused]] auto written = ::write(fd, &one, sizeof(one));
+  }
+  if (watch_count_.load(std::memory_order_acquire) == 0) {
+    return;
+  }
+  bool woke = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Watch * watch : watches_) {
+      if (watch->entered_ == State::UNDEFINED && hasState(watch->targets_, state)) {
+        watch->entered_ = state;
+        woke = true;
+      }
+    }
+  }
+  if (woke) {
+    cv_.notify_all();
+  }
+}
+
+std::expected<int, std::string> StateWaiters::eventFd()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  int fd = event_fd_.load(std::memory_order_relaxed);
+  if (fd < 0) {
+    fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+      return std::unexpected(std::string("Cannot create state eventfd: ") + std::strerror(errno));
+    }
+    event_fd_.store(fd, std::memory_order_release);
+  }
+  return fd;
+}
+
+}  // namespace packml_sm
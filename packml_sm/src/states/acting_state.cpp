@@ -14,54 +14,116 @@
 // limitations under the License.
 //
 
-#include <iostream>
-#include <thread>
+#include <chrono>
+#include <exception>
 
 #include <QEvent>
-#include <QtConcurrent/QtConcurrent>
 
 #include "packml_sm/states/acting_state.hpp"
 
 #include "packml_sm/events/sc_event.hpp"
 #include "packml_sm/events/error_event.hpp"
+#include "packml_sm/log.hpp"
+#include "packml_sm/timer_service.hpp"
+#include "packml_sm/trace.hpp"
 
 namespace packml_sm {
 
+ActingState::~ActingState()
+{
+  cancelTimer(delay_timer_);
+  stop_.request_stop();
+  if (function_state_.valid()) {
+    function_state_.wait();
+  }
+  for (auto & operation : abandoned_) {
+    operation.wait();
+  }
+}
+
 void ActingState::onEntry(QEvent * e)
 {
   PackmlState::onEntry(e);
-  printf("Starting thread for state operation\n");
-  function_state_ = QtConcurrent::run(std::bind(&ActingState::operation, this));
+  if (!function_) {
+    // A timed state only occupies a timer until it completes
+    PACKML_LOG_DEBUG("Default operation of {}, completing in {} ms", state_, delay_ms);
+    // The callback may run on the thread of a simulated clock, it leaves delay_timer_ to onExit()
+    delay_timer_ = startTimer(
+      std::chrono::milliseconds(delay_ms), [this, entry = entry_count_]() {
+        machine()->postEvent(makeEvent<StateCompleteEvent>(event_pool_, this, entry));
+      });
+    return;
+  }
+
+  if (!executor_) {
+    executor_ = ActingExecutor::global();
+  }
+  std::erase_if(abandoned_, [](const std::shared_future<void> & operation) {
+      return operation.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    });
+
+  // Every entry gets its own stop source, an abandoned operation keeps the token of its entry
+  stop_ = std::stop_source();
+  running_stoppable_ = stoppable_;
+  PACKML_LOG_DEBUG("Queueing state operation: {} on lane {}", state_, laneFor(state_));
+  function_state_ = executor_->submit(
+    laneFor(state_), [this, token = stop_.get_token(), entry = entry_count_]() {operation(token, entry);});
 }
 
 void ActingState::onExit(QEvent * e)
 {
-  if (function_state_.isRunning()) {
-    printf(
-      "State exit triggered early, waiting for state operation to complete\n");
+  // Runs on the state machine thread as soon as the exit transition has been selected
+  cancelTimer(delay_timer_);
+  stop_.request_stop();
+  if (function_state_.valid() &&
+    function_state_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+  {
+    PACKML_LOG_DEBUG("State exit triggered early, waiting for state operation to stop: {}", state_);
+    tracing::Scope span("exit_wait", state_);
+    if (!running_stoppable_ || exit_timeout_ == std::chrono::milliseconds::max()) {
+      function_state_.wait();
+    } else if (function_state_.wait_for(exit_timeout_) != std::future_status::ready) {
+      PACKML_LOG_WARN(
+        "State operation of {} did not stop within {} ms, leaving the state without it", state_,
+        exit_timeout_.count());
+      abandoned_.push_back(function_state_);
+    }
   }
-  function_state_.waitForFinished();
+  function_state_ = std::shared_future<void>();
   PackmlState::onExit(e);
 }
 
 
-void ActingState::operation()
+void ActingState::operation(std::stop_token token, std::uint64_t entry)
 {
   QEvent * sc;
   if (function_) {
-    printf("Executing operational function in acting state\n");
-    int error_code = function_();
+    PACKML_LOG_DEBUG("Executing operational function in acting state: {}", state_);
+    int error_code;
+    try {
+      tracing::Scope span("operation", state_);
+      error_code = function_(token);
+    } catch (const std::exception & ex) {
+      PACKML_LOG_ERROR("Operational function of {} threw: {}", state_, ex.what());
+      error_code = kOperationExceptionErrorCode;
+    } catch (...) {
+      PACKML_LOG_ERROR("Operational function of {} threw an unknown exception", state_);
+      error_code = kOperationExceptionErrorCode;
+    }
+    if (token.stop_requested()) {
+      // The state was left, nothing would take the result
+      PACKML_LOG_DEBUG("Operational function of {} returned after cancellation", state_);
+      return;
+    }
     if (0 == error_code) {
-      sc = new StateCompleteEvent();
+      sc = makeEvent<StateCompleteEvent>(event_pool_, this, entry);
     } else {
-      std::cout << "Operational function returned error code: " << error_code << std::endl;
-      sc = new ErrorEvent(error_code);
+      PACKML_LOG_WARN("Operational function of {} returned error code: {}", state_, error_code);
+      sc = makeEvent<ErrorEvent>(event_pool_, error_code, this, entry);
     }
   } else {
-    std::cout << "Default operation, delaying " << delay_ms << " ms" << std::endl;
-    std::this_thread::sleep_for(std::chrono::seconds(static_cast<int>(delay_ms / 1000.0)));
-    printf("Operation delay complete\n");
-    sc = new StateCompleteEvent();
+    // Timed states complete from their timer, without function there is nothing to wait for
+    sc = makeEvent<StateCompleteEvent>(event_pool_, this, entry);
   }
   machine()->postEvent(sc);
 }
@@ -15,31 +15,103 @@
 
 #include <QtConcurrent/QtConcurrent>
 
-#include <iostream>
 #include <chrono>
+#include <utility>
 
 #include "packml_sm/states/state.hpp"
+#include "packml_sm/events/error_event.hpp"
+#include "packml_sm/log.hpp"
+#include "packml_sm/timer_service.hpp"
+#include "packml_sm/trace.hpp"
 
 namespace packml_sm
 {
 
+PackmlState::~PackmlState()
+{
+  cancelTimer(watchdog_timer_);
+}
+
+
+TimerWheel::TimerId PackmlState::startTimer(
+  std::chrono::milliseconds delay, TimerWheel::Callback callback)
+{
+  if (clock_->simulated()) {
+    return clock_->schedule(clock_->now() + delay, std::move(callback));
+  }
+  return timer_service_->start(delay, std::move(callback));
+}
+
+
+void PackmlState::cancelTimer(TimerWheel::TimerId & timer)
+{
+  if (timer == TimerWheel::kNoTimer || clock_ == nullptr) {
+    return;
+  }
+  // Timer ids are generation tagged, cancelling a timer that already fired does nothing
+  if (clock_->simulated()) {
+    clock_->cancel(timer);
+  } else if (!TimerService::destroyedForCurrentThread()) {
+    timer_service_->cancel(timer);
+  }
+  timer = TimerWheel::kNoTimer;
+}
+
+
 void PackmlState::onEntry(QEvent * /*e*/)  // NOLINT(readability/casting)
 {
-  std::cout << "Entering state: " << name_.toUtf8().constData() << "(" << state_ << ")" <<
-    std::endl;
+  timer_service_ = &TimerService::forCurrentThread();
+  if (event_pool_ == nullptr) {
+    if (auto provider = dynamic_cast<EventPoolProvider *>(machine())) {
+      event_pool_ = &provider->eventPool();
+    }
+  }
+  // The clock may only change while the machine is stopped, read it again on every entry
+  auto clock_provider = dynamic_cast<ClockProvider *>(machine());
+  clock_ = clock_provider != nullptr ? &clock_provider->clock() : Clock::system().get();
+  PACKML_LOG_DEBUG("Entering state: {}", state_);
+  ++entry_count_;
+  traceSpan('b');
   emit stateEntered(state_, name_);
-  enter_time_ = std::chrono::system_clock::now();
+  enter_time_ = clock_->now();
+
+  auto watchdog = watchdog_timeout_.load();
+  if (watchdog > std::chrono::milliseconds(0)) {
+    watchdog_timer_ = startTimer(
+      watchdog, [this, entry = entry_count_, watchdog]() {
+        PACKML_LOG_WARN("Watchdog of {} expired after {} ms", state_, watchdog.count());
+        auto error = makeEvent<ErrorEvent>(event_pool_, kWatchdogErrorCode, this, entry);
+        error->name = "watchdog";
+        machine()->postEvent(error);
+      });
+  }
 }
 
 
 void PackmlState::onExit(QEvent * /*e*/)  // NOLINT(readability/casting)
 {
-  std::cout << "Exiting state: " << name_.toUtf8().constData() << "(" << state_ << ")" <<
-    std::endl;
-  exit_time_ = std::chrono::system_clock::now();
+  PACKML_LOG_DEBUG("Exiting state: {}", state_);
+  traceSpan('e');
+  cancelTimer(watchdog_timer_);
+  exit_time_ = clock_->now();
   cummulative_time_ = cummulative_time_ + (exit_time_ - enter_time_);
-  std::cout << "Updating cummulative time, for state: " << name_.toUtf8().constData() << "(" <<
-    state_ << ") to: " << cummulative_time_.count() << std::endl;
+  PACKML_LOG_DEBUG("Updating cummulative time, for state: {} to: {} ns", state_, cummulative_time_.count());
+}
+
+void PackmlState::traceSpan(char phase)
+{
+  if (!tracing::enabled()) {
+    return;
+  }
+  // Super states are spans around the spans of their nested states
+  auto track = tracing::trackOf(machine());
+  std::string super_state = state_ == State::UNDEFINED ? name_.toStdString() : std::string();
+  tracing::Name name = state_ == State::UNDEFINED ? tracing::Name::copy(super_state) : tracing::Name(state_);
+  if (phase == 'b') {
+    tracing::begin("state", name, track);
+  } else {
+    tracing::end("state", name, track);
+  }
 }
 
 }  // namespace packml_sm
@@ -0,0 +1,545 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/table_state_machine.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <sstream>
+#include <utility>
+
+#include "packml_sm/log.hpp"
+#include "packml_sm/trace.hpp"
+
+namespace packml_sm
+{
+
+std::shared_ptr<TableStateMachine> TableStateMachine::singleCycleSM()
+{
+  return create<SingleCyclePolicy>();
+}
+
+std::shared_ptr<TableStateMachine> TableStateMachine::continuousCycleSM()
+{
+  return create<ContinuousCyclePolicy>();
+}
+
+TableStateMachine::TableStateMachine(const TransitionTable & table)
+: table_(table),
+  mode_graphs_(std::make_shared<const ModeGraphs>(ModeRegistry::global(), table_)),
+  graph_(&mode_graphs_->unmoded()),
+  clock_(Clock::system()),
+  executor_(ActingExecutor::global())
+{
+}
+
+TableStateMachine::~TableStateMachine()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  active_.store(false, std::memory_order_release);
+  ++generation_;
+  cancelTimer();
+  stop_.request_stop();
+  cv_.wait(lock, [this] {return running_operations_ == 0;});
+}
+
+bool TableStateMachine::activate()
+{
+  const ModeDefinition * restored_mode = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    active_.store(true, std::memory_order_release);
+    // The state of the previous activation was left by deactivate()
+    state_value_.store(State::UNDEFINED, std::memory_order_relaxed);
+    // Same initial state as the Qt state machine
+    State initial = State::ABORTED;
+    if (std::exchange(restore_pending_, false) && restart_policy_ != RestartPolicy::COLD) {
+      if (auto saved = snapshot_file_->load()) {
+        initial = restore(*saved);
+        restored_mode = graph_->definition;
+      }
+    }
+    enter(initial);
+  }
+  deliverEntries();
+  if (restored_mode != nullptr) {
+    on_mode_changed(restored_mode->mode);
+  }
+  return true;
+}
+
+// Must be called with mutex_ locked, before the first state is entered
+State TableStateMachine::restore(const MachineSnapshot & saved)
+{
+  state_times_.restore(saved.times);
+  abort_latency_ = saved.abort_latency;
+  if (saved.mode) {
+    const ModeGraph * graph = mode_graphs_->find(*saved.mode);
+    if (graph != nullptr) {
+      available_.store(graph->definition->available, std::memory_order_release);
+      graph_ = graph;
+    } else {
+      PACKML_LOG_WARN("Mode {} of the snapshot is not registered, no mode is set", *saved.mode);
+    }
+  }
+  State initial = restartState(saved, restart_policy_);
+  PACKML_LOG_INFO("Restored snapshot {}, saved in state {}, starting in {}",
+    snapshot_file_->path(), saved.state, initial);
+  return initial;
+}
+
+bool TableStateMachine::deactivate()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (active_.exchange(false, std::memory_order_release)) {
+    tracing::end("state", state_value_.load(std::memory_order_relaxed), tracing::trackOf(this));
+  }
+  // Invalidates the running operation
+  ++generation_;
+  cancelTimer();
+  stop_.request_stop();
+  return true;
+}
+
+bool TableStateMachine::setExecute(std::function<int()> execute_method)
+{
+  return setOperationMethod(State::EXECUTE, std::move(execute_method));
+}
+
+bool TableStateMachine::setResetting(std::function<int()> resetting_method)
+{
+  return setOperationMethod(State::RESETTING, std::move(resetting_method));
+}
+
+void TableStateMachine::setExecutor(std::shared_ptr<ActingExecutor> executor)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  executor_ = std::move(executor);
+}
+
+bool TableStateMachine::setOperationMethod(State state, std::function<int()> method)
+{
+  if (!method) {
+    return setCancellableOperation(state, nullptr);
+  }
+  return setCancellableOperation(state, [method = std::move(method)](std::stop_token) {return method();});
+}
+
+bool TableStateMachine::setCancellableOperation(State state, CancellableOperation method)
+{
+  if (!isActingState(state)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  operations_[toIndex(state)].method = std::move(method);
+  return true;
+}
+
+bool TableStateMachine::setWatchdog(State state, std::chrono::milliseconds timeout)
+{
+  if (toIndex(state) >= kStateCount) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  watchdogs_[toIndex(state)] = std::max(timeout, std::chrono::milliseconds(0));
+  return true;
+}
+
+bool TableStateMachine::setModeRegistry(std::shared_ptr<const ModeRegistry> registry)
+{
+  if (!registry) {
+    return false;
+  }
+  // Compiled outside the lock, commands keep being served from the current graphs
+  auto graphs = std::make_shared<const ModeGraphs>(std::move(registry), table_);
+  std::lock_guard<std::mutex> lock(mutex_);
+  const ModeGraph * graph = &graphs->unmoded();
+  if (graph_->definition != nullptr) {
+    graph = graphs->find(graph_->definition->mode);
+    if (graph == nullptr) {
+      PACKML_LOG_WARN("Mode registry lacks the current mode {}", graph_->definition->name);
+      return false;
+    }
+    available_.store(graph->definition->available, std::memory_order_release);
+  }
+  mode_graphs_ = std::move(graphs);
+  graph_ = graph;
+  return true;
+}
+
+std::shared_ptr<const ModeGraphs> TableStateMachine::getModeGraphs()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return mode_graphs_;
+}
+
+CommandMask TableStateMachine::getAllowedCommands()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!active_.load(std::memory_order_relaxed)) {
+    return 0;
+  }
+  return graph_->allowedCommands(state_value_.load(std::memory_order_relaxed));
+}
+
+bool TableStateMachine::setClock(std::shared_ptr<Clock> clock)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!clock || active_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  clock_ = std::move(clock);
+  return true;
+}
+
+bool TableStateMachine::setSnapshotFile(std::shared_ptr<SnapshotFile> file, RestartPolicy policy)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file || active_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  snapshot_file_ = std::move(file);
+  restart_policy_ = policy;
+  restore_pending_ = true;
+  return true;
+}
+
+bool TableStateMachine::setJournal(std::shared_ptr<JournalWriter> journal)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (active_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  journal_ = std::move(journal);
+  return true;
+}
+
+StateTimes TableStateMachine::getStateTimes()
+{
+  std::shared_ptr<Clock> clock;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clock = clock_;
+  }
+  return state_times_.snapshot(clock->now());
+}
+
+std::vector<TransitionStats> TableStateMachine::getTransitionStats()
+{
+  return transition_stats_.snapshot();
+}
+
+LatencyStats TableStateMachine::getAbortLatency()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return abort_latency_;
+}
+
+bool TableStateMachine::setOperationDelay(State state, std::chrono::milliseconds delay)
+{
+  if (!isActingState(state)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  operations_[toIndex(state)].method = nullptr;
+  operations_[toIndex(state)].delay = delay;
+  return true;
+}
+
+State TableStateMachine::transit(TransitionCmd command)
+{
+  // Commands are taken on the calling thread, their span and latency include waiting for the lock
+  auto posted = std::chrono::steady_clock::now();
+  std::int64_t submitted = tracing::enabled() ? tracing::now() : -1;
+  EntryDelivery delivery(*this);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!active_.load(std::memory_order_relaxed)) {
+    return State::UNDEFINED;
+  }
+  // Transitions into states the mode disables are not in its graph
+  State current = state_value_.load(std::memory_order_relaxed);
+  State target = graph_->onCommand(current, command);
+  record(JournalRecord::ofCommand(journalTime(), current, command, target != State::UNDEFINED));
+  if (target == State::UNDEFINED) {
+    transition_stats_.rejected(table_, current, Trigger::COMMAND, command);
+    if (submitted >= 0) {
+      tracing::complete("command", command, submitted, "accepted", 0);
+    }
+    return State::UNDEFINED;
+  }
+  if (command == TransitionCmd::ABORT) {
+    abort_selected_ = clock_->now();
+  }
+  enter(target);
+  transition_stats_.accepted(
+    current, Trigger::COMMAND, command, target, std::chrono::steady_clock::now() - posted);
+  if (submitted >= 0) {
+    tracing::complete("command", command, submitted, "accepted", 1);
+  }
+  return target;
+}
+
+bool TableStateMachine::completeState(int error_code)
+{
+  std::uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!active_.load(std::memory_order_relaxed) ||
+      !isActingState(state_value_.load(std::memory_order_relaxed)))
+    {
+      return false;
+    }
+    generation = generation_;
+  }
+  complete(generation, error_code);
+  return true;
+}
+
+void TableStateMachine::complete(std::uint64_t generation, int error_code)
+{
+  auto posted = std::chrono::steady_clock::now();
+  EntryDelivery delivery(*this);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (generation != generation_ || !active_.load(std::memory_order_relaxed)) {
+    // State was left before its operation returned
+    return;
+  }
+  State current = state_value_.load(std::memory_order_relaxed);
+  record(JournalRecord::ofCompletion(journalTime(), current, error_code));
+  Trigger trigger = (error_code == 0) ? Trigger::COMPLETED : Trigger::FAILED;
+  State target = (error_code == 0) ? graph_->onComplete(current) : graph_->onError(current);
+  if (target == State::UNDEFINED) {
+    // Same as an ignored event in the Qt state machine, we stay in the current state
+    transition_stats_.rejected(table_, current, trigger, TransitionCmd::NO_COMMAND);
+    return;
+  }
+  enter(target);
+  transition_stats_.accepted(
+    current, trigger, TransitionCmd::NO_COMMAND, target, std::chrono::steady_clock::now() - posted);
+}
+
+// Must be called with mutex_ locked
+void TableStateMachine::enter(State state)
+{
+  ++generation_;
+  cancelTimer();
+  if (stop_shared_ || stop_.stop_requested()) {
+    stop_.request_stop();
+    stop_ = std::stop_source();
+    stop_shared_ = false;
+  }
+  auto now = clock_->now();
+  state_times_.enter(state, now);
+  if (state == State::ABORTED && abort_selected_) {
+    abort_latency_.add(now - *abort_selected_);
+    abort_selected_.reset();
+  }
+  State previous = state_value_.exchange(state, std::memory_order_release);
+  if (previous != State::UNDEFINED) {
+    tracing::end("state", previous, tracing::trackOf(this));
+  }
+  tracing::begin("state", state, tracing::trackOf(this));
+  record(JournalRecord::ofEntry(now.time_since_epoch(), state));
+  saveSnapshot(now);
+  pending_entries_.push_back(state);
+  notifyStateEntered(state);
+
+  auto watchdog = watchdogs_[toIndex(state)];
+  if (watchdog.count() > 0) {
+    auto generation = generation_;
+    ++running_operations_;
+    watchdog_timer_ = clock_->schedule(
+      now + watchdog, [this, generation, state]() {
+        PACKML_LOG_WARN("Watchdog expired in state {}", state);
+        complete(generation, kWatchdogErrorCode);
+        finished();
+      });
+  }
+
+  if (!isActingState(state)) {
+    return;
+  }
+  const Operation & op = operations_[toIndex(state)];
+  if (!op.method && op.delay == std::chrono::milliseconds::max()) {
+    // Waits for completeState()
+    return;
+  }
+  auto generation = generation_;
+  ++running_operations_;
+  if (op.method) {
+    stop_shared_ = true;
+    executor_->submit(
+      laneFor(state), [this, state, generation, method = op.method, token = stop_.get_token()]() {
+        // However the job ends, the destructor waits for it
+        struct Finished
+        {
+          TableStateMachine * sm;
+          ~Finished() {sm->finished();}
+        } guard{this};
+        if (!isCurrent(generation)) {
+          // State was left while the job was queued, do not occupy the lane with it
+          return;
+        }
+        int error_code;
+        try {
+          tracing::Scope span("operation", state);
+          error_code = method(token);
+        } catch (const std::exception & ex) {
+          PACKML_LOG_ERROR("Operation of {} threw: {}", state, ex.what());
+          error_code = kOperationExceptionErrorCode;
+        } catch (...) {
+          PACKML_LOG_ERROR("Operation of {} threw an unknown exception", state);
+          error_code = kOperationExceptionErrorCode;
+        }
+        complete(generation, error_code);
+      });
+  } else {
+    timer_ = clock_->schedule(
+      now + op.delay, [this, generation]() {
+        complete(generation, 0);
+        finished();
+      });
+  }
+}
+
+// Must be called with mutex_ unlocked. The first thread to get here runs on_state_changed for the
+// entries of every thread, in order and without the lock, until none are left.
+void TableStateMachine::deliverEntries()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (delivering_) {
+    return;
+  }
+  delivering_ = true;
+  while (!pending_entries_.empty()) {
+    // Swapped, both keep their capacity
+    std::swap(delivered_entries_, pending_entries_);
+    lock.unlock();
+    for (State state : delivered_entries_) {
+      on_state_changed(state);
+    }
+    delivered_entries_.clear();
+    lock.lock();
+  }
+  delivering_ = false;
+}
+
+// Must be called with mutex_ locked
+void TableStateMachine::saveSnapshot(Clock::TimePoint now)
+{
+  if (!snapshot_file_) {
+    return;
+  }
+  MachineSnapshot snapshot;
+  snapshot.state = state_value_.load(std::memory_order_relaxed);
+  if (graph_->definition != nullptr) {
+    snapshot.mode = graph_->definition->mode;
+  }
+  snapshot.times = state_times_.snapshot(now);
+  snapshot.abort_latency = abort_latency_;
+  snapshot.saved_at = std::chrono::system_clock::now();
+  snapshot_file_->save(snapshot);
+}
+
+bool TableStateMachine::isCurrent(std::uint64_t generation)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return generation == generation_;
+}
+
+// Must be called with mutex_ locked
+void TableStateMachine::cancelTimer()
+{
+  for (auto * timer : {&timer_, &watchdog_timer_}) {
+    if (*timer != TimerWheel::kNoTimer && clock_->cancel(*timer)) {
+      --running_operations_;
+    }
+    *timer = TimerWheel::kNoTimer;
+  }
+}
+
+void TableStateMachine::finished()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  --running_operations_;
+  // Notify while holding the lock, the destructor may free cv_ as soon as it is released
+  cv_.notify_all();
+}
+
+std::expected<bool, std::string> TableStateMachine::changeState(TransitionCmd command)
+{
+  bool command_rtn = false;
+  switch (command) {
+    case TransitionCmd::ABORT:
+    case TransitionCmd::STOP:
+    case TransitionCmd::CLEAR:
+    case TransitionCmd::HOLD:
+    case TransitionCmd::RESET:
+    case TransitionCmd::START:
+    case TransitionCmd::SUSPEND:
+    case TransitionCmd::UNHOLD:
+    case TransitionCmd::UNSUSPEND:
+      command_rtn = dispatch(command);
+      break;
+    default:
+      return std::unexpected<std::string>("Invalid transition request command: " + to_string(command));
+  }
+
+  if (!command_rtn) {
+    return std::unexpected<std::string>("Transition command failed: " + to_string(command));
+  }
+  return true;
+}
+
+StateChangeResult TableStateMachine::changeStateAsync(TransitionCmd command)
+{
+  // Commands are evaluated synchronously, both results are known on return
+  State target = transit(command);
+  return StateChangeResult{makeReadyResult(target != State::UNDEFINED), makeReadyResult(target)};
+}
+
+std::expected<bool, std::string> TableStateMachine::changeMode(ModeType mode)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    State current = state_value_.load(std::memory_order_relaxed);
+    const ModeGraph * graph = mode_graphs_->find(mode);
+    if (graph == nullptr) {
+      record(JournalRecord::ofModeChange(journalTime(), current, mode, false));
+      return std::unexpected("Unknown mode: " + to_string(mode));
+    }
+    // Same rule as StatesGenerator::mode_switcher, the first mode can be set in any state
+    const ModeDefinition * definition = graph->definition;
+    bool allowed = graph_->definition == nullptr || definition->allowsSwitchFrom(current);
+    record(JournalRecord::ofModeChange(journalTime(), current, mode, allowed));
+    if (!allowed) {
+      std::stringstream msg;
+      msg << "Cannot switch to mode " << definition->name << " in state: " << current;
+      return std::unexpected(msg.str());
+    }
+    available_.store(definition->available, std::memory_order_release);
+    graph_ = graph;
+    if (active_.load(std::memory_order_relaxed)) {
+      saveSnapshot(clock_->now());
+    }
+  }
+  on_mode_changed(mode);
+  return true;
+}
+
+}  // namespace packml_sm
@@ -0,0 +1,92 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/timer_service.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace packml_sm
+{
+
+namespace
+{
+
+// Trivially destructible, so it can still be read after the service of the thread is destroyed
+thread_local bool t_service_destroyed = false;
+
+}  // namespace
+
+TimerService & TimerService::forCurrentThread()
+{
+  // Destroyed with the thread, see destroyedForCurrentThread()
+  thread_local TimerService service;
+  return service;
+}
+
+bool TimerService::destroyedForCurrentThread()
+{
+  return t_service_destroyed;
+}
+
+TimerService::TimerService()
+{
+  timer_.setSingleShot(true);
+  timer_.setTimerType(Qt::PreciseTimer);
+  QObject::connect(&timer_, &QTimer::timeout, [this]() {onTimeout();});
+}
+
+TimerService::~TimerService()
+{
+  t_service_destroyed = true;
+}
+
+TimerWheel::TimerId TimerService::start(std::chrono::nanoseconds delay, TimerWheel::Callback callback)
+{
+  auto id = wheel_.schedule(Clock::now() + delay, std::move(callback));
+  rearm();
+  return id;
+}
+
+bool TimerService::cancel(TimerWheel::TimerId id)
+{
+  // An early wakeup is harmless, the QTimer is left armed
+  return wheel_.cancel(id);
+}
+
+void TimerService::rearm()
+{
+  auto next = wheel_.nextWakeup();
+  if (!next) {
+    timer_.stop();
+    armed_.reset();
+    return;
+  }
+  if (armed_ && timer_.isActive() && *armed_ <= *next) {
+    return;
+  }
+  auto delay = std::chrono::ceil<std::chrono::milliseconds>(*next - Clock::now());
+  timer_.start(static_cast<int>(std::clamp<std::chrono::milliseconds::rep>(delay.count(), 0, 1 << 30)));
+  armed_ = next;
+}
+
+void TimerService::onTimeout()
+{
+  armed_.reset();
+  wheel_.advance(Clock::now());
+  rearm();
+}
+
+}  // namespace packml_sm
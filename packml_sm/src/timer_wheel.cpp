@@ -0,0 +1,238 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/timer_wheel.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace packml_sm
+{
+
+TimerWheel::TimerWheel(std::chrono::nanoseconds tick, Clock::time_point origin)
+: tick_(std::max(tick, std::chrono::nanoseconds(1))), origin_(origin), now_tick_(0)
+{
+  for (auto & level : heads_) {
+    level.fill(kNil);
+  }
+}
+
+std::uint64_t TimerWheel::ceilTick(Clock::time_point time) const
+{
+  if (time <= origin_) {
+    return 0;
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(time - origin_);
+  return static_cast<std::uint64_t>((elapsed + tick_ - std::chrono::nanoseconds(1)) / tick_);
+}
+
+std::uint64_t TimerWheel::floorTick(Clock::time_point time) const
+{
+  if (time <= origin_) {
+    return 0;
+  }
+  return static_cast<std::uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(time - origin_) / tick_);
+}
+
+TimerWheel::TimerId TimerWheel::schedule(Clock::time_point deadline, Callback callback)
+{
+  std::uint32_t index;
+  if (free_.empty()) {
+    index = static_cast<std::uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+  } else {
+    index = free_.back();
+    free_.pop_back();
+  }
+  Node & node = nodes_[index];
+  node.expiry = std::max(ceilTick(deadline), now_tick_ + 1);
+  node.callback = std::move(callback);
+  // Generation 0 is skipped so that no id equals kNoTimer
+  if (++node.generation == 0) {
+    node.generation = 1;
+  }
+  insert(index);
+  ++size_;
+  return (static_cast<TimerId>(node.generation) << 32) | index;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+  auto index = static_cast<std::uint32_t>(id & 0xffffffffu);
+  auto generation = static_cast<std::uint32_t>(id >> 32);
+  if (index >= nodes_.size()) {
+    return false;
+  }
+  Node & node = nodes_[index];
+  if (!node.linked || node.generation != generation) {
+    return false;
+  }
+  unlink(index);
+  node.callback = nullptr;
+  free_.push_back(index);
+  --size_;
+  return true;
+}
+
+void TimerWheel::insert(std::uint32_t index)
+{
+  Node & node = nodes_[index];
+  std::uint64_t expiry = node.expiry;
+  std::uint64_t delta = expiry - now_tick_;
+  unsigned level = 0;
+  while (level + 1 < kLevels && delta >= (std::uint64_t(1) << shift(level + 1))) {
+    ++level;
+  }
+  if (delta >= (std::uint64_t(1) << shift(kLevels))) {
+    // Beyond the range of the wheel, park in the furthest slot and re-cascade from there
+    expiry = now_tick_ + (std::uint64_t(1) << shift(kLevels)) - 1;
+  }
+  auto slot = static_cast<std::uint8_t>((expiry >> shift(level)) & kSlotMask);
+
+  node.level = static_cast<std::uint8_t>(level);
+  node.slot = slot;
+  node.prev = kNil;
+  node.next = heads_[level][slot];
+  if (node.next != kNil) {
+    nodes_[node.next].prev = index;
+  }
+  heads_[level][slot] = index;
+  node.linked = true;
+  ++level_size_[level];
+}
+
+void TimerWheel::unlink(std::uint32_t index)
+{
+  Node & node = nodes_[index];
+  if (node.prev != kNil) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    heads_[node.level][node.slot] = node.next;
+  }
+  if (node.next != kNil) {
+    nodes_[node.next].prev = node.prev;
+  }
+  node.prev = kNil;
+  node.next = kNil;
+  node.linked = false;
+  --level_size_[node.level];
+}
+
+void TimerWheel::cascade(unsigned level)
+{
+  auto slot = (now_tick_ >> shift(level)) & kSlotMask;
+  std::uint32_t index = heads_[level][slot];
+  while (index != kNil) {
+    std::uint32_t next = nodes_[index].next;
+    unlink(index);
+    insert(index);
+    index = next;
+  }
+}
+
+template<typename Sink>
+std::size_t TimerWheel::fire(Sink && sink)
+{
+  std::size_t fired = 0;
+  auto slot = now_tick_ & kSlotMask;
+  // Re-read the head every time, a callback may cancel or schedule timers of this slot
+  while (heads_[0][slot] != kNil) {
+    std::uint32_t index = heads_[0][slot];
+    unlink(index);
+    Callback callback = std::move(nodes_[index].callback);
+    nodes_[index].callback = nullptr;
+    free_.push_back(index);
+    --size_;
+    if (callback) {
+      sink(std::move(callback));
+    }
+    ++fired;
+  }
+  return fired;
+}
+
+template<typename Sink>
+std::size_t TimerWheel::step(Clock::time_point now, Sink && sink)
+{
+  std::uint64_t target = floorTick(now);
+  std::size_t fired = 0;
+  while (now_tick_ < target) {
+    if (size_ == 0) {
+      now_tick_ = target;
+      break;
+    }
+    // Skip the ticks in which nothing can happen: up to the next boundary of the lowest level that
+    // holds timers
+    unsigned lowest = 0;
+    while (level_size_[lowest] == 0) {
+      ++lowest;
+    }
+    if (lowest > 0) {
+      std::uint64_t mask = (std::uint64_t(1) << shift(lowest)) - 1;
+      now_tick_ = std::min(target, now_tick_ | mask);
+      if (now_tick_ == target) {
+        break;
+      }
+    }
+
+    ++now_tick_;
+    for (unsigned level = 1; level < kLevels; ++level) {
+      if ((now_tick_ & ((std::uint64_t(1) << shift(level)) - 1)) != 0) {
+        break;
+      }
+      cascade(level);
+    }
+    fired += fire(sink);
+  }
+  return fired;
+}
+
+std::size_t TimerWheel::advance(Clock::time_point now)
+{
+  return step(now, [](Callback && callback) {callback();});
+}
+
+std::size_t TimerWheel::collect(Clock::time_point now, std::vector<Callback> & due)
+{
+  return step(now, [&due](Callback && callback) {due.push_back(std::move(callback));});
+}
+
+std::optional<TimerWheel::Clock::time_point> TimerWheel::nextWakeup() const
+{
+  if (size_ == 0) {
+    return std::nullopt;
+  }
+  std::optional<std::uint64_t> earliest;
+  for (unsigned level = 0; level < kLevels; ++level) {
+    if (level_size_[level] == 0) {
+      continue;
+    }
+    // Level 0 slots hold the exact expiry, higher levels are due when they are cascaded
+    std::uint64_t period = now_tick_ >> shift(level);
+    for (std::uint64_t ii = 1; ii <= kSlots; ++ii) {
+      if (heads_[level][(period + ii) & kSlotMask] != kNil) {
+        std::uint64_t tick = (period + ii) << shift(level);
+        if (!earliest || tick < *earliest) {
+          earliest = tick;
+        }
+        break;
+      }
+    }
+  }
+  return earliest ? std::optional<Clock::time_point>(timeOf(*earliest)) : std::nullopt;
+}
+
+}  // namespace packml_sm
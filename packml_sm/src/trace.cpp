@@ -0,0 +1,329 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/trace.hpp"
+
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace packml_sm
+{
+namespace tracing
+{
+namespace detail
+{
+
+namespace
+{
+
+/**
+* @brief Single producer (the owning thread), single consumer (the writer thread) ring of events
+*/
+struct Ring
+{
+  static constexpr std::size_t kCapacity = 4096;
+
+  std::array<Event, kCapacity> events;
+  alignas(64) std::atomic<std::size_t> head{0};
+  alignas(64) std::atomic<std::size_t> tail{0};
+  std::atomic<std::uint64_t> dropped{0};
+  std::atomic<bool> retired{false};
+  std::uint32_t thread = 0;
+};
+
+void appendEscaped(std::string & out, std::string_view text)
+{
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) >= 0x20) {
+      out += c;
+    }
+  }
+}
+
+// Chrome trace time stamps are microseconds
+void appendMicros(std::string & out, std::int64_t ns)
+{
+  char buffer[32];
+  std::snprintf(
+    buffer, sizeof(buffer), "%lld.%03lld", static_cast<long long>(ns / 1000),
+    static_cast<long long>(ns % 1000));
+  out += buffer;
+}
+
+
+class Tracer
+{
+public:
+  static Tracer & instance()
+  {
+    // Never destroyed, threads may trace during static destruction
+    static Tracer * tracer = new Tracer();
+    return *tracer;
+  }
+
+  std::shared_ptr<Ring> registerThread()
+  {
+    auto ring = std::make_shared<Ring>();
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring->thread = ++thread_count_;
+    rings_.push_back(ring);
+    return ring;
+  }
+
+  std::uint32_t session() const {return session_.load(std::memory_order_relaxed);}
+
+  std::expected<bool, std::string> start(const std::string & path)
+  {
+    std::lock_guard<std::mutex> control(control_mutex_);
+    stopWriter();
+    std::FILE * file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+      return std::unexpected("Cannot open trace " + path + ": " + std::strerror(errno));
+    }
+    // JSON array format, viewers also load a trace whose process died before the closing bracket
+    std::fputs("[\n", file);
+    file_ = file;
+    first_ = true;
+    // Events still queued from the previous trace belong to its session and are skipped
+    session_.fetch_add(1, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = false;
+    }
+    writer_ = std::thread(&Tracer::run, this);
+    g_enabled.store(true, std::memory_order_relaxed);
+    return true;
+  }
+
+  void stop()
+  {
+    std::lock_guard<std::mutex> control(control_mutex_);
+    stopWriter();
+  }
+
+  std::uint64_t dropped()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::uint64_t count = retired_dropped_;
+    for (const auto & ring : rings_) {
+      count += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return count;
+  }
+
+private:
+  Tracer() = default;
+
+  // Must be called with control_mutex_ locked
+  void stopWriter()
+  {
+    if (!writer_.joinable()) {
+      return;
+    }
+    g_enabled.store(false, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+    std::fputs("\n]\n", file_);
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+
+  void run()
+  {
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::string out;
+    bool stopping = false;
+    while (!stopping) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, std::chrono::milliseconds(20), [this] {return stop_;});
+        // The last pass writes what was traced before the trace was disabled
+        stopping = stop_;
+        rings = rings_;
+      }
+
+      for (auto & ring : rings) {
+        drain(*ring, out);
+      }
+      if (!out.empty()) {
+        std::fwrite(out.data(), 1, out.size(), file_);
+        std::fflush(file_);
+        out.clear();
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::erase_if(rings_, [this](const std::shared_ptr<Ring> & ring) {
+          bool done = ring->retired.load(std::memory_order_acquire) &&
+          ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+          if (done) {
+            retired_dropped_ += ring->dropped.load(std::memory_order_relaxed);
+          }
+          return done;
+        });
+    }
+  }
+
+  void drain(Ring & ring, std::string & out)
+  {
+    auto tail = ring.tail.load(std::memory_order_relaxed);
+    auto head = ring.head.load(std::memory_order_acquire);
+    auto session = session_.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail) {
+      const Event & event = ring.events[tail % Ring::kCapacity];
+      if (event.session == session) {
+        format(event, ring.thread, out);
+      }
+      ring.tail.store(tail + 1, std::memory_order_release);
+    }
+  }
+
+  void format(const Event & event, std::uint32_t thread, std::string & out)
+  {
+    out += first_ ? "{\"name\":\"" : ",\n{\"name\":\"";
+    first_ = false;
+    if (event.literal != nullptr) {
+      appendEscaped(out, event.literal);
+    } else if (event.format != nullptr) {
+      appendEscaped(out, event.format(event.value));
+    } else {
+      appendEscaped(out, event.text);
+    }
+    out += "\",\"cat\":\"";
+    out += event.category;
+    out += "\",\"ph\":\"";
+    out += event.phase;
+    out += "\",\"ts\":";
+    appendMicros(out, event.stamp_ns);
+    if (event.phase == 'X') {
+      out += ",\"dur\":";
+      appendMicros(out, event.duration_ns);
+    } else {
+      char id[32];
+      std::snprintf(id, sizeof(id), "0x%llx", static_cast<unsigned long long>(event.id));
+      out += ",\"id\":\"";
+      out += id;
+      out += '"';
+    }
+    out += ",\"pid\":";
+    out += std::to_string(pid_);
+    out += ",\"tid\":";
+    out += std::to_string(thread);
+    if (event.arg_name != nullptr) {
+      out += ",\"args\":{\"";
+      appendEscaped(out, event.arg_name);
+      out += "\":";
+      out += std::to_string(event.arg_value);
+      out += '}';
+    }
+    out += '}';
+  }
+
+  // Serializes start() and stop()
+  std::mutex control_mutex_;
+  std::thread writer_;
+  std::FILE * file_ = nullptr;
+  bool first_ = true;
+  const int pid_ = static_cast<int>(::getpid());
+  std::atomic<std::uint32_t> session_{0};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::vector<std::shared_ptr<Ring>> rings_;
+  std::uint32_t thread_count_{0};
+  std::uint64_t retired_dropped_{0};
+};
+
+
+/**
+* @brief Owner of the ring of a thread, retires it when the thread exits
+*/
+struct ThreadRing
+{
+  ThreadRing()
+  : ring(Tracer::instance().registerThread()) {}
+
+  ~ThreadRing()
+  {
+    ring->retired.store(true, std::memory_order_release);
+  }
+
+  std::shared_ptr<Ring> ring;
+};
+
+thread_local ThreadRing t_ring;
+
+}  // namespace
+
+std::atomic<bool> g_enabled{false};
+
+void record(
+  char phase, const char * category, const Name & name, std::uint64_t id, std::int64_t stamp_ns,
+  std::int64_t duration_ns, const char * arg_name, std::int64_t arg_value)
+{
+  Ring & ring = *t_ring.ring;
+  auto head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= Ring::kCapacity) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  Event & event = ring.events[head % Ring::kCapacity];
+  event.stamp_ns = stamp_ns;
+  event.duration_ns = duration_ns;
+  event.id = id;
+  event.category = category;
+  event.setName(name);
+  event.arg_name = arg_name;
+  event.arg_value = arg_value;
+  event.session = Tracer::instance().session();
+  event.phase = phase;
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+}  // namespace detail
+
+std::expected<bool, std::string> start(const std::string & path)
+{
+  return detail::Tracer::instance().start(path);
+}
+
+void stop()
+{
+  detail::Tracer::instance().stop();
+}
+
+std::uint64_t dropped()
+{
+  return detail::Tracer::instance().dropped();
+}
+
+}  // namespace tracing
+}  // namespace packml_sm
@@ -0,0 +1,146 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 ROS-Industrial Consortium Asia Pacific (ROS 2 compatibility)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "packml_sm/transition_stats.hpp"
+
+namespace packml_sm
+{
+
+TransitionStatsTable::TransitionStatsTable()
+: cells_(std::make_unique<Cell[]>(kStateCount * kTriggerCount))
+{
+}
+
+TransitionStatsTable::~TransitionStatsTable()
+{
+  for (std::size_t ii = 0; ii < kStateCount * kTriggerCount; ++ii) {
+    Target * targets = cells_[ii].targets.load(std::memory_order_relaxed);
+    if (targets == nullptr) {
+      continue;
+    }
+    for (std::size_t to = 0; to < kStateCount; ++to) {
+      delete targets[to].latency.load(std::memory_order_relaxed);
+    }
+    delete[] targets;
+  }
+}
+
+TransitionStatsTable::Target & TransitionStatsTable::target(
+  State from, Trigger trigger, TransitionCmd command, State to)
+{
+  Cell & counters = cell(from, trigger, command);
+  Target * targets = counters.targets.load(std::memory_order_acquire);
+  if (targets == nullptr) {
+    auto created = new Target[kStateCount];
+    if (counters.targets.compare_exchange_strong(targets, created, std::memory_order_acq_rel)) {
+      targets = created;
+    } else {
+      delete[] created;
+    }
+  }
+  return targets[toIndex(to)];
+}
+
+void TransitionStatsTable::accepted(
+  State from, Trigger trigger, TransitionCmd command, State to, std::chrono::nanoseconds latency)
+{
+  Target & counters = target(from, trigger, command, to);
+  AtomicLatencyHistogram * histogram = counters.latency.load(std::memory_order_acquire);
+  if (histogram == nullptr) {
+    auto created = new AtomicLatencyHistogram();
+    if (counters.latency.compare_exchange_strong(histogram, created, std::memory_order_acq_rel)) {
+      histogram = created;
+    } else {
+      delete created;
+    }
+  }
+  histogram->add(latency);
+  counters.accepted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransitionStatsTable::rejectedByMode(State from, Trigger trigger, TransitionCmd command, State to)
+{
+  target(from, trigger, command, to).rejected_by_mode.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransitionStatsTable::rejectedByState(State from, Trigger trigger, TransitionCmd command)
+{
+  cell(from, trigger, command).rejected_by_state.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransitionStatsTable::rejected(
+  const TransitionTable & table, State from, Trigger trigger, TransitionCmd command)
+{
+  State to;
+  switch (trigger) {
+    case Trigger::COMMAND:
+      to = table.onCommand(from, command);
+      break;
+    case Trigger::COMPLETED:
+      to = table.onComplete(from);
+      break;
+    default:
+      to = table.onError(from);
+      break;
+  }
+  if (to != State::UNDEFINED) {
+    rejectedByMode(from, trigger, command, to);
+  } else {
+    rejectedByState(from, trigger, command);
+  }
+}
+
+std::vector<TransitionStats> TransitionStatsTable::snapshot() const
+{
+  std::vector<TransitionStats> transitions;
+  for (std::size_t from = 0; from < kStateCount; ++from) {
+    for (std::size_t trigger = 0; trigger < kTriggerCount; ++trigger) {
+      const Cell & counters = cells_[from * kTriggerCount + trigger];
+      TransitionStats stats;
+      stats.from = static_cast<State>(from);
+      if (trigger < kCommandCount) {
+        stats.command = static_cast<TransitionCmd>(trigger);
+      } else {
+        stats.trigger = static_cast<Trigger>(trigger - kCommandCount + 1);
+      }
+      stats.rejected_by_state = counters.rejected_by_state.load(std::memory_order_relaxed);
+      if (stats.rejected_by_state > 0) {
+        transitions.push_back(stats);
+      }
+      const Target * targets = counters.targets.load(std::memory_order_acquire);
+      if (targets == nullptr) {
+        continue;
+      }
+      for (std::size_t to = 0; to < kStateCount; ++to) {
+        const Target & target = targets[to];
+        TransitionStats entry = stats;
+        entry.to = static_cast<State>(to);
+        entry.rejected_by_state = 0;
+        entry.accepted = target.accepted.load(std::memory_order_relaxed);
+        entry.rejected_by_mode = target.rejected_by_mode.load(std::memory_order_relaxed);
+        if (entry.accepted == 0 && entry.rejected_by_mode == 0) {
+          continue;
+        }
+        if (const AtomicLatencyHistogram * histogram = target.latency.load(std::memory_order_acquire)) {
+          entry.latency = histogram->snapshot();
+        }
+        transitions.push_back(std::move(entry));
+      }
+    }
+  }
+  return transitions;
+}
+
+}  // namespace packml_sm
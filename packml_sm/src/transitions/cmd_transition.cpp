@@ -19,6 +19,7 @@
 
 #include "packml_sm/events/cmd_event.hpp"
 #include "packml_sm/transitions/cmd_transition.hpp"
+#include "packml_sm/log.hpp"
 
 namespace packml_sm {
 CmdTransition::CmdTransition(const TransitionCmd &cmd_value,
@@ -27,9 +28,7 @@ CmdTransition::CmdTransition(const TransitionCmd &cmd_value,
     : cmd(cmd_value), name(name_value) {
   this->setTargetState(&to);
   from.addTransition(this);
-  std::cout << "Creating " << this->name.toStdString() << " transition from "
-            << from.name() << " to " << to.name()
-            << std::endl;
+  PACKML_LOG_DEBUG("Creating {} transition from {} to {}", cmd_value, from.state(), to.state());
 }
 
 bool CmdTransition::eventTest(QEvent *e) {
@@ -40,8 +39,7 @@ bool CmdTransition::eventTest(QEvent *e) {
   }
   CmdEvent *se = static_cast<CmdEvent *>(e);
 
-  std::cout << "Received transition command: " << se->cmd
-            << " on transition: " << this->name.toStdString() << std::endl;
+  PACKML_LOG_DEBUG("Received transition command: {} on transition: {}", se->cmd, cmd);
 
   // call parent function to test if transition is available
   bool available = PackmlTransition::eventTest(e);
@@ -57,7 +55,7 @@ bool CmdTransition::eventTest(QEvent *e) {
     return true;
   }
 
-  std::cout << "Event is not for this transition" << std::endl;
+  PACKML_LOG_DEBUG("Event is not for this transition");
 
   e->ignore();
 
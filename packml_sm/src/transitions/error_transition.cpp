@@ -17,14 +17,14 @@
 #include "QEvent"
 #include "packml_sm/transitions/error_transition.hpp"
 #include "packml_sm/events/error_event.hpp"
+#include "packml_sm/log.hpp"
 
 namespace packml_sm {
 
 ErrorTransition::ErrorTransition(PackmlState &from, PackmlState &to) {
   this->setTargetState(&to);
   from.addTransition(this);
-  std::cout << "Creating error transition from " << from.name()
-            << " to " << to.name() << std::endl;
+  PACKML_LOG_DEBUG("Creating error transition from {} to {}", from.state(), to.state());
 }
 
 bool ErrorTransition::eventTest(QEvent *e) {
@@ -32,6 +32,13 @@ bool ErrorTransition::eventTest(QEvent *e) {
     return false;
   }
 
+  // Operations abandoned on exit may still report, only the current state entry may complete
+  auto event = static_cast<ErrorEvent *>(e);
+  if (event->origin && !event->origin->isCurrentEntry(event->entry)) {
+    PACKML_LOG_DEBUG("Discarding result of a previous entry of {}", event->origin->state());
+    return false;
+  }
+
   // call parent function to test if transition is available
   bool available = PackmlTransition::eventTest(e);
 
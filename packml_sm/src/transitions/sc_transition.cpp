@@ -17,6 +17,7 @@
 #include "QEvent"
 #include "packml_sm/transitions/sc_transition.hpp"
 #include "packml_sm/events/sc_event.hpp"
+#include "packml_sm/log.hpp"
 #include "packml_sm/states/state.hpp"
 #include "packml_sm/transitions/packml_transitions.hpp"
 
@@ -26,9 +27,7 @@ StateCompleteTransition::StateCompleteTransition(PackmlState &from,
                                                  PackmlState &to) {
   this->setTargetState(&to);
   from.addTransition(this);
-  std::cout << "Creating state complete transition from "
-            << from.name() << " to " << to.name()
-            << std::endl;
+  PACKML_LOG_DEBUG("Creating state complete transition from {} to {}", from.state(), to.state());
 }
 
 bool StateCompleteTransition::eventTest(QEvent *e) {
@@ -36,6 +35,21 @@ bool StateCompleteTransition::eventTest(QEvent *e) {
     return false;
   }
 
+  // Operations abandoned on exit may still report, only the current state entry may complete
+  auto event = static_cast<StateCompleteEvent *>(e);
+  if (event->origin && !event->origin->isCurrentEntry(event->entry)) {
+    PACKML_LOG_DEBUG("Discarding result of a previous entry of {}", event->origin->state());
+    return false;
+  }
+
+  // A state looped by the mode only takes its loop transition
+  auto current = mode();
+  auto source = static_cast<PackmlState *>(sourceState());
+  bool looped = current != nullptr && current->loops(source->state());
+  if (mode_loop_ ? !looped : (looped && targetState() != sourceState())) {
+    return false;
+  }
+
   // call parent function to test if transition is available
   bool available = PackmlTransition::eventTest(e);
 
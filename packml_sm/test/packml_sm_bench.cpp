@@ -0,0 +1,496 @@
+// Copyright (c) 2016 Shaun Edwards
+// Copyright (c) 2019 Dejanira Araiza Illan, ROS-Industrial Asia Pacific
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Throughput and latency of both state machine backends. Results are written as JSON unless the
+// command line selects another --benchmark_format.
+
+#include <QCoreApplication>
+#include <benchmark/benchmark.h>
+#include <malloc.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "packml_sm/clock.hpp"
+#include "packml_sm/common.hpp"
+#include "packml_sm/journal.hpp"
+#include "packml_sm/state_change_bus.hpp"
+#include "packml_sm/state_machine.hpp"
+#include "packml_sm/table_state_machine.hpp"
+#include "packml_sm/transition_table.hpp"
+
+namespace
+{
+
+// Bytes held by live allocations, a machine keeps the difference over its construction
+std::atomic<std::int64_t> live_bytes{0};
+
+}  // namespace
+
+void * operator new(std::size_t size)
+{
+  void * block = std::malloc(size == 0 ? 1 : size);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  live_bytes.fetch_add(static_cast<std::int64_t>(malloc_usable_size(block)), std::memory_order_relaxed);
+  return block;
+}
+
+// GCC cannot tell that the replaced operator new allocates with malloc
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void * block) noexcept
+{
+  if (block != nullptr) {
+    live_bytes.fetch_sub(static_cast<std::int64_t>(malloc_usable_size(block)), std::memory_order_relaxed);
+    std::free(block);
+  }
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+void operator delete(void * block, std::size_t /*size*/) noexcept
+{
+  operator delete(block);
+}
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+using packml_sm::State;
+using packml_sm::TransitionCmd;
+
+void qtWorker(int argc, char * argv[])
+{
+  QCoreApplication a(argc, argv);
+  a.exec();
+}
+
+double seconds(Clock::duration elapsed)
+{
+  return std::chrono::duration<double>(elapsed).count();
+}
+
+
+/**
+* @brief Records when every state was last entered and lets the benchmark thread wait for a state
+*/
+class StateWaiter
+{
+public:
+  void entered(State state)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      state_ = state;
+      entered_at_[packml_sm::toIndex(state)] = Clock::now();
+    }
+    changed_.notify_all();
+  }
+
+  bool wait(State state)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, std::chrono::seconds(5), [this, state] {return state_ == state;});
+  }
+
+  Clock::time_point enteredAt(State state)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entered_at_[packml_sm::toIndex(state)];
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  State state_ = State::UNDEFINED;
+  std::array<Clock::time_point, packml_sm::kStateCount> entered_at_{};
+};
+
+
+/**
+* @brief Table machine in IDLE whose acting states wait for completeState(), nothing runs in the
+* background
+* @param journal - optional journal the machine records into
+*/
+std::shared_ptr<packml_sm::TableStateMachine> idleTable(
+  std::shared_ptr<packml_sm::VirtualClock> clock,
+  std::shared_ptr<packml_sm::JournalWriter> journal = nullptr)
+{
+  auto sm = packml_sm::TableStateMachine::singleCycleSM();
+  sm->setClock(clock);
+  if (journal) {
+    sm->setJournal(std::move(journal));
+  }
+  for (std::size_t ii = 0; ii < packml_sm::kStateCount; ++ii) {
+    if (packml_sm::isActingState(static_cast<State>(ii))) {
+      sm->setOperationDelay(static_cast<State>(ii), std::chrono::milliseconds::max());
+    }
+  }
+  sm->activate();
+  sm->clear();
+  sm->completeState(0);
+  sm->reset();
+  sm->completeState(0);
+  return sm;
+}
+
+
+/**
+* @brief Qt machine in IDLE whose acting states complete as soon as they are entered
+*/
+std::shared_ptr<packml_sm::StateMachine> idleQt(StateWaiter & waiter)
+{
+  auto sm = packml_sm::StateMachine::singleCycleSM();
+  for (std::size_t ii = 0; ii < packml_sm::kStateCount; ++ii) {
+    if (packml_sm::isActingState(static_cast<State>(ii))) {
+      sm->setOperationDelay(static_cast<State>(ii), std::chrono::milliseconds(0));
+    }
+  }
+  sm->on_state_changed = [&waiter](State value, QString /*name*/) {waiter.entered(value);};
+  sm->activate();
+  waiter.wait(State::ABORTED);
+  sm->clear();
+  waiter.wait(State::STOPPED);
+  sm->reset();
+  waiter.wait(State::IDLE);
+  return sm;
+}
+
+
+// Command round trip: from changeState() to the command being accepted or rejected
+
+void BM_TableCommandAccepted(benchmark::State & state)
+{
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  auto sm = idleTable(clock);
+  for (auto _ : state) {
+    auto started = Clock::now();
+    bool accepted = sm->changeState(TransitionCmd::STOP).has_value();
+    auto elapsed = Clock::now() - started;
+    sm->completeState(0);
+    started = Clock::now();
+    accepted = sm->changeState(TransitionCmd::RESET).has_value() && accepted;
+    elapsed += Clock::now() - started;
+    sm->completeState(0);
+    if (!accepted) {
+      state.SkipWithError("Command rejected");
+      break;
+    }
+    state.SetIterationTime(seconds(elapsed) / 2);
+  }
+  sm->deactivate();
+}
+BENCHMARK(BM_TableCommandAccepted)->UseManualTime();
+
+void BM_TableCommandRejected(benchmark::State & state)
+{
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  auto sm = idleTable(clock);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sm->changeState(TransitionCmd::UNHOLD));
+  }
+  sm->deactivate();
+}
+BENCHMARK(BM_TableCommandRejected);
+
+void BM_QtCommandAccepted(benchmark::State & state)
+{
+  StateWaiter waiter;
+  auto sm = idleQt(waiter);
+  for (auto _ : state) {
+    auto started = Clock::now();
+    bool accepted = sm->changeStateAsync(TransitionCmd::STOP).accepted.get();
+    auto elapsed = Clock::now() - started;
+    waiter.wait(State::STOPPED);
+    started = Clock::now();
+    accepted = sm->changeStateAsync(TransitionCmd::RESET).accepted.get() && accepted;
+    elapsed += Clock::now() - started;
+    if (!accepted || !waiter.wait(State::IDLE)) {
+      state.SkipWithError("Command rejected");
+      break;
+    }
+    state.SetIterationTime(seconds(elapsed) / 2);
+  }
+  sm->deactivate();
+}
+BENCHMARK(BM_QtCommandAccepted)->UseManualTime();
+
+void BM_QtCommandRejected(benchmark::State & state)
+{
+  StateWaiter waiter;
+  auto sm = idleQt(waiter);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sm->changeStateAsync(TransitionCmd::UNHOLD).accepted.get());
+  }
+  sm->deactivate();
+}
+BENCHMARK(BM_QtCommandRejected);
+
+
+// State complete: from the operation of an acting state returning to the next state being entered
+
+void BM_TableCompleteToEntry(benchmark::State & state)
+{
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  auto sm = idleTable(clock);
+  for (auto _ : state) {
+    sm->changeState(TransitionCmd::STOP);
+    auto started = Clock::now();
+    sm->completeState(0);
+    auto elapsed = Clock::now() - started;
+    sm->changeState(TransitionCmd::RESET);
+    started = Clock::now();
+    sm->completeState(0);
+    elapsed += Clock::now() - started;
+    if (sm->getCurrentState() != State::IDLE) {
+      state.SkipWithError("Operation result ignored");
+      break;
+    }
+    state.SetIterationTime(seconds(elapsed) / 2);
+  }
+  sm->deactivate();
+}
+BENCHMARK(BM_TableCompleteToEntry)->UseManualTime();
+
+void BM_QtCompleteToEntry(benchmark::State & state)
+{
+  // The operations of the acting states return on entry, the time between the entries is the
+  // completion posted to the state machine thread and the transition it triggers
+  StateWaiter waiter;
+  auto sm = idleQt(waiter);
+  for (auto _ : state) {
+    sm->stop();
+    bool reached = waiter.wait(State::STOPPED);
+    auto elapsed = waiter.enteredAt(State::STOPPED) - waiter.enteredAt(State::STOPPING);
+    sm->reset();
+    reached = waiter.wait(State::IDLE) && reached;
+    elapsed += waiter.enteredAt(State::IDLE) - waiter.enteredAt(State::RESETTING);
+    if (!reached) {
+      state.SkipWithError("Operation result ignored");
+      break;
+    }
+    state.SetIterationTime(seconds(elapsed) / 2);
+  }
+  sm->deactivate();
+}
+BENCHMARK(BM_QtCompleteToEntry)->UseManualTime();
+
+
+// Command round trip while a bus subscriber is stuck in its callback, compare with
+// BM_TableCommandAccepted: the entries only overwrite its queue
+
+void BM_TableCommandWithBlockedSubscriber(benchmark::State & state)
+{
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  auto sm = idleTable(clock);
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  auto blocked = sm->stateChanges().subscribe(
+    [released](const packml_sm::StateChange & /*change*/) {released.wait();},
+    64, packml_sm::OverflowPolicy::DROP_OLDEST);
+  for (auto _ : state) {
+    auto started = Clock::now();
+    bool accepted = sm->changeState(TransitionCmd::STOP).has_value();
+    auto elapsed = Clock::now() - started;
+    sm->completeState(0);
+    started = Clock::now();
+    accepted = sm->changeState(TransitionCmd::RESET).has_value() && accepted;
+    elapsed += Clock::now() - started;
+    sm->completeState(0);
+    if (!accepted) {
+      state.SkipWithError("Command rejected");
+      break;
+    }
+    state.SetIterationTime(seconds(elapsed) / 2);
+  }
+  state.counters["dropped"] = static_cast<double>(blocked->dropped());
+  release.set_value();
+  blocked.reset();
+  sm->deactivate();
+}
+BENCHMARK(BM_TableCommandWithBlockedSubscriber)->UseManualTime();
+
+
+// Transition with and without a journal: STOP and RESET round trips, each journaling its command,
+// the result of its acting state and the states it enters
+
+void BM_TableTransitionJournal(benchmark::State & state, bool journaled)
+{
+  auto path = (std::filesystem::temp_directory_path() / "packml_sm_bench_journal.bin").string();
+  std::filesystem::remove(path);
+  std::shared_ptr<packml_sm::JournalWriter> journal;
+  if (journaled) {
+    auto opened = packml_sm::JournalWriter::open(path);
+    if (!opened) {
+      state.SkipWithError(opened.error().c_str());
+      return;
+    }
+    journal = *opened;
+  }
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  auto sm = idleTable(clock, journal);
+  for (auto _ : state) {
+    auto started = Clock::now();
+    bool accepted = sm->changeState(TransitionCmd::STOP).has_value();
+    sm->completeState(0);
+    accepted = sm->changeState(TransitionCmd::RESET).has_value() && accepted;
+    sm->completeState(0);
+    auto elapsed = Clock::now() - started;
+    if (!accepted) {
+      state.SkipWithError("Command rejected");
+      break;
+    }
+    state.SetIterationTime(seconds(elapsed) / 2);
+  }
+  sm->deactivate();
+  if (journal) {
+    journal->flush();
+    state.counters["records"] = static_cast<double>(journal->records());
+  }
+  sm.reset();
+  journal.reset();
+  std::filesystem::remove(path);
+}
+BENCHMARK_CAPTURE(BM_TableTransitionJournal, journal_off, false)->UseManualTime();
+BENCHMARK_CAPTURE(BM_TableTransitionJournal, journal_on, true)->UseManualTime();
+
+
+// awaitState() wake-up: from completeState() on another thread to the waiting thread returning
+
+void BM_TableAwaitStateWakeup(benchmark::State & state)
+{
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  auto sm = idleTable(clock);
+  for (auto _ : state) {
+    sm->changeState(TransitionCmd::STOP);
+    Clock::time_point completed;
+    std::thread completer([&sm, &completed]() {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        completed = Clock::now();
+        sm->completeState(0);
+      });
+    bool reached = sm->awaitState(State::STOPPED, std::chrono::seconds(5));
+    auto woke = Clock::now();
+    completer.join();
+    sm->changeState(TransitionCmd::RESET);
+    sm->completeState(0);
+    if (!reached) {
+      state.SkipWithError("State not reached");
+      break;
+    }
+    state.SetIterationTime(seconds(woke - completed));
+  }
+  sm->deactivate();
+}
+BENCHMARK(BM_TableAwaitStateWakeup)->UseManualTime();
+
+
+// Mode switch between two built-in modes, both may be switched to in IDLE
+
+void BM_TableModeSwitch(benchmark::State & state)
+{
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  auto sm = idleTable(clock);
+  bool manual = false;
+  for (auto _ : state) {
+    manual = !manual;
+    if (!sm->changeMode(manual ? packml_sm::ModeType::MANUAL : packml_sm::ModeType::PRODUCTION)) {
+      state.SkipWithError("Mode switch rejected");
+      break;
+    }
+  }
+  sm->deactivate();
+}
+BENCHMARK(BM_TableModeSwitch);
+
+void BM_QtModeSwitch(benchmark::State & state)
+{
+  StateWaiter waiter;
+  auto sm = idleQt(waiter);
+  bool manual = false;
+  for (auto _ : state) {
+    manual = !manual;
+    if (!sm->changeMode(manual ? packml_sm::ModeType::MANUAL : packml_sm::ModeType::PRODUCTION)) {
+      state.SkipWithError("Mode switch rejected");
+      break;
+    }
+  }
+  sm->deactivate();
+}
+BENCHMARK(BM_QtModeSwitch);
+
+
+// Construction time, and the memory a machine holds once constructed
+
+template<class Factory>
+void BM_Construct(benchmark::State & state, Factory factory)
+{
+  std::int64_t bytes = 0;
+  for (auto _ : state) {
+    auto before = live_bytes.load(std::memory_order_relaxed);
+    auto sm = factory();
+    bytes += live_bytes.load(std::memory_order_relaxed) - before;
+    state.PauseTiming();
+    sm.reset();
+    state.ResumeTiming();
+  }
+  state.counters["bytes_per_machine"] = benchmark::Counter(
+    static_cast<double>(bytes), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK_CAPTURE(BM_Construct, table_single_cycle, &packml_sm::TableStateMachine::singleCycleSM);
+BENCHMARK_CAPTURE(BM_Construct, table_continuous_cycle, &packml_sm::TableStateMachine::continuousCycleSM);
+BENCHMARK_CAPTURE(BM_Construct, qt_single_cycle, &packml_sm::StateMachine::singleCycleSM);
+BENCHMARK_CAPTURE(BM_Construct, qt_continuous_cycle, &packml_sm::StateMachine::continuousCycleSM);
+
+}  // namespace
+
+int main(int argc, char ** argv)
+{
+  std::thread thr(qtWorker, argc, argv);
+  while (NULL == QCoreApplication::instance()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  thr.detach();
+
+  // JSON unless the command line selects another format, later flags win
+  char json[] = "--benchmark_format=json";
+  std::vector<char *> args(argv, argv + argc);
+  args.insert(args.begin() + 1, json);
+  int count = static_cast<int>(args.size());
+  args.push_back(nullptr);
+  benchmark::Initialize(&count, args.data());
+  if (benchmark::ReportUnrecognizedArguments(count, args.data())) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -16,15 +16,86 @@
 #include <QCoreApplication>
 #include <QTimer>
 #include <gtest/gtest.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <thread>
 #include <iostream>
 #include <chrono>
 #include <memory>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <coroutine>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <new>
+#include <vector>
+#include "packml_sm/acting_executor.hpp"
+#include "packml_sm/async_result.hpp"
+#include "packml_sm/clock.hpp"
+#include "packml_sm/command_queue.hpp"
 #include "packml_sm/common.hpp"
+#include "packml_sm/event_pool.hpp"
+#include "packml_sm/journal.hpp"
+#include "packml_sm/log.hpp"
+#include "packml_sm/machine_policy.hpp"
+#include "packml_sm/machine_host.hpp"
+#include "packml_sm/mode_graph.hpp"
+#include "packml_sm/mode_registry.hpp"
+#include "packml_sm/replay.hpp"
+#include "packml_sm/snapshot.hpp"
+#include "packml_sm/state_change_bus.hpp"
+#include "packml_sm/state_times.hpp"
 // #include "packml_sm/events.hpp"
 #include "packml_sm/state_machine.hpp"
+#include "packml_sm/state_registry.hpp"
+#include "packml_sm/table_state_machine.hpp"
+#include "packml_sm/timer_wheel.hpp"
+#include "packml_sm/trace.hpp"
+#include "packml_sm/transition_stats.hpp"
 #include "rclcpp/rclcpp.hpp"
 
+namespace
+{
+
+// Calls of the global operator new made by the calling thread, tests take the difference over a
+// section so that the other threads of the process do not count
+thread_local std::uint64_t heap_allocations = 0;
+
+}  // namespace
+
+void * operator new(std::size_t size)
+{
+  void * block = std::malloc(size == 0 ? 1 : size);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  ++heap_allocations;
+  return block;
+}
+
+// GCC cannot tell that the replaced operator new allocates with malloc
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void * block) noexcept
+{
+  std::free(block);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+void operator delete(void * block, std::size_t /*size*/) noexcept
+{
+  operator delete(block);
+}
+
 void qtWorker(int argc, char * argv[])
 {
   printf("Here\n");
@@ -41,19 +112,14 @@ void qtWorker(int argc, char * argv[])
  */
 
 
-bool waitForState(packml_sm::State state, packml_sm::StateMachine & sm)
+bool waitForState(packml_sm::State state, packml_sm::StateMachineInterface & sm)
 {
-  const double TIMEOUT = 2.0;
-  const int SAMPLES = 50;
-  rclcpp::Rate r(static_cast<double>(SAMPLES) / TIMEOUT);
-  for (int ii = 0; ii < SAMPLES; ++ii) {
-    if (sm.getCurrentState() == state) {
-      std::cout << "State changed to " << state << std::endl;
-      return true;
-    }
-    std::cout << "Waiting for state to change to " << state << std::endl;
-    r.sleep();
+  // Woken by the entry of the state, a wait no longer adds up to a polling period of latency
+  if (sm.awaitState(state, std::chrono::seconds(2))) {
+    std::cout << "State changed to " << state << std::endl;
+    return true;
   }
+  std::cout << "Timed out waiting for state " << state << ", state is " << sm.getCurrentState() << std::endl;
   return false;
 }
 
@@ -269,6 +335,2060 @@ TEST(Packml_sm, testing_setResetting)
   EXPECT_TRUE(sm.isActive());
 }
 
+TEST(Packml_sm, table_single_cycle_state_machine_follow_diagram)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  EXPECT_FALSE(sm->isActive());
+  sm->setExecute(std::bind(success));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_TRUE(waitForState(packml_sm::State::COMPLETE, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_TRUE(sm->hold());
+  ASSERT_TRUE(waitForState(packml_sm::State::HELD, *sm));
+  ASSERT_TRUE(sm->unhold());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_TRUE(sm->suspend());
+  ASSERT_TRUE(waitForState(packml_sm::State::SUSPENDED, *sm));
+  ASSERT_TRUE(sm->unsuspend());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->abort());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  sm->setExecute(std::bind(fail));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  sm->deactivate();
+  EXPECT_FALSE(sm->isActive());
+}
+
+TEST(Packml_sm, table_state_changed_callback_may_call_back_into_the_machine)
+{
+  using packml_sm::State;
+
+  auto sm = packml_sm::TableStateMachine::singleCycleSM();
+  std::mutex mutex;
+  std::vector<State> entered;
+  std::promise<void> idle;
+  // Runs without the machine lock: taking it again or commanding the machine does not deadlock
+  sm->on_state_changed = [&](State value) {
+      sm->getAbortLatency();
+      sm->getAllowedCommands();
+      if (value == State::STOPPED) {
+        EXPECT_TRUE(sm->reset());
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      entered.push_back(value);
+      if (value == State::IDLE) {
+        idle.set_value();
+      }
+    };
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(sm->clear());
+  ASSERT_EQ(idle.get_future().wait_for(std::chrono::seconds(2)), std::future_status::ready);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(entered, (std::vector<State>{State::ABORTED, State::CLEARING, State::STOPPED,
+        State::RESETTING, State::IDLE}));
+  }
+  sm->deactivate();
+}
+
+TEST(Packml_sm, table_continuous_execution_state_machine_follow_diagram)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::continuousCycleSM();
+  sm->setExecute(std::bind(success));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_FALSE(waitForState(packml_sm::State::COMPLETE, *sm));
+  ASSERT_TRUE(sm->hold());
+  ASSERT_TRUE(waitForState(packml_sm::State::HELD, *sm));
+  ASSERT_TRUE(sm->unhold());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_TRUE(sm->suspend());
+  ASSERT_TRUE(waitForState(packml_sm::State::SUSPENDED, *sm));
+  ASSERT_TRUE(sm->unsuspend());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->abort());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+}
+
+namespace
+{
+
+// Continuous cycle machine without the SUSPENDING, SUSPENDED and UNSUSPENDING states
+struct NoSuspendPolicy
+{
+  static constexpr const char * kName = "NO SUSPEND";
+  static constexpr packml_sm::StateMask kSelfLoops = packml_sm::stateBit(packml_sm::State::EXECUTE);
+  static constexpr packml_sm::StateMask kAvailable = packml_sm::kAllStates &
+    ~packml_sm::stateBit(packml_sm::State::SUSPENDING) &
+    ~packml_sm::stateBit(packml_sm::State::SUSPENDED) &
+    ~packml_sm::stateBit(packml_sm::State::UNSUSPENDING);
+  static constexpr packml_sm::TransitionTable kTable =
+    packml_sm::makeTransitionTable(kSelfLoops, kAvailable);
+
+  static constexpr std::optional<std::chrono::milliseconds> operationDelay(packml_sm::State state)
+  {
+    if (state == packml_sm::State::EXECUTE) {
+      return std::chrono::milliseconds(20);
+    }
+    return std::nullopt;
+  }
+};
+
+static_assert(packml_sm::MachinePolicy<NoSuspendPolicy>);
+static_assert(NoSuspendPolicy::kTable.onCommand(
+    packml_sm::State::EXECUTE, packml_sm::TransitionCmd::SUSPEND) == packml_sm::State::UNDEFINED);
+static_assert(NoSuspendPolicy::kTable.onCommand(
+    packml_sm::State::SUSPENDED, packml_sm::TransitionCmd::ABORT) == packml_sm::State::UNDEFINED);
+static_assert(NoSuspendPolicy::kTable.onComplete(packml_sm::State::EXECUTE) ==
+  packml_sm::State::EXECUTE);
+
+}  // namespace
+
+TEST(Packml_sm, table_policy_machine_has_only_its_available_states)
+{
+  auto sm = packml_sm::TableStateMachine::create<NoSuspendPolicy>();
+  sm->setExecute(std::bind(success));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_FALSE(sm->suspend());
+  ASSERT_FALSE(waitForState(packml_sm::State::COMPLETE, *sm));
+  ASSERT_TRUE(sm->hold());
+  ASSERT_TRUE(waitForState(packml_sm::State::HELD, *sm));
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  sm->deactivate();
+}
+
+TEST(Packml_sm, policy_machine_has_only_its_available_states)
+{
+  auto sm = std::make_shared<packml_sm::Machine<NoSuspendPolicy>>();
+  sm->init();
+  sm->setExecute(std::bind(success));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  // The Qt graph has no SUSPENDING state to take the command into
+  ASSERT_FALSE(sm->suspend());
+  ASSERT_FALSE(waitForState(packml_sm::State::COMPLETE, *sm));
+  ASSERT_TRUE(sm->hold());
+  ASSERT_TRUE(waitForState(packml_sm::State::HELD, *sm));
+  ASSERT_FALSE(sm->unsuspend());
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  sm->deactivate();
+}
+
+TEST(Packml_sm, table_command_script_runs_steps_and_stops_at_first_failure)
+{
+  using packml_sm::State;
+  using packml_sm::StepOutcome;
+  using packml_sm::TransitionCmd;
+  using std::chrono::milliseconds;
+
+  auto sm = packml_sm::TableStateMachine::singleCycleSM();
+  sm->setExecute(std::bind(success));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(State::ABORTED, *sm));
+
+  auto result = sm->runScript({
+      {TransitionCmd::CLEAR, State::STOPPED, milliseconds(2000)},
+      {TransitionCmd::RESET, State::IDLE, milliseconds(2000)},
+      // STARTING is left as soon as it is entered, the step still sees it
+      {TransitionCmd::START, State::STARTING, milliseconds(2000)},
+      {TransitionCmd::NO_COMMAND, State::COMPLETE, milliseconds(5000)}});
+  ASSERT_TRUE(result.success) << result.message;
+  ASSERT_EQ(result.steps.size(), 4u);
+  for (const auto & step : result.steps) {
+    EXPECT_EQ(step.outcome, StepOutcome::DONE);
+    EXPECT_LE(step.accepted_after, step.duration);
+  }
+  EXPECT_EQ(result.steps[3].state, State::COMPLETE);
+  // The last step waits for the execute method, which takes one second
+  EXPECT_GE(result.steps[3].duration, milliseconds(900));
+  EXPECT_GE(result.duration, result.steps[3].duration);
+
+  auto rejected = sm->runScript({
+      {TransitionCmd::HOLD, State::HELD, milliseconds(1000)},
+      {TransitionCmd::RESET, State::IDLE, milliseconds(1000)}});
+  EXPECT_FALSE(rejected.success);
+  EXPECT_EQ(rejected.steps[0].outcome, StepOutcome::REJECTED);
+  EXPECT_EQ(rejected.steps[0].state, State::COMPLETE);
+  EXPECT_EQ(rejected.steps[1].outcome, StepOutcome::NOT_RUN);
+  EXPECT_FALSE(rejected.message.empty());
+
+  auto timed_out = sm->runScript({{TransitionCmd::RESET, State::EXECUTE, milliseconds(200)}});
+  EXPECT_FALSE(timed_out.success);
+  EXPECT_EQ(timed_out.steps[0].outcome, StepOutcome::TIMED_OUT);
+  EXPECT_NE(timed_out.steps[0].state, State::EXECUTE);
+  EXPECT_GE(timed_out.steps[0].duration, milliseconds(200));
+  sm->deactivate();
+}
+
+TEST(Packml_sm, table_await_state_is_woken_by_entries_and_eventfd)
+{
+  using packml_sm::State;
+  using std::chrono::milliseconds;
+
+  auto sm = packml_sm::TableStateMachine::singleCycleSM();
+  auto fd = sm->getStateEventFd();
+  ASSERT_TRUE(fd.has_value()) << fd.error();
+  ASSERT_TRUE(sm->activate());
+  EXPECT_TRUE(sm->awaitState(State::ABORTED, milliseconds(2000)));
+
+  pollfd readable{*fd, POLLIN, 0};
+  ASSERT_EQ(poll(&readable, 1, 1000), 1);
+  std::uint64_t entries = 0;
+  ASSERT_EQ(read(*fd, &entries, sizeof(entries)), static_cast<ssize_t>(sizeof(entries)));
+  EXPECT_GE(entries, 1u);
+  EXPECT_EQ(poll(&readable, 1, 0), 0);
+
+  EXPECT_FALSE(sm->awaitState(State::IDLE, milliseconds(50)));
+  ASSERT_TRUE(sm->clear());
+  EXPECT_EQ(sm->awaitAnyOf({State::STOPPED, State::IDLE}, milliseconds(2000)), State::STOPPED);
+  EXPECT_EQ(poll(&readable, 1, 0), 1);
+
+  // Woken by an entry caused on another thread
+  std::thread resetter([&sm]() {
+      std::this_thread::sleep_for(milliseconds(50));
+      sm->reset();
+    });
+  EXPECT_TRUE(sm->awaitState(State::IDLE, milliseconds(2000)));
+  resetter.join();
+  EXPECT_EQ(sm->awaitAnyOf({State::EXECUTE, State::HELD}, milliseconds(20)), State::UNDEFINED);
+  sm->deactivate();
+}
+
+TEST(Packml_sm, table_state_change_bus_never_waits_for_subscribers)
+{
+  using packml_sm::OverflowPolicy;
+  using packml_sm::State;
+  using packml_sm::StateChange;
+
+  auto sm = packml_sm::TableStateMachine::singleCycleSM();
+  for (std::size_t ii = 0; ii < packml_sm::kStateCount; ++ii) {
+    if (packml_sm::isActingState(static_cast<State>(ii))) {
+      sm->setOperationDelay(static_cast<State>(ii), std::chrono::milliseconds::max());
+    }
+  }
+  auto latest = sm->stateChanges().subscribe(4, OverflowPolicy::DROP_OLDEST);
+  auto earliest = sm->stateChanges().subscribe(4, OverflowPolicy::DROP_NEWEST);
+
+  // Blocked in its callback until every transition is done
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::vector<State> delivered;
+  std::atomic<std::size_t> delivered_count{0};
+  auto blocked = sm->stateChanges().subscribe(
+    [&](const StateChange & change) {
+      released.wait();
+      delivered.push_back(change.state);
+      ++delivered_count;
+    }, 16, OverflowPolicy::DROP_NEWEST);
+
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(sm->clear());
+  sm->completeState(0);
+  ASSERT_TRUE(sm->reset());
+  sm->completeState(0);
+  ASSERT_TRUE(sm->start());
+  sm->completeState(0);
+  ASSERT_EQ(sm->getCurrentState(), State::EXECUTE);
+
+  auto collect = [](packml_sm::StateChangeBus::Subscription & subscription) {
+      std::vector<StateChange> changes;
+      subscription.poll([&changes](const StateChange & change) {changes.push_back(change);});
+      return changes;
+    };
+  auto newest = collect(*latest);
+  ASSERT_EQ(newest.size(), 4u);
+  EXPECT_EQ(latest->dropped(), 3u);
+  EXPECT_EQ(newest.front().state, State::RESETTING);
+  EXPECT_EQ(newest.back().state, State::EXECUTE);
+  EXPECT_EQ(newest.back().sequence, 7u);
+  EXPECT_LE(newest.front().entered, newest.back().entered);
+
+  auto oldest = collect(*earliest);
+  ASSERT_EQ(oldest.size(), 4u);
+  EXPECT_EQ(earliest->dropped(), 3u);
+  EXPECT_EQ(oldest.front().state, State::ABORTED);
+  EXPECT_EQ(oldest.back().state, State::RESETTING);
+  EXPECT_TRUE(collect(*earliest).empty());
+
+  release.set_value();
+  for (int ii = 0; ii < 200 && delivered_count.load() < 7; ++ii) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  blocked.reset();
+  EXPECT_EQ(delivered, (std::vector<State>{State::ABORTED, State::CLEARING, State::STOPPED,
+      State::RESETTING, State::IDLE, State::STARTING, State::EXECUTE}));
+  sm->deactivate();
+}
+
+TEST(Packml_sm, table_testing_failed_state_transition_executions)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  sm->activate();
+  waitForState(packml_sm::State::ABORTED, *sm);
+  ASSERT_FALSE(sm->start());
+  ASSERT_FALSE(sm->reset());
+  ASSERT_FALSE(sm->hold());
+  ASSERT_FALSE(sm->unhold());
+  ASSERT_FALSE(sm->suspend());
+  ASSERT_FALSE(sm->unsuspend());
+  ASSERT_FALSE(sm->stop());
+  ASSERT_FALSE(sm->abort());
+  sm->clear();
+  waitForState(packml_sm::State::STOPPED, *sm);
+  ASSERT_FALSE(sm->unhold());
+  ASSERT_FALSE(sm->clear());
+  ASSERT_FALSE(sm->changeState(packml_sm::TransitionCmd::NO_COMMAND).has_value());
+}
+
+TEST(Packml_sm, table_throwing_operation_aborts_and_machine_destroys)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  sm->setExecute([]() -> int {throw std::runtime_error("operation failed");});
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_EQ(1u, sm->getStateTimes().entries[packml_sm::toIndex(packml_sm::State::ABORTING)]);
+
+  // The destructor waits for the operations it started, the one that threw included
+  auto destroyed = std::make_shared<std::promise<void>>();
+  auto done = destroyed->get_future();
+  std::thread destroyer([sm = std::move(sm), destroyed]() mutable {
+      sm.reset();
+      destroyed->set_value();
+    });
+  if (done.wait_for(std::chrono::seconds(5)) != std::future_status::ready) {
+    destroyer.detach();
+    FAIL() << "Destruction did not complete";
+  }
+  destroyer.join();
+}
+
+TEST(Packml_sm, table_maintenance_mode_disables_completing)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  sm->setExecute([]() {return 0;});
+  ASSERT_TRUE(sm->changeMode(packml_sm::ModeType::MAINTENANCE).has_value());
+  sm->activate();
+  ASSERT_FALSE(sm->changeMode(packml_sm::ModeType::PRODUCTION).has_value());
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  // EXECUTE completes, but COMPLETING is not available in this mode
+  ASSERT_FALSE(waitForState(packml_sm::State::COMPLETING, *sm));
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+}
+
+TEST(Packml_sm, maintenance_mode_disables_completing)
+{
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+  sm->setCancellableOperation(packml_sm::State::EXECUTE, [](std::stop_token) {return 0;});
+  ASSERT_TRUE(sm->changeMode(packml_sm::ModeType::MAINTENANCE).has_value());
+  sm->activate();
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_FALSE(sm->changeMode(packml_sm::ModeType::PRODUCTION).has_value());
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  // The completion of EXECUTE is not taken, COMPLETING is masked out in this mode
+  ASSERT_FALSE(waitForState(packml_sm::State::COMPLETING, *sm));
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  sm->deactivate();
+}
+
+TEST(Packml_sm, command_queue_concurrent_submissions_get_own_result)
+{
+  const int kProducers = 8;
+  const int kCommands = 2000;
+  packml_sm::CommandQueue queue;
+  std::atomic<int> wakeups{0};
+  std::atomic<bool> done{false};
+
+  // Consumer accepts START and rejects every other command
+  std::thread consumer([&]() {
+      while (!done.load() || queue.size() > 0) {
+        queue.drain([](packml_sm::CommandTicket * ticket) {
+            ticket->complete(ticket->cmd == packml_sm::TransitionCmd::START);
+            delete ticket;
+          });
+        std::this_thread::yield();
+      }
+    });
+
+  std::vector<std::thread> producers;
+  std::atomic<int> mismatches{0};
+  for (int ii = 0; ii < kProducers; ++ii) {
+    producers.emplace_back([&, ii]() {
+        for (int jj = 0; jj < kCommands; ++jj) {
+          bool start = ((ii + jj) % 2) == 0;
+          auto ticket = new packml_sm::CommandTicket(
+            start ? packml_sm::TransitionCmd::START : packml_sm::TransitionCmd::STOP);
+          auto result = ticket->accepted();
+          if (queue.submit(ticket)) {
+            ++wakeups;
+          }
+          if (result.get() != start) {
+            ++mismatches;
+          }
+        }
+      });
+  }
+  for (auto & producer : producers) {
+    producer.join();
+  }
+  done = true;
+  consumer.join();
+  ASSERT_EQ(0, mismatches.load());
+  ASSERT_GE(wakeups.load(), 1);
+  ASSERT_EQ(0u, queue.size());
+}
+
+TEST(Packml_sm, command_queue_rejects_undispatched_tickets)
+{
+  std::shared_future<bool> accepted;
+  std::shared_future<packml_sm::State> reached;
+  {
+    packml_sm::CommandQueue queue;
+    auto ticket = new packml_sm::CommandTicket(packml_sm::TransitionCmd::ABORT);
+    accepted = ticket->accepted().future();
+    reached = ticket->reached().future();
+    ASSERT_TRUE(queue.submit(ticket));
+  }
+  ASSERT_FALSE(accepted.get());
+  ASSERT_EQ(packml_sm::State::UNDEFINED, reached.get());
+}
+
+TEST(Packml_sm, command_queue_dispatches_emergency_lane_first_and_coalesces)
+{
+  using packml_sm::State;
+  using packml_sm::TransitionCmd;
+  const packml_sm::TransitionTable table = packml_sm::makeTransitionTable();
+  auto next = [&table](State from, TransitionCmd cmd) {return table.onCommand(from, cmd);};
+  packml_sm::CommandQueue queue;
+  std::vector<packml_sm::StateChangeResult> results;
+  auto submit = [&](std::initializer_list<TransitionCmd> commands) {
+      results.clear();
+      bool wakeup = true;
+      for (auto cmd : commands) {
+        auto ticket = new packml_sm::CommandTicket(cmd);
+        results.push_back(ticket->results());
+        ASSERT_EQ(wakeup, queue.submit(ticket));
+        wakeup = false;
+      }
+    };
+  // Evaluates the dispatched commands like the state machine, one after the other
+  State state = State::UNDEFINED;
+  std::vector<TransitionCmd> dispatched;
+  auto dispatch = [&](packml_sm::CommandTicket * ticket) {
+      dispatched.push_back(ticket->cmd);
+      queue.dispatched(*ticket);
+      State entered = table.onCommand(state, ticket->cmd);
+      ticket->complete(entered != State::UNDEFINED);
+      if (entered != State::UNDEFINED) {
+        ticket->reach(entered);
+        state = entered;
+      }
+      delete ticket;
+    };
+  auto discard = [](packml_sm::CommandTicket * ticket) {delete ticket;};
+
+  // EXECUTE accepts the HOLD, so HOLD and UNHOLD cancel out. The second SUSPEND would be evaluated
+  // in SUSPENDING, which rejects it.
+  submit({TransitionCmd::HOLD, TransitionCmd::UNHOLD, TransitionCmd::SUSPEND, TransitionCmd::SUSPEND});
+  state = State::EXECUTE;
+  queue.drain(state, next, dispatch, discard);
+  ASSERT_EQ(std::vector<TransitionCmd>{TransitionCmd::SUSPEND}, dispatched);
+  ASSERT_FALSE(results[0].accepted.get());
+  ASSERT_FALSE(results[1].accepted.get());
+  ASSERT_EQ(State::UNDEFINED, results[1].reached.get());
+  ASSERT_TRUE(results[2].accepted.get());
+  ASSERT_EQ(State::SUSPENDING, results[2].reached.get());
+  ASSERT_FALSE(results[3].accepted.get());
+  ASSERT_EQ(State::UNDEFINED, results[3].reached.get());
+  ASSERT_EQ(3u, queue.stats().lane(packml_sm::CommandPriority::NORMAL).coalesced);
+
+  // ABORT and STOP overtake the commands queued before them. ABORTING rejects the HOLD, so the
+  // pair is dispatched and the UNHOLD is answered by the state machine.
+  submit({TransitionCmd::START, TransitionCmd::HOLD, TransitionCmd::UNHOLD, TransitionCmd::STOP,
+      TransitionCmd::STOP, TransitionCmd::ABORT});
+  auto stats = queue.stats();
+  ASSERT_EQ(3u, stats.lane(packml_sm::CommandPriority::EMERGENCY).depth);
+  ASSERT_EQ(3u, stats.lane(packml_sm::CommandPriority::NORMAL).depth);
+  dispatched.clear();
+  state = State::SUSPENDED;
+  queue.drain(state, next, dispatch, discard);
+  std::vector<TransitionCmd> expected{TransitionCmd::STOP, TransitionCmd::ABORT, TransitionCmd::START,
+    TransitionCmd::HOLD, TransitionCmd::UNHOLD};
+  ASSERT_EQ(expected, dispatched);
+  ASSERT_EQ(0u, queue.size());
+  ASSERT_TRUE(results[3].accepted.get());
+  ASSERT_EQ(State::STOPPING, results[3].reached.get());
+  ASSERT_FALSE(results[4].accepted.get());
+  ASSERT_TRUE(results[5].accepted.get());
+  ASSERT_EQ(State::ABORTING, results[5].reached.get());
+  ASSERT_FALSE(results[0].accepted.get());
+  ASSERT_FALSE(results[1].accepted.get());
+  ASSERT_FALSE(results[2].accepted.get());
+
+  // Without the state of the machine every command is dispatched
+  submit({TransitionCmd::RESET, TransitionCmd::RESET});
+  dispatched.clear();
+  state = State::STOPPED;
+  queue.drain(dispatch);
+  ASSERT_EQ(2u, dispatched.size());
+  ASSERT_TRUE(results[0].accepted.get());
+  ASSERT_FALSE(results[1].accepted.get());
+
+  stats = queue.stats();
+  const auto & emergency = stats.lane(packml_sm::CommandPriority::EMERGENCY);
+  ASSERT_EQ(0u, emergency.depth);
+  ASSERT_EQ(3u, emergency.max_depth);
+  ASSERT_EQ(3u, emergency.submitted);
+  ASSERT_EQ(1u, emergency.coalesced);
+  ASSERT_EQ(2u, emergency.time_to_dispatch.count);
+  const auto & normal = stats.lane(packml_sm::CommandPriority::NORMAL);
+  ASSERT_EQ(4u, normal.max_depth);
+  ASSERT_EQ(3u, normal.coalesced);
+  ASSERT_EQ(6u, normal.time_to_dispatch.count);
+}
+
+TEST(Packml_sm, concurrent_commands_get_own_result)
+{
+  using packml_sm::State;
+  using packml_sm::TransitionCmd;
+  // Rejected in every state the machine passes while commanded: IDLE, STARTING and EXECUTE, then
+  // STOPPING and STOPPED without RESET
+  const std::vector<TransitionCmd> rejected = {
+    TransitionCmd::CLEAR, TransitionCmd::UNHOLD, TransitionCmd::UNSUSPEND, TransitionCmd::RESET};
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::continuousCycleSM();
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(State::IDLE, *sm));
+
+  // Each round one thread sends the only valid command while the others send rejected ones
+  for (auto [accepted, rejected_count, target] : {
+      std::tuple{TransitionCmd::START, rejected.size(), State::EXECUTE},
+      std::tuple{TransitionCmd::STOP, rejected.size() - 1, State::STOPPED}})
+  {
+    std::atomic<bool> done{false};
+    std::atomic<int> sent{0};
+    std::atomic<int> wrongly_accepted{0};
+    std::vector<std::thread> threads;
+    for (std::size_t ii = 0; ii < rejected_count; ++ii) {
+      threads.emplace_back([&, cmd = rejected[ii]]() {
+          while (!done.load()) {
+            if (sm->changeState(cmd).has_value()) {
+              ++wrongly_accepted;
+            }
+            ++sent;
+          }
+        });
+    }
+    while (sent.load() < 100) {
+      std::this_thread::yield();
+    }
+    auto result = sm->changeState(accepted);
+    EXPECT_TRUE(result.has_value()) << result.error();
+    ASSERT_TRUE(waitForState(target, *sm));
+    done = true;
+    for (auto & thread : threads) {
+      thread.join();
+    }
+    ASSERT_EQ(0, wrongly_accepted.load());
+  }
+  sm->deactivate();
+}
+
+TEST(Packml_sm, abort_overtakes_queued_start_and_hold_commands)
+{
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+
+  // Holds the state machine thread while the backlog is submitted, so one drain posts it all
+  std::promise<void> blocked;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  QMetaObject::invokeMethod(sm.get(), [&blocked, released]() {
+      blocked.set_value();
+      released.wait();
+    }, Qt::QueuedConnection);
+  blocked.get_future().wait();
+  std::vector<packml_sm::StateChangeResult> backlog;
+  for (int ii = 0; ii < 50; ++ii) {
+    backlog.push_back(sm->changeStateAsync(
+        ii % 2 == 0 ? packml_sm::TransitionCmd::START : packml_sm::TransitionCmd::HOLD));
+  }
+  auto abort = sm->changeStateAsync(packml_sm::TransitionCmd::ABORT);
+  release.set_value();
+
+  // Had the first START been evaluated before it, IDLE would have accepted it
+  ASSERT_TRUE(abort.accepted.get());
+  ASSERT_EQ(packml_sm::State::ABORTING, abort.reached.get());
+  for (auto & result : backlog) {
+    ASSERT_FALSE(result.accepted.get());
+  }
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_EQ(50u, sm->getCommandIntakeStats().lane(packml_sm::CommandPriority::NORMAL).max_depth);
+  sm->deactivate();
+}
+
+TEST(Packml_sm, hold_and_unhold_queued_in_execute_cancel_each_other)
+{
+  std::promise<void> finish;
+  std::shared_future<void> finished = finish.get_future().share();
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+  sm->setExecute([finished]() {finished.wait(); return 0;});
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+
+  // Both are queued before the state machine thread drains them from EXECUTE
+  std::promise<void> blocked;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  QMetaObject::invokeMethod(sm.get(), [&blocked, released]() {
+      blocked.set_value();
+      released.wait();
+    }, Qt::QueuedConnection);
+  blocked.get_future().wait();
+  auto hold = sm->changeStateAsync(packml_sm::TransitionCmd::HOLD);
+  auto unhold = sm->changeStateAsync(packml_sm::TransitionCmd::UNHOLD);
+  release.set_value();
+
+  ASSERT_FALSE(hold.accepted.get());
+  ASSERT_FALSE(unhold.accepted.get());
+  ASSERT_EQ(2u, sm->getCommandIntakeStats().lane(packml_sm::CommandPriority::NORMAL).coalesced);
+  ASSERT_EQ(packml_sm::State::EXECUTE, sm->getCurrentState());
+  ASSERT_EQ(0u, sm->getStateTimes().entries[packml_sm::toIndex(packml_sm::State::HOLDING)]);
+  finish.set_value();
+  ASSERT_TRUE(waitForState(packml_sm::State::COMPLETE, *sm));
+  sm->deactivate();
+}
+
+// Coroutine type that starts eagerly and is not awaited by anyone
+struct DetachedTask
+{
+  struct promise_type
+  {
+    DetachedTask get_return_object() {return {};}
+    std::suspend_never initial_suspend() noexcept {return {};}
+    std::suspend_never final_suspend() noexcept {return {};}
+    void return_void() {}
+    void unhandled_exception() {std::terminate();}
+  };
+};
+
+DetachedTask awaitResult(packml_sm::AsyncResult<int> result, int & out)
+{
+  out = co_await result;
+}
+
+TEST(Packml_sm, async_result_future_callback_and_coroutine)
+{
+  packml_sm::AsyncPromise<int> promise;
+  auto result = promise.result();
+  int from_callback = 0;
+  int from_coroutine = 0;
+  result.then([&from_callback](const int & value) {from_callback = value;});
+  awaitResult(result, from_coroutine);
+  ASSERT_FALSE(result.ready());
+  ASSERT_EQ(0, from_coroutine);
+
+  std::thread producer([&promise]() {promise.set(42);});
+  producer.join();
+  ASSERT_EQ(42, result.get());
+  ASSERT_EQ(42, from_callback);
+  ASSERT_EQ(42, from_coroutine);
+  ASSERT_FALSE(promise.set(1));
+
+  // Consumers that arrive late get the value immediately
+  int late = 0;
+  result.then([&late](const int & value) {late = value;});
+  awaitResult(result, from_coroutine);
+  ASSERT_EQ(42, late);
+  ASSERT_EQ(42, result.future().get());
+}
+
+TEST(Packml_sm, table_change_state_async_reports_acceptance_and_target)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  auto mode = sm->changeModeAsync(packml_sm::ModeType::MANUAL);
+  ASSERT_TRUE(mode.get().has_value());
+  sm->activate();
+
+  auto rejected = sm->changeStateAsync(packml_sm::TransitionCmd::START);
+  ASSERT_FALSE(rejected.accepted.get());
+  ASSERT_EQ(packml_sm::State::UNDEFINED, rejected.reached.get());
+
+  auto clear = sm->changeStateAsync(packml_sm::TransitionCmd::CLEAR);
+  ASSERT_TRUE(clear.accepted.get());
+  ASSERT_EQ(packml_sm::State::CLEARING, clear.reached.get());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+}
+
+TEST(Packml_sm, log_formats_deferred_arguments_on_sink_thread)
+{
+  std::mutex mutex;
+  std::vector<std::string> lines;
+  // Other threads may log at the same time, only the lines of this test are kept
+  packml_sm::logging::setSink([&mutex, &lines](packml_sm::logging::Level, std::string_view line) {
+      if (line.find("deferred-log-test") != std::string_view::npos) {
+        std::lock_guard<std::mutex> lock(mutex);
+        lines.emplace_back(line);
+      }
+    });
+  auto previous = packml_sm::logging::level();
+  packml_sm::logging::setLevel(packml_sm::logging::Level::INFO);
+
+  PACKML_LOG_DEBUG("deferred-log-test filtered {}", 1);
+  PACKML_LOG_INFO("deferred-log-test state {} cmd {} code {} name {}", packml_sm::State::EXECUTE,
+    packml_sm::TransitionCmd::ABORT, -3, std::string("filler"));
+  packml_sm::logging::flush();
+
+  packml_sm::logging::setSink(nullptr);
+  packml_sm::logging::setLevel(previous);
+  ASSERT_EQ(1u, lines.size());
+  ASSERT_NE(std::string::npos, lines[0].find("[INFO]"));
+  ASSERT_NE(std::string::npos, lines[0].find("state EXECUTE cmd ABORT code -3 name filler"));
+}
+
+TEST(Packml_sm, state_times_snapshot_is_consistent_while_written)
+{
+  using Clock = packml_sm::StateTimeAccounting::Clock;
+  packml_sm::StateTimeAccounting accounting;
+  const auto start = Clock::now();
+  const int kEntries = 200000;
+  accounting.enter(packml_sm::State::IDLE, start);
+
+  std::atomic<bool> done{false};
+  std::thread writer([&]() {
+      for (int ii = 1; ii <= kEntries; ++ii) {
+        auto state = (ii % 2) ? packml_sm::State::EXECUTE : packml_sm::State::IDLE;
+        accounting.enter(state, start + std::chrono::microseconds(ii));
+      }
+      done = true;
+    });
+
+  int torn = 0;
+  while (!done) {
+    auto times = accounting.snapshot(start + std::chrono::microseconds(kEntries + 1));
+    std::uint64_t entries = 0;
+    for (auto count : times.entries) {
+      entries += count;
+    }
+    // Every entry advanced the clock by 1 us, a torn copy breaks the relation
+    auto closed = times.total(packml_sm::State::IDLE) + times.total(packml_sm::State::EXECUTE) - times.in_state;
+    if (closed != std::chrono::microseconds(entries - 1)) {
+      ++torn;
+    }
+  }
+  writer.join();
+  ASSERT_EQ(0, torn);
+
+  auto times = accounting.snapshot(start + std::chrono::microseconds(kEntries + 10));
+  ASSERT_EQ(packml_sm::State::IDLE, times.current);
+  ASSERT_EQ(std::chrono::microseconds(10), times.in_state);
+  ASSERT_EQ(std::uint64_t(kEntries / 2), times.entries[packml_sm::toIndex(packml_sm::State::EXECUTE)]);
+  ASSERT_EQ(std::chrono::microseconds(kEntries / 2), times.total(packml_sm::State::EXECUTE));
+}
+
+TEST(Packml_sm, table_state_machine_reports_state_times)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  sm->activate();
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  auto times = sm->getStateTimes();
+  ASSERT_EQ(packml_sm::State::STOPPED, times.current);
+  ASSERT_EQ(1u, times.entries[packml_sm::toIndex(packml_sm::State::CLEARING)]);
+  // CLEARING runs the default 200 ms operation
+  ASSERT_GE(times.total(packml_sm::State::CLEARING), std::chrono::milliseconds(200));
+  ASSERT_LT(times.total(packml_sm::State::CLEARING), std::chrono::milliseconds(1000));
+  ASSERT_GE(times.in_state, std::chrono::milliseconds(50));
+  ASSERT_EQ(times.in_state, times.total(packml_sm::State::STOPPED));
+}
+
+TEST(Packml_sm, acting_executor_safety_lane_never_waits_behind_execute)
+{
+  packml_sm::ExecutorConfig config;
+  config.lane(packml_sm::ExecutorLane::SAFETY).threads = 1;
+  config.lane(packml_sm::ExecutorLane::EXECUTE).threads = 1;
+  config.lane(packml_sm::ExecutorLane::NORMAL).threads = 1;
+  packml_sm::ActingExecutor executor(config);
+
+  ASSERT_EQ(packml_sm::ExecutorLane::SAFETY, packml_sm::laneFor(packml_sm::State::ABORTING));
+  ASSERT_EQ(packml_sm::ExecutorLane::SAFETY, packml_sm::laneFor(packml_sm::State::STOPPING));
+  ASSERT_EQ(packml_sm::ExecutorLane::EXECUTE, packml_sm::laneFor(packml_sm::State::EXECUTE));
+  ASSERT_EQ(packml_sm::ExecutorLane::NORMAL, packml_sm::laneFor(packml_sm::State::RESETTING));
+
+  std::promise<void> gate;
+  std::shared_future<void> open = gate.get_future().share();
+  std::vector<std::shared_future<void>> blocked;
+  for (int ii = 0; ii < 3; ++ii) {
+    blocked.push_back(executor.submit(packml_sm::ExecutorLane::EXECUTE, [open]() {open.wait();}));
+  }
+  blocked.push_back(executor.submit(packml_sm::ExecutorLane::NORMAL, [open]() {open.wait();}));
+
+  // Both the EXECUTE and the NORMAL workers are busy, the SAFETY lane still runs immediately
+  auto safety = executor.submit(packml_sm::ExecutorLane::SAFETY, []() {});
+  ASSERT_EQ(std::future_status::ready, safety.wait_for(std::chrono::seconds(1)));
+
+  // With the SAFETY worker busy an idle NORMAL worker takes safety work before its own
+  gate.set_value();
+  for (auto & job : blocked) {
+    job.wait();
+  }
+  std::promise<void> safety_gate;
+  std::shared_future<void> safety_open = safety_gate.get_future().share();
+  auto busy = executor.submit(packml_sm::ExecutorLane::SAFETY, [safety_open]() {safety_open.wait();});
+  while (executor.metrics(packml_sm::ExecutorLane::SAFETY).running == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto stolen = executor.submit(packml_sm::ExecutorLane::SAFETY, []() {});
+  ASSERT_EQ(std::future_status::ready, stolen.wait_for(std::chrono::seconds(1)));
+  safety_gate.set_value();
+  busy.wait();
+
+  auto execute = executor.metrics(packml_sm::ExecutorLane::EXECUTE);
+  ASSERT_EQ(3u, execute.submitted);
+  ASSERT_EQ(3u, execute.completed);
+  ASSERT_EQ(0u, execute.queue_depth);
+  ASSERT_EQ(2u, execute.max_queue_depth);
+  ASSERT_GT(execute.max_dispatch_latency, std::chrono::nanoseconds(0));
+  ASSERT_EQ(3u, executor.metrics(packml_sm::ExecutorLane::SAFETY).submitted);
+
+  // Exceptions thrown by a job are reported through its future
+  auto failed = executor.submit(packml_sm::ExecutorLane::NORMAL, []() {throw std::runtime_error("failed");});
+  ASSERT_THROW(failed.get(), std::runtime_error);
+}
+
+TEST(Packml_sm, table_abort_cancels_running_operation)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  std::atomic<bool> cancelled{false};
+  sm->setCancellableOperation(packml_sm::State::EXECUTE, [&cancelled](std::stop_token token) {
+      // Would run for a minute unless cancelled
+      for (int ii = 0; ii < 6000 && !token.stop_requested(); ++ii) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      cancelled = token.stop_requested();
+      return 0;
+    });
+  ASSERT_FALSE(sm->setCancellableOperation(packml_sm::State::IDLE, nullptr));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_TRUE(sm->abort());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  for (int ii = 0; ii < 100 && !cancelled; ++ii) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_TRUE(cancelled);
+
+  auto latency = sm->getAbortLatency();
+  ASSERT_EQ(1u, latency.count);
+  // Only the ABORTING operation, not the remaining execute time
+  ASSERT_LT(latency.max, std::chrono::seconds(1));
+}
+
+TEST(Packml_sm, abort_does_not_wait_for_uncooperative_operation)
+{
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+  // Ignores its stop token
+  sm->setCancellableOperation(packml_sm::State::EXECUTE, [](std::stop_token) {
+      std::this_thread::sleep_for(std::chrono::seconds(3));
+      return 0;
+    });
+  sm->setExitTimeout(std::chrono::milliseconds(50));
+  sm->activate();
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_TRUE(sm->abort());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+
+  auto latency = sm->getAbortLatency();
+  ASSERT_EQ(1u, latency.count);
+  ASSERT_LT(latency.max, std::chrono::seconds(1));
+
+  // The late completion of the abandoned operation must not move the machine
+  std::this_thread::sleep_for(std::chrono::seconds(3));
+  ASSERT_EQ(packml_sm::State::ABORTED, sm->getCurrentState());
+  sm->deactivate();
+}
+
+TEST(Packml_sm, exit_waits_for_operation_without_stop_token)
+{
+  std::atomic<int> running{0};
+  std::atomic<int> overlapping{0};
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::continuousCycleSM();
+  // Cannot be cancelled, the exit timeout does not apply to it
+  sm->setExecute([&running, &overlapping]() {
+      if (++running > 1) {
+        ++overlapping;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+      --running;
+      return 0;
+    });
+  sm->setExitTimeout(std::chrono::milliseconds(10));
+  sm->activate();
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  ASSERT_TRUE(sm->hold());
+  ASSERT_TRUE(waitForState(packml_sm::State::HELD, *sm));
+  ASSERT_EQ(0, running.load());
+  ASSERT_TRUE(sm->unhold());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  // Continuous EXECUTE enters itself again after every run
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_EQ(0, running.load());
+  ASSERT_EQ(0, overlapping.load());
+  sm->deactivate();
+}
+
+TEST(Packml_sm, timer_wheel_fires_in_deadline_order_and_never_early)
+{
+  using Clock = packml_sm::TimerWheel::Clock;
+  auto origin = Clock::now();
+  packml_sm::TimerWheel wheel(std::chrono::milliseconds(1), origin);
+  std::vector<int> fired;
+  wheel.schedule(origin + std::chrono::milliseconds(30), [&fired] {fired.push_back(30);});
+  wheel.schedule(origin + std::chrono::milliseconds(5), [&fired] {fired.push_back(5);});
+  auto cancelled = wheel.schedule(origin + std::chrono::milliseconds(10), [&fired] {fired.push_back(10);});
+  // Beyond the 2^24 ticks covered by the levels, re-cascaded until due
+  wheel.schedule(origin + std::chrono::hours(6), [&fired] {fired.push_back(-1);});
+  ASSERT_EQ(4u, wheel.size());
+  ASSERT_TRUE(wheel.cancel(cancelled));
+  ASSERT_FALSE(wheel.cancel(cancelled));
+  ASSERT_EQ(origin + std::chrono::milliseconds(5), wheel.nextWakeup());
+
+  ASSERT_EQ(0u, wheel.advance(origin + std::chrono::microseconds(4999)));
+  ASSERT_EQ(1u, wheel.advance(origin + std::chrono::milliseconds(29)));
+  ASSERT_EQ(1u, wheel.advance(origin + std::chrono::milliseconds(30)));
+  ASSERT_EQ((std::vector<int>{5, 30}), fired);
+
+  ASSERT_EQ(0u, wheel.advance(origin + std::chrono::hours(6) - std::chrono::milliseconds(1)));
+  std::vector<packml_sm::TimerWheel::Callback> due;
+  ASSERT_EQ(1u, wheel.collect(origin + std::chrono::hours(6), due));
+  ASSERT_EQ(2u, fired.size());
+  due.front()();
+  ASSERT_EQ(-1, fired.back());
+  ASSERT_TRUE(wheel.empty());
+  ASSERT_FALSE(wheel.nextWakeup());
+}
+
+TEST(Packml_sm, table_watchdog_raises_error_when_state_overstays)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  sm->setCancellableOperation(packml_sm::State::EXECUTE, [](std::stop_token token) {
+      while (!token.stop_requested()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      return 0;
+    });
+  ASSERT_TRUE(sm->setWatchdog(packml_sm::State::EXECUTE, std::chrono::milliseconds(100)));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  // Watchdog error goes through ABORTING
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+
+  // Leaving the state in time stops the watchdog
+  ASSERT_TRUE(sm->setWatchdog(packml_sm::State::STOPPED, std::chrono::milliseconds(300)));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  std::this_thread::sleep_for(std::chrono::milliseconds(400));
+  ASSERT_EQ(packml_sm::State::IDLE, sm->getCurrentState());
+  sm->deactivate();
+}
+
+TEST(Packml_sm, watchdog_raises_error_when_state_overstays)
+{
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+  sm->setCancellableOperation(packml_sm::State::EXECUTE, [](std::stop_token token) {
+      while (!token.stop_requested()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      return 0;
+    });
+  ASSERT_TRUE(sm->setWatchdog(packml_sm::State::EXECUTE, std::chrono::milliseconds(100)));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  // The ErrorEvent posted by the TimerService of the machine thread goes through ABORTING
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+
+  // Leaving the state in time stops the watchdog
+  ASSERT_TRUE(sm->setWatchdog(packml_sm::State::STOPPED, std::chrono::milliseconds(300)));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  std::this_thread::sleep_for(std::chrono::milliseconds(400));
+  ASSERT_EQ(packml_sm::State::IDLE, sm->getCurrentState());
+  sm->deactivate();
+}
+
+TEST(Packml_sm, machine_host_spreads_machines_over_shards)
+{
+  packml_sm::MachineHostConfig config;
+  config.shards = 2;
+  config.probe_interval = std::chrono::milliseconds(10);
+  packml_sm::MachineHost host(config);
+  ASSERT_EQ(2u, host.shardCount());
+
+  std::vector<std::shared_ptr<packml_sm::StateMachine>> machines;
+  for (int ii = 0; ii < 4; ++ii) {
+    machines.push_back(packml_sm::StateMachine::singleCycleSM());
+    ASSERT_TRUE(host.add(machines.back()).has_value());
+  }
+  ASSERT_FALSE(host.add(machines.front(), 1));
+  ASSERT_FALSE(host.add(packml_sm::StateMachine::singleCycleSM(), 2));
+  ASSERT_EQ(2u, host.metrics(0).machines);
+  ASSERT_EQ(2u, host.metrics(1).machines);
+
+  for (auto & machine : machines) {
+    ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *machine));
+    ASSERT_TRUE(machine->clear());
+  }
+  for (auto & machine : machines) {
+    ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *machine));
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  for (const auto & shard : host.metrics()) {
+    ASSERT_GT(shard.wakeups, 0u);
+    ASSERT_GT(shard.loop_latency.count, 0u);
+    ASSERT_LE(shard.utilisation(), 1.0);
+  }
+
+  ASSERT_TRUE(host.remove(machines.front()));
+  ASSERT_FALSE(host.shardOf(machines.front()).has_value());
+  ASSERT_EQ(3u, host.metrics(0).machines + host.metrics(1).machines);
+}
+
+namespace
+{
+
+struct PooledTestEvent : public packml_sm::PooledEvent
+{
+  explicit PooledTestEvent(int value_value)
+  : value(value_value) {}
+
+  virtual ~PooledTestEvent() = default;
+
+  int value;
+};
+
+}  // namespace
+
+TEST(Packml_sm, event_pool_recycles_blocks_without_heap_allocations)
+{
+  auto pool = std::make_unique<packml_sm::EventPool>(2);
+  ASSERT_EQ(2u, pool->stats().heap_allocations);
+
+  std::vector<PooledTestEvent *> events;
+  for (int ii = 0; ii < 3; ++ii) {
+    events.push_back(packml_sm::makeEvent<PooledTestEvent>(pool.get(), ii));
+  }
+  // One block more than preallocated
+  ASSERT_EQ(3u, pool->stats().heap_allocations);
+  ASSERT_EQ(3u, pool->stats().outstanding);
+  for (auto event : events) {
+    delete event;
+  }
+  ASSERT_EQ(3u, pool->stats().free);
+
+  // Steady state: events are created on one thread and deleted on another, as Qt does
+  std::atomic<PooledTestEvent *> handed{nullptr};
+  std::uint64_t consumer_allocations = 0;
+  std::thread consumer([&handed, &consumer_allocations]() {
+      auto before = heap_allocations;
+      for (int ii = 0; ii < 1000; ++ii) {
+        PooledTestEvent * event;
+        while ((event = handed.exchange(nullptr, std::memory_order_acquire)) == nullptr) {
+          std::this_thread::yield();
+        }
+        EXPECT_EQ(ii, event->value);
+        delete event;
+      }
+      consumer_allocations = heap_allocations - before;
+    });
+  auto before = heap_allocations;
+  for (int ii = 0; ii < 1000; ++ii) {
+    auto event = packml_sm::makeEvent<PooledTestEvent>(pool.get(), ii);
+    PooledTestEvent * empty = nullptr;
+    while (!handed.compare_exchange_weak(empty, event, std::memory_order_release)) {
+      empty = nullptr;
+      std::this_thread::yield();
+    }
+  }
+  consumer.join();
+  ASSERT_EQ(before, heap_allocations);
+  ASSERT_EQ(0u, consumer_allocations);
+  auto stats = pool->stats();
+  ASSERT_EQ(3u, stats.heap_allocations);
+  ASSERT_EQ(1003u, stats.allocations);
+  ASSERT_EQ(1002u, stats.recycled);
+  ASSERT_EQ(0u, stats.outstanding);
+
+  // Without a pool the event lives on the heap, and may outlive the pool it came from
+  delete packml_sm::makeEvent<PooledTestEvent>(nullptr, 1);
+  auto late = packml_sm::makeEvent<PooledTestEvent>(pool.get(), 2);
+  pool.reset();
+  ASSERT_EQ(2, late->value);
+  delete late;
+}
+
+TEST(Packml_sm, state_machine_cycles_without_event_allocations)
+{
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::continuousCycleSM();
+  sm->activate();
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+
+  // Warm up, then every further transition must be served from the pool
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  auto warm = sm->getEventPoolStats();
+  auto entries = sm->getStateTimes().entries;
+  std::this_thread::sleep_for(std::chrono::seconds(3));
+  ASSERT_TRUE(sm->hold());
+  ASSERT_TRUE(waitForState(packml_sm::State::HELD, *sm));
+  ASSERT_TRUE(sm->unhold());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  auto cycled = sm->getEventPoolStats();
+  auto later = sm->getStateTimes().entries;
+
+  std::uint64_t transitions = 0;
+  for (std::size_t ii = 0; ii < later.size(); ++ii) {
+    transitions += later[ii] - entries[ii];
+  }
+  ASSERT_GT(transitions, 4u);
+  ASSERT_GT(cycled.allocations, warm.allocations);
+  // Heap allocations per transition. QStateMachine allocates lists of its own in every microstep,
+  // so the events are counted by the pool they are taken from.
+  ASSERT_EQ(0u, cycled.heap_allocations - warm.heap_allocations);
+  sm->deactivate();
+}
+
+TEST(Packml_sm, table_state_machine_cycles_without_allocations)
+{
+  using std::chrono::milliseconds;
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::continuousCycleSM();
+  ASSERT_TRUE(sm->setClock(clock));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(sm->clear());
+  clock->advance(milliseconds(200));
+  ASSERT_TRUE(sm->reset());
+  clock->advance(milliseconds(200));
+  ASSERT_TRUE(sm->start());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::EXECUTE, sm->getCurrentState());
+
+  // Warm up, the first cycles size the buffers the machine and the clock reuse. The timers fire on
+  // this thread, every allocation of a cycle is made by it.
+  clock->advance(std::chrono::seconds(10));
+  auto entries = sm->getStateTimes().entries[packml_sm::toIndex(packml_sm::State::EXECUTE)];
+  auto before = heap_allocations;
+  clock->advance(std::chrono::seconds(100));
+  ASSERT_EQ(before, heap_allocations);
+  ASSERT_EQ(entries + 100, sm->getStateTimes().entries[packml_sm::toIndex(packml_sm::State::EXECUTE)]);
+  sm->deactivate();
+}
+
+TEST(Packml_sm, state_registry_indexes_states_and_super_states)
+{
+  static_assert(packml_sm::registryName(packml_sm::State::EXECUTE) == "EXECUTE");
+  static_assert(packml_sm::registryIndex("STOPPABLE") == packml_sm::registryIndex(packml_sm::SuperState::STOPPABLE));
+  for (std::size_t ii = 0; ii < packml_sm::kStateCount; ++ii) {
+    auto state = static_cast<packml_sm::State>(ii);
+    ASSERT_EQ(packml_sm::to_string(state), packml_sm::registryName(state));
+  }
+  ASSERT_EQ(packml_sm::to_string(packml_sm::SuperState::ABORTABLE), packml_sm::registryName(packml_sm::SuperState::ABORTABLE));
+
+  int execute = 0;
+  int abortable = 0;
+  packml_sm::StateRegistry<int> registry;
+  ASSERT_TRUE(registry.add(packml_sm::State::EXECUTE, &execute));
+  ASSERT_FALSE(registry.add(packml_sm::State::EXECUTE, &abortable));
+  ASSERT_TRUE(registry.add(packml_sm::SuperState::ABORTABLE, &abortable));
+  ASSERT_EQ(&execute, registry[packml_sm::State::EXECUTE]);
+  ASSERT_EQ(&abortable, registry.get(packml_sm::SuperState::ABORTABLE));
+  ASSERT_EQ(nullptr, registry[packml_sm::State::IDLE]);
+  ASSERT_EQ(&execute, registry.find("EXECUTE"));
+  ASSERT_EQ(nullptr, registry.find("NOT_A_STATE"));
+  ASSERT_EQ(2u, registry.size());
+
+  std::vector<std::string_view> names;
+  registry.forEach([&names](std::string_view name, int *) {names.push_back(name);});
+  ASSERT_EQ((std::vector<std::string_view>{"EXECUTE", "ABORTABLE"}), names);
+}
+
+TEST(Packml_sm, mode_registry_loads_user_defined_modes)
+{
+  auto registry = packml_sm::ModeRegistry::fromYaml(
+    "modes:\n"
+    "  - name: MAINTENANCE\n"
+    "    switch_states: [IDLE, STOPPED]\n"
+    "  - name: CONTINUOUS\n"
+    "    id: 10\n"
+    "    unavailable: [COMPLETING, COMPLETE]\n"
+    "    self_loops: [EXECUTE]\n");
+  ASSERT_TRUE(registry.has_value()) << registry.error();
+
+  // Built-in modes keep the fields the file does not override
+  auto maintenance = registry->find(packml_sm::ModeType::MAINTENANCE);
+  ASSERT_NE(nullptr, maintenance);
+  ASSERT_FALSE(maintenance->isAvailable(packml_sm::State::COMPLETING));
+  ASSERT_TRUE(maintenance->allowsSwitchFrom(packml_sm::State::STOPPED));
+  ASSERT_NE(nullptr, registry->find(packml_sm::ModeType::PRODUCTION));
+
+  auto continuous = registry->find(static_cast<packml_sm::ModeType>(10));
+  ASSERT_NE(nullptr, continuous);
+  ASSERT_EQ(continuous, registry->find("CONTINUOUS"));
+  ASSERT_TRUE(continuous->loops(packml_sm::State::EXECUTE));
+  ASSERT_FALSE(continuous->isAvailable(packml_sm::State::COMPLETE));
+  ASSERT_TRUE(continuous->allowsSwitchFrom(packml_sm::State::IDLE));
+  ASSERT_FALSE(continuous->allowsSwitchFrom(packml_sm::State::EXECUTE));
+  ASSERT_EQ(nullptr, registry->find(static_cast<packml_sm::ModeType>(9)));
+
+  // JSON is valid YAML
+  ASSERT_TRUE(packml_sm::ModeRegistry::fromYaml(R"({"modes": [{"name": "SETUP", "id": 4}]})").has_value());
+
+  ASSERT_FALSE(packml_sm::ModeRegistry::fromYaml("modes: [{name: NEW}]").has_value());
+  ASSERT_FALSE(packml_sm::ModeRegistry::fromYaml("modes: [{name: A, id: 4, self_loops: [IDLE]}]").has_value());
+  ASSERT_FALSE(packml_sm::ModeRegistry::fromYaml("modes: [{name: A, id: 4, available: [RUNNING]}]").has_value());
+  ASSERT_FALSE(packml_sm::ModeRegistry::fromYaml("modes: [{name: MANUAL, id: 4}]").has_value());
+  ASSERT_FALSE(packml_sm::ModeRegistry::fromYaml("modes: [{name: A, id: four}]").has_value());
+  ASSERT_FALSE(packml_sm::ModeRegistry::fromYaml("modes: {").has_value());
+}
+
+TEST(Packml_sm, table_user_defined_mode_loops_execute)
+{
+  auto registry = packml_sm::ModeRegistry::fromYaml(
+    "modes: [{name: CONTINUOUS, id: 4, self_loops: [EXECUTE]}]");
+  ASSERT_TRUE(registry.has_value()) << registry.error();
+  auto continuous = static_cast<packml_sm::ModeType>(4);
+
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  std::atomic<int> executions{0};
+  sm->setExecute([&executions]() {++executions; return 0;});
+  ASSERT_FALSE(sm->changeMode(continuous).has_value());
+  ASSERT_TRUE(sm->setModeRegistry(std::make_shared<packml_sm::ModeRegistry>(std::move(*registry))));
+  ASSERT_TRUE(sm->changeMode(continuous).has_value());
+  sm->activate();
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  // EXECUTE re-enters itself instead of completing
+  ASSERT_FALSE(waitForState(packml_sm::State::COMPLETING, *sm));
+  ASSERT_GT(executions.load(), 1);
+  ASSERT_FALSE(sm->changeMode(packml_sm::ModeType::PRODUCTION).has_value());
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+}
+
+TEST(Packml_sm, user_defined_mode_loops_execute)
+{
+  auto registry = packml_sm::ModeRegistry::fromYaml(
+    "modes: [{name: CONTINUOUS, id: 4, self_loops: [EXECUTE]}]");
+  ASSERT_TRUE(registry.has_value()) << registry.error();
+  auto continuous = static_cast<packml_sm::ModeType>(4);
+
+  // A single cycle machine, EXECUTE only loops through the mode loop transitions of the states
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+  std::atomic<int> executions{0};
+  sm->setExecute([&executions]() {++executions; return 0;});
+  ASSERT_FALSE(sm->changeMode(continuous).has_value());
+  ASSERT_TRUE(sm->setModeRegistry(std::make_shared<packml_sm::ModeRegistry>(std::move(*registry))));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->changeMode(continuous).has_value());
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  // EXECUTE re-enters itself instead of completing
+  ASSERT_FALSE(waitForState(packml_sm::State::COMPLETING, *sm));
+  ASSERT_GT(executions.load(), 1);
+  ASSERT_EQ(packml_sm::State::EXECUTE, sm->getCurrentState());
+  ASSERT_FALSE(sm->changeMode(packml_sm::ModeType::PRODUCTION).has_value());
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+
+  // Back in PRODUCTION the same machine completes
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->changeMode(packml_sm::ModeType::PRODUCTION).has_value());
+  ASSERT_TRUE(sm->start());
+  ASSERT_TRUE(waitForState(packml_sm::State::COMPLETE, *sm));
+  sm->deactivate();
+}
+
+TEST(Packml_sm, mode_registry_reload_frees_replaced_graphs)
+{
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  std::weak_ptr<const packml_sm::ModeGraphs> replaced = sm->getModeGraphs();
+  for (int ii = 0; ii < 3; ++ii) {
+    ASSERT_TRUE(sm->setModeRegistry(packml_sm::ModeRegistry::global()));
+  }
+  // Queued on the state machine thread behind the release of the replaced graphs
+  ASSERT_TRUE(sm->changeModeAsync(packml_sm::ModeType::MANUAL).get().has_value());
+  EXPECT_TRUE(replaced.expired());
+  sm->deactivate();
+}
+
+TEST(Packml_sm, mode_graphs_report_unreachable_states_and_dead_ends)
+{
+  auto registry = packml_sm::ModeRegistry::fromYaml(
+    "modes: [{name: LOCKED, id: 4, unavailable: [CLEARING]}]");
+  ASSERT_TRUE(registry.has_value()) << registry.error();
+  packml_sm::ModeGraphs graphs(
+    std::make_shared<packml_sm::ModeRegistry>(std::move(*registry)), packml_sm::kSingleCycleTable);
+
+  auto idle = packml_sm::commandBit(packml_sm::TransitionCmd::START) |
+    packml_sm::commandBit(packml_sm::TransitionCmd::STOP) |
+    packml_sm::commandBit(packml_sm::TransitionCmd::ABORT);
+  ASSERT_EQ(idle, graphs.unmoded().allowedCommands(packml_sm::State::IDLE));
+  ASSERT_EQ(packml_sm::kAllStates, graphs.unmoded().reachable);
+  ASSERT_EQ(0u, graphs.unmoded().dead_ends);
+
+  // COMPLETING is disabled, EXECUTE never completes and COMPLETE cannot be reached
+  auto maintenance = graphs.find(packml_sm::ModeType::MAINTENANCE);
+  ASSERT_NE(nullptr, maintenance);
+  ASSERT_EQ(packml_sm::State::UNDEFINED, maintenance->onComplete(packml_sm::State::EXECUTE));
+  ASSERT_EQ(packml_sm::stateBit(packml_sm::State::COMPLETE), maintenance->unreachable);
+  ASSERT_EQ(packml_sm::stateBit(packml_sm::State::EXECUTE), maintenance->stalled);
+  ASSERT_EQ(0u, maintenance->dead_ends);
+  ASSERT_TRUE(maintenance->allows(packml_sm::State::EXECUTE, packml_sm::TransitionCmd::HOLD));
+
+  // Without CLEARING nothing leads out of the initial ABORTED state
+  auto locked = graphs.find(static_cast<packml_sm::ModeType>(4));
+  ASSERT_NE(nullptr, locked);
+  ASSERT_EQ(packml_sm::stateBit(packml_sm::State::ABORTED), locked->dead_ends);
+  ASSERT_EQ(0, locked->allowedCommands(packml_sm::State::ABORTED));
+  ASSERT_EQ("unreachable: STOPPED, STARTING, IDLE, SUSPENDED, EXECUTE, STOPPING, ABORTING, HOLDING, HELD, "
+    "UNHOLDING, SUSPENDING, UNSUSPENDING, RESETTING, COMPLETING, COMPLETE; dead ends: ABORTED",
+    packml_sm::describeModeGraph(*locked));
+
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  ASSERT_EQ(0, sm->getAllowedCommands());
+  sm->activate();
+  ASSERT_EQ(packml_sm::commandBit(packml_sm::TransitionCmd::CLEAR), sm->getAllowedCommands());
+  ASSERT_TRUE(sm->getModeGraphs()->find(packml_sm::ModeType::PRODUCTION) != nullptr);
+}
+
+TEST(Packml_sm, virtual_clock_runs_a_week_of_table_cycles)
+{
+  using std::chrono::milliseconds;
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::continuousCycleSM();
+  ASSERT_TRUE(sm->setClock(clock));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_FALSE(sm->setClock(std::make_shared<packml_sm::VirtualClock>()));
+  ASSERT_TRUE(sm->clear());
+  clock->advance(milliseconds(199));
+  ASSERT_EQ(packml_sm::State::CLEARING, sm->getCurrentState());
+  clock->advance(milliseconds(1));
+  ASSERT_EQ(packml_sm::State::STOPPED, sm->getCurrentState());
+  ASSERT_TRUE(sm->reset());
+  clock->advance(milliseconds(200));
+  ASSERT_TRUE(sm->start());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::EXECUTE, sm->getCurrentState());
+
+  auto started = std::chrono::steady_clock::now();
+  clock->advance(std::chrono::hours(24 * 7));
+  ASSERT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(60));
+
+  auto times = sm->getStateTimes();
+  ASSERT_EQ(packml_sm::State::EXECUTE, times.current);
+  ASSERT_EQ(7u * 24 * 3600 + 1, times.entries[packml_sm::toIndex(packml_sm::State::EXECUTE)]);
+  ASSERT_EQ(std::chrono::hours(24 * 7), times.total(packml_sm::State::EXECUTE));
+  ASSERT_EQ(milliseconds(200), times.total(packml_sm::State::CLEARING));
+  ASSERT_EQ(std::chrono::nanoseconds(0), times.in_state);
+  sm->deactivate();
+}
+
+TEST(Packml_sm, virtual_clock_expires_table_watchdog)
+{
+  using std::chrono::milliseconds;
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  ASSERT_TRUE(sm->setClock(clock));
+  ASSERT_TRUE(sm->setWatchdog(packml_sm::State::EXECUTE, milliseconds(500)));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(sm->clear());
+  clock->advance(milliseconds(200));
+  ASSERT_TRUE(sm->reset());
+  clock->advance(milliseconds(200));
+  ASSERT_TRUE(sm->start());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::EXECUTE, sm->getCurrentState());
+  clock->advance(milliseconds(499));
+  ASSERT_EQ(packml_sm::State::EXECUTE, sm->getCurrentState());
+  clock->advance(milliseconds(1));
+  ASSERT_EQ(packml_sm::State::ABORTING, sm->getCurrentState());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::ABORTED, sm->getCurrentState());
+  // Nothing is left to fire once the machine waits for a command
+  ASSERT_EQ(0u, clock->pending());
+  sm->deactivate();
+}
+
+TEST(Packml_sm, virtual_clock_step_waits_for_outstanding_work)
+{
+  using std::chrono::milliseconds;
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  std::atomic<bool> done{false};
+  std::thread worker;
+  // Work a timer hands to another thread, as a posted event of a Qt state machine
+  clock->schedule(
+    clock->now() + milliseconds(10), [&]() {
+      clock->beginWork();
+      worker = std::thread([&]() {
+          std::this_thread::sleep_for(milliseconds(50));
+          done = true;
+          clock->endWork();
+        });
+    });
+  clock->advance(milliseconds(20));
+  EXPECT_TRUE(done);
+  worker.join();
+
+  // Counted by an event pool from its first block taken to its last block returned
+  packml_sm::EventPool pool(2);
+  pool.setBusyListener([&clock](bool busy) {
+      if (busy) {
+        clock->beginWork();
+      } else {
+        clock->endWork();
+      }
+    });
+  void * block = pool.allocate(16);
+  done = false;
+  worker = std::thread([&]() {
+      std::this_thread::sleep_for(milliseconds(50));
+      done = true;
+      packml_sm::EventPool::deallocate(block);
+    });
+  clock->advance(milliseconds(1));
+  EXPECT_TRUE(done);
+  worker.join();
+  pool.setBusyListener(nullptr);
+}
+
+TEST(Packml_sm, virtual_clock_fast_forwards_qt_state_machine)
+{
+  using std::chrono::milliseconds;
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::continuousCycleSM();
+  ASSERT_TRUE(sm->setClock(clock));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::STOPPED, sm->getCurrentState());
+  ASSERT_TRUE(sm->reset());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::IDLE, sm->getCurrentState());
+  ASSERT_TRUE(sm->start());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::EXECUTE, sm->getCurrentState());
+  clock->advance(std::chrono::hours(1));
+
+  auto times = sm->getStateTimes();
+  ASSERT_EQ(3601u, times.entries[packml_sm::toIndex(packml_sm::State::EXECUTE)]);
+  ASSERT_EQ(std::chrono::hours(1), times.total(packml_sm::State::EXECUTE));
+  ASSERT_EQ(milliseconds(200), times.total(packml_sm::State::STARTING));
+  ASSERT_TRUE(sm->stop());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::STOPPED, sm->getCurrentState());
+  sm->deactivate();
+}
+
+TEST(Packml_sm, snapshot_file_keeps_last_complete_save)
+{
+  auto path = (std::filesystem::temp_directory_path() / "packml_sm_snapshot_file.bin").string();
+  std::filesystem::remove(path);
+  {
+    auto file = packml_sm::SnapshotFile::open(path);
+    ASSERT_TRUE(file.has_value()) << file.error();
+    ASSERT_FALSE((*file)->load().has_value());
+    packml_sm::MachineSnapshot snapshot;
+    snapshot.state = packml_sm::State::STOPPED;
+    snapshot.times.entries[packml_sm::toIndex(packml_sm::State::CLEARING)] = 3;
+    (*file)->save(snapshot);
+    snapshot.state = packml_sm::State::IDLE;
+    snapshot.mode = packml_sm::ModeType::MANUAL;
+    (*file)->save(snapshot);
+    auto loaded = (*file)->load();
+    ASSERT_TRUE(loaded.has_value());
+    ASSERT_EQ(packml_sm::State::IDLE, loaded->state);
+    ASSERT_EQ(packml_sm::ModeType::MANUAL, loaded->mode);
+    ASSERT_EQ(3u, loaded->times.entries[packml_sm::toIndex(packml_sm::State::CLEARING)]);
+  }
+
+  // A save torn by a crash falls back to the save before it, the second save went to the first slot
+  {
+    std::fstream raw(path, std::ios::in | std::ios::out | std::ios::binary);
+    raw.seekp(40);
+    raw.put('x');
+  }
+  auto file = packml_sm::SnapshotFile::open(path);
+  ASSERT_TRUE(file.has_value()) << file.error();
+  auto loaded = (*file)->load();
+  ASSERT_TRUE(loaded.has_value());
+  ASSERT_EQ(packml_sm::State::STOPPED, loaded->state);
+  ASSERT_FALSE(loaded->mode.has_value());
+
+  // Crashed in the middle of an operation, only wait states are resumed
+  loaded->state = packml_sm::State::EXECUTE;
+  ASSERT_EQ(packml_sm::State::ABORTED,
+    packml_sm::restartState(loaded, packml_sm::RestartPolicy::RESUME_WAIT_STATE));
+  ASSERT_EQ(packml_sm::State::ABORTED, packml_sm::restartState(std::nullopt, packml_sm::RestartPolicy::RESUME_WAIT_STATE));
+  std::filesystem::remove(path);
+}
+
+TEST(Packml_sm, table_restart_resumes_wait_state_from_snapshot)
+{
+  using std::chrono::milliseconds;
+  auto path = (std::filesystem::temp_directory_path() / "packml_sm_table_restart.bin").string();
+  std::filesystem::remove(path);
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  {
+    std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+    ASSERT_TRUE(sm->setClock(clock));
+    ASSERT_TRUE(sm->setSnapshotFile(*packml_sm::SnapshotFile::open(path), packml_sm::RestartPolicy::RESUME_WAIT_STATE));
+    ASSERT_TRUE(sm->activate());
+    ASSERT_TRUE(sm->clear());
+    clock->advance(milliseconds(200));
+    ASSERT_TRUE(sm->reset());
+    clock->advance(milliseconds(200));
+    ASSERT_EQ(packml_sm::State::IDLE, sm->getCurrentState());
+    ASSERT_TRUE(sm->changeMode(packml_sm::ModeType::MANUAL).has_value());
+    // Dropped without deactivate(), as if the process died
+  }
+
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  std::atomic<int> mode{-1};
+  sm->on_mode_changed = [&mode](packml_sm::ModeType value) {mode = static_cast<int>(value);};
+  ASSERT_TRUE(sm->setClock(clock));
+  ASSERT_TRUE(sm->setSnapshotFile(*packml_sm::SnapshotFile::open(path), packml_sm::RestartPolicy::RESUME_WAIT_STATE));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_FALSE(sm->setSnapshotFile(*packml_sm::SnapshotFile::open(path), packml_sm::RestartPolicy::COLD));
+  ASSERT_EQ(packml_sm::State::IDLE, sm->getCurrentState());
+  ASSERT_EQ(static_cast<int>(packml_sm::ModeType::MANUAL), mode);
+  auto times = sm->getStateTimes();
+  ASSERT_EQ(milliseconds(200), times.total(packml_sm::State::CLEARING));
+  ASSERT_EQ(1u, times.entries[packml_sm::toIndex(packml_sm::State::RESETTING)]);
+  // The resumed state counts as entered again
+  ASSERT_EQ(2u, times.entries[packml_sm::toIndex(packml_sm::State::IDLE)]);
+  ASSERT_TRUE(sm->start());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::EXECUTE, sm->getCurrentState());
+  sm->deactivate();
+
+  // Stopped in EXECUTE, only the counters survive the next restart
+  sm = packml_sm::TableStateMachine::singleCycleSM();
+  ASSERT_TRUE(sm->setSnapshotFile(*packml_sm::SnapshotFile::open(path), packml_sm::RestartPolicy::RESUME_WAIT_STATE));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_EQ(packml_sm::State::ABORTED, sm->getCurrentState());
+  ASSERT_EQ(1u, sm->getStateTimes().entries[packml_sm::toIndex(packml_sm::State::EXECUTE)]);
+  sm->deactivate();
+
+  sm = packml_sm::TableStateMachine::singleCycleSM();
+  ASSERT_TRUE(sm->setSnapshotFile(*packml_sm::SnapshotFile::open(path), packml_sm::RestartPolicy::COLD));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_EQ(0u, sm->getStateTimes().entries[packml_sm::toIndex(packml_sm::State::EXECUTE)]);
+  sm->deactivate();
+  std::filesystem::remove(path);
+}
+
+TEST(Packml_sm, restart_resumes_wait_state_from_snapshot)
+{
+  auto path = (std::filesystem::temp_directory_path() / "packml_sm_qt_restart.bin").string();
+  std::filesystem::remove(path);
+  {
+    std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+    sm->setExecute(std::bind(success));
+    ASSERT_TRUE(sm->setSnapshotFile(*packml_sm::SnapshotFile::open(path), packml_sm::RestartPolicy::RESUME_WAIT_STATE));
+    ASSERT_TRUE(sm->activate());
+    ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+    ASSERT_TRUE(sm->clear());
+    ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+    ASSERT_TRUE(sm->reset());
+    ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+    ASSERT_TRUE(sm->start());
+    ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+    ASSERT_TRUE(sm->hold());
+    ASSERT_TRUE(waitForState(packml_sm::State::HELD, *sm));
+    sm->deactivate();
+  }
+
+  // HELD is nested in ABORTABLE and STOPPABLE, both are entered through it
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+  sm->setExecute(std::bind(success));
+  ASSERT_TRUE(sm->setSnapshotFile(*packml_sm::SnapshotFile::open(path), packml_sm::RestartPolicy::RESUME_WAIT_STATE));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::HELD, *sm));
+  ASSERT_EQ(1u, sm->getStateTimes().entries[packml_sm::toIndex(packml_sm::State::HOLDING)]);
+  ASSERT_TRUE(sm->unhold());
+  ASSERT_TRUE(waitForState(packml_sm::State::EXECUTE, *sm));
+  // The initial states are back once started: clear enters CLEARING and reset RESETTING, not HELD
+  ASSERT_TRUE(sm->abort());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  ASSERT_TRUE(sm->clear());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  sm->deactivate();
+
+  sm = packml_sm::StateMachine::singleCycleSM();
+  ASSERT_TRUE(sm->setSnapshotFile(*packml_sm::SnapshotFile::open(path), packml_sm::RestartPolicy::RESUME_WAIT_STATE));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  ASSERT_TRUE(sm->stop());
+  ASSERT_TRUE(waitForState(packml_sm::State::STOPPED, *sm));
+  ASSERT_TRUE(sm->reset());
+  ASSERT_TRUE(waitForState(packml_sm::State::IDLE, *sm));
+  sm->deactivate();
+
+  sm = packml_sm::StateMachine::singleCycleSM();
+  ASSERT_TRUE(sm->setSnapshotFile(*packml_sm::SnapshotFile::open(path), packml_sm::RestartPolicy::COLD));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(waitForState(packml_sm::State::ABORTED, *sm));
+  sm->deactivate();
+  std::filesystem::remove(path);
+}
+
+TEST(Packml_sm, journal_reader_skips_unknown_records_and_torn_tail)
+{
+  using packml_sm::JournalRecord;
+  auto path = (std::filesystem::temp_directory_path() / "packml_sm_journal.bin").string();
+  std::filesystem::remove(path);
+  {
+    packml_sm::JournalOptions options;
+    options.batch_bytes = 256;
+    auto journal = packml_sm::JournalWriter::open(path, options);
+    ASSERT_TRUE(journal.has_value());
+    for (int ii = 0; ii < 1000; ++ii) {
+      std::chrono::nanoseconds time(ii);
+      (*journal)->append(JournalRecord::ofCommand(time, packml_sm::State::IDLE, packml_sm::TransitionCmd::START, ii % 2 == 0));
+      (*journal)->append(JournalRecord::ofCompletion(time, packml_sm::State::EXECUTE, -ii));
+    }
+    ASSERT_TRUE((*journal)->flush());
+    ASSERT_EQ(2000u, (*journal)->records());
+  }
+  {
+    // A record type of a newer version, then a record torn by a crash
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    std::uint16_t length = 20;
+    std::vector<char> unknown(length, 0);
+    unknown[0] = 99;
+    out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    out.write(unknown.data(), length);
+    length = 16;
+    out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    out.write(unknown.data(), 5);
+  }
+
+  auto reader = packml_sm::JournalReader::open(path);
+  ASSERT_TRUE(reader.has_value());
+  auto records = reader->readAll();
+  ASSERT_TRUE(reader->truncated());
+  ASSERT_EQ(2000u, records.size());
+  ASSERT_EQ(JournalRecord::Type::COMMAND, records[998].type);
+  ASSERT_EQ(std::chrono::nanoseconds(499), records[998].time);
+  ASSERT_EQ(packml_sm::TransitionCmd::START, records[998].command);
+  ASSERT_FALSE(records[998].accepted);
+  ASSERT_EQ(JournalRecord::Type::COMPLETED, records[999].type);
+  ASSERT_EQ(packml_sm::State::EXECUTE, records[999].state);
+  ASSERT_EQ(-499, records[999].code);
+  ASSERT_FALSE(packml_sm::JournalReader::open(path + ".missing").has_value());
+  std::filesystem::remove(path);
+}
+
+TEST(Packml_sm, table_journal_replays_without_divergence)
+{
+  using std::chrono::milliseconds;
+  auto path = (std::filesystem::temp_directory_path() / "packml_sm_table_journal.bin").string();
+  std::filesystem::remove(path);
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  auto journal = packml_sm::JournalWriter::open(path);
+  ASSERT_TRUE(journal.has_value());
+  ASSERT_TRUE(sm->setClock(clock));
+  ASSERT_TRUE(sm->setJournal(*journal));
+  ASSERT_TRUE(sm->activate());
+  ASSERT_FALSE(sm->setJournal(nullptr));
+  ASSERT_TRUE(sm->clear());
+  clock->advance(milliseconds(200));
+  ASSERT_TRUE(sm->reset());
+  clock->advance(milliseconds(200));
+  ASSERT_TRUE(sm->changeMode(packml_sm::ModeType::MANUAL).has_value());
+  ASSERT_TRUE(sm->start());
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::EXECUTE, sm->getCurrentState());
+  // The operation fails before its delay is over
+  ASSERT_TRUE(sm->completeState(5));
+  clock->advance(milliseconds(200));
+  ASSERT_EQ(packml_sm::State::ABORTED, sm->getCurrentState());
+  ASSERT_FALSE(sm->start());
+  auto times = sm->getStateTimes();
+  sm->deactivate();
+  ASSERT_TRUE((*journal)->flush());
+
+  auto reader = packml_sm::JournalReader::open(path);
+  ASSERT_TRUE(reader.has_value());
+  auto records = reader->readAll();
+  ASSERT_FALSE(reader->truncated());
+  std::size_t entries = 0;
+  for (const auto & record : records) {
+    entries += record.type == packml_sm::JournalRecord::Type::STATE_ENTERED;
+  }
+  ASSERT_EQ(9u, entries);
+
+  auto replayed = packml_sm::TableStateMachine::singleCycleSM();
+  auto report = packml_sm::replayJournal(records, *replayed, std::make_shared<packml_sm::VirtualClock>());
+  ASSERT_TRUE(report.has_value());
+  ASSERT_TRUE(report->reproduced()) << report->first_divergence;
+  ASSERT_EQ(records.size(), report->records);
+  ASSERT_EQ(entries, report->transitions);
+  ASSERT_EQ(milliseconds(800), report->journal_time);
+  ASSERT_EQ(packml_sm::State::ABORTED, replayed->getCurrentState());
+  ASSERT_EQ(times.total(packml_sm::State::EXECUTE), replayed->getStateTimes().total(packml_sm::State::EXECUTE));
+  replayed->deactivate();
+
+  // A journal the machine cannot reproduce
+  records.back().accepted = true;
+  replayed = packml_sm::TableStateMachine::singleCycleSM();
+  report = packml_sm::replayJournal(records, *replayed, std::make_shared<packml_sm::VirtualClock>());
+  ASSERT_TRUE(report.has_value());
+  ASSERT_EQ(1u, report->divergences);
+  ASSERT_FALSE(report->first_divergence.empty());
+  replayed->deactivate();
+  std::filesystem::remove(path);
+}
+
+TEST(Packml_sm, trace_records_state_spans_commands_and_operations)
+{
+  using std::chrono::milliseconds;
+  auto path = (std::filesystem::temp_directory_path() / "packml_sm_trace.json").string();
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  ASSERT_TRUE(sm->setClock(clock));
+  ASSERT_TRUE(sm->setOperationMethod(packml_sm::State::RESETTING, []() {return 0;}));
+
+  ASSERT_FALSE(packml_sm::tracing::enabled());
+  ASSERT_TRUE(packml_sm::tracing::start(path).has_value());
+  ASSERT_EQ(packml_sm::tracing::kCompiledIn, packml_sm::tracing::enabled());
+  ASSERT_TRUE(sm->activate());
+  ASSERT_TRUE(sm->clear());
+  clock->advance(milliseconds(200));
+  ASSERT_FALSE(sm->start());
+  ASSERT_TRUE(sm->reset());
+  for (int ii = 0; ii < 2000 && sm->getCurrentState() != packml_sm::State::IDLE; ++ii) {
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+  ASSERT_EQ(packml_sm::State::IDLE, sm->getCurrentState());
+  sm->deactivate();
+  packml_sm::tracing::stop();
+  ASSERT_FALSE(packml_sm::tracing::enabled());
+  // Trace points of a stopped trace are not written
+  packml_sm::tracing::begin("state", packml_sm::State::HELD, 1);
+
+  std::ifstream in(path);
+  std::string trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (!packml_sm::tracing::kCompiledIn) {
+    ASSERT_EQ("[\n\n]\n", trace);
+    return;
+  }
+  ASSERT_EQ(0u, trace.find("[\n{"));
+  ASSERT_EQ(trace.size() - 3, trace.rfind("\n]\n"));
+  auto count = [&trace](const std::string & text) {
+      std::size_t found = 0;
+      for (auto pos = trace.find(text); pos != std::string::npos; pos = trace.find(text, pos + 1)) {
+        ++found;
+      }
+      return found;
+    };
+  // ABORTED, CLEARING, STOPPED, RESETTING and IDLE, each closed by the next or by deactivate()
+  ASSERT_EQ(5u, count("\"cat\":\"state\",\"ph\":\"b\""));
+  ASSERT_EQ(5u, count("\"cat\":\"state\",\"ph\":\"e\""));
+  ASSERT_EQ(1u, count("{\"name\":\"RESETTING\",\"cat\":\"operation\",\"ph\":\"X\""));
+  ASSERT_EQ(1u, count("{\"name\":\"START\",\"cat\":\"command\",\"ph\":\"X\""));
+  ASSERT_EQ(2u, count("\"args\":{\"accepted\":1}"));
+  ASSERT_EQ(1u, count("\"args\":{\"accepted\":0}"));
+  ASSERT_EQ(0u, count("HELD"));
+  ASSERT_EQ(0u, packml_sm::tracing::dropped());
+  std::filesystem::remove(path);
+}
+
+TEST(Packml_sm, latency_histogram_percentiles)
+{
+  using std::chrono::nanoseconds;
+  packml_sm::LatencyHistogram histogram;
+  ASSERT_EQ(nanoseconds(0), histogram.percentile(0.5));
+  for (int ii = 1; ii <= 100; ++ii) {
+    histogram.add(nanoseconds(ii * 1000));
+  }
+  ASSERT_EQ(100u, histogram.count);
+  ASSERT_EQ(nanoseconds(50500), histogram.mean());
+  ASSERT_EQ(nanoseconds(100000), histogram.max);
+  // Buckets are at most 12.5 % wide
+  for (double q : {0.5, 0.9, 0.99}) {
+    auto exact = static_cast<double>(q * 100 * 1000);
+    auto reported = static_cast<double>(histogram.percentile(q).count());
+    ASSERT_GE(reported, exact);
+    ASSERT_LE(reported, exact * 1.125);
+  }
+  ASSERT_EQ(nanoseconds(100000), histogram.percentile(1.0));
+  ASSERT_EQ(histogram.kBucketCount - 1, packml_sm::LatencyHistogram::bucketOf(~std::uint64_t{0}));
+}
+
+TEST(Packml_sm, table_counts_transitions_by_outcome)
+{
+  using std::chrono::milliseconds;
+  using packml_sm::State;
+  using packml_sm::TransitionCmd;
+  using packml_sm::Trigger;
+  auto clock = std::make_shared<packml_sm::VirtualClock>();
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  ASSERT_TRUE(sm->setClock(clock));
+  ASSERT_TRUE(sm->getTransitionStats().empty());
+  ASSERT_TRUE(sm->changeMode(packml_sm::ModeType::MAINTENANCE).has_value());
+  ASSERT_TRUE(sm->activate());
+  ASSERT_FALSE(sm->start());
+  ASSERT_FALSE(sm->start());
+  ASSERT_TRUE(sm->clear());
+  clock->advance(milliseconds(200));
+  ASSERT_TRUE(sm->reset());
+  clock->advance(milliseconds(200));
+  ASSERT_TRUE(sm->start());
+  clock->advance(milliseconds(200));
+  // COMPLETING is not available in this mode, EXECUTE stays when its delay is over
+  clock->advance(milliseconds(1000));
+  ASSERT_EQ(State::EXECUTE, sm->getCurrentState());
+  sm->deactivate();
+
+  auto stats = sm->getTransitionStats();
+  auto find = [&stats](State from, Trigger trigger, TransitionCmd command) {
+      auto it = std::find_if(stats.begin(), stats.end(), [&](const packml_sm::TransitionStats & entry) {
+            return entry.from == from && entry.trigger == trigger && entry.command == command;
+          });
+      return it == stats.end() ? nullptr : &*it;
+    };
+  auto rejected = find(State::ABORTED, Trigger::COMMAND, TransitionCmd::START);
+  ASSERT_NE(nullptr, rejected);
+  ASSERT_EQ(2u, rejected->rejected_by_state);
+  ASSERT_EQ(0u, rejected->accepted);
+  ASSERT_EQ(State::UNDEFINED, rejected->to);
+  ASSERT_EQ(0u, rejected->latency.count);
+
+  auto start = find(State::IDLE, Trigger::COMMAND, TransitionCmd::START);
+  ASSERT_NE(nullptr, start);
+  ASSERT_EQ(1u, start->accepted);
+  ASSERT_EQ(State::STARTING, start->to);
+  ASSERT_EQ(1u, start->latency.count);
+  ASSERT_GT(start->latency.max.count(), 0);
+
+  auto completed = find(State::CLEARING, Trigger::COMPLETED, TransitionCmd::NO_COMMAND);
+  ASSERT_NE(nullptr, completed);
+  ASSERT_EQ(1u, completed->accepted);
+  ASSERT_EQ(State::STOPPED, completed->to);
+
+  auto disabled = find(State::EXECUTE, Trigger::COMPLETED, TransitionCmd::NO_COMMAND);
+  ASSERT_NE(nullptr, disabled);
+  ASSERT_EQ(1u, disabled->rejected_by_mode);
+  ASSERT_EQ(0u, disabled->accepted);
+  ASSERT_EQ(State::COMPLETING, disabled->to);
+  ASSERT_EQ(nullptr, find(State::IDLE, Trigger::COMMAND, TransitionCmd::RESET));
+}
+
+// Runs a machine through a mode that loops EXECUTE and then through PRODUCTION, so the completion
+// of EXECUTE is taken into two different states
+void expectTransitionsCountedPerTarget(packml_sm::StateMachineInterface & sm)
+{
+  using packml_sm::State;
+  using packml_sm::TransitionCmd;
+  using packml_sm::Trigger;
+  auto registry = packml_sm::ModeRegistry::fromYaml(
+    "modes: [{name: CONTINUOUS, id: 4, self_loops: [EXECUTE]}]");
+  ASSERT_TRUE(registry.has_value()) << registry.error();
+  std::atomic<int> executions{0};
+  sm.setExecute([&executions]() {++executions; return 0;});
+  ASSERT_TRUE(sm.setModeRegistry(std::make_shared<packml_sm::ModeRegistry>(std::move(*registry))));
+  ASSERT_TRUE(sm.activate());
+  ASSERT_TRUE(waitForState(State::ABORTED, sm));
+  ASSERT_FALSE(sm.start());
+  ASSERT_TRUE(sm.clear());
+  ASSERT_TRUE(waitForState(State::STOPPED, sm));
+  ASSERT_TRUE(sm.reset());
+  ASSERT_TRUE(waitForState(State::IDLE, sm));
+  ASSERT_TRUE(sm.changeMode(static_cast<packml_sm::ModeType>(4)).has_value());
+  ASSERT_TRUE(sm.start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (executions.load() < 3 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_GE(executions.load(), 3);
+  ASSERT_TRUE(sm.stop());
+  ASSERT_TRUE(waitForState(State::STOPPED, sm));
+  ASSERT_TRUE(sm.reset());
+  ASSERT_TRUE(waitForState(State::IDLE, sm));
+  ASSERT_TRUE(sm.changeMode(packml_sm::ModeType::PRODUCTION).has_value());
+  ASSERT_TRUE(sm.start());
+  ASSERT_TRUE(waitForState(State::COMPLETE, sm));
+
+  auto stats = sm.getTransitionStats();
+  auto find = [&stats](State from, Trigger trigger, TransitionCmd command, State to) {
+      auto it = std::find_if(stats.begin(), stats.end(), [&](const packml_sm::TransitionStats & entry) {
+            return entry.from == from && entry.trigger == trigger && entry.command == command &&
+                   entry.to == to;
+          });
+      return it == stats.end() ? nullptr : &*it;
+    };
+  auto looped = find(State::EXECUTE, Trigger::COMPLETED, TransitionCmd::NO_COMMAND, State::EXECUTE);
+  ASSERT_NE(nullptr, looped);
+  ASSERT_GE(looped->accepted, 2u);
+  ASSERT_EQ(looped->accepted, looped->latency.count);
+  auto completed = find(State::EXECUTE, Trigger::COMPLETED, TransitionCmd::NO_COMMAND, State::COMPLETING);
+  ASSERT_NE(nullptr, completed);
+  ASSERT_EQ(1u, completed->accepted);
+  ASSERT_EQ(1u, completed->latency.count);
+
+  auto started = find(State::IDLE, Trigger::COMMAND, TransitionCmd::START, State::STARTING);
+  ASSERT_NE(nullptr, started);
+  ASSERT_EQ(2u, started->accepted);
+  auto rejected = find(State::ABORTED, Trigger::COMMAND, TransitionCmd::START, State::UNDEFINED);
+  ASSERT_NE(nullptr, rejected);
+  ASSERT_EQ(1u, rejected->rejected_by_state);
+  ASSERT_EQ(0u, rejected->accepted);
+}
+
+TEST(Packml_sm, table_counts_each_target_of_a_transition)
+{
+  std::shared_ptr<packml_sm::TableStateMachine> sm = packml_sm::TableStateMachine::singleCycleSM();
+  expectTransitionsCountedPerTarget(*sm);
+  sm->deactivate();
+}
+
+TEST(Packml_sm, counts_each_target_of_a_transition)
+{
+  // Recorded on the state machine thread when transitions are selected and taken
+  std::shared_ptr<packml_sm::StateMachine> sm = packml_sm::StateMachine::singleCycleSM();
+  expectTransitionsCountedPerTarget(*sm);
+  sm->deactivate();
+}
+
 int main(int argc, char ** argv)
 {
   std::thread thr(qtWorker, argc, argv);